@@ -0,0 +1,17 @@
+// Members read & written through index, see Domain::set_read_only
+int counter;
+array history;
+
+// Read member into a local array only
+array peek()
+{
+    array t = ({ 0 });
+    t[0] = counter;
+    return t;
+}
+
+// Write element of member
+void record(int v)
+{
+    history[0] = v;
+}
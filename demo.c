@@ -0,0 +1,48 @@
+int counter;
+
+int add(int a, int b)
+{
+    return a + b;
+}
+
+int sum(int n)
+{
+    int total = 0;
+    loop (int i = 1 upto n)
+        total += i;
+    return total;
+}
+
+// Echo the data received by sockets
+int start_echo()
+{
+    return socket_listen("127.0.0.1", 0);
+}
+
+// Greet in the first callback, the connection is usable already
+void socket_accepted(int listen_id, int id, string address)
+{
+    socket_send(id, "> ");
+}
+
+void socket_read(int id, buffer data)
+{
+    socket_send(id, data);
+}
+
+void socket_closed(int id)
+{
+}
+
+// Build arrays in a call without arguments, GC may run in it
+int make_list()
+{
+    array list = ({ });
+    int count = 0;
+    loop (int i = 1 upto 100)
+    {
+        list = ({ i, list });
+        count += 1;
+    }
+    return count;
+}
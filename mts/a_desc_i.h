@@ -63,6 +63,7 @@ Program *create_desc_i_program()
     };
     function->set_byte_codes(arr1, STD_SIZE_N(arr1));
 
+    program->register_program();
     return program;
 }
 
@@ -105,7 +105,7 @@ enum Op
     OP_INC_PRE  = MULTI_CHARS('+', '+', '(', ')'),
     OP_DEC_PRE  = MULTI_CHARS('-', '-', '(', ')'),
     OP_INC_POST = MULTI_CHARS('(', ')', '+', '+'),
-    OP_DEC_POST = MULTI_CHARS('(', ')', '+', '+'),
+    OP_DEC_POST = MULTI_CHARS('(', ')', '-', '-'),
     OP_IF_REF   = MULTI_CHARS('i', 'r', 'e', 'f'),
     OP_CAST     = MULTI_CHARS('c', 'a', 's', 't'),
 
@@ -162,6 +162,14 @@ enum AstVarAttrib
     AST_VAR_CONST = 0x08,
 };
 
+// How a local variable is used, derived by constant folding
+enum AstVarUsage
+{
+    AST_VAR_REASSIGNED = 0x01,  // Assigned after declared
+    AST_VAR_ESCAPED    = 0x02,  // Value is passed out or updated by index
+    AST_VAR_PROPAGATED = 0x04,  // Constant initializer replaces all references
+};
+
 // Node utilties
 
 template <typename T>
@@ -410,6 +418,7 @@ struct AstDeclaration : AstNode
         int         no;
     };
     AstExpr*    expr;     // assign expression
+    Uint8       usage;    // AstVarUsage
 
     virtual void collect_children()
     {
@@ -422,7 +431,8 @@ struct AstDeclaration : AstNode
         AstNode(context),
         name(""),
         no(0),
-        expr(0)
+        expr(0),
+        usage(0)
     {
     }
 };
@@ -483,14 +493,18 @@ struct AstExpr : AstNode
 {
     AstVarType var_type;    // Value type of this expression
     bool   is_constant;     // if this is a constant expression
+    bool   is_folded;       // if the value is worked out at compile time
     Int32  reg_index;       // expression output register index
+    MMMValue folded_value;  // Value of folded expression
 
     virtual simple::string to_string();
 
     AstExpr(Lang* context) :
         AstNode(context),
         is_constant(false),
-        reg_index(0)
+        is_folded(false),
+        reg_index(0),
+        folded_value(Value(NIL))
     {
         var_type.basic_var_type = MIXED;
         var_type.var_attrib = 0;
@@ -858,12 +872,24 @@ struct AstExprVariable : AstExpr
 {
     virtual AstNodeType get_node_type() { return AstNodeType::AST_EXPR_VARIABLE; }
     simple::string name;   // Variable name
+    Uint32         ident_type; // IdentType: argument, local or object var
+    AstNode*       declaration;// AstDeclaration or AstFunctionArg
+    union
+    {
+        ArgNo       arg_no;         // Number of argument
+        LocalNo     local_var_no;   // Number of var as local
+        VariableNo  object_var_no;  // Number of var in object
+        int         no;
+    };
 
     virtual simple::string to_string();
 
     AstExprVariable(Lang* context) :
         AstExpr(context),
-        name("")
+        name(""),
+        ident_type(0),
+        declaration(0),
+        no(0)
     {
     }
 };
@@ -1030,10 +1056,11 @@ struct AstLoopEach : AstNode
     virtual AstNodeType get_node_type() { return AstNodeType::AST_LOOP_EACH; }
     AstNode* decl_or_variable;
     AstExpr* container;
+    AstNode* block;
 
     virtual void collect_children()
     {
-        collect_children_of(decl_or_variable, container);
+        collect_children_of(decl_or_variable, container, block);
     }
 
     virtual bool contains_new_frame()
@@ -1044,7 +1071,8 @@ struct AstLoopEach : AstNode
     AstLoopEach(Lang* context) :
         AstNode(context),
         decl_or_variable(0),
-        container(0)
+        container(0),
+        block(0)
     {
     }
 };
@@ -1057,10 +1085,11 @@ struct AstLoopRange : AstNode
     AstExpr* begin;
     AstExpr* to;
     int      direction; // 1(upto) or -1(downto)
+    AstNode* block;
 
     virtual void collect_children()
     {
-        collect_children_of(decl_or_variable, begin, to);
+        collect_children_of(decl_or_variable, begin, to, block);
     }
 
     virtual bool contains_new_frame()
@@ -1075,7 +1104,8 @@ struct AstLoopRange : AstNode
         decl_or_variable(0),
         begin(0),
         to(0),
-        direction(0)
+        direction(0),
+        block(0)
     {
     }
 };
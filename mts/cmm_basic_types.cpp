@@ -10,7 +10,7 @@ namespace cmm
 void GlobalId::print(char *buf, size_t size, const char *prefix) const
 {
     snprintf(buf, size, "%s[%zu:v%zu@%zu]",
-             prefix, index(), version, process_id);
+             prefix, index(), (size_t)version, (size_t)process_id);
     buf[size - 1] = 0;
 }
 
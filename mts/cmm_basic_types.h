@@ -55,7 +55,9 @@ enum ValueType
 
 enum
 {
-    GLOBAL_ID_PER_PAGE = (1 << 8)
+    GLOBAL_ID_PER_PAGE = (1 << 8),
+    GLOBAL_ID_PAGE_BITS = 20,
+    GLOBAL_ID_MAX_PAGES = (1 << GLOBAL_ID_PAGE_BITS)
 };
 
 // Global Id is a 64bits, cross multi-process Id.
@@ -68,8 +70,8 @@ struct GlobalId
     {
         struct
         {
-            size_t  version : 32;
-            size_t  index_page : 16;
+            size_t  version : 28;
+            size_t  index_page : GLOBAL_ID_PAGE_BITS;
             size_t  index_offset : 8;
             size_t  process_id : 8;
         };
@@ -3,6 +3,7 @@
 
 #include "cmm.h"
 #include "cmm_call.h"
+#include "cmm_scheduler.h"
 
 namespace cmm
 {
@@ -55,8 +56,48 @@ Value call_other(Thread *thread, ObjectId oid, const Value& function_name, Value
     if (!program)
         return NIL;
 
+    auto *domain = entry->domain;
+    if (domain && domain->get_type() == Domain::READ_ONLY && thread->get_current_domain())
+    {
+        // The object won't be changed, call it in current domain without
+        // lock (see Domain::set_read_only)
+        auto *object = entry->object;
+        if (!object || object->get_oid() != oid || object->get_domain() != domain)
+            return NIL;
+
+        return program->invoke_read_only(thread, object, function_name, args, n);
+    }
+
     Value ret = program->invoke(thread, oid, function_name, args, n);
     return ret;
 }
 
+// Post call to other object without waiting
+AsyncCall *call_other_async(Thread *thread, ObjectId oid, const Value& function_name, Value *args, ArgNo n)
+{
+    auto *entry = Object::get_entry_by_id(oid);
+    auto *domain = entry ? entry->domain : 0;
+    auto *call = XNEW(AsyncCall, thread, oid, function_name, args, n);
+    if (!domain)
+    {
+        // No such object
+        call->finish(thread, NIL, AsyncCall::FAILED);
+        return call;
+    }
+
+    domain->post_call(call);
+
+    // Let a worker run it if there is scheduler
+    Scheduler::schedule_domain(domain);
+    return call;
+}
+
+// Wait the async call finished, return the result & free the handle
+Value wait_async_call(Thread *thread, AsyncCall *call)
+{
+    Value ret = call->wait(thread);
+    XDELETE(call);
+    return ret;
+}
+
 }
@@ -5,6 +5,7 @@
 #include <stddef.h>
 #include "cmm_domain.h"
 #include "cmm_efun.h"
+#include "cmm_mailbox.h"
 #include "cmm_object.h"
 #include "cmm_program.h"
 #include "cmm_thread.h"
@@ -78,4 +79,20 @@ inline Value call_other(Thread *thread, ObjectId oid, const Value& function_name
     return call_other(thread, oid, function_name, params, n);
 }
 
+// Post call to other object without waiting (without parameter)
+// The returned handle must be passed to wait_async_call() later
+AsyncCall *call_other_async(Thread *thread, ObjectId oid, const Value& function_name, Value *args = 0, ArgNo n = 0);
+
+// Post call to other object without waiting (with parameter)
+template<class... Types>
+inline AsyncCall *call_other_async(Thread *thread, ObjectId oid, const Value& function_name, Types&&... args)
+{
+    Value params[] = { args... };
+    ArgNo n = sizeof(params) / sizeof(params[0]);
+    return call_other_async(thread, oid, function_name, params, n);
+}
+
+// Wait the async call finished, return the result & free the handle
+Value wait_async_call(Thread *thread, AsyncCall *call);
+
 }
\ No newline at end of file
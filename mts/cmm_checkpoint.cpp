@@ -0,0 +1,438 @@
+// cmm_checkpoint.cpp
+
+#include <stdio.h>
+#include "std_port/std_port.h"
+#include "std_memmgr/std_memmgr.h"
+#include "cmm_checkpoint.h"
+#include "cmm_domain.h"
+#include "cmm_object.h"
+#include "cmm_output.h"
+#include "cmm_program.h"
+#include "cmm_thread.h"
+#include "cmm_value_list.h"
+
+namespace cmm
+{
+
+Checkpointer::Checkpointer(OutputSink *sink) :
+    m_serializer(sink),
+    m_saved_count(0),
+    m_destructed_count(0),
+    m_failed(false)
+{
+}
+
+// Save changed objects in all domains
+size_t Checkpointer::save(Thread *thread, size_t max_objects)
+{
+    begin_segment();
+
+    size_t pending = 0;
+    auto* prev_domain = thread->get_current_domain();
+    auto ids = Domain::get_all_domain_ids();
+    for (auto& id : ids)
+    {
+        auto* domain = Domain::get_domain_by_id(id);
+        if (!domain)
+            // Domain was destructed
+            continue;
+
+        thread->switch_domain(domain);
+        if (domain->has_contexts())
+        {
+            // Some frames may be changing the objects, try later
+            if (domain->get_dirty_count() || domain->get_destructed_count())
+                pending++;
+            continue;
+        }
+
+        if (!save_domain(domain, max_objects))
+            pending++;
+    }
+    thread->switch_domain(prev_domain);
+
+    // Write to sink without holding any domain
+    if (!end_segment())
+        m_failed = true;
+    return pending;
+}
+
+// Save all objects of all domains in a forked child process
+std_pid_t Checkpointer::fork_snapshot(Thread *thread, const char *path, std_freq_t *held_us)
+{
+    // Hold all domains, then no one is changing the objects. A thread holds
+    // one domain at most (it leaves the current one before entering the
+    // other), so they can be held in any order.
+    auto* prev_domain = thread->get_current_domain();
+    thread->switch_domain(0);
+
+    auto begin_time = std_get_os_us_counter();
+    simple::vector<Domain *> domains;
+    auto ids = Domain::get_all_domain_ids();
+    for (auto& id : ids)
+    {
+        auto* domain = Domain::get_domain_by_id(id);
+        if (!domain)
+            continue;
+
+        domain->enter();
+        domains.push_back(domain);
+    }
+
+    // Only this thread is alive in child, hold the locks of memory manager
+    // to prevent the child from inheriting them in locked state
+    std_lock_mem_mgr_for_fork();
+    int pid = std_fork();
+    std_unlock_mem_mgr_after_fork();
+
+    if (pid == 0)
+    {
+        // Child process
+        bool ok = false;
+        FILE *fp = fopen(path, "wb");
+        if (fp)
+        {
+            FileSink sink(fp);
+            Checkpointer checkpointer(&sink);
+            ok = checkpointer.save_all(domains);
+            ok = (fclose(fp) == 0) && ok;
+        }
+        std_exit_forked_process(ok ? 0 : 1);
+    }
+
+    for (auto& domain : domains)
+        domain->leave();
+    thread->switch_domain(prev_domain);
+
+    if (held_us)
+        *held_us = std_get_os_us_counter() - begin_time;
+    return pid > 0 ? (std_pid_t)pid : 0;
+}
+
+// Wait for the child saving snapshot
+bool Checkpointer::wait_snapshot(std_pid_t pid)
+{
+    int exit_code;
+    if (!pid || !std_wait_process(pid, &exit_code))
+        return false;
+
+    return exit_code == 0;
+}
+
+// Save changed objects in domain
+bool Checkpointer::save_domain(Domain *domain, size_t max_objects)
+{
+    if (!domain->get_dirty_count() && !domain->get_destructed_count())
+        // Nothing changed
+        return true;
+
+    write_domain(domain);
+
+    ObjectId oid;
+    while (domain->pop_destructed_object(&oid))
+    {
+        m_serializer.write_byte(RECORD_DESTRUCTED);
+        m_serializer.write_uint((Uint64)oid.i64);
+        m_destructed_count++;
+    }
+
+    for (size_t count = 0; !max_objects || count < max_objects; count++)
+    {
+        auto* ob = domain->pop_dirty_object();
+        if (!ob)
+            return true;
+
+        write_object(ob);
+    }
+    return domain->get_dirty_count() == 0;
+}
+
+// Save all objects in domains
+// The records can be flushed at any time since no other thread is alive
+// in the child process
+bool Checkpointer::save_all(simple::vector<Domain *>& domains)
+{
+    begin_segment();
+    for (auto& domain : domains)
+    {
+        write_domain(domain);
+        for (auto& ob : domain->get_objects())
+            write_object(ob);
+
+        if (!m_serializer.flush())
+            m_failed = true;
+    }
+    if (!end_segment())
+        m_failed = true;
+    return !m_failed;
+}
+
+// Start a segment
+void Checkpointer::begin_segment()
+{
+    // Strings are shared in segment only, then each segment can be
+    // replayed after the previous ones without the whole stream
+    m_serializer.reset_strings();
+    m_serializer.write_uint(MAGIC);
+    m_serializer.write_uint(VERSION);
+}
+
+// End the segment & write all records to sink
+bool Checkpointer::end_segment()
+{
+    m_serializer.write_byte(RECORD_END);
+    return m_serializer.flush(true);
+}
+
+// Write domain record, the following objects belong to it
+void Checkpointer::write_domain(Domain *domain)
+{
+    auto* name = STRING_ALLOC(domain->get_name());
+    m_serializer.write_byte(RECORD_DOMAIN);
+    m_serializer.write_uint((Uint64)domain->get_id().i64);
+    m_serializer.write_string(name);
+    STRING_FREE(name);
+}
+
+// Write object record
+void Checkpointer::write_object(Object *ob)
+{
+    // Each record is a graph, it can be restored without others
+    m_serializer.reset_references();
+    m_serializer.write_byte(RECORD_OBJECT);
+    m_serializer.write_uint((Uint64)ob->get_oid().i64);
+    m_serializer.write_object_vars(ob);
+    m_saved_count++;
+}
+
+CheckpointLoader::CheckpointLoader() :
+    m_failed_count(0)
+{
+}
+
+// Load segments in memory
+// The records before bad data are restored still
+bool CheckpointLoader::load(Thread *thread, const void *data, size_t len)
+{
+    ValueList values;
+    Deserializer reader(&values, data, len);
+    auto* prev_domain = thread->get_current_domain();
+    bool ok = true;
+    while (ok && !reader.is_end())
+        ok = load_segment(thread, &reader, &values);
+    thread->switch_domain(prev_domain);
+
+    // Free values of the bad record
+    values.free();
+    return ok;
+}
+
+// Load segments in file
+bool CheckpointLoader::load_file(Thread *thread, const char *path)
+{
+    FILE *fp = fopen(path, "rb");
+    if (!fp)
+        return false;
+
+    simple::unsafe_vector<Uint8> data;
+    Uint8 buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+        data.push_back_array(buf, n);
+    fclose(fp);
+
+    return load(thread, data.get_array_address(0), data.size());
+}
+
+// Get the restored domain of saved domain id
+Domain *CheckpointLoader::get_domain(DomainId saved_id) const
+{
+    Domain *domain;
+    if (!m_domains.try_get(saved_id, &domain))
+        return 0;
+    return domain;
+}
+
+// Load a segment
+bool CheckpointLoader::load_segment(Thread *thread, Deserializer *reader, ValueList *values)
+{
+    Uint64 magic, version;
+    if (!reader->read_uint(&magic) || magic != Checkpointer::MAGIC ||
+        !reader->read_uint(&version) || version != Checkpointer::VERSION)
+        return false;
+
+    reader->reset_strings();
+    SavedDomain saved_domain;
+    saved_domain.id.i64 = 0;
+    saved_domain.name = 0;
+    for (;;)
+    {
+        Uint8 record;
+        Uint64 id;
+        if (!reader->read_byte(&record))
+            return false;
+
+        switch (record)
+        {
+        case Checkpointer::RECORD_END:
+            return true;
+
+        case Checkpointer::RECORD_DOMAIN:
+            if (!reader->read_uint(&id) || !reader->read_string(&saved_domain.name))
+                return false;
+            saved_domain.id.i64 = (Int64)id;
+            break;
+
+        case Checkpointer::RECORD_DESTRUCTED:
+        {
+            if (!reader->read_uint(&id))
+                return false;
+
+            ObjectId oid;
+            Object *ob;
+            oid.i64 = (Int64)id;
+            if (m_objects.try_get(oid, &ob))
+            {
+                thread->switch_domain(ob->get_domain());
+                XDELETE(ob);
+                m_objects.erase(oid);
+            }
+            break;
+        }
+
+        case Checkpointer::RECORD_OBJECT:
+            if (!saved_domain.name)
+                // Object out of domain
+                return false;
+            if (!load_object(thread, saved_domain, reader, values))
+                return false;
+            break;
+
+        default:
+            // Bad record
+            return false;
+        }
+    }
+}
+
+// Load an object record
+bool CheckpointLoader::load_object(Thread *thread, const SavedDomain& saved_domain, Deserializer *reader, ValueList *values)
+{
+    Uint64 id;
+    StringImpl *program_name;
+    if (!reader->read_uint(&id) || !reader->read_string(&program_name))
+        return false;
+
+    ObjectId oid;
+    oid.i64 = (Int64)id;
+    reader->reset_references();
+
+    Program *program = 0;
+    auto* shared_name = Program::find_string(program_name);
+    if (shared_name)
+        program = Program::find_program_by_name(shared_name);
+
+    Object *ob = 0;
+    if (m_objects.try_get(oid, &ob) && ob->get_program() != program)
+    {
+        // Program of object was changed, create it again
+        thread->switch_domain(ob->get_domain());
+        XDELETE(ob);
+        m_objects.erase(oid);
+        ob = 0;
+    }
+
+    if (!ob && program)
+    {
+        Domain *domain;
+        if (!m_domains.try_get(saved_domain.id, &domain))
+        {
+            domain = XNEW(Domain, saved_domain.name->c_str());
+            m_domains.put(saved_domain.id, domain);
+        }
+
+        thread->switch_domain(domain);
+        ob = program->new_instance(domain, oid);
+        if (ob)
+            m_objects.put(oid, ob);
+    }
+
+    if (!ob)
+        // Skip the vars
+        m_failed_count++;
+    else
+        thread->switch_domain(ob->get_domain());
+
+    if (!read_object_vars(ob, reader))
+        return false;
+
+    if (!ob)
+    {
+        values->free();
+        return true;
+    }
+
+    // The values are referred by object now
+    auto* domain = ob->get_domain();
+    domain->concat_value_list(values);
+    domain->check_gc();
+    return true;
+}
+
+// Read vars of object record
+bool CheckpointLoader::read_object_vars(Object *ob, Deserializer *reader)
+{
+    Uint64 components_count;
+    if (!reader->read_uint(&components_count))
+        return false;
+
+    auto* program = ob ? ob->get_program() : 0;
+    for (Uint64 i = 0; i < components_count; i++)
+    {
+        StringImpl *component_name;
+        Uint64 vars_count;
+        if (!reader->read_string(&component_name) || !reader->read_uint(&vars_count))
+            return false;
+
+        // Lookup component by name (the names are shared)
+        Program *component = 0;
+        AbstractComponent *p = 0;
+        auto* shared_component_name = program ? Program::find_string(component_name) : 0;
+        for (ComponentNo k = 0; shared_component_name && k < program->get_components_count(); k++)
+        {
+            if (program->get_component_name(k) == shared_component_name)
+            {
+                component = program->get_component(k);
+                p = (AbstractComponent *)((Uint8 *)ob + program->get_component_offset(k));
+                break;
+            }
+        }
+
+        for (Uint64 n = 0; n < vars_count; n++)
+        {
+            StringImpl *var_name;
+            Value value = NIL;
+            if (!reader->read_string(&var_name) || !reader->read_value(&value))
+                return false;
+
+            if (!component || value.m_type == NIL)
+                continue;
+
+            auto* shared_var_name = Program::find_string(var_name);
+            for (VariableNo v = 0; shared_var_name && v < component->get_object_vars_count(); v++)
+            {
+                auto* object_var = component->get_object_var(v);
+                if (object_var->get_name() != shared_var_name)
+                    continue;
+
+                // Keep the var if type was changed
+                if (object_var->get_type() == value.m_type || object_var->get_type() == MIXED)
+                    p->m_object_vars[v] = value;
+                break;
+            }
+        }
+    }
+    return true;
+}
+
+} // End of namespace: cmm
@@ -0,0 +1,163 @@
+// cmm_checkpoint.h
+// Incremental checkpoints & snapshots of objects in domains
+
+#pragma once
+
+#include "std_port/std_port.h"
+#include "std_template/simple_hash_map.h"
+#include "std_template/simple_vector.h"
+#include "cmm.h"
+#include "cmm_basic_types.h"
+#include "cmm_serializer.h"
+
+namespace cmm
+{
+
+class Domain;
+class Object;
+class OutputSink;
+class Thread;
+class ValueList;
+
+// Save objects changed since last checkpoint
+// An object is regarded as changed once it's called (see
+// Domain::mark_dirty), so only these objects are written each time.
+// Each save() writes a segment:
+//     MAGIC VERSION
+//     DOMAIN id name
+//         DESTRUCTED oid
+//         OBJECT oid vars (see Serializer::write_object_vars)
+//         ...
+//     ...
+//     END
+// Replay the segments in order to restore the latest state, a record of
+// an oid replaces the earlier ones. The strings are shared in a segment,
+// but an array/mapping/buffer referred by several objects is written in
+// each record of them.
+// The records are written to memory while holding a domain, then flushed
+// to sink after returning to previous domain. To avoid stalling a domain,
+// at most max_objects objects are saved each time, the others are left
+// for next save(). A domain can't be saved while some threads have frames
+// in it (the objects may be half changed), skip it & retry later.
+//
+// A snapshot is a segment of all objects, it's written by a forked child
+// process. The parent holds all domains while forking only, then goes on
+// with the pages copied on write.
+class Checkpointer
+{
+public:
+    enum { MAGIC = 0x504B4D43, VERSION = 1 };
+
+    enum Record
+    {
+        RECORD_END = 0,
+        RECORD_DOMAIN = 1,
+        RECORD_OBJECT = 2,
+        RECORD_DESTRUCTED = 3,
+    };
+
+public:
+    Checkpointer(OutputSink *sink);
+
+public:
+    // Save changed objects in all domains, at most max_objects objects of
+    // a domain each time (0 means no limit)
+    // Return count of domains not finished (call again later)
+    size_t save(Thread *thread, size_t max_objects = 0);
+
+public:
+    // Save all objects of all domains to file in a child process
+    // held_us receives how long the domains were held (optional)
+    // Return pid of the child, or 0 if failed (not supported on Windows)
+    static std_pid_t fork_snapshot(Thread *thread, const char *path, std_freq_t *held_us = 0);
+
+    // Wait for the child, return true if the snapshot was saved
+    static bool wait_snapshot(std_pid_t pid);
+
+public:
+    size_t get_saved_count() const { return m_saved_count; }
+    size_t get_destructed_count() const { return m_destructed_count; }
+    size_t get_unsupported_count() const { return m_serializer.get_unsupported_count(); }
+    size_t get_written() const { return m_serializer.get_flushed(); }
+
+    // Was the sink failed?
+    bool is_failed() const { return m_failed; }
+
+private:
+    // Save changed objects in domain (domain must be held)
+    // Return false if there are objects left
+    bool save_domain(Domain *domain, size_t max_objects);
+
+    // Save all objects in domains (they must be held)
+    bool save_all(simple::vector<Domain *>& domains);
+
+    // Write records
+    void begin_segment();
+    bool end_segment();
+    void write_domain(Domain *domain);
+    void write_object(Object *ob);
+
+private:
+    Serializer m_serializer;
+    size_t m_saved_count;
+    size_t m_destructed_count;
+    bool m_failed;
+};
+
+// Restore objects from checkpoints & snapshots
+// The segments are replayed in order. A domain is created when the first
+// object of it is restored, the objects are created with saved oids
+// (they must not be used in this process), a later record of same oid
+// updates the object. The vars are restored by names of components &
+// vars, a var is kept if the saved value is nil or the type is changed.
+// The objects are not created by calling "create", they are restored as
+// they were saved.
+class CheckpointLoader
+{
+public:
+    CheckpointLoader();
+
+public:
+    // Load segments in memory, return false if the data is bad
+    bool load(Thread *thread, const void *data, size_t len);
+
+    // Load segments in file
+    bool load_file(Thread *thread, const char *path);
+
+public:
+    // Get the restored domain of saved domain id
+    Domain *get_domain(DomainId saved_id) const;
+
+    size_t get_restored_count() const { return m_objects.size(); }
+    size_t get_domains_count() const { return m_domains.size(); }
+
+    // Count of objects can't be restored (no such program or oid is in use)
+    size_t get_failed_count() const { return m_failed_count; }
+
+private:
+    // A domain in segment
+    struct SavedDomain
+    {
+        DomainId id;
+        StringImpl *name;   // In string table of reader
+    };
+
+private:
+    // Load a segment
+    bool load_segment(Thread *thread, Deserializer *reader, ValueList *values);
+
+    // Load an object record, return false if the data is bad
+    bool load_object(Thread *thread, const SavedDomain& saved_domain, Deserializer *reader, ValueList *values);
+
+    // Read vars of object record, set them if ob is not 0
+    bool read_object_vars(Object *ob, Deserializer *reader);
+
+private:
+    typedef simple::hash_map<DomainId, Domain *, global_id_hash_func> DomainMap;
+    typedef simple::hash_map<ObjectId, Object *, global_id_hash_func> ObjectMap;
+    DomainMap m_domains;
+    ObjectMap m_objects;
+    size_t m_failed_count;
+};
+
+} // End of namespace: cmm
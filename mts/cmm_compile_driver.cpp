@@ -0,0 +1,243 @@
+// cmm_compile_driver.cpp
+
+#include <stdio.h>
+#include "std_port/std_port_os.h"
+#include "cmm_compile_driver.h"
+#include "cmm_lang.h"
+#include "cmm_program.h"
+#include "cmm_program_cache.h"
+#include "cmm_shell.h"
+#include "cmm_thread.h"
+
+namespace cmm
+{
+
+CompileDriver::CompileDriver(ResolveFunc resolve) :
+    m_resolve(resolve),
+    m_busy_count(0),
+    m_compiled_count(0),
+    m_cached_count(0),
+    m_failed_count(0),
+    m_running_count(0),
+    m_use_cache(false),
+    m_register_programs(true),
+    m_compile_loaded(true)
+{
+    std_new_critical_section(&m_cs);
+}
+
+CompileDriver::~CompileDriver()
+{
+    STD_ASSERT(("There are still workers running.", m_running_count == 0));
+    std_delete_critical_section(m_cs);
+}
+
+// Add a source file to be compiled
+void CompileDriver::add_file(const char* file_name, const char* program_name)
+{
+    std_enter_critical_section(m_cs);
+    if (!m_seen_programs.contains(program_name))
+    {
+        m_seen_programs.put(program_name);
+        Job job;
+        job.file_name = file_name;
+        job.program_name = program_name;
+        m_jobs.push_back(job);
+    }
+    std_leave_critical_section(m_cs);
+}
+
+// Compile all files on workers & wait until done
+size_t CompileDriver::compile_all(size_t worker_count)
+{
+    if (!worker_count)
+        worker_count = (size_t)std_get_cpu_count();
+
+    for (size_t i = 0; i < worker_count; i++)
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "Compiler(%zu)", i);
+        std_cpu_lock_add(&m_running_count, 1);
+        if (!std_create_task(name, NULL, (void *)worker_entry, this))
+        {
+            std_cpu_lock_add(&m_running_count, -1);
+            STD_TRACE("Failed to create compiler %zu.\n", i);
+        }
+    }
+
+    if (!m_running_count)
+        // No worker, compile in this thread
+        run_jobs();
+
+    while (m_running_count > 0)
+        std_sleep(1);
+
+    return m_failed_count;
+}
+
+// Entry of worker thread
+void *CompileDriver::worker_entry(CompileDriver *driver)
+{
+    auto *thread = XNEW(Thread);
+    thread->start();
+
+    driver->run_jobs();
+
+    thread->stop();
+    XDELETE(thread);
+    std_cpu_lock_add(&driver->m_running_count, -1);
+    return 0;
+}
+
+// Compile until all jobs are done
+void CompileDriver::run_jobs()
+{
+    Job job;
+    while (take_job(&job))
+    {
+        simple::vector<simple::string> components;
+        bool succ = compile_file(job, &components);
+
+        std_enter_critical_section(m_cs);
+        if (succ)
+            m_compiled_count++;
+        else
+            m_failed_count++;
+        add_components(components);
+        m_busy_count--;
+        std_leave_critical_section(m_cs);
+    }
+}
+
+// Take a job
+// Wait if there is no job but the others are compiling, they may queue
+// the components found
+bool CompileDriver::take_job(Job *job)
+{
+    for (;;)
+    {
+        std_enter_critical_section(m_cs);
+        if (m_jobs.size())
+        {
+            *job = m_jobs[m_jobs.size() - 1];
+            m_jobs.remove(m_jobs.size() - 1);
+            m_busy_count++;
+            std_leave_critical_section(m_cs);
+            return true;
+        }
+        bool is_all_done = (m_busy_count == 0);
+        std_leave_critical_section(m_cs);
+
+        if (is_all_done)
+            return false;
+        std_sleep(1);
+    }
+}
+
+// Compile a file in a new context
+// Try the image at first if cache is used, skip compiling if it's valid
+bool CompileDriver::compile_file(const Job& job, simple::vector<simple::string> *components)
+{
+    ProgramCache::SourceStamp stamp;
+    bool use_cache = m_use_cache &&
+                     ProgramCache::stat_source_file(job.file_name.c_str(), &stamp);
+    if (use_cache && load_from_cache(job, &stamp, components))
+        return true;
+
+    // Lex the mapped file in place, or read it when it can't be mapped
+    auto* context = XNEW(Lang);
+    FILE *fp = 0;
+    if (!context->m_lexer.start_new_mapped_file(NULL, job.file_name.c_str(), job.file_name))
+    {
+        fp = fopen(job.file_name.c_str(), "r");
+        if (!fp)
+        {
+            cmm_errprintf("Failed to open %s for program %s.\n",
+                          job.file_name.c_str(), job.program_name.c_str());
+            XDELETE(context);
+            return false;
+        }
+        context->m_lexer.start_new_file(NULL, (IntR)fp, job.file_name);
+    }
+    context->m_program_name = job.program_name;
+    context->m_register_program = false;
+    auto ret = context->parse();
+    for (auto& it : context->m_components)
+        components->push_back(it);
+
+    simple::string image_file_name;
+    if (use_cache && ret == ErrorCode::OK && context->m_program &&
+        ProgramCache::get_image_file_name(job.program_name, &image_file_name) &&
+        !ProgramCache::save(image_file_name.c_str(), job.file_name.c_str(), &stamp, context->m_program))
+        STD_TRACE("Failed to save image %s.\n", image_file_name.c_str());
+
+    if (ret == ErrorCode::OK && context->m_program)
+        add_program(context->m_program);
+
+    XDELETE(context);
+    if (fp)
+        fclose(fp);
+
+    return ret == ErrorCode::OK;
+}
+
+// Load program from image
+bool CompileDriver::load_from_cache(const Job& job, ProgramCache::SourceStamp *stamp, simple::vector<simple::string> *components)
+{
+    simple::string image_file_name;
+    if (!ProgramCache::get_image_file_name(job.program_name, &image_file_name))
+        return false;
+
+    auto* program = ProgramCache::load(image_file_name.c_str(), job.file_name.c_str(), stamp, components);
+    if (!program)
+        return false;
+
+    add_program(program);
+    std_enter_critical_section(m_cs);
+    m_cached_count++;
+    std_leave_critical_section(m_cs);
+    return true;
+}
+
+// Program is done, register it if necessary
+void CompileDriver::add_program(Program* program)
+{
+    if (m_register_programs)
+        // Let the others see it
+        program->register_program();
+
+    std_enter_critical_section(m_cs);
+    m_programs.push_back(program);
+    std_leave_critical_section(m_cs);
+}
+
+// Is the program in program table?
+static bool is_loaded(const simple::string& program_name)
+{
+    auto* name = Program::find_string(program_name.c_str());
+    return name && Program::find_program_by_name(name);
+}
+
+// Queue the components never seen
+void CompileDriver::add_components(simple::vector<simple::string>& components)
+{
+    for (auto& program_name : components)
+    {
+        if (m_seen_programs.contains(program_name))
+            continue;
+        m_seen_programs.put(program_name);
+
+        if (!m_compile_loaded && is_loaded(program_name))
+            // Use the active one
+            continue;
+
+        Job job;
+        if (!m_resolve || !m_resolve(program_name, &job.file_name))
+            // No source, it should be created by others
+            continue;
+        job.program_name = program_name;
+        m_jobs.push_back(job);
+    }
+}
+
+}
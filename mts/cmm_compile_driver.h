@@ -0,0 +1,120 @@
+// cmm_compile_driver.h
+// Compile source files to programs on worker threads
+
+#pragma once
+
+#include "std_port/std_port.h"
+#include "std_template/simple_hash_set.h"
+#include "std_template/simple_string.h"
+#include "std_template/simple_vector.h"
+#include "cmm.h"
+#include "cmm_program_cache.h"
+
+namespace cmm
+{
+
+class Program;
+
+// Compile a set of source files concurrently
+// Each file is parsed, checked & generated by one worker with its own Lang
+// context (so its own MemList for AST). After a file is compiled, the
+// components it refers are resolved to source files & queued if they are
+// never seen, so the whole component graph is walked.
+// The program is registered to program table by Lang when it's generated,
+// call Program::update_all_programs() after all files are compiled.
+// When cache is used, a program is loaded from its image in output
+// directory if the image is valid for the source, and the image is saved
+// after the program is compiled (see ProgramCache).
+// When reloading, the programs are not registered by driver & the
+// components already loaded are not compiled again (see ProgramReloader).
+class CompileDriver
+{
+public:
+    // Map program name to source file name
+    // Return false if there is no source for the program (such as native)
+    typedef bool (*ResolveFunc)(const simple::string& program_name, simple::string* file_name);
+
+    struct Job
+    {
+        simple::string file_name;
+        simple::string program_name;
+    };
+
+public:
+    CompileDriver(ResolveFunc resolve = 0);
+    ~CompileDriver();
+
+public:
+    // Add a source file to be compiled
+    void add_file(const char* file_name, const char* program_name);
+
+    // Compile all files & the components referred by them
+    // Use count of cpus if worker_count is 0
+    // Return count of failed files
+    size_t compile_all(size_t worker_count = 0);
+
+    // Load from/save to program images in output directory
+    void set_use_cache(bool use_cache)
+    {
+        m_use_cache = use_cache;
+    }
+
+    // Register programs to program table when they are generated
+    void set_register_programs(bool register_programs)
+    {
+        m_register_programs = register_programs;
+    }
+
+    // Compile the components which are already loaded
+    void set_compile_loaded_components(bool compile_loaded)
+    {
+        m_compile_loaded = compile_loaded;
+    }
+
+public:
+    size_t get_compiled_count() const { return m_compiled_count; }
+    size_t get_cached_count() const { return m_cached_count; }
+    size_t get_failed_count() const { return m_failed_count; }
+
+    // Get programs generated or loaded from cache
+    const simple::vector<Program*>& get_programs() const { return m_programs; }
+
+private:
+    // Entry of worker thread
+    static void *worker_entry(CompileDriver *driver);
+
+    // Compile until all jobs are done
+    void run_jobs();
+
+    // Take a job, return false if all jobs are done
+    bool take_job(Job *job);
+
+    // Compile a file & collect the components referred by it
+    bool compile_file(const Job& job, simple::vector<simple::string> *components);
+
+    // Program is done, register it if necessary
+    void add_program(Program* program);
+
+    // Load program from image, return false if the image is not valid
+    bool load_from_cache(const Job& job, ProgramCache::SourceStamp *stamp, simple::vector<simple::string> *components);
+
+    // Queue the components never seen (lock must be held)
+    void add_components(simple::vector<simple::string>& components);
+
+private:
+    ResolveFunc m_resolve;
+    struct std_critical_section *m_cs;
+    simple::vector<Job> m_jobs;         // Pending jobs
+    simple::hash_set<simple::string> m_seen_programs;
+    simple::vector<Program*> m_programs;
+    size_t m_busy_count;                // Count of jobs being compiled
+    size_t m_compiled_count;           // Include the loaded from cache
+    size_t m_cached_count;
+    size_t m_failed_count;
+    volatile AtomInt m_running_count;   // Count of alive workers
+    bool m_use_cache;
+    bool m_register_programs;
+    bool m_compile_loaded;
+};
+
+}
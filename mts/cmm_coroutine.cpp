@@ -0,0 +1,175 @@
+// cmm_coroutine.cpp
+
+#include <stdio.h>
+#include "std_port/std_port.h"
+#include "std_port/std_port_mmap.h"
+#include "cmm.h"
+#include "cmm_coroutine.h"
+#include "cmm_thread.h"
+
+#ifdef _WINDOWS
+#include <windows.h>
+#endif
+
+namespace cmm
+{
+
+// Create coroutine, it won't run until resume()
+Coroutine::Coroutine(Entry entry, void *para, size_t stack_size)
+{
+    m_entry = entry;
+    m_para = para;
+    m_state = READY;
+    m_thread = 0;
+    m_host_thread = 0;
+
+#ifdef _WINDOWS
+    m_host_fiber = 0;
+    m_fiber = CreateFiber(stack_size, (LPFIBER_START_ROUTINE)fiber_entry, this);
+    if (!m_fiber)
+        throw_error("Failed to create fiber for coroutine.\n");
+#else
+    // Reserve stack with a guard page at bottom
+    m_stack_size = std_align_size(stack_size) + STD_PAGE_SIZE;
+    m_stack = std_mem_reserve(0, m_stack_size);
+    if (!m_stack)
+        throw_error("Failed to reserve stack for coroutine.\n");
+    if (!std_mem_commit((Uint8 *)m_stack + STD_PAGE_SIZE, m_stack_size - STD_PAGE_SIZE,
+                        STD_PAGE_READ | STD_PAGE_WRITE))
+    {
+        std_mem_release(m_stack, m_stack_size);
+        throw_error("Failed to commit stack for coroutine.\n");
+    }
+
+    getcontext(&m_start_context);
+    m_start_context.uc_stack.ss_sp = (Uint8 *)m_stack + STD_PAGE_SIZE;
+    m_start_context.uc_stack.ss_size = m_stack_size - STD_PAGE_SIZE;
+    m_start_context.uc_link = 0;
+    // makecontext passes int arguments only, split the pointer
+    Uint64 p = (Uint64)(size_t)this;
+    makecontext(&m_start_context, (void (*)())context_entry, 2, (int)(p >> 32), (int)(p & 0xFFFFFFFF));
+    m_resume_context = &m_start_context;
+    m_host_context = 0;
+#endif
+}
+
+Coroutine::~Coroutine()
+{
+    STD_ASSERT(("Can't free a running coroutine.", m_state != RUNNING));
+    STD_ASSERT(("Coroutine is not finished, the stack would be leaked.",
+                m_state == READY || m_state == FINISHED));
+
+#ifdef _WINDOWS
+    DeleteFiber(m_fiber);
+#else
+    std_mem_release(m_stack, m_stack_size);
+#endif
+}
+
+// Run the coroutine until it yields or finishes
+bool Coroutine::resume()
+{
+    STD_ASSERT(("Coroutine is running or finished.", m_state == READY || m_state == SUSPENDED));
+    STD_ASSERT(("Can't resume a coroutine in another one.", !get_current()));
+
+    // Let the coroutine's Thread be the current thread
+    m_host_thread = Thread::get_current_thread();
+    Thread::set_current_thread(m_thread);
+    m_state = RUNNING;
+
+#ifdef _WINDOWS
+    m_host_fiber = GetCurrentFiber();
+    if (!m_host_fiber || m_host_fiber == (void *)0x1E00)
+        m_host_fiber = ConvertThreadToFiber(0);
+    SwitchToFiber(m_fiber);
+#else
+    ucontext_t here;
+    m_host_context = &here;
+    swapcontext(&here, m_resume_context);
+#endif
+
+    // Back from coroutine
+    Thread::set_current_thread(m_host_thread);
+    m_host_thread = 0;
+    return m_state != FINISHED;
+}
+
+// Get coroutine running in current OS thread
+Coroutine *Coroutine::get_current()
+{
+    auto *thread = Thread::get_current_thread();
+    return thread ? thread->get_coroutine() : 0;
+}
+
+// Give up the cpu, back to the resumer
+void Coroutine::yield()
+{
+    auto *thread = Thread::get_current_thread();
+    auto *co = thread ? thread->get_coroutine() : 0;
+    if (!co)
+    {
+        // Not in coroutine, just relinquish
+        std_relinquish();
+        return;
+    }
+
+    // Registers are saved in the context on coroutine stack, above the end
+    // sp, so the GC can find all roots of suspended coroutine
+    thread->update_end_sp_of_current_domain_context();
+    co->m_state = SUSPENDED;
+
+#ifdef _WINDOWS
+    SwitchToFiber(co->m_host_fiber);
+#else
+    ucontext_t here;
+    co->m_resume_context = &here;
+    swapcontext(&here, co->m_host_context);
+#endif
+}
+
+// Body of coroutine
+void Coroutine::run()
+{
+    // Create the execution context on this stack
+    auto *thread = XNEW(Thread, "Coroutine");
+    thread->m_coroutine = this;
+    thread->start();
+    m_thread = thread;
+
+    auto *call_context = thread->get_this_call_context();
+    try
+    {
+        m_entry(m_para);
+    }
+    catch (...)
+    {
+        thread->restore_call_stack_for_error(call_context);
+    }
+
+    thread->stop();
+    XDELETE(thread);
+    m_thread = 0;
+    m_state = FINISHED;
+
+    // Back to resumer, never return
+#ifdef _WINDOWS
+    SwitchToFiber(m_host_fiber);
+#else
+    setcontext(m_host_context);
+#endif
+}
+
+#ifdef _WINDOWS
+void __stdcall Coroutine::fiber_entry(void *para)
+{
+    ((Coroutine *)para)->run();
+}
+#else
+void Coroutine::context_entry(int hi, int lo)
+{
+    Uint64 p = ((Uint64)(Uint32)hi << 32) | (Uint64)(Uint32)lo;
+    ((Coroutine *)(size_t)p)->run();
+}
+#endif
+
+} // End of namespace: cmm
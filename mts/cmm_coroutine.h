@@ -0,0 +1,96 @@
+// cmm_coroutine.h
+// Stackful coroutine to run script without pinning an OS thread
+
+#pragma once
+
+#include "std_port/std_port.h"
+#include "cmm.h"
+
+#ifdef _WINDOWS
+#else
+#include <ucontext.h>
+#endif
+
+namespace cmm
+{
+
+class Thread;
+
+// A coroutine owns a mmap'd stack & a Thread (the execution context of
+// script). The Thread is created on the coroutine stack, so the domain
+// contexts of it describe the coroutine stack & GC can scan it as normal.
+// When script waits for a domain, it yields to the resumer (usually a
+// worker of Scheduler) instead of blocking the OS thread. Script never
+// waits for socket I/O, the reactors post the socket events as calls (see
+// Socket).
+// ATTENTION: A suspended coroutine may be resumed by another OS thread.
+class Coroutine
+{
+public:
+    typedef void (*Entry)(void *para);
+
+    enum State
+    {
+        READY = 0,      // Created, never run
+        RUNNING = 1,    // Running
+        SUSPENDED = 2,  // Yielded
+        FINISHED = 3,   // Entry returned
+    };
+
+    enum { DEFAULT_STACK_SIZE = 256 * 1024 };
+
+public:
+    Coroutine(Entry entry, void *para, size_t stack_size = DEFAULT_STACK_SIZE);
+    ~Coroutine();
+
+public:
+    // Run the coroutine until it yields or finishes
+    // Return false if it's finished
+    bool resume();
+
+    // Get state of coroutine
+    State get_state() const { return (State)m_state; }
+
+    // Is the coroutine finished?
+    bool is_finished() const { return m_state == FINISHED; }
+
+    // Get the execution context (valid when started & not finished)
+    Thread *get_thread() const { return m_thread; }
+
+public:
+    // Get coroutine running in current OS thread (0 if none)
+    static Coroutine *get_current();
+
+    // Give up the cpu, back to the resumer
+    static void yield();
+
+private:
+    // Body of coroutine
+    void run();
+
+#ifdef _WINDOWS
+    static void __stdcall fiber_entry(void *para);
+#else
+    static void context_entry(int hi, int lo);
+#endif
+
+private:
+    Entry   m_entry;
+    void   *m_para;
+    volatile int m_state;
+    Thread *m_thread;           // Thread of this coroutine
+    Thread *m_host_thread;      // Thread of the resumer
+
+#ifdef _WINDOWS
+    void   *m_fiber;            // Fiber of this coroutine
+    void   *m_host_fiber;       // Fiber of the resumer
+#else
+    void   *m_stack;            // Reserved stack (include guard page)
+    size_t  m_stack_size;
+    ucontext_t  m_start_context;
+    ucontext_t *m_resume_context;   // Where to continue this coroutine
+    ucontext_t *m_host_context;     // Where to back to resumer
+#endif
+};
+
+} // End of namespace: cmm
@@ -0,0 +1,549 @@
+// cmm_data_image.cpp
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "std_port/std_port.h"
+#include "std_port/std_port_mmap.h"
+#include "std_template/simple_hash_map.h"
+#include "std_template/simple_string.h"
+#include "std_template/simple_vector.h"
+#include "cmm_data_image.h"
+#include "cmm_domain.h"
+#include "cmm_file_path.h"
+
+namespace cmm
+{
+
+// Hash of integer (real is hashed by bits)
+static Uint32 hash_int(Uint64 u)
+{
+    u ^= u >> 33;
+    u *= 0xFF51AFD7ED558CCDULL;
+    u ^= u >> 33;
+    return (Uint32)u;
+}
+
+// Compare pairs by hash
+static int compare_pair(const void *a, const void *b)
+{
+    auto ha = ((const DataImage::Pair *)a)->hash;
+    auto hb = ((const DataImage::Pair *)b)->hash;
+    return ha < hb ? -1 : (ha > hb ? 1 : 0);
+}
+
+// Append nodes to image
+class DataImageWriter
+{
+public:
+    DataImageWriter() :
+        m_data(4096),
+        m_too_large(false)
+    {
+        DataImage::ImageHeader header;
+        memset(&header, 0, sizeof(header));
+        write(&header, sizeof(header));
+    }
+
+public:
+    // Write value & the values referred by it, return 0 if failed
+    DataImage::Ref write_value(const Value& value, size_t depth)
+    {
+        if (depth > DataImage::MAX_DEPTH)
+            return 0;
+
+        switch (value.m_type)
+        {
+        case NIL:
+        {
+            Uint64 zero = 0;
+            return write_node(NIL, 0, 0, &zero, sizeof(zero));
+        }
+
+        case INTEGER:
+            return write_node(INTEGER, 0, 0, &value.m_int, sizeof(value.m_int));
+
+        case REAL:
+            return write_node(REAL, 0, 0, &value.m_real, sizeof(value.m_real));
+
+        case STRING:
+        {
+            // Same strings are written once
+            auto *string = value.m_string;
+            simple::string key(string->c_str(), string->length());
+            DataImage::Ref ref;
+            if (m_strings.try_get(key, &ref))
+                return ref;
+            ref = write_node(STRING, string->length(), 0, string->c_str(), string->length() + 1);
+            m_strings.put(key, ref);
+            return ref;
+        }
+
+        case BUFFER:
+        {
+            auto *buffer = value.m_buffer;
+            if (buffer->buffer_attrib & BufferImpl::CONTAIN_CLASS)
+                // The class may contain pointers
+                return 0;
+
+            DataImage::Ref ref;
+            if (m_references.try_get(buffer, &ref))
+                return ref;
+            ref = write_node(BUFFER, buffer->length(), 0, buffer->data(), buffer->length());
+            m_references.put(buffer, ref);
+            return ref;
+        }
+
+        case ARRAY:
+        {
+            // Shared arrays are written once, 0 means it's being written
+            // (a cycle)
+            DataImage::Ref ref;
+            if (m_references.try_get(value.m_reference, &ref))
+                return ref;
+            m_references.put(value.m_reference, 0);
+
+            auto *arr = value.m_array;
+            simple::unsafe_vector<DataImage::Ref> elements(arr->size());
+            Uint16 max_depth = 0;
+            for (auto& it : arr->a)
+            {
+                auto element = write_value(it, depth + 1);
+                if (!element)
+                    return 0;
+                elements.push_back(element);
+                if (get_depth(element) > max_depth)
+                    max_depth = get_depth(element);
+            }
+            ref = write_node(ARRAY, elements.size(), max_depth + 1,
+                             elements.get_array_address(0), elements.size() * sizeof(DataImage::Ref));
+            m_references.put(value.m_reference, ref);
+            return ref;
+        }
+
+        case MAPPING:
+        {
+            DataImage::Ref ref;
+            if (m_references.try_get(value.m_reference, &ref))
+                return ref;
+            m_references.put(value.m_reference, 0);
+
+            auto *map = value.m_map;
+            simple::unsafe_vector<DataImage::Pair> pairs(map->size());
+            Uint16 max_depth = 0;
+            for (auto& it : map->m)
+            {
+                auto key_type = it.first.m_type;
+                if (key_type != INTEGER && key_type != REAL && key_type != STRING)
+                    // Can't be found by key
+                    return 0;
+
+                DataImage::Pair pair;
+                pair.hash = DataImage::hash_key(it.first);
+                pair.key = write_value(it.first, depth + 1);
+                pair.value = write_value(it.second, depth + 1);
+                if (!pair.key || !pair.value)
+                    return 0;
+                pairs.push_back(pair);
+                if (get_depth(pair.value) > max_depth)
+                    max_depth = get_depth(pair.value);
+            }
+            if (pairs.size())
+                qsort(pairs.get_array_address(0), pairs.size(), sizeof(DataImage::Pair), compare_pair);
+            ref = write_node(MAPPING, pairs.size(), max_depth + 1,
+                             pairs.get_array_address(0), pairs.size() * sizeof(DataImage::Pair));
+            m_references.put(value.m_reference, ref);
+            return ref;
+        }
+
+        default:
+            // Object, function... can't be in image
+            return 0;
+        }
+    }
+
+    // Set root of image
+    void set_root(DataImage::Ref root)
+    {
+        DataImage::ImageHeader header;
+        header.magic = DataImage::IMAGE_MAGIC;
+        header.version = DataImage::IMAGE_VERSION;
+        header.reserved = 0;
+        header.image_size = (Uint32)m_data.size();
+        header.root = root;
+        memcpy(data(), &header, sizeof(header));
+    }
+
+    size_t size() const { return m_data.size(); }
+    Uint8* data() const { return &m_data[0]; }
+
+    // Is the image out of range of Ref?
+    bool is_too_large() const { return m_too_large; }
+
+private:
+    void write(const void* data, size_t size)
+    {
+        m_data.push_back_array((const Uint8*)data, size);
+    }
+
+    // Write node & payload, aligned
+    DataImage::Ref write_node(ValueType type, size_t count, Uint16 depth, const void *payload, size_t size)
+    {
+        align();
+        if (m_data.size() + sizeof(DataImage::Node) + size > (Uint32)-1 - DataImage::NODE_ALIGN)
+        {
+            m_too_large = true;
+            return 0;
+        }
+
+        DataImage::Node node;
+        node.type = (Uint8)type;
+        node.reserved = 0;
+        node.depth = depth;
+        node.count = (Uint32)count;
+        auto ref = (DataImage::Ref)m_data.size();
+        write(&node, sizeof(node));
+        write(payload, size);
+        align();
+        return ref;
+    }
+
+    Uint16 get_depth(DataImage::Ref ref) const
+    {
+        return ((const DataImage::Node *)&m_data[ref])->depth;
+    }
+
+    void align()
+    {
+        Uint8 zero = 0;
+        while (m_data.size() % DataImage::NODE_ALIGN)
+            write(&zero, 1);
+    }
+
+private:
+    simple::vector<Uint8> m_data;
+    simple::hash_map<simple::string, DataImage::Ref> m_strings;
+    simple::hash_map<ReferenceImpl *, DataImage::Ref> m_references;
+    bool m_too_large;
+};
+
+DataImage::DataImage(void *image, size_t size) :
+    m_image((const Uint8 *)image),
+    m_header((const ImageHeader *)image),
+    m_size(size)
+{
+}
+
+DataImage::~DataImage()
+{
+    std_unmap_file((void *)m_image, m_size);
+}
+
+// Compile value to image
+bool DataImage::save(const char *image_file_name, const Value& root)
+{
+    DataImageWriter writer;
+    auto ref = writer.write_value(root, 0);
+    if (!ref || writer.is_too_large())
+        return false;
+    writer.set_root(ref);
+
+    // Write to temporary file & rename, the processes mapped the old image
+    // keep reading it
+    if (FilePath::assure_path(image_file_name) != OK)
+        return false;
+    simple::string temp_file_name = simple::string(image_file_name) + ".tmp";
+    FILE *fp = fopen(temp_file_name.c_str(), "wb");
+    if (!fp)
+        return false;
+    bool succ = fwrite(writer.data(), 1, writer.size(), fp) == writer.size();
+    succ = (fclose(fp) == 0) && succ;
+    if (succ && rename(temp_file_name.c_str(), image_file_name) != 0)
+    {
+        // Rename can't replace existed file on some platforms
+        remove(image_file_name);
+        succ = rename(temp_file_name.c_str(), image_file_name) == 0;
+    }
+    if (!succ)
+        remove(temp_file_name.c_str());
+    return succ;
+}
+
+// Map image
+DataImage *DataImage::load(const char *image_file_name)
+{
+    size_t size;
+    void *image = std_map_file(image_file_name, &size);
+    if (!image)
+        return 0;
+
+    auto *data_image = XNEW(DataImage, image, size);
+    if (!data_image->validate())
+    {
+        XDELETE(data_image);
+        return 0;
+    }
+    return data_image;
+}
+
+// Load image as a READ_ONLY domain
+Domain *DataImage::load_domain(const char *image_file_name, const char *domain_name)
+{
+    auto *data_image = load(image_file_name);
+    if (!data_image)
+        return 0;
+
+    auto *domain = XNEW(Domain, domain_name, Domain::READ_ONLY);
+    domain->set_data_image(data_image);
+    return domain;
+}
+
+// Hash of key in image
+Uint32 DataImage::hash_key(const Value& key)
+{
+    switch (key.m_type)
+    {
+    case INTEGER:
+        return hash_int((Uint64)key.m_int);
+
+    case REAL:
+    {
+        Uint64 bits;
+        memcpy(&bits, &key.m_real, sizeof(bits));
+        return hash_int(bits);
+    }
+
+    case STRING:
+        return (Uint32)simple::string::hash_string(key.m_string->ptr());
+
+    default:
+        return 0;
+    }
+}
+
+// Hash of key node
+Uint32 DataImage::hash_node(Ref ref) const
+{
+    switch (get_type(ref))
+    {
+    case INTEGER:
+        return hash_int((Uint64)get_int(ref));
+
+    case REAL:
+        return hash_int(*(const Uint64 *)(get_node(ref) + 1));
+
+    case STRING:
+        return (Uint32)simple::string::hash_string((const char_t *)get_bytes(ref));
+
+    default:
+        return 0;
+    }
+}
+
+// Get element of array
+DataImage::Ref DataImage::get_element(Ref array, size_t index) const
+{
+    if (get_type(array) != ARRAY || index >= get_count(array))
+        return 0;
+    return get_elements(array)[index];
+}
+
+// Find value by key in mapping
+DataImage::Ref DataImage::find(Ref map, const Value& key) const
+{
+    if (get_type(map) != MAPPING)
+        return 0;
+
+    // Lower bound of the hash, then compare the keys of same hash
+    auto hash = hash_key(key);
+    auto *pairs = get_pairs(map);
+    size_t lo = 0, hi = get_count(map);
+    while (lo < hi)
+    {
+        size_t mid = (lo + hi) / 2;
+        if (pairs[mid].hash < hash)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    for (size_t i = lo; i < get_count(map) && pairs[i].hash == hash; i++)
+        if (is_key_equal(pairs[i].key, key))
+            return pairs[i].value;
+    return 0;
+}
+
+// Index array or mapping
+DataImage::Ref DataImage::index(Ref container, const Value& key) const
+{
+    if (get_type(container) == ARRAY)
+    {
+        if (key.m_type != INTEGER || key.m_int < 0)
+            return 0;
+        return get_element(container, (size_t)key.m_int);
+    }
+    return find(container, key);
+}
+
+// Is the node a key equal to value?
+bool DataImage::is_key_equal(Ref ref, const Value& key) const
+{
+    if (get_type(ref) != key.m_type)
+        return false;
+
+    switch (key.m_type)
+    {
+    case INTEGER:
+        return get_int(ref) == key.m_int;
+
+    case REAL:
+        return get_real(ref) == key.m_real;
+
+    case STRING:
+        return get_count(ref) == key.m_string->length() &&
+               memcmp(get_bytes(ref), key.m_string->c_str(), get_count(ref)) == 0;
+
+    default:
+        return false;
+    }
+}
+
+// Copy node to a value in current domain
+// The depth of node is limited by validate()
+Value DataImage::to_value(Ref ref) const
+{
+    switch (get_type(ref))
+    {
+    case INTEGER:
+        return get_int(ref);
+
+    case REAL:
+        return get_real(ref);
+
+    case STRING:
+        return String(get_bytes(ref), get_count(ref));
+
+    case BUFFER:
+        return BUFFER_ALLOC(get_bytes(ref), get_count(ref));
+
+    case ARRAY:
+    {
+        Array arr(get_count(ref));
+        auto *elements = get_elements(ref);
+        for (size_t i = 0; i < get_count(ref); i++)
+            arr.push_back(to_value(elements[i]));
+        return arr;
+    }
+
+    case MAPPING:
+    {
+        Map map(get_count(ref));
+        auto *pairs = get_pairs(ref);
+        for (size_t i = 0; i < get_count(ref); i++)
+            map.set(to_value(pairs[i].key), to_value(pairs[i].value));
+        return map;
+    }
+
+    default:
+        return NIL;
+    }
+}
+
+// Validate header & all nodes of image
+// The nodes are scanned in order, a node can refer the nodes before it
+// only, so there is no cycle & the depth is limited.
+bool DataImage::validate()
+{
+    if (m_size < sizeof(ImageHeader) || m_size > (Uint32)-1)
+        return false;
+
+    if (m_header->magic != IMAGE_MAGIC ||
+        m_header->version != IMAGE_VERSION ||
+        m_header->image_size != m_size)
+        return false;
+
+    // Bitmap of offsets of nodes
+    simple::unsafe_vector<Uint8> starts(m_size / NODE_ALIGN / 8 + 1);
+    starts.push_backs(0, m_size / NODE_ALIGN / 8 + 1);
+    auto is_node = [&starts](Ref ref)
+    {
+        return ref % NODE_ALIGN == 0 &&
+               (starts[ref / NODE_ALIGN / 8] & (1 << (ref / NODE_ALIGN % 8)));
+    };
+
+    size_t offset = (sizeof(ImageHeader) + NODE_ALIGN - 1) & ~(size_t)(NODE_ALIGN - 1);
+    while (offset < m_size)
+    {
+        if (m_size - offset < sizeof(Node))
+            return false;
+
+        auto ref = (Ref)offset;
+        auto *node = get_node(ref);
+        size_t payload;
+        switch (node->type)
+        {
+        case NIL:
+        case INTEGER:
+        case REAL:     payload = sizeof(Uint64); break;
+        case STRING:   payload = (size_t)node->count + 1; break;
+        case BUFFER:   payload = node->count; break;
+        case ARRAY:    payload = (size_t)node->count * sizeof(Ref); break;
+        case MAPPING:  payload = (size_t)node->count * sizeof(Pair); break;
+        default:       return false;
+        }
+        if (payload > m_size - offset - sizeof(Node))
+            return false;
+
+        switch (node->type)
+        {
+        case STRING:
+            if (get_bytes(ref)[node->count] != 0)
+                return false;
+            break;
+
+        case ARRAY:
+        {
+            auto *elements = get_elements(ref);
+            for (size_t i = 0; i < node->count; i++)
+                if (elements[i] >= ref || !is_node(elements[i]) ||
+                    get_node(elements[i])->depth >= node->depth)
+                    return false;
+            break;
+        }
+
+        case MAPPING:
+        {
+            auto *pairs = get_pairs(ref);
+            for (size_t i = 0; i < node->count; i++)
+            {
+                auto& pair = pairs[i];
+                if (pair.key >= ref || !is_node(pair.key) ||
+                    pair.value >= ref || !is_node(pair.value) ||
+                    get_node(pair.value)->depth >= node->depth)
+                    return false;
+
+                // The key must be found by hash
+                auto key_type = get_type(pair.key);
+                if ((key_type != INTEGER && key_type != REAL && key_type != STRING) ||
+                    hash_node(pair.key) != pair.hash ||
+                    (i > 0 && pairs[i - 1].hash > pair.hash))
+                    return false;
+            }
+            break;
+        }
+
+        default:
+            if (node->depth)
+                return false;
+            break;
+        }
+        if (node->depth > MAX_DEPTH + 1)
+            return false;
+
+        starts[ref / NODE_ALIGN / 8] |= (Uint8)(1 << (ref / NODE_ALIGN % 8));
+        offset = (offset + sizeof(Node) + payload + NODE_ALIGN - 1) & ~(size_t)(NODE_ALIGN - 1);
+    }
+
+    return m_header->root && m_header->root < m_size && is_node(m_header->root);
+}
+
+} // End of namespace: cmm
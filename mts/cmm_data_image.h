@@ -0,0 +1,133 @@
+// cmm_data_image.h
+// Memory-mapped image of constant data, read by any thread without lock
+
+#pragma once
+
+#include "std_port/std_port.h"
+#include "cmm.h"
+#include "cmm_value.h"
+
+namespace cmm
+{
+
+class Domain;
+
+// Large static data (tables, maps, texts...) are compiled offline into an
+// image, then mapped read-only & shared by all processes through the page
+// cache. The data are read in place without lock, copying or GC scanning,
+// only the value queried is copied to the domain of caller.
+// Layout of image:
+//    [ImageHeader]
+//    Nodes, each one is aligned to 8 bytes:
+//        NIL/INTEGER/REAL: [Node] [8 bytes]
+//        STRING/BUFFER:    [Node(count = length)] bytes (string with 0)
+//        ARRAY:            [Node] offset of element x count
+//        MAPPING:          [Pair] x count, sorted by hash of key
+// A node refers others by offset in image, so the image is position
+// independent. The children are written before the parent, then the image
+// can be validated in one pass when loading.
+class DataImage
+{
+public:
+    enum
+    {
+        IMAGE_MAGIC = 0x444D4D43,   // "CMMD"
+        IMAGE_VERSION = 1,
+        NODE_ALIGN = 8,
+        MAX_DEPTH = 1024,           // Max depth of containers
+    };
+
+    // Offset of node in image, 0 means not found
+    typedef Uint32 Ref;
+
+    struct ImageHeader
+    {
+        Uint32 magic;
+        Uint16 version;
+        Uint16 reserved;
+        Uint32 image_size;          // Size of whole image
+        Ref    root;                // Root value
+    };
+
+    struct Node
+    {
+        Uint8  type;                // ValueType
+        Uint8  reserved;
+        Uint16 depth;               // 0 for non-container, or max depth of children + 1
+        Uint32 count;               // Length of string/buffer, size of container
+    };
+
+    struct Pair
+    {
+        Uint32 hash;                // Hash of key
+        Ref    key;
+        Ref    value;
+    };
+
+public:
+    // Take the mapped image, call validate() before accessing it
+    DataImage(void *image, size_t size);
+    ~DataImage();
+
+public:
+    // Compile value to image, only nil, integer, real, string, buffer,
+    // array & mapping are supported (key must be integer, real or string)
+    // Return false if the value is not supported
+    static bool save(const char *image_file_name, const Value& root);
+
+    // Map image, return 0 if it's not existed or bad
+    static DataImage *load(const char *image_file_name);
+
+    // Load image as a READ_ONLY domain, the domain owns the image
+    static Domain *load_domain(const char *image_file_name, const char *domain_name);
+
+    // Hash of key in image
+    static Uint32 hash_key(const Value& key);
+
+public:
+    Ref get_root() const { return m_header->root; }
+    size_t get_size() const { return m_size; }
+
+    // Access node, the ref must be valid
+    ValueType get_type(Ref ref) const { return (ValueType)get_node(ref)->type; }
+    size_t get_count(Ref ref) const { return get_node(ref)->count; }
+    Integer get_int(Ref ref) const { return *(const Integer *)(get_node(ref) + 1); }
+    Real get_real(Ref ref) const { return *(const Real *)(get_node(ref) + 1); }
+    const char *get_bytes(Ref ref) const { return (const char *)(get_node(ref) + 1); }
+
+    // Get element of array, return 0 if out of range
+    Ref get_element(Ref array, size_t index) const;
+
+    // Get key of the nth pair in mapping, the ref must be valid
+    Ref get_key(Ref map, size_t index) const { return get_pairs(map)[index].key; }
+
+    // Find value by key in mapping, return 0 if not found
+    Ref find(Ref map, const Value& key) const;
+
+    // Index array by integer or mapping by key, return 0 if not found
+    Ref index(Ref container, const Value& key) const;
+
+    // Copy node to a value in current domain
+    Value to_value(Ref ref) const;
+
+    // Validate header & all nodes of image, return false if it's bad
+    bool validate();
+
+private:
+    const Node *get_node(Ref ref) const { return (const Node *)(m_image + ref); }
+    const Ref *get_elements(Ref ref) const { return (const Ref *)(get_node(ref) + 1); }
+    const Pair *get_pairs(Ref ref) const { return (const Pair *)(get_node(ref) + 1); }
+
+    // Is the node a key equal to value?
+    bool is_key_equal(Ref ref, const Value& key) const;
+
+    // Hash of key node
+    Uint32 hash_node(Ref ref) const;
+
+private:
+    const Uint8 *m_image;
+    const ImageHeader *m_header;
+    size_t m_size;
+};
+
+} // End of namespace: cmm
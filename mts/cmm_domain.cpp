@@ -1,16 +1,18 @@
 // cmm_domain.cpp
 
+#include <limits.h>
 #include <stdio.h>
 
 #include "std_port/std_port.h"
 #include "std_port/std_port_os.h"
 #include "std_template/simple_hash_set.h"
+#include "cmm_coroutine.h"
+#include "cmm_data_image.h"
 #include "cmm_domain.h"
 #include "cmm_object.h"
 #include "cmm_program.h"
 #include "cmm_value.h"
-
-int conflict; ////----
+#include "cmm_vm.h"
 
 namespace cmm
 {
@@ -19,14 +21,16 @@ Domain::DomainIdManager *Domain::m_id_manager = 0;
 Domain::DomainIdMap *Domain::m_all_domains = 0;
 Domain *Domain::m_domain_0 = 0;
 struct std_critical_section *Domain::m_domain_cs = 0;
+bool Domain::m_spin_enabled = true;
 
 // Initialize this module
 bool Domain::init()
 {
     std_new_critical_section(&m_domain_cs);
+    m_spin_enabled = (std_get_cpu_count() > 1);
 
     // Create the id manager
-    m_id_manager = XNEW(DomainIdManager, MAX_ID_PAGES);
+    m_id_manager = XNEW(DomainIdManager);
 
     // Create the domain 0
     m_all_domains = XNEW(DomainIdMap);
@@ -51,23 +55,34 @@ void Domain::shutdown()
     std_delete_critical_section(m_domain_cs);
 }
 
-Domain::Domain(const char *name)
+Domain::Domain(const char *name, Type type)
 {
-    m_type = NORMAL;
+    m_type = type;
     m_id.i64 = 0;
-    m_running = 0;
-    m_wait_counter = 0;
     m_thread_holder_id = 0;
+    m_data_image = 0;
+
+    // Init lock
+    m_next_ticket = 0;
+    m_now_serving = 0;
+    m_spin_limit = MIN_SPIN;
+    memset((void *)m_wait_slots, 0, sizeof(m_wait_slots));
+    m_enter_us = 0;
+    memset(&m_lock_stat, 0, sizeof(m_lock_stat));
+
+    // Not scheduled yet
+    m_scheduled = 0;
+    m_last_worker = -1;
 
     // GC counter (first gc after 8 allocation)
     m_gc_counter = 8;
 
-    // Create event for synchronous
-    std_create_event(&m_event_id);
-
     // Assign an id
     auto* entry = m_id_manager->allocate_id();
+    if (!entry)
+        throw_error("Out of domain id entries.\n");
     m_id = entry->gid;
+    entry->domain = this;
 
     // Store the domain name
     char buf[sizeof(m_name)];
@@ -89,6 +104,11 @@ Domain::Domain(const char *name)
 
 Domain::~Domain()
 {
+    // Fail all calls not executed
+    Mailbox::Node *node;
+    while ((node = m_mailbox.pop()) != 0)
+        AsyncCall::from_node(node)->finish(Thread::get_current_thread(), NIL, AsyncCall::FAILED);
+
     // Remove all objects
     auto objects = m_objects.to_array();
     for (auto& it: objects)
@@ -100,43 +120,299 @@ Domain::~Domain()
     STD_ASSERT(m_value_list.get_count() == 0);
 #endif
     m_value_list.free();
+    m_constant_list.free();
 
-    std_delete_event(m_event_id);
+    if (m_data_image)
+        XDELETE(m_data_image);
 
     std_enter_critical_section(m_domain_cs);
     m_all_domains->erase(m_id);
     std_leave_critical_section(m_domain_cs);
 
+    // Unbind from id entry
+    auto *entry = m_id_manager->get_entry_by_id(m_id);
+    if (entry)
+        entry->domain = 0;
+
     // The reference values list should be empty
     ////----        STD_ASSERT(("Objects in domain should be empty.", !m_objects.size()));
     ////----        STD_ASSERT(("Values in domain should be empty.", !m_value_list.get_count()));
 }
 
+// Set the constant data of READ_ONLY domain
+void Domain::set_data_image(DataImage *data_image)
+{
+    STD_ASSERT(("Only READ_ONLY domain has data image.", m_type == READ_ONLY));
+    if (m_data_image)
+        XDELETE(m_data_image);
+    m_data_image = data_image;
+}
+
+// Turn this domain to READ_ONLY (domain must be held)
+// All functions of the objects are verified not writing any member, then
+// the values referred by members are marked constant, so nothing can be
+// changed while calling them without lock.
+void Domain::set_read_only()
+{
+    if (m_type == READ_ONLY)
+        return;
+
+    if (has_contexts())
+        throw_error("Domain %s is being called, can't be read-only.\n", m_name);
+
+    // Verify each program once
+    simple::hash_set<Program *> verified;
+    for (auto& ob : m_objects)
+    {
+        auto* program = ob->get_program();
+        if (verified.contains(program))
+            continue;
+
+        for (ComponentNo i = 0; i < program->get_components_count(); i++)
+        {
+            auto* component = program->get_component(i);
+            for (FunctionNo k = 0; k < component->get_functions_count(); k++)
+            {
+                auto* function = component->get_function(k);
+                if (!function->is_being_interpreted())
+                    // Native code may write anything
+                    throw_error("Function %s in %s is not interpreted, can't be read-only.\n",
+                                function->get_name()->c_str(), component->get_name()->c_str());
+
+                auto pos = Simulator::find_member_write(function);
+                if (pos < function->get_byte_codes_count())
+                    throw_error("Function %s in %s writes member at %zu, can't be read-only.\n",
+                                function->get_name()->c_str(), component->get_name()->c_str(), pos);
+            }
+        }
+        verified.put(program);
+    }
+
+    // Mark all values referred by members
+    for (auto& ob : m_objects)
+    {
+        auto* program = ob->get_program();
+        for (ComponentNo i = 0; i < program->get_components_count(); i++)
+        {
+            auto* component = program->get_component(i);
+            auto* p = (AbstractComponent *)((Uint8 *)ob + program->get_component_offset(i));
+            for (VariableNo k = 0; k < component->get_object_vars_count(); k++)
+            {
+                auto* var = &p->m_object_vars[k];
+                if (var->is_reference_value())
+                    Program::mark_constant(var, &m_constant_list);
+            }
+        }
+    }
+
+    // Publish the values before any thread calls without lock
+    std_cpu_mfence();
+    m_type = READ_ONLY;
+}
+
 // Thread enter domain
 void Domain::enter()
 {
-    UintR running;
-    running = std_cpu_lock_xchg(&m_running, 1);
-    if (running)
+    auto *thread = Thread::get_current_thread();
+    if (thread && thread->get_coroutine())
     {
-        conflict++;
-        std_cpu_lock_add(&m_wait_counter, 1);
-        while ((running = std_cpu_lock_xchg(&m_running, 1)))
-            std_wait_event(m_event_id);
+        enter_in_coroutine();
+        return;
     }
+
+    UintR ticket = (UintR)std_cpu_lock_add(&m_next_ticket, 1);
+    if (m_now_serving != ticket)
+        wait_for_ticket(ticket);
+
+    // Got the ownership
+    m_lock_stat.acquisitions++;
+    m_enter_us = std_get_os_us_counter();
 }
 
 // Thread leave domain
 void Domain::leave()
 {
-    m_running = 0;
+    m_lock_stat.hold_us += std_get_os_us_counter() - m_enter_us;
+
+    // Hand off to next ticket
+    UintR next = m_now_serving + 1;
+    m_now_serving = next;
 
     std_cpu_mfence();
-    if (m_wait_counter)
+    auto *slot = &m_wait_slots[next & (WAIT_SLOTS - 1)];
+    if (slot->parked)
+    {
+        // Someone is sleeping on the slot of next ticket, wake up them
+        // (usually there is only one). The futex word is int, don't use
+        // std_cpu_lock_add on it; a lost increment still changes the word,
+        // then the waiter won't sleep on the old value
+        slot->seq++;
+        std_wake_address(&slot->seq, INT_MAX);
+    }
+}
+
+// Enter domain in coroutine
+// A coroutine yields while waiting, it mustn't hold a ticket then: the
+// native threads parked behind the ticket may occupy all workers, and no
+// one would resume the coroutine. So take a ticket only when the domain
+// is free, yield & retry otherwise.
+void Domain::enter_in_coroutine()
+{
+    bool contended = false;
+    for (;;)
+    {
+        UintR serving = m_now_serving;
+        if ((UintR)m_next_ticket == serving &&
+            std_cpu_lock_cas(&m_next_ticket, (AtomInt)serving, (AtomInt)(serving + 1)))
+            break;
+
+        contended = true;
+        Coroutine::yield();
+    }
+
+    // Got the ownership
+    if (contended)
+        m_lock_stat.contended++;
+    m_lock_stat.acquisitions++;
+    m_enter_us = std_get_os_us_counter();
+}
+
+// Wait until my ticket is served
+void Domain::wait_for_ticket(UintR ticket)
+{
+    // Spin for a while if I'm near the head of queue, it's cheaper than
+    // sleeping since the holder usually leaves quickly
+    int spin_limit = m_spin_limit;
+    if (!m_spin_enabled || ticket - m_now_serving > (UintR)SPIN_QUEUE_DEPTH)
+        spin_limit = 0;
+    for (int i = 0; i < spin_limit; i++)
+    {
+        std_cpu_pause();
+        if (m_now_serving == ticket)
+        {
+            // Got by spinning, adjust the spin limit toward 2 * i
+            m_spin_limit += (i * 2 - m_spin_limit) / 8;
+            if (m_spin_limit < MIN_SPIN)
+                m_spin_limit = MIN_SPIN;
+            else
+            if (m_spin_limit > MAX_SPIN)
+                m_spin_limit = MAX_SPIN;
+            m_lock_stat.contended++;
+            return;
+        }
+    }
+
+    // Park on the slot of my ticket
+    auto *slot = &m_wait_slots[ticket & (WAIT_SLOTS - 1)];
+    std_cpu_lock_add(&slot->parked, 1);
+    for (;;)
+    {
+        int seq = slot->seq;
+        if (m_now_serving == ticket)
+            break;
+        std_wait_address(&slot->seq, seq, STD_WAIT_FOREVER);
+    }
+    std_cpu_lock_add(&slot->parked, -1);
+
+    // Spinning didn't help, reduce it
+    if (spin_limit)
+    {
+        m_spin_limit /= 2;
+        if (m_spin_limit < MIN_SPIN)
+            m_spin_limit = MIN_SPIN;
+    }
+    m_lock_stat.contended++;
+    m_lock_stat.parked++;
+}
+
+// Post an asynchronous call to mailbox
+void Domain::post_call(AsyncCall *call)
+{
+    call->m_domain = this;
+    m_mailbox.push(&call->m_node);
+}
+
+// Execute calls in mailbox
+// The thread must hold this domain
+size_t Domain::drain_mailbox(Thread *thread, size_t max_calls)
+{
+    STD_ASSERT(("Domain must be held by the thread.", thread->get_current_domain() == this));
+
+    size_t count = 0;
+    while (count < max_calls)
     {
-        std_cpu_lock_add(&m_wait_counter, 1);
-        std_raise_event(m_event_id);
+        auto *node = m_mailbox.pop();
+        if (!node)
+            break;
+        execute_async_call(thread, AsyncCall::from_node(node));
+        count++;
     }
+    return count;
+}
+
+// Execute an asynchronous call
+void Domain::execute_async_call(Thread *thread, AsyncCall *call)
+{
+    // Verify the object, it may be destructed or moved after posted
+    auto *entry = Object::get_entry_by_id(call->m_oid);
+    auto *ob = entry ? entry->object : 0;
+    if (!ob || ob->get_oid() != call->m_oid || ob->get_domain() != this)
+    {
+        call->finish(thread, NIL, AsyncCall::FAILED);
+        return;
+    }
+
+    auto *program = ob->get_program();
+    Program::CalleeInfo callee;
+    if (call->m_function_name.m_type != ValueType::STRING ||
+        !program->get_public_callee_by_name((String *)&call->m_function_name, &callee))
+    {
+        // No such function
+        call->finish(thread, NIL, AsyncCall::DONE);
+        return;
+    }
+
+    // Copy arguments to stack so GC can find them, then take over the values
+    ArgNo n = call->m_arg_no;
+    Value *args = (Value *)STD_ALLOCA(sizeof(Value) * (n + 1));
+    if (n)
+        memcpy(args, call->m_args, sizeof(Value) * n);
+    concat_value_list(&call->m_values);
+    check_gc();
+    mark_dirty(ob);
+
+    // Call
+    auto component_no = callee.component_no;
+    auto offset = program->get_component_offset(component_no);
+    auto *component_impl = (AbstractComponent *)(((Uint8 *)ob) + offset);
+    auto func = callee.function->get_script_entry();
+    auto *call_context = thread->get_this_call_context();
+    Value ret = NIL;
+    try
+    {
+        thread->push_call_context(ob, callee.function, args, n, component_no);
+        ret = (component_impl->*func)(thread, args, n);
+        thread->pop_call_context();
+    }
+    catch (const char *str)
+    {
+        // Report the error like a synchronous caller (the call stack was
+        // traced by throw_error), there is no caller to catch it
+        printf("Async call %s::%s failed: %s\n",
+               program->get_name()->c_str(), callee.function->get_name()->c_str(), str);
+        thread->restore_call_stack_for_error(call_context);
+        call->finish(thread, NIL, AsyncCall::FAILED);
+        return;
+    }
+    catch (...)
+    {
+        printf("Async call %s::%s failed: unknown error\n",
+               program->get_name()->c_str(), callee.function->get_name()->c_str());
+        thread->restore_call_stack_for_error(call_context);
+        call->finish(thread, NIL, AsyncCall::FAILED);
+        return;
+    }
+    call->finish(thread, ret, AsyncCall::DONE);
 }
 
 // Garbage collect
@@ -316,6 +592,8 @@ void Domain::join_object(Object *ob)
 {
     STD_ASSERT(ob->get_domain() == this);
     m_objects.put(ob);
+    link_instance(ob);
+    mark_dirty(ob);
 }
 
 // Object was destructed, left domain
@@ -323,19 +601,119 @@ void Domain::object_was_destructed(Object *ob)
 {
     STD_ASSERT(m_objects.contains(ob));
     m_objects.erase(ob);
+    unlink_instance(ob);
+    m_destructed_objects.push_back(ob->get_oid());
+}
+
+// Object was moved to new memory or changed program
+// The new_ob may be same as ob, or a copy of it
+void Domain::object_was_replaced(Object *ob, Object *new_ob, Program *new_program)
+{
+    STD_ASSERT(m_objects.contains(ob));
+    unlink_instance(ob);
+    if (new_ob != ob)
+    {
+        m_objects.erase(ob);
+        m_objects.put(new_ob);
+    }
+    new_ob->m_program = new_program;
+    link_instance(new_ob);
+    mark_dirty(new_ob);
+}
+
+// Object was called, add it to dirty list if it's not there
+void Domain::mark_dirty(Object *ob)
+{
+    if (ob->m_dirty)
+        return;
+
+    ob->m_dirty = true;
+    m_dirty_objects.push_back(ob->m_oid);
+}
+
+// Pop an object changed since last checkpoint
+// The object may be destructed after it was marked, skip it
+Object *Domain::pop_dirty_object()
+{
+    while (m_dirty_objects.size())
+    {
+        auto oid = m_dirty_objects[m_dirty_objects.size() - 1];
+        m_dirty_objects.shrink(m_dirty_objects.size() - 1);
+
+        auto *entry = Object::get_entry_by_id(oid);
+        auto *ob = entry ? entry->object : 0;
+        if (ob && ob->m_oid == oid && ob->m_domain == this && ob->m_dirty)
+        {
+            ob->m_dirty = false;
+            return ob;
+        }
+    }
+    return 0;
+}
+
+// Pop oid of an object destructed since last checkpoint
+bool Domain::pop_destructed_object(ObjectId *oid)
+{
+    if (!m_destructed_objects.size())
+        return false;
+
+    *oid = m_destructed_objects[m_destructed_objects.size() - 1];
+    m_destructed_objects.shrink(m_destructed_objects.size() - 1);
+    return true;
+}
+
+// Link object at head of list of its program
+void Domain::link_instance(Object *ob)
+{
+    auto &head = m_program_instances[ob->m_program];
+    ob->m_prev_instance = 0;
+    ob->m_next_instance = head;
+    if (head)
+        head->m_prev_instance = ob;
+    head = ob;
+}
+
+// Unlink object from list of its program
+void Domain::unlink_instance(Object *ob)
+{
+    if (ob->m_next_instance)
+        ob->m_next_instance->m_prev_instance = ob->m_prev_instance;
+    if (ob->m_prev_instance)
+        ob->m_prev_instance->m_next_instance = ob->m_next_instance;
+    else if (ob->m_next_instance)
+        m_program_instances[ob->m_program] = ob->m_next_instance;
+    else
+        // The last one
+        m_program_instances.erase(ob->m_program);
+    ob->m_prev_instance = 0;
+    ob->m_next_instance = 0;
+}
+
+// Get ids of all domains
+simple::vector<DomainId> Domain::get_all_domain_ids()
+{
+    std_enter_critical_section(m_domain_cs);
+    auto ids = m_all_domains->keys();
+    std_leave_critical_section(m_domain_cs);
+    return ids;
 }
 
 // Generate a map for detail information
 Map Domain::get_domain_detail()
 {
     Value map = NIL;
-    map = XNEW(MapImpl, 7);
+    map = XNEW(MapImpl, 12);
     map.set("type", m_type);
     map.set("id", m_id);
     map.set("name", m_name);
-    map.set("running", m_running);
-    map.set("wait_counter", m_wait_counter);
+    map.set("running", is_running());
+    map.set("wait_counter", get_wait_counter());
     map.set("thread_holder_id", (size_t)m_thread_holder_id);
+    map.set("acquisitions", (Int64)m_lock_stat.acquisitions);
+    map.set("contended", (Int64)m_lock_stat.contended);
+    map.set("parked", (Int64)m_lock_stat.parked);
+    map.set("hold_us", (Int64)m_lock_stat.hold_us);
+    map.set("data_image_size", m_data_image ? m_data_image->get_size() : 0);
     return map;
 }
 
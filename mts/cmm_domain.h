@@ -5,6 +5,7 @@
 #include "std_template/simple_list.h"
 
 #include "cmm.h"
+#include "cmm_mailbox.h"
 #include "cmm_value.h"
 #include "cmm_value_list.h"
 #include "cmm_thread.h"
@@ -13,12 +14,15 @@ namespace cmm
 {
 
 struct ReferenceImpl;
+class DataImage;
 class Object;
+class Program;
 class Thread;
 
 // Domain can't be a virtual class
 class Domain
 {
+friend class Scheduler;
 friend class Thread;
 
 public:
@@ -34,7 +38,14 @@ public:
         Domain *domain;     // Domain
     };
 
-    enum { MAX_ID_PAGES = 1024 };
+    // Statistics of domain lock
+    struct LockStat
+    {
+        Uint64 acquisitions;    // Times of enter
+        Uint64 contended;       // Times of enter while domain was held
+        Uint64 parked;          // Times of sleeping in kernel while waiting
+        Uint64 hold_us;         // Total time of holding (in us)
+    };
 
 public:
     // Initialize/shutdown this module
@@ -42,7 +53,7 @@ public:
     static void shutdown();
 
 public:
-    Domain(const char *name);
+    Domain(const char *name, Type type = NORMAL);
     ~Domain();
 
 public:
@@ -52,6 +63,29 @@ public:
     // Leave domain
     void leave();
 
+private:
+    // Wait until my ticket is served
+    void wait_for_ticket(UintR ticket);
+
+    // Enter domain in coroutine without waiting in queue
+    void enter_in_coroutine();
+
+public:
+    enum { MAX_DRAIN_BATCH = 64 };
+
+    // Post an asynchronous call to mailbox (any thread)
+    void post_call(AsyncCall *call);
+
+    // Execute calls in mailbox (by the holder of domain)
+    size_t drain_mailbox(Thread *thread, size_t max_calls = MAX_DRAIN_BATCH);
+
+    // Are there calls in mailbox?
+    bool has_pending_calls() const { return !m_mailbox.is_empty(); }
+
+private:
+    // Execute an asynchronous call
+    void execute_async_call(Thread *thread, AsyncCall *call);
+
 public:
     // Bind a value to this domain
     void bind_value(ReferenceImpl *value, size_t count = 1)
@@ -102,6 +136,43 @@ public:
     // Object was destructed, left domain
     void object_was_destructed(Object *ob);
 
+    // Object was moved to new memory or changed program (by reloading)
+    void object_was_replaced(Object *ob, Object *new_ob, Program *new_program);
+
+    // Get first object of program in this domain, then follow
+    // Object::get_next_instance()
+    Object *get_first_instance(Program *program) const
+    {
+        Object *ob;
+        return m_program_instances.try_get(program, &ob) ? ob : 0;
+    }
+
+    // Get all objects in this domain
+    simple::hash_set<Object *>& get_objects() { return m_objects; }
+
+    // Are there threads have frames in this domain?
+    bool has_contexts() const { return m_context_list.size() > 0; }
+
+public:
+    // Object was called, regard it as changed since last checkpoint
+    // (domain must be held)
+    void mark_dirty(Object *ob);
+
+    // Pop an object changed since last checkpoint, return 0 if none
+    Object *pop_dirty_object();
+
+    // Pop oid of an object destructed since last checkpoint
+    bool pop_destructed_object(ObjectId *oid);
+
+    // How many objects may be changed/destructed since last checkpoint
+    size_t get_dirty_count() const { return m_dirty_objects.size(); }
+    size_t get_destructed_count() const { return m_destructed_objects.size(); }
+
+private:
+    // Link/unlink object into list of its program
+    void link_instance(Object *ob);
+    void unlink_instance(Object *ob);
+
 public:
     // Get id of this domain
     DomainId get_id() const { return m_id; }
@@ -115,15 +186,50 @@ public:
     // Get type of this domain
     Type get_type() const { return m_type; }
 
+    // Get/set the constant data of READ_ONLY domain (see DataImage)
+    // The image is owned by domain, it's read by any thread without
+    // entering the domain, so the domain must be alive while reading
+    DataImage *get_data_image() const { return m_data_image; }
+    void set_data_image(DataImage *data_image);
+
+    // Turn to READ_ONLY domain after the objects were initialized (domain
+    // must be held). The objects are called by any thread without entering
+    // the domain (see call_other), so they must not be changed any more:
+    // - Each function must be interpreted & not write any member
+    // - The values referred by members are marked constant
+    // - No object can be created in the domain
+    // The domain must be alive while being called.
+    void set_read_only();
+
     // How many threads in wait list
-    size_t get_wait_counter() const { return m_wait_counter; }
+    size_t get_wait_counter() const
+    {
+        // Read the holder first, the next ticket is never behind it
+        UintR serving = m_now_serving;
+        UintR held = (UintR)m_next_ticket - serving;
+        return held > 1 ? (size_t)(held - 1) : 0;
+    }
 
     // Is this domain running?
-    bool is_running() const { return m_running ? true : false; }
+    bool is_running() const { return (UintR)m_next_ticket != m_now_serving; }
+
+    // Get statistics of domain lock
+    const LockStat& get_lock_stat() const { return m_lock_stat; }
 
     // Return domain in a mapping value
     Map get_domain_detail();
 
+public:
+    // Get domain by id, return 0 if not found
+    static Domain *get_domain_by_id(DomainId id)
+    {
+        auto *entry = m_id_manager->get_entry_by_id_safe(id);
+        return entry ? entry->domain : 0;
+    }
+
+    // Get ids of all domains
+    static simple::vector<DomainId> get_all_domain_ids();
+
 private:
     // Get domain 0
     static Domain *get_domain_0() { return m_domain_0; }
@@ -132,23 +238,56 @@ private:
     char        m_name[32];         // Name
     Type        m_type;             // Type
     DomainId    m_id;               // Id
-    AtomInt     m_running;          // Is this domain running?
-    AtomInt     m_wait_counter;     // How many threads are waiting to take ownership
     Thread::Id  m_thread_holder_id; // Hold by which thread?
-
-    // Event for synchronize
-    std_event_id_t m_event_id;
+    DataImage  *m_data_image;       // Constant data of READ_ONLY domain
+
+    // Domain lock is a ticket lock, threads take the ownership in FIFO
+    // order. A waiter spins for a while then park on one of the wait
+    // slots selected by its ticket, the leaver wakes up the slot of the
+    // next ticket only. The tickets are unsigned, they wrap around.
+    // A coroutine takes a ticket only when the domain is free.
+    enum { WAIT_SLOTS = 8, MIN_SPIN = 16, MAX_SPIN = 4096, SPIN_QUEUE_DEPTH = 2 };
+    struct WaitSlot
+    {
+        volatile int seq;       // Futex word, increased when waking
+        volatile AtomInt parked;// Count of parked threads
+    };
+    volatile AtomInt m_next_ticket;     // Ticket for next comer
+    volatile UintR   m_now_serving;     // Ticket of the holder
+    int          m_spin_limit;          // Adaptive spin count
+    WaitSlot     m_wait_slots[WAIT_SLOTS];
+    std_freq_t   m_enter_us;            // When the holder entered
+    LockStat     m_lock_stat;
 
     // All objects
     simple::hash_set<Object *> m_objects;
 
+    // Program -> first object of the program in this domain
+    typedef simple::hash_map<Program *, Object *> ProgramInstancesMap;
+    ProgramInstancesMap m_program_instances;
+
+    // Objects changed/destructed since last checkpoint
+    // Refer by oid, the object may be moved by reloading
+    simple::unsafe_vector<ObjectId> m_dirty_objects;
+    simple::unsafe_vector<ObjectId> m_destructed_objects;
+
     // List of all reference value in this domain
     ValueList m_value_list;
     IntR m_gc_counter;
 
+    // Values referred by members of READ_ONLY domain
+    ValueList m_constant_list;
+
     // List of all contexts in threads
     simple::manual_list<DomainContext> m_context_list;
 
+    // Asynchronous calls posted to this domain
+    Mailbox m_mailbox;
+
+    // For scheduler
+    volatile AtomInt m_scheduled;       // Is in deque of a worker?
+    int          m_last_worker;         // Index of worker ran me last time
+
 private:
     typedef GlobalIdManager<Entry> DomainIdManager;
     static DomainIdManager *m_id_manager;
@@ -159,6 +298,9 @@ private:
 
     // Critical Section to operate m_all_domains
     static struct std_critical_section *m_domain_cs;
+
+    // Spinning is useless on single processor
+    static bool m_spin_enabled;
 };
 
 } // End of namespace: cmm
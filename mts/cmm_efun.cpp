@@ -4,6 +4,8 @@
 #include "std_template/simple_string.h"
 #include "cmm_efun.h"
 #include "cmm_efun_core.h"
+#include "cmm_efun_data.h"
+#include "cmm_efun_socket.h"
 #include "cmm_program.h"
 #include "cmm_prototype_grammar.h"
 #include "cmm_thread.h"
@@ -21,12 +23,16 @@ bool Efun::init()
     
     // Initialize all efun modules
     init_efun_core();
+    init_efun_socket();
+    init_efun_data();
     return true;
 }
 
 void Efun::shutdown()
 {
     // Shutdown all efun modules
+    shutdown_efun_data();
+    shutdown_efun_socket();
     shutdown_efun_core();
 
     // Cleanup all efuns packages & maps
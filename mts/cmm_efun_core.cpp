@@ -19,7 +19,7 @@ DEFINE_EFUN(void, error, (string format, ...))
 
     String& format = (String&)__args[0];
     Output output;
-    String ret = output.format_output(format.c_str(), &__args[1], __n - 1);
+    String ret = output.format_output(format.m_string, &__args[1], __n - 1);
     throw_error("%s", ret.c_str());
 }
 
@@ -28,7 +28,7 @@ DEFINE_EFUN(void, printf, (string format, ...))
 {
     String& format = (String&)__args[0];
     Output output;
-    String ret = output.format_output(format.c_str(), &__args[1], __n - 1);
+    String ret = output.format_output(format.m_string, &__args[1], __n - 1);
     printf("%s", ret.c_str());
     return NIL;
 }
@@ -0,0 +1,110 @@
+// cmm_efun_data.cpp
+
+#include "std_port/std_port.h"
+#include "cmm_data_image.h"
+#include "cmm_domain.h"
+#include "cmm_efun.h"
+#include "cmm_efun_data.h"
+#include "cmm_thread.h"
+#include "cmm_value.h"
+
+namespace cmm
+{
+
+// Get data image of READ_ONLY domain by id
+// The image is read without entering the domain
+static DataImage *get_data_image(const Value& id)
+{
+    DomainId domain_id;
+    domain_id.i64 = id.m_int;
+    auto *domain = Domain::get_domain_by_id(domain_id);
+    if (!domain || !domain->get_data_image())
+        throw_error("Domain %llx has no data image.\n", (long long)domain_id.i64);
+    return domain->get_data_image();
+}
+
+// Locate node by path of keys, return 0 if not found
+static DataImage::Ref locate(DataImage *image, Value *keys, ArgNo n)
+{
+    auto ref = image->get_root();
+    for (ArgNo i = 0; i < n && ref; i++)
+        ref = image->index(ref, keys[i]);
+    return ref;
+}
+
+// Efun: data_domain(string name)
+// Return id of the domain of data image, 0 if not found
+DEFINE_EFUN(int, data_domain, (string name))
+{
+    String& name = (String&)__args[0];
+    auto ids = Domain::get_all_domain_ids();
+    for (auto& id : ids)
+    {
+        auto *domain = Domain::get_domain_by_id(id);
+        if (domain && domain->get_data_image() &&
+            strcmp(domain->get_name(), name.c_str()) == 0)
+            return (Integer)id.i64;
+    }
+    return 0;
+}
+
+// Efun: data_get(int domain, ...)
+// Get value by path of keys (index of array or key of mapping), only the
+// value got is copied to current domain
+DEFINE_EFUN(mixed, data_get, (int domain, ...))
+{
+    auto *image = get_data_image(__args[0]);
+    auto ref = locate(image, &__args[1], __n - 1);
+    if (!ref)
+        return NIL;
+    return image->to_value(ref);
+}
+
+// Efun: data_size(int domain, ...)
+// Get size of array/mapping or length of string/buffer by path of keys
+// Return -1 if not found
+DEFINE_EFUN(int, data_size, (int domain, ...))
+{
+    auto *image = get_data_image(__args[0]);
+    auto ref = locate(image, &__args[1], __n - 1);
+    if (!ref)
+        return -1;
+    return (Integer)image->get_count(ref);
+}
+
+// Efun: data_keys(int domain, ...)
+// Get keys of mapping by path of keys without copying the values
+DEFINE_EFUN(array?, data_keys, (int domain, ...))
+{
+    auto *image = get_data_image(__args[0]);
+    auto ref = locate(image, &__args[1], __n - 1);
+    if (!ref || image->get_type(ref) != MAPPING)
+        return NIL;
+
+    auto count = image->get_count(ref);
+    Array ret(count);
+    for (size_t i = 0; i < count; i++)
+        ret.push_back(image->to_value(image->get_key(ref, i)));
+    return ret;
+}
+
+int init_efun_data()
+{
+    // Efun definitions
+    EfunDef data_efuns[] =
+    {
+        { EFUN_ITEM(data_domain) },
+        { EFUN_ITEM(data_get) },
+        { EFUN_ITEM(data_size) },
+        { EFUN_ITEM(data_keys) },
+        { 0, 0 }
+    };
+    Efun::add_efuns("system.data", data_efuns);
+    return 0;
+}
+
+void shutdown_efun_data()
+{
+}
+
+}
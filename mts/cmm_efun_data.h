@@ -0,0 +1,18 @@
+// cmm_efun_data.h
+
+#pragma once
+
+#include "cmm_efun.h"
+
+namespace cmm
+{
+
+int init_efun_data();
+void shutdown_efun_data();
+
+DECLARE_EFUN(data_domain);
+DECLARE_EFUN(data_get);
+DECLARE_EFUN(data_size);
+DECLARE_EFUN(data_keys);
+
+}
@@ -0,0 +1,164 @@
+// cmm_efun_socket.cpp
+
+#include "std_port/std_port.h"
+#include "cmm_efun.h"
+#include "cmm_efun_socket.h"
+#include "cmm_object.h"
+#include "cmm_output.h"
+#include "cmm_socket.h"
+#include "cmm_thread.h"
+#include "cmm_value.h"
+
+namespace cmm
+{
+
+// Efun: socket_listen(string host, int port)
+// this_object() will receive the callbacks (see Socket)
+DEFINE_EFUN(int, socket_listen, (string host, int port))
+{
+    String& host = (String&)__args[0];
+    auto owner = _thread->get_this_object()->get_oid();
+    return Socket::listen(owner, host.c_str(), (int)__args[1].m_int);
+}
+
+// Efun: socket_connect(string host, int port)
+DEFINE_EFUN(int, socket_connect, (string host, int port))
+{
+    String& host = (String&)__args[0];
+    auto owner = _thread->get_this_object()->get_oid();
+    return Socket::connect(owner, host.c_str(), (int)__args[1].m_int);
+}
+
+// Get slice of string or buffer
+static void get_slice(const Value& data, Socket::Slice* slice)
+{
+    if (data.m_type == ValueType::STRING)
+    {
+        slice->data = data.m_string->c_str();
+        slice->size = data.m_string->length();
+        return;
+    }
+    if (data.m_type == ValueType::BUFFER)
+    {
+        slice->data = data.m_buffer->data();
+        slice->size = data.m_buffer->length();
+        return;
+    }
+    throw_error("Expect string or buffer to send, got %s.\n", Value::type_to_name(data.m_type));
+}
+
+// Efun: socket_send(int id, mixed data)
+// The data is string, buffer or array of them, the array is gathered
+// without concating
+DEFINE_EFUN(int, socket_send, (int id, mixed data))
+{
+    auto& data = __args[1];
+    if (data.m_type != ValueType::ARRAY)
+    {
+        Socket::Slice slice;
+        get_slice(data, &slice);
+        return Socket::send(__args[0].m_int, &slice, 1);
+    }
+
+    auto* arr = data.m_array;
+    simple::unsafe_vector<Socket::Slice> slices(arr->size());
+    for (size_t i = 0; i < arr->size(); i++)
+    {
+        Socket::Slice slice;
+        get_slice(arr->a[i], &slice);
+        slices.push_back(slice);
+    }
+    return Socket::send(__args[0].m_int, slices.get_array_address(0), slices.size());
+}
+
+// Efun: socket_broadcast(array targets, string format, ...)
+// Format once & send to all sockets owned by the target objects
+// Return status of each target: bytes queued before (for backpressure) or
+// -1 if it owns no socket or the output is full
+DEFINE_EFUN(array, socket_broadcast, (array targets, string format, ...))
+{
+    auto* targets = __args[0].m_array;
+    String& format = (String&)__args[1];
+    Output output;
+    String data = output.format_output(format.m_string, &__args[2], __n - 2);
+
+    simple::unsafe_vector<ObjectId> owners(targets->size());
+    for (size_t i = 0; i < targets->size(); i++)
+    {
+        ObjectId oid;
+        oid.i64 = 0;
+        if (targets->a[i].m_type == ValueType::OBJECT)
+            oid = targets->a[i].m_oid;
+        owners.push_back(oid);
+    }
+
+    simple::unsafe_vector<Integer> statuses(owners.size());
+    statuses.push_backs(-1, owners.size());
+    if (owners.size())
+        Socket::broadcast(owners.get_array_address(0), owners.size(), data.c_str(), data.length(),
+                          statuses.get_array_address(0));
+
+    Array ret(statuses.size());
+    for (size_t i = 0; i < statuses.size(); i++)
+        ret.push_back(statuses[i]);
+    return ret;
+}
+
+// Efun: socket_send_value(int id, mixed value)
+// Dump the value (as %O) to socket in chunks without building the whole
+// text, for big values
+// Return count of bytes sent or -1 if the output of socket is full
+DEFINE_EFUN(int, socket_send_value, (int id, mixed value))
+{
+    SocketSink sink(__args[0].m_int);
+    Output output;
+    if (! output.type_value(&__args[1], &sink))
+        return -1;
+    return (Integer)sink.get_sent();
+}
+
+// Efun: socket_close(int id)
+DEFINE_EFUN(int, socket_close, (int id))
+{
+    return Socket::close(__args[0].m_int) ? 1 : 0;
+}
+
+// Efun: socket_set_owner(int id, object ob)
+DEFINE_EFUN(int, socket_set_owner, (int id, object ob))
+{
+    return Socket::set_owner(__args[0].m_int, __args[1].m_oid) ? 1 : 0;
+}
+
+// Efun: socket_address(int id)
+DEFINE_EFUN(string?, socket_address, (int id))
+{
+    simple::string address;
+    if (!Socket::get_address(__args[0].m_int, &address))
+        return NIL;
+    return String(address.c_str());
+}
+
+int init_efun_socket()
+{
+    // Efun definitions
+    EfunDef socket_efuns[] =
+    {
+        { EFUN_ITEM(socket_listen) },
+        { EFUN_ITEM(socket_connect) },
+        { EFUN_ITEM(socket_send) },
+        { EFUN_ITEM(socket_broadcast) },
+        { EFUN_ITEM(socket_send_value) },
+        { EFUN_ITEM(socket_close) },
+        { EFUN_ITEM(socket_set_owner) },
+        { EFUN_ITEM(socket_address) },
+        { 0, 0 }
+    };
+    Efun::add_efuns("system.socket", socket_efuns);
+    return 0;
+}
+
+void shutdown_efun_socket()
+{
+}
+
+}
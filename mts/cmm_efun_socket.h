@@ -0,0 +1,20 @@
+// cmm_efun_socket.h
+
+#pragma once
+
+#include "cmm_efun.h"
+
+namespace cmm
+{
+
+int init_efun_socket();
+void shutdown_efun_socket();
+
+DECLARE_EFUN(socket_listen);
+DECLARE_EFUN(socket_connect);
+DECLARE_EFUN(socket_send);
+DECLARE_EFUN(socket_close);
+DECLARE_EFUN(socket_set_owner);
+DECLARE_EFUN(socket_address);
+
+}
@@ -13,24 +13,26 @@ namespace cmm
 {
 
 // Print variables (arguments & local) of function
+// The values are streamed to stdout, no string is built for them
 void print_variables(const Variables& variables, const char *type, Value *arr, ArgNo n)
 {
     Output output;
+    FileSink sink(stdout);
 
     ArgNo i = 0;
     for (auto &it : (Variables&)variables)
     {
         printf("%s %s(%d) = ", type, it->get_name()->c_str(), i + 1);
-        String str = output.type_value(&arr[i]);
-        printf("%s\n", str.c_str());
+        output.type_value(&arr[i], &sink);
+        printf("\n");
         i++;
     }
 
     while (i < n)
     {
         printf("%s $%d = ", type, i + 1);
-        String str = output.type_value(&arr[i]);
-        printf("%s\n", str.c_str());
+        output.type_value(&arr[i], &sink);
+        printf("\n");
         i++;
     }
 }
@@ -65,6 +65,8 @@ enum ErrorCode
     C_NOT_CONTAINER             = 2109,
     C_CANNOT_OPER               = 2110,
     C_CAST_TO_NON_CONST         = 2900,
+    C_NOT_SUPPORTED             = 2999,
+    C_UNDEFINED_FUNCTION        = 3861,
     C_ASSIGN_TO_CONST           = 3892,
 
     // Compiling warning codes (with prefix C_)
@@ -290,14 +290,17 @@ ErrorCode FilePath::generate_os_file_name(const char *in_file_name, char *full_n
 }
 
 // Generate output file name
-// x/y/z.c -> output/x/y/z.cpp
-ErrorCode FilePath::generate_output_file_name(const char *in_file_name, char *output_file_name, size_t size)
+// x/y/z.c -> output/x/y/z.cpp (or other suffix specified)
+ErrorCode FilePath::generate_output_file_name(const char *in_file_name, char *output_file_name, size_t size, const char *suffix)
 {
     char temp_name[MAX_PATH_LEN];
 
     STD_ASSERT(in_file_name != NULL);
     STD_ASSERT(output_file_name != NULL);
 
+    if (suffix == NULL)
+        suffix = OUTPUT_SUFFIX;
+
     // Remove slash @ tail when necessary
     get_output_dir(temp_name, sizeof(temp_name));
     auto temp_len = strlen(temp_name);
@@ -308,14 +311,18 @@ ErrorCode FilePath::generate_output_file_name(const char *in_file_name, char *ou
         temp_name[temp_len] = 0;
     }
 
-    if (strlen(in_file_name) + temp_len > size - 5)
+    if (strlen(in_file_name) + temp_len + strlen(suffix) >= size)
         // File name is too long
         return PATH_NAME_TOO_LONG;
 
     // Generate output file name
+    // Only lookup the dot in pure file name, the output dir may have dots
     strcat(temp_name, in_file_name);
-    if (strchr(temp_name, '.') == NULL)
-        strcat(temp_name, OUTPUT_SUFFIX);
+    const char *pure_name = strrchr(temp_name, PATH_SEPARATOR);
+    if (pure_name == NULL)
+        pure_name = temp_name;
+    if (strchr(pure_name, '.') == NULL)
+        strcat(temp_name, suffix);
     else
     {
         IntR i;
@@ -325,7 +332,7 @@ ErrorCode FilePath::generate_output_file_name(const char *in_file_name, char *ou
         {
             if (temp_name[i] == '.')
             {
-                if (strcmp(temp_name + i, OUTPUT_SUFFIX) == 0)
+                if (strcmp(temp_name + i, suffix) == 0)
                     // It's already an output file
                     return FILE_NAME_WAS_OUTPUT_FILE;
                 break;
@@ -333,7 +340,7 @@ ErrorCode FilePath::generate_output_file_name(const char *in_file_name, char *ou
         }
 
         // Append suffix
-        strcpy(temp_name + i, OUTPUT_SUFFIX);
+        strcpy(temp_name + i, suffix);
     }
 
     if (strlen(temp_name) >= size)
@@ -33,7 +33,7 @@ public:
     static ErrorCode    set_output_dir(const char *str);
     static ErrorCode    derive_file_name(const char *name, const char *suffix, char *dest, size_t size);
     static ErrorCode    generate_local_file_name(const char *file_name, char *local_file_name, size_t size);
-    static ErrorCode    generate_output_file_name(const char *in_file_name, char *output_file_name, size_t size);
+    static ErrorCode    generate_output_file_name(const char *in_file_name, char *output_file_name, size_t size, const char *suffix = NULL);
     static ErrorCode    generate_os_file_name(const char *in_file_name, char *full_bame, size_t size);
     static ErrorCode    assure_path(const char *path);
 
@@ -3,6 +3,7 @@
 #pragma once
 
 #include "std_port/std_port.h"
+#include "std_port/std_port_mmap.h"
 #include "cmm.h"
 
 // This file implements template for ID management.
@@ -20,29 +21,58 @@ public:
     typedef simple::manual_list<Entry> EntryList;
 
     // To lookup an item by GlobalId following these steps
-    // 1. Get page by Id.index_page
-    // 2. Get object by Id.index_offset in page
+    // 1. Get directory by high bits of Id.index_page
+    // 2. Get page by low bits of Id.index_page in directory
+    // 3. Get object by Id.index_offset in page
     // Why not use a simple array or vector?
     // Since we don't want to lock mutex when trying to get an object. So we use
-    // two-level indexes to find the object by ID. 
+    // a radix table to find the object by ID. Directories & pages are created
+    // on demand & never moved or freed before destruction, a reader can walk
+    // the table without lock.
     struct NodePage
     {
         Node nodes[GLOBAL_ID_PER_PAGE];
     };
 
-public:
-    GlobalIdManager(size_t max_pages)
+    enum
+    {
+        DIR_BITS = GLOBAL_ID_PAGE_BITS / 2,
+        PAGES_PER_DIR = (1 << DIR_BITS),
+        MAX_DIRS = (GLOBAL_ID_MAX_PAGES >> DIR_BITS),
+    };
+
+    struct PageDir
+    {
+        NodePage *volatile pages[PAGES_PER_DIR];
+    };
+
+    // Node pages are carved from chunks. The chunk size is doubled each time
+    // until it reaches STD_HUGE_PAGE_SIZE, so a small manager costs a few
+    // pages only while a huge one is backed by huge pages.
+    struct Chunk
     {
-        m_max_pages = max_pages;
+        void *reserved;     // Start of reserved address
+        size_t reserved_size;
+        Uint8 *base;        // Start of committed address
+        size_t page_count;  // Node pages can be carved in this chunk
+        size_t used;        // Node pages carved
+    };
 
+public:
+    GlobalIdManager()
+    {
         // Init entries lock
         std_init_spin_lock(&m_entries_lock);
 
-        // Init pages
-        m_pages = XNEWN(NodePage *, m_max_pages);
-        for (size_t i = 0; i < m_max_pages; i++)
-            m_pages[i] = 0;
+        // Init directories
+        for (size_t i = 0; i < MAX_DIRS; i++)
+            m_dirs[i] = 0;
         m_page_count = 0;
+        m_dir_count = 0;
+
+        // Init chunks
+        memset(&m_chunk, 0, sizeof(m_chunk));
+        m_next_chunk_size = std_align_size(sizeof(NodePage));
 
         // Init the free entries list
         m_free_entries = XNEW(EntryList);
@@ -53,48 +83,36 @@ public:
         // Free the free entries list
         XDELETE(m_free_entries);
 
-        // Free pages
-        for (size_t i = 0; i < m_max_pages; i++)
-            if (m_pages[i])
-                XDELETE(m_pages[i]);
-        XDELETEN(m_pages);
+        // Free directories, the node pages are freed with chunks
+        for (size_t i = 0; i < MAX_DIRS; i++)
+        {
+            PageDir *dir = m_dirs[i];
+            if (dir)
+                XDELETE(dir);
+        }
+
+        // Free chunks
+        if (m_chunk.reserved)
+            m_chunks.push_back(m_chunk);
+        for (auto &it : m_chunks)
+            std_mem_release(it.reserved, it.reserved_size);
 
         // Free entries lock
         std_destroy_spin_lock(&m_entries_lock);
     }
 
     // Allocate a gid (create new page when necessary)
+    // Return 0 if all pages are used
     Entry *allocate_id()
     {
         // Not free node? Create a new page
         std_get_spin_lock(&m_entries_lock);
 
         // Lookup a free node
-        if (m_free_entries->size() == 0)
+        if (m_free_entries->size() == 0 && !add_page())
         {
-            if (m_page_count >= m_max_pages)
-            {
-                STD_TRACE("Out of object id entries page, please adjust Object::MAX_PAGES.\n");
-                return 0;
-            }
-            auto *m_page = XNEW(NodePage);
-            if (!m_page)
-            {
-                STD_TRACE("Can not allocate new object id entries page.\n");
-                return 0;
-            }
-            memset(m_page, 0, sizeof(NodePage));
-            auto page_no = m_page_count++;
-            m_pages[page_no] = m_page;
-
-            // Put nodes of the new page to list
-            for (size_t i = 0; i < GLOBAL_ID_PER_PAGE; i++)
-            {
-                auto *entry = &m_page->nodes[i].value;
-                entry->gid.index_page = page_no;
-                entry->gid.index_offset = i;
-                m_free_entries->append_node(&m_page->nodes[i]);
-            }
+            std_release_spin_lock(&m_entries_lock);
+            return 0;
         }
 
         // Take off the first node
@@ -114,6 +132,38 @@ public:
         return entry;
     }
 
+    // Allocate the specified gid (to restore a saved one), the pages
+    // before it are created
+    // Return 0 if the gid is in use or out of pages
+    Entry *allocate_id(GlobalId gid)
+    {
+        std_get_spin_lock(&m_entries_lock);
+
+        Entry *entry = 0;
+        while (m_page_count <= gid.index_page)
+        {
+            if (!add_page())
+                break;
+        }
+
+        if (m_page_count > gid.index_page)
+        {
+            auto *page = m_dirs[gid.index_page >> DIR_BITS]->pages[gid.index_page & (PAGES_PER_DIR - 1)];
+            auto *node = &page->nodes[gid.index_offset];
+            if (!node->value.object)
+            {
+                // A node not bound to object is in free list, take it off
+                // & use the saved version
+                m_free_entries->remove_node(node);
+                node->value.gid = gid;
+                entry = &node->value;
+            }
+        }
+
+        std_release_spin_lock(&m_entries_lock);
+        return entry;
+    }
+
     // Return the gid to pool
     void free_id(GlobalId gid)
     {
@@ -150,14 +200,119 @@ public:
         return node ? &node->value : 0;
     }
 
+    // Return count of allocated pages
+    size_t get_page_count() const
+    {
+        return m_page_count;
+    }
+
 private:
+    // Create a new page & put all nodes to the free list
+    // The m_entries_lock must be held by caller
+    bool add_page()
+    {
+        if (m_page_count >= GLOBAL_ID_MAX_PAGES)
+        {
+            STD_TRACE("Out of global id entries page.\n");
+            return false;
+        }
+
+        auto page_no = m_page_count;
+        auto dir_no = page_no >> DIR_BITS;
+        auto *dir = m_dirs[dir_no];
+        if (!dir)
+        {
+            dir = XNEW(PageDir);
+            if (!dir)
+            {
+                STD_TRACE("Can not allocate new global id directory.\n");
+                return false;
+            }
+            memset((void *)dir, 0, sizeof(PageDir));
+            std_cpu_mfence();
+            m_dirs[dir_no] = dir;
+            m_dir_count++;
+        }
+
+        auto *page = carve_page();
+        if (!page)
+        {
+            STD_TRACE("Can not allocate new global id entries page.\n");
+            return false;
+        }
+
+        // Init the nodes before publishing the page to readers
+        for (size_t i = 0; i < GLOBAL_ID_PER_PAGE; i++)
+        {
+            auto *entry = &page->nodes[i].value;
+            entry->gid.index_page = page_no;
+            entry->gid.index_offset = i;
+        }
+        std_cpu_mfence();
+        dir->pages[page_no & (PAGES_PER_DIR - 1)] = page;
+        m_page_count++;
+
+        // Put nodes of the new page to list
+        for (size_t i = 0; i < GLOBAL_ID_PER_PAGE; i++)
+            m_free_entries->append_node(&page->nodes[i]);
+        return true;
+    }
+
+    // Take a zeroed node page from current chunk, create new chunk if
+    // necessary
+    // The m_entries_lock must be held by caller
+    NodePage *carve_page()
+    {
+        if (m_chunk.used >= m_chunk.page_count)
+        {
+            // Create a new chunk
+            Chunk chunk;
+            size_t size = m_next_chunk_size;
+            bool huge = (size >= STD_HUGE_PAGE_SIZE);
+            chunk.reserved_size = huge ? size + STD_HUGE_PAGE_SIZE : size;
+            chunk.reserved = std_mem_reserve(0, chunk.reserved_size);
+            if (!chunk.reserved)
+                return 0;
+
+            chunk.base = (Uint8 *)chunk.reserved;
+            if (huge)
+            {
+                // Align to huge page
+                size_t addr = (size_t)chunk.reserved;
+                addr = (addr + STD_HUGE_PAGE_SIZE - 1) & ~((size_t)STD_HUGE_PAGE_SIZE - 1);
+                chunk.base = (Uint8 *)addr;
+            }
+            if (!std_mem_commit(chunk.base, size, STD_PAGE_READ | STD_PAGE_WRITE))
+            {
+                std_mem_release(chunk.reserved, chunk.reserved_size);
+                return 0;
+            }
+            if (huge)
+                std_mem_advise_huge_page(chunk.base, size);
+            chunk.page_count = size / sizeof(NodePage);
+            chunk.used = 0;
+
+            // Retire previous chunk & grow next one
+            if (m_chunk.reserved)
+                m_chunks.push_back(m_chunk);
+            m_chunk = chunk;
+            m_next_chunk_size *= 2;
+            if (m_next_chunk_size > STD_HUGE_PAGE_SIZE)
+                m_next_chunk_size = STD_HUGE_PAGE_SIZE;
+        }
+
+        // Committed memory is zero filled by system
+        return (NodePage *)(m_chunk.base + sizeof(NodePage) * m_chunk.used++);
+    }
+
     // Return the node by id (unchecked, the gid must/or used to be valid)
     Node *get_node_by_id(GlobalId gid)
     {
-        STD_ASSERT(("gid.index_page is over limit.", gid.index_page < m_max_pages));
+        auto *dir = m_dirs[gid.index_page >> DIR_BITS];
+        STD_ASSERT(("Dir[gid.index_page] is not existed.", dir));
 
-        auto *page = m_pages[gid.index_page];
-        STD_ASSERT(("Page[old.index_page] is not existed.", page));
+        auto *page = dir->pages[gid.index_page & (PAGES_PER_DIR - 1)];
+        STD_ASSERT(("Page[gid.index_page] is not existed.", page));
 
         STD_ASSERT(gid.index_offset <= GLOBAL_ID_PER_PAGE);
         auto *node = &page->nodes[gid.index_offset];
@@ -172,13 +327,12 @@ private:
     // Return the node by id (check valid, any input is fine)
     Node *get_node_by_id_safe(GlobalId gid)
     {
-        NodePage *page;
-
-        if (gid.index_page >= m_max_pages)
-            // Bad index
+        auto *dir = m_dirs[gid.index_page >> DIR_BITS];
+        if (!dir)
+            // No such directory
             return 0;
 
-        page = m_pages[gid.index_page];
+        auto *page = dir->pages[gid.index_page & (PAGES_PER_DIR - 1)];
         if (!page)
             // No such page
             return 0;
@@ -195,9 +349,12 @@ private:
 
 private:
     std_spin_lock_t m_entries_lock;
-    size_t m_max_pages;
     size_t m_page_count;
-    NodePage **m_pages;
+    size_t m_dir_count;
+    PageDir *volatile m_dirs[MAX_DIRS];
+    Chunk m_chunk;
+    size_t m_next_chunk_size;
+    simple::vector<Chunk> m_chunks;
     EntryList *m_free_entries;
 };
 
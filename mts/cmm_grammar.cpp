@@ -52,7 +52,7 @@
 #define YYSKELETON_NAME "yacc.c"
 
 /* Pure parsers.  */
-#define YYPURE 0
+#define YYPURE 1
 
 /* Push parsers.  */
 #define YYPUSH 0
@@ -1409,9 +1409,9 @@ while (YYID (0))
 /* YYLEX -- calling `yylex' with the right arguments.  */
 
 #ifdef YYLEX_PARAM
-# define YYLEX yylex (YYLEX_PARAM)
+# define YYLEX yylex (&yylval, YYLEX_PARAM)
 #else
-# define YYLEX yylex ()
+# define YYLEX yylex (&yylval)
 #endif
 
 /* Enable debugging if requested.  */
@@ -1860,14 +1860,6 @@ int yyparse ();
 #endif /* ! YYPARSE_PARAM */
 
 
-/* The lookahead symbol.  */
-int yychar;
-
-/* The semantic value of the lookahead symbol.  */
-YYSTYPE yylval;
-
-/* Number of syntax errors so far.  */
-int yynerrs;
 
 
 
@@ -1897,7 +1889,14 @@ yyparse (context)
 #endif
 #endif
 {
+/* The lookahead symbol.  */
+int yychar;
+
+/* The semantic value of the lookahead symbol.  */
+YYSTYPE yylval;
 
+    /* Number of syntax errors so far.  */
+    int yynerrs;
 
     int yystate;
     /* Number of tokens to shift before error messages enabled.  */
@@ -2986,7 +2985,12 @@ yyreduce:
 /* Line 1455 of yacc.c  */
 #line 853 "Z:\\doing\\Project\\mts\\mts\\cmm_grammar.yyy"
     {
-            (yyval.node) = (yyvsp[(3) - (6)].node);
+            auto* node = (yyvsp[(3) - (6)].node);
+            if (node->get_node_type() == AST_LOOP_RANGE)
+                ((AstLoopRange*)node)->block = (yyvsp[(6) - (6)].node);
+            else
+                ((AstLoopEach*)node)->block = (yyvsp[(6) - (6)].node);
+            (yyval.node) = node;
             context->pop_loop_switch((yyvsp[(1) - (6)].int_val));
 		;}
     break;
@@ -3718,7 +3722,8 @@ yyreduce:
 #line 1342 "Z:\\doing\\Project\\mts\\mts\\cmm_grammar.yyy"
     {
             auto* node = LANG_NEW(context, AstExprConstant, context);
-            node->value = Value((yyvsp[(1) - (1)].string));
+            // Use string in pool, it won't be freed by GC
+            node->value = Program::find_or_add_string((yyvsp[(1) - (1)].string));
             (yyval.expression) = node;
         ;}
     break;
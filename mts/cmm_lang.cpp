@@ -52,6 +52,9 @@ Lang::Lang() :
     m_current_attrib = 0;
     m_error_code = ErrorCode::OK;
     m_frame_tag = 0;
+    m_program = 0;
+    m_register_program = true;
+    m_code = 0;
 }
 
 // Parse & generate AST
@@ -76,6 +79,9 @@ ErrorCode Lang::parse()
     if (!pass1())
         return ErrorCode::PASS1_ERROR;
 
+    // Evaluate constant expressions
+    fold_constants();
+
     if (!pass2())
         return ErrorCode::PASS2_ERROR;
 
@@ -14,11 +14,16 @@
 #include "cmm_lex_util.h"
 #include "cmm_lexer.h"
 #include "cmm_mem_list.h"
+#include "cmm_register_allocator.h"
 #include "cmm_value.h"
+#include "cmm_vm.h"
 
 namespace cmm
 {
 
+class Program;
+struct CodeContext;
+
 // the state of context
 // #if state
 struct IfStatement
@@ -39,6 +44,19 @@ struct IfStatement
     }
 };
 
+// Operand of instruction during generating byte codes
+// A temporary value or a local variable is kept in a virtual register,
+// which will be mapped to a local slot after the whole function is
+// generated (see RegisterAllocator).
+struct CodeOperand
+{
+    Instruction::ParaType type;
+    Uint32    value;        // Constant/argument/member no, or virtual register
+    Uint16    offset;       // Offset in block of virtual registers
+    bool      is_register;  // Is value a virtual register?
+    ValueType value_type;   // Type of value if it's known, else MIXED
+};
+
 class Lang
 {
     friend class Lexer;
@@ -95,9 +113,71 @@ private:
     LocalNo         alloc_anonymouse_local(ValueType type);
     void            free_anonymouse_local(LocalNo no);
 
+    // Constant folding - Work out constant expressions before pass2
+private:
+    // How the value of expression is used by parent
+    enum ValueUsage
+    {
+        VALUE_READ_ONLY,    // Read only (or dropped)
+        VALUE_MAY_ESCAPE,   // May be stored or passed out
+        VALUE_ASSIGNED,     // The lvalue is assigned
+        VALUE_MUTATED,      // The container is updated by index
+    };
+
+    void            fold_constants();
+    void            mark_var_usage(AstNode* node, ValueUsage usage);
+    void            fold_node(AstNode* node, ValueUsage usage);
+    bool            fold_expr(AstExpr* expr, ValueUsage usage, Value* result);
+    bool            fold_container(AstExpr* expr, ValueUsage usage, Value* result);
+    ValueUsage      get_child_usage(AstNode* node, AstNode* child, ValueUsage usage);
+
     // Pass2 - Create final result
 private:
     bool pass2();
+    void define_function(AstFunction* function);
+    void generate_function(AstFunction* function);
+    void generate_arguments_prologue(AstFunction* function);
+    void generate_statement(AstNode* node);
+    void generate_declaration(AstDeclaration* decl);
+    void generate_loop_range(AstLoopRange* node);
+    void generate_loop_each(AstLoopEach* node);
+    void generate_switch_case(AstSwitchCase* node);
+    void generate_branch(AstExpr* expr, bool when, int label);
+    CodeOperand generate_expr(AstExpr* expr, const CodeOperand* dest, bool discard = false);
+    void        generate_expr_to(AstExpr* expr, const CodeOperand& dest);
+    CodeOperand generate_operand(AstExpr* expr, bool will_be_modified);
+    CodeOperand generate_assign(AstExprAssign* expr, const CodeOperand* dest);
+    CodeOperand generate_binary(Op op, const CodeOperand& a, const CodeOperand& b, const CodeOperand* dest);
+    CodeOperand generate_unary(AstExprUnary* expr, const CodeOperand* dest, bool discard);
+    CodeOperand generate_function_call(AstExprFunctionCall* expr, const CodeOperand* dest);
+    bool        generate_inline_call(AstFunction* callee, AstExpr* ret_expr, simple::vector<CodeOperand>& args, const CodeOperand* dest, CodeOperand* result);
+    CodeOperand generate_create_container(AstExpr* expr, const CodeOperand* dest);
+    CodeOperand generate_logic(AstExpr* expr);
+    bool        generate_lvalue(AstExpr* expr, bool load, bool protect, CodeOperand* operand, CodeOperand* container, CodeOperand* index);
+    void        generate_store(const CodeOperand& dest, const CodeOperand& src);
+
+private:
+    // Code generating utilities
+    CodeOperand new_register(ValueType type = MIXED, Uint16 width = 1);
+    CodeOperand block_element(const CodeOperand& block, Uint16 offset, ValueType type = MIXED);
+    CodeOperand constant_operand(const Value& value);
+    CodeOperand nil_operand();
+    CodeOperand imm_operand(Uint32 imm);
+    CodeOperand local_operand(AstDeclaration* decl);
+    bool        variable_operand(AstExprVariable* variable, CodeOperand* operand);
+    bool        is_temporary(const CodeOperand& operand);
+    size_t      emit(Instruction::Code code, const CodeOperand* p1 = 0, const CodeOperand* p2 = 0, const CodeOperand* p3 = 0);
+    void        emit_jump(int label);
+    void        emit_jump_if(const CodeOperand& cond, int label);
+    void        emit_jump_unless(const CodeOperand& cond, int label);
+    int         new_label();
+    void        bind_label(int label);
+    bool        resolve_codes(simple::vector<Instruction>* codes, LocalNo* max_local_no);
+    void        eliminate_dead_codes(simple::vector<Uint32>* positions);
+    AstExpr*    get_inline_expr(AstFunction* callee, size_t argn);
+    bool        is_inlinable_expr(AstNode* node, AstFunction* callee, size_t* budget);
+    bool        has_side_effect(AstNode* node);
+    void        report_not_supported(AstNode* node, const char* what);
 
 private:
     // Pass utilty functions
@@ -157,6 +237,19 @@ public:
     // All components
     simple::vector<simple::string> m_components;
 
+    // Name of program to be generated by pass2
+    simple::string m_program_name;
+
+    // Generated program
+    Program* m_program;
+
+    // Register the generated program to program table? (false if the
+    // caller registers it, such as reloading)
+    bool m_register_program;
+
+    // Context of generating byte codes (valid in pass2 only)
+    CodeContext* m_code;
+
     // All anonymouse local information
     struct LocalInfo
     {
@@ -2,559 +2,514 @@
 // Initial version 2011.07.16 by shenyq
 // Immigrated 2015.11.3 by doing
 
-#include <math.h>
 #include "std_port/std_port.h"
-#include "cmm_common_util.h"
 #include "cmm_lang.h"
-#include "cmm_lexer.h"
+#include "cmm_program.h"
 #include "cmm_value.h"
 
-#if 0
 namespace cmm
 {
-#include "cmm_grammar.h"
-
-Value          create_const_value(Lang* context, AstElement* element);
-Integer        const_to_int(Lang* context, Value val); 
-Real           const_to_real(Lang* context, Value val);
-String         const_to_string(Lang* context, Value val);
-bool           const_to_bool(Lang* context, Value val);
-AstElement* generate_const_to_element(Lang* context, Value val);
-AstElement* cast_const_to_number(Lang* context, AstElement* element);
-AstElement* cast_const_to_real(Lang* context, AstElement* element);
-AstElement* cast_const_to_string(Lang* context, AstElement* element);
-AstElement* add_const(Lang* context, AstElement* element, AstElement* node2);
-AstElement* sub_const(Lang* context, AstElement* element, AstElement* node2);
-AstElement* mul_const(Lang* context, AstElement* element, AstElement* node2);
-AstElement* mod_const(Lang* context, AstElement* element, AstElement* node2);
-AstElement* div_const(Lang* context, AstElement* element, AstElement* node2);
-AstElement* and_const(Lang* context, AstElement* element, AstElement* node2);
-AstElement* or_const(Lang* context, AstElement* element, AstElement* node2);
-AstElement* xor_const(Lang* context, AstElement* element, AstElement* node2);
-AstElement* neg_const(Lang* context, AstElement* element);
-AstElement* rev_const(Lang* context, AstElement* element);
-AstElement* ge_const(Lang* context, AstElement* element, AstElement* node2);
-AstElement* le_const(Lang* context, AstElement* element, AstElement* node2);
-AstElement* gt_const(Lang* context, AstElement* element, AstElement* node2);
-AstElement* lt_const(Lang* context, AstElement* element, AstElement* node2);
-AstElement* eq_const(Lang* context, AstElement* element, AstElement* node2);
-AstElement* ne_const(Lang* context, AstElement* element, AstElement* node2);
-AstElement* lsh_const(Lang* context, AstElement* element, AstElement* node2);
-AstElement* rsh_const(Lang* context, AstElement* element, AstElement* node2);
-AstElement* land_const(Lang* context, AstElement* element, AstElement* node2);
-AstElement* lor_const(Lang* context, AstElement* element, AstElement* node2);
-AstElement* lnot_const(Lang* context, AstElement* element);
-AstElement* select_const(Lang* context, AstElement* element, AstElement* node2, AstElement* pNodes3);
-
-/* Generate operation const */
-AstExpression* Lang::gen_op_const(Uint32 op, AstExpression* left, AstExpression* right)
-{
-    auto* context = this;
-    AstElement* element = NULL;
-    AstExpression* expression = NULL;
-    AstElement* const_left = NULL, *const_right = NULL;
-
-    STD_ASSERT(left || right);
-
-    /* must be constant */
-    if (left)
-    {
-        const_left = left->element;
-        if (! const_left)
-            return NULL;
-    }
-
-    if (right)
-    {
-        const_right = right->element;
-        if (! const_right)
-            return NULL;
-    }
 
-    if (const_left)
-    {
-        if (! const_left->is_constant)
-            return NULL;
-    }
-        
-    if (const_right)
-    {
-        if (! const_right->is_constant)
-            return NULL;
-    }
-    
-    switch (op)
+// Is the constant a scalar (can't be modified by anyone)?
+static bool is_scalar_constant(const Value& value)
+{
+    switch (value.m_type)
     {
-    case '+':
-        element = add_const(context, const_left, const_right);
-        break;
-
-    case '-':
-        if (const_left && const_right)
-            /* sub */
-            element = sub_const(context, const_left, const_right);
-        else if (const_right)
-            /* negativ */
-            element = neg_const(context, const_right);
-
-        break;
-
-    case '*':
-        element = mul_const(context, const_left, const_right);
-        break;
-
-    case '%':
-        element = mod_const(context, const_left, const_right);
-        break;
-
-    case '/':
-        element = div_const(context, const_left, const_right);
-        break;
-
-    case '&':
-        element = and_const(context, const_left, const_right);
-        break;
-
-    case '|':
-        element = or_const(context, const_left, const_right);
-        break;
-
-    case '^':
-        element = xor_const(context, const_left, const_right);
-        break;
-
-    case '~':
-        element = rev_const(context, const_right);
-        break;
-
-    case F_GE:
-        element = ge_const(context, const_left, const_right);
-        break;
-
-    case F_LE:
-        element = le_const(context, const_left, const_right);
-        break;
-
-    case F_GT:
-        element = gt_const(context, const_left, const_right);
-        break;
-
-    case F_LT:
-        element = lt_const(context, const_left, const_right);
-        break;
-
-    case L_EQ:
-        element = eq_const(context, const_left, const_right);
-        break;
-    
-    case L_NE:
-        element = ne_const(context, const_left, const_right);
-        break;
-
-    case F_NE:
-        element = ne_const(context, const_left, const_right);
-        break;
-
-    case L_LSH:
-        element = lsh_const(context, const_left, const_right);
-        break;
-
-    case L_RSH:
-        element = rsh_const(context, const_left, const_right);
-        break;
-        
-    case L_LOR:
-        element = lor_const(context, const_left, const_right);
-        break;
-
-    case L_LAND:
-        element = land_const(context, const_left, const_right);
-        break;
-
-    case L_LNOT:
-    case '!':
-        element = lnot_const(context, const_right);
-        break;
-
+    case NIL:
+    case INTEGER:
+    case REAL:
+    case STRING:
+        return true;
     default:
-
-        STD_ASSERT(0 && "not supported const operation!");
+        return false;
     }
-
-    expression = context->syntax_create_expression(element);
-    expression->is_constant = 1;
-
-    return expression;
 }
 
-
-/* cast const to type */
-AstExpression* Lang::gen_cast_const(AstExpression* exp, IntR type)
+static bool is_number_constant(const Value& value)
 {
-    auto* context = this;
-    AstElement* element = NULL;
-    AstElement* element = NULL;
-    AstExpression* expression = NULL;
-
-    if (! exp->element || ! exp->element->is_constant)
-        return NULL;
+    return value.m_type == INTEGER || value.m_type == REAL;
+}
 
-    element = exp->element;
-    
-    switch (type)
+// Is the node an expression may be folded?
+static bool is_foldable_node(AstNode* node)
+{
+    switch (node->get_node_type())
     {
-    case INTEGER:
-        element = cast_const_to_number(context, element);
-        break;
-
-    case REAL:
-        element = cast_const_to_real(context, element);
-        break;
-
-    case STRING:
-        element = cast_const_to_string(context, element);
-        break;
-
+    case AST_EXPR_BINARY:
+    case AST_EXPR_CAST:
+    case AST_EXPR_CREATE_ARRAY:
+    case AST_EXPR_CREATE_MAPPING:
+    case AST_EXPR_SINGLE_VALUE:
+    case AST_EXPR_TERNARY:
+    case AST_EXPR_UNARY:
+    case AST_EXPR_VARIABLE:
+        return true;
     default:
-        /* Impossible to cast */
-        return NULL;
+        return false;
     }
-
-    expression = context->syntax_create_expression(element);
-    expression->is_constant = 1;
-    return expression;
 }
 
-/* Get value of const value */
-/* Return integer/real/string in pointer */
-Value create_const_value(Lang* context, AstElement* element)
+// Get value of constant or folded expression
+static bool get_folded_value(AstNode* node, Value* value)
 {
-    STD_ASSERT(element->is_constant);
+    if (!node)
+        return false;
 
-    switch (element->type)
+    if (node->get_node_type() == AST_EXPR_CONSTANT)
     {
-    case INTEGER:
-        /* Got number */
-        return (Integer)strtol64(element->output.c_str(), NULL, 10, true);
-
-    case REAL:
-        /* Got real */
-        return (Real)atof(element->output.c_str());
+        *value = ((AstExprConstant*)node)->value;
+        return true;
+    }
 
-    case STRING:
-        /* Got string */
-        return element->output.ptr();
+    if (!is_foldable_node(node) || !((AstExpr*)node)->is_folded)
+        return false;
 
-    default:
-        /* Impossible to here */
-        STD_ASSERT(0);
-        return 0;
-    }
+    *value = ((AstExpr*)node)->folded_value;
+    return true;
 }
 
-/* Convert const value to integer */
-Integer const_to_int(Lang* context, Value val)
+// Is the local never changed after declared?
+static bool is_unchanged_local(AstDeclaration* decl)
 {
-    return (Integer)val;
+    return (decl->ident_type & IDENT_LOCAL_VAR) &&
+           !(decl->usage & (AST_VAR_REASSIGNED | AST_VAR_ESCAPED));
 }
 
-/* Convert const value to real */
-Real const_to_real(Lang* context, Value val)
+// Convert constant to type of variable, return false if can't
+static bool convert_constant(const Value& value, ValueType type, Value* result)
 {
-    return (Real)val;
-}
+    if (type == MIXED || type == value.m_type)
+    {
+        *result = value;
+        return true;
+    }
 
-/* Convert const value to string (char *) */
-String const_to_string(Lang* context, Value val)
-{
-    return (String)val;
-}
+    if (type == INTEGER && value.m_type == REAL)
+    {
+        *result = (Integer)value.m_real;
+        return true;
+    }
 
-/* Convert const value to string (1 or 0) */
-bool const_to_bool(Lang* context, Value val)
-{
-    return (bool)val;
+    if (type == REAL && value.m_type == INTEGER)
+    {
+        *result = (Real)value.m_int;
+        return true;
+    }
+
+    return false;
 }
 
-/* Generate element by const value */
-AstElement* generate_const_to_element(Lang* context, Value val)
+// Fold constant expressions & propagate constant locals
+// Since locals may be assigned at anywhere (even before the reference
+// by loop), all usages of locals are marked at first, then the AST is
+// folded from bottom to top.
+// Scalars are always safe to fold. A container literal is folded only
+// when the value won't be stored or updated, since the folded one is
+// shared by all executions.
+void Lang::fold_constants()
 {
-    char output[64];
-    AstElement* element = context->syntax_create_element();
+    if (!m_root)
+        return;
 
-    element->is_constant = true;
-    element->type = val.m_type;
+    mark_var_usage(m_root, VALUE_READ_ONLY);
+    fold_node(m_root, VALUE_READ_ONLY);
+}
 
-    switch (val.m_type)
+// Mark usages of all local variables
+void Lang::mark_var_usage(AstNode* node, ValueUsage usage)
+{
+    switch (node->get_node_type())
     {
-    case INTEGER:
-		int64_to_string(output, sizeof(output), val.m_int, 10, 1, 0);
-        element->output = output;
+    case AST_EXPR_VARIABLE:
+    {
+        auto* variable = (AstExprVariable*)node;
+        if (!(variable->ident_type & IDENT_LOCAL_VAR) || !variable->declaration)
+            break;
+
+        auto* decl = (AstDeclaration*)variable->declaration;
+        switch (usage)
+        {
+        case VALUE_ASSIGNED:
+            decl->usage |= AST_VAR_REASSIGNED;
+            break;
+        case VALUE_MUTATED:
+        case VALUE_MAY_ESCAPE:
+            decl->usage |= AST_VAR_ESCAPED;
+            break;
+        default:
+            break;
+        }
         break;
+    }
 
-    case REAL:
-        snprintf(output, sizeof(output), "%.12g", (double)val.m_real);
-        element->output = output;
+    case AST_LOOP_EACH:
+    case AST_LOOP_RANGE:
+    {
+        // The loop variable is updated by each round
+        auto* decl_or_variable = node->get_node_type() == AST_LOOP_EACH ?
+            ((AstLoopEach*)node)->decl_or_variable :
+            ((AstLoopRange*)node)->decl_or_variable;
+        if (decl_or_variable->get_node_type() == AST_DECLARATIONS)
+        {
+            auto* decl = ((AstDeclarations*)decl_or_variable)->decl_list;
+            decl->usage |= AST_VAR_REASSIGNED;
+        }
         break;
+    }
 
-    case STRING:
-        element->output = val.m_string;
-        break;
-    
     default:
-
-        /* can not be herer */
-        STD_ASSERT(0);
+        break;
     }
 
-    return element;
+    for (auto* p = node->children; p != 0; p = p->sibling)
+        mark_var_usage(p, get_child_usage(node, p, usage));
 }
 
-
-/* Const operations */
-/* cast type: (IntR) */
-AstElement* cast_const_to_number(Lang* context, AstElement* element)
+// Fold the node & all children
+void Lang::fold_node(AstNode* node, ValueUsage usage)
 {
-    Value a;
+    for (auto* p = node->children; p != 0; p = p->sibling)
+    {
+        auto child_usage = get_child_usage(node, p, usage);
+        if (node->get_node_type() == AST_DECLARATION &&
+            is_unchanged_local((AstDeclaration*)node))
+            // The initializer will be propagated to read only references
+            child_usage = VALUE_READ_ONLY;
+        fold_node(p, child_usage);
+    }
 
-    a = create_const_value(context, element);
-    a = const_to_int(context, a);
-    return generate_const_to_element(context, a);
-}
+    switch (node->get_node_type())
+    {
+    case AST_DECLARATION:
+    {
+        // Propagate the initializer if the local is never changed
+        auto* decl = (AstDeclaration*)node;
+        if (!is_unchanged_local(decl))
+            break;
 
-/* cast type: (float) */
-AstElement* cast_const_to_real(Lang* context, AstElement* element)
-{
-    Value a;
-    a = create_const_value(context, element);
-    a = const_to_real(context, a);
-    return generate_const_to_element(context, a);
-}
+        Value value = NIL;
+        if (!get_folded_value(decl->expr, &value))
+            break;
 
-/* cast type: (string) */
-AstElement* cast_const_to_string(Lang* context, AstElement* element)
-{
-    Value a;
-    a = create_const_value(context, element);
-    a = const_to_string(context, a);
-    return generate_const_to_element(context, a);
-}
+        if (!convert_constant(value, decl->var_type.basic_var_type, &decl->expr->folded_value))
+            break;
 
-/* a + b */
-AstElement* add_const(Lang* context, AstElement* element, AstElement* node2)
-{
-    Value a, b, r;
-    a = create_const_value(context, element);
-    b = create_const_value(context, node2);
-    r = a + b;
-    return generate_const_to_element(context, r);
-}
+        decl->expr->is_folded = true;
+        decl->usage |= AST_VAR_PROPAGATED;
+        break;
+    }
 
-/* a - b */
-AstElement* sub_const(Lang* context, AstElement* element, AstElement* node2)
-{
-    Value a, b, r;
-    a = create_const_value(context, element);
-    b = create_const_value(context, node2);
-    r = a - b;
-    return generate_const_to_element(context, r);
+    default:
+    {
+        if (!is_foldable_node(node))
+            break;
+
+        auto* expr = (AstExpr*)node;
+        Value value = NIL;
+        if (!fold_expr(expr, usage, &value))
+            break;
+
+        if (value.m_type == STRING)
+            // Use string in pool, it won't be freed by GC
+            value = Program::find_or_add_string(value.m_string);
+        expr->folded_value = value;
+        expr->is_folded = true;
+        break;
+    }
+    }
 }
 
-/* a * b */
-AstElement* mul_const(Lang* context, AstElement* element, AstElement* node2)
+// Try to work out the value of expression
+bool Lang::fold_expr(AstExpr* expr, ValueUsage usage, Value* result)
 {
-    Value a, b, r;
-    a = create_const_value(context, element);
-    b = create_const_value(context, node2);
-    r = a * b;
-    return generate_const_to_element(context, r);
-}
+    Value a = NIL;
+    Value b = NIL;
 
-/* a % b */
-AstElement* mod_const(Lang* context, AstElement* element, AstElement* node2)
-{
-    Value a, b, r;
-    a = create_const_value(context, element);
-    b = create_const_value(context, node2);
-    r = a % b;
-    return generate_const_to_element(context, r);
-}
+    switch (expr->get_node_type())
+    {
+    case AST_EXPR_VARIABLE:
+    {
+        auto* variable = (AstExprVariable*)expr;
+        if (!(variable->ident_type & IDENT_LOCAL_VAR) || !variable->declaration)
+            return false;
 
-/* a / b */
-AstElement* div_const(Lang* context, AstElement* element, AstElement* node2)
-{
-    Value a, b, r;
-    a = create_const_value(context, element);
-    b = create_const_value(context, node2);
-    r = a / b;
-    return generate_const_to_element(context, r);
-}
+        auto* decl = (AstDeclaration*)variable->declaration;
+        if (!(decl->usage & AST_VAR_PROPAGATED))
+            return false;
 
-/* a & b */
-AstElement* and_const(Lang* context, AstElement* element, AstElement* node2)
-{
-    Value a, b, r;
-    a = create_const_value(context, element);
-    b = create_const_value(context, node2);
-    r = a & b;
-    return generate_const_to_element(context, r);
-}
+        *result = decl->expr->folded_value;
+        return true;
+    }
 
-/* a | b */
-AstElement* or_const(Lang* context, AstElement* element, AstElement* node2)
-{
-    Value a, b, r;
-    a = create_const_value(context, element);
-    b = create_const_value(context, node2);
-    r = a | b;
-    return generate_const_to_element(context, r);
-}
+    case AST_EXPR_SINGLE_VALUE:
+    {
+        // All values must be folded, take the last one
+        for (AstNode* p = ((AstExprSingleValue*)expr)->expr_list; p != 0; p = p->sibling)
+            if (!get_folded_value(p, result))
+                return false;
+        return true;
+    }
 
-/* a ^ b */
-AstElement* xor_const(Lang* context, AstElement* element, AstElement* node2)
-{
-    Value a, b, r;
-    a = create_const_value(context, element);
-    b = create_const_value(context, node2);
-    r = a ^ b;
-    return generate_const_to_element(context, r);
-}
+    case AST_EXPR_CAST:
+    {
+        auto* cast = (AstExprCast*)expr;
+        if (!get_folded_value(cast->expr1, &a))
+            return false;
+        if (!is_scalar_constant(a))
+            return false;
+        return convert_constant(a, cast->var_type.basic_var_type, result);
+    }
 
-/* -a */
-AstElement* neg_const(Lang* context, AstElement* element)
-{
-    Value a, r;
+    case AST_EXPR_UNARY:
+    {
+        auto* unary = (AstExprUnary*)expr;
+        if (!get_folded_value(unary->expr1, &a))
+            return false;
+
+        switch (unary->op)
+        {
+        case OP_NEG:
+            if (!is_number_constant(a))
+                return false;
+            *result = -a;
+            return true;
+
+        case OP_REV:
+            if (a.m_type != INTEGER)
+                return false;
+            *result = ~a;
+            return true;
+
+        case OP_NOT:
+            if (!is_scalar_constant(a))
+                return false;
+            *result = (Integer)(a.is_zero() ? 1 : 0);
+            return true;
+
+        default:
+            return false;
+        }
+    }
 
-    a = create_const_value(context, element);
-    r = -a;
-    return generate_const_to_element(context, r);
-}
+    case AST_EXPR_BINARY:
+    {
+        auto* binary = (AstExprBinary*)expr;
+        if (!get_folded_value(binary->expr1, &a))
+            return false;
+
+        if (binary->op == OP_LAND || binary->op == OP_LOR)
+        {
+            if (!is_scalar_constant(a))
+                return false;
+
+            // The 2nd one is skipped if the result is decided by 1st one
+            if (a.is_zero() == (binary->op == OP_LAND))
+            {
+                *result = a;
+                return true;
+            }
+            if (!get_folded_value(binary->expr2, &b) || !is_scalar_constant(b))
+                return false;
+            *result = b;
+            return true;
+        }
+
+        if (!get_folded_value(binary->expr2, &b))
+            return false;
+        if (!is_scalar_constant(a) || !is_scalar_constant(b))
+            return false;
+
+        bool both_numbers = is_number_constant(a) && is_number_constant(b);
+        bool both_integers = a.m_type == INTEGER && b.m_type == INTEGER;
+        bool comparable = both_numbers || (a.m_type == STRING && b.m_type == STRING);
+        switch (binary->op)
+        {
+        case OP_ADD:
+            if (!both_numbers && !(a.m_type == STRING && b.m_type != NIL))
+                return false;
+            *result = a + b;
+            return true;
+
+        case OP_SUB: if (!both_numbers) return false; *result = a - b; return true;
+        case OP_MUL: if (!both_numbers) return false; *result = a * b; return true;
+
+        case OP_DIV:
+        case OP_MOD:
+            // Leave divided by zero to runtime
+            if (!both_numbers || b.is_zero())
+                return false;
+            *result = (binary->op == OP_DIV) ? a / b : a % b;
+            return true;
+
+        case OP_AND: if (!both_integers) return false; *result = a & b; return true;
+        case OP_OR:  if (!both_integers) return false; *result = a | b; return true;
+        case OP_XOR: if (!both_integers) return false; *result = a ^ b; return true;
+        case OP_LSH: if (!both_integers) return false; *result = a << b; return true;
+        case OP_RSH: if (!both_integers) return false; *result = a >> b; return true;
+
+        case OP_EQ: *result = (Integer)(a == b); return true;
+        case OP_NE: *result = (Integer)(a != b); return true;
+
+        case OP_LT: if (!comparable) return false; *result = (Integer)(a < b);  return true;
+        case OP_LE: if (!comparable) return false; *result = (Integer)(a <= b); return true;
+        case OP_GT: if (!comparable) return false; *result = (Integer)(a > b);  return true;
+        case OP_GE: if (!comparable) return false; *result = (Integer)(a >= b); return true;
+
+        default:
+            return false;
+        }
+    }
 
-/* ~a */
-AstElement* rev_const(Lang* context, AstElement* element)
-{
-    Value a, r;
-    a = create_const_value(context, element);
-    r = ~a;
-    return generate_const_to_element(context, r);
-}
+    case AST_EXPR_TERNARY:
+    {
+        auto* ternary = (AstExprTernary*)expr;
+        if (!get_folded_value(ternary->expr1, &a) || !is_scalar_constant(a))
+            return false;
+        return get_folded_value(a.is_non_zero() ? ternary->expr2 : ternary->expr3, result);
+    }
 
-/* a >= b */
-AstElement* ge_const(Lang* context, AstElement* element, AstElement* node2)
-{
-    Value a, b, r;
-    a = create_const_value(context, element);
-    b = create_const_value(context, node2);
-    r = (a >= b);
-    return generate_const_to_element(context, r);
-}
+    case AST_EXPR_CREATE_ARRAY:
+    case AST_EXPR_CREATE_MAPPING:
+        return fold_container(expr, usage, result);
 
-/* a <= b */
-AstElement* le_const(Lang* context, AstElement* element, AstElement* node2)
-{
-    Value a, b, r;
-    a = create_const_value(context, element);
-    b = create_const_value(context, node2);
-    r = (a <= b);
-    return generate_const_to_element(context, r);
+    default:
+        return false;
+    }
 }
 
-/* a > b */
-AstElement* gt_const(Lang* context, AstElement* element, AstElement* node2)
+// Fold container literal if all elements are scalar constants & the
+// container won't be modified by anyone
+bool Lang::fold_container(AstExpr* expr, ValueUsage usage, Value* result)
 {
-    Value a, b, r;
-    a = create_const_value(context, element);
-    b = create_const_value(context, node2);
-    r = (a > b);
-    return generate_const_to_element(context, r);
-}
+    if (usage != VALUE_READ_ONLY)
+        return false;
 
-/* a < b */
-AstElement* lt_const(Lang* context, AstElement* element, AstElement* node2)
-{
-    Value a, b, r;
-    a = create_const_value(context, element);
-    b = create_const_value(context, node2);
-    r = (a < b);
-    return generate_const_to_element(context, r);
-}
+    auto* expr_list = expr->get_node_type() == AST_EXPR_CREATE_ARRAY ?
+        ((AstExprCreateArray*)expr)->expr_list :
+        ((AstExprCreateMapping*)expr)->expr_list;
 
-/* a == b */
-AstElement* eq_const(Lang* context, AstElement* element, AstElement* node2)
-{
-    Value a, b, r;
-    a = create_const_value(context, element);
-    b = create_const_value(context, node2);
-    r = (a == b);
-    return generate_const_to_element(context, a);
-}
+    size_t count = 0;
+    Value element = NIL;
+    for (AstNode* p = expr_list; p != 0; p = p->sibling, count++)
+        if (!get_folded_value(p, &element) || !is_scalar_constant(element))
+            return false;
 
-/* a != b */
-AstElement* ne_const(Lang* context, AstElement* element, AstElement* node2)
-{
-    Value a, b, r;
-    a = create_const_value(context, element);
-    b = create_const_value(context, node2);
-    r = (a != b);
-    return generate_const_to_element(context, r);
-}
+    // The container is managed by the context (not binded to domain), it
+    // will be copied into constants pool of program by pass2
+    if (expr->get_node_type() == AST_EXPR_CREATE_ARRAY)
+    {
+        auto* array = LANG_NEW(this, ArrayImpl, count);
+        for (AstNode* p = expr_list; p != 0; p = p->sibling)
+        {
+            get_folded_value(p, &element);
+            array->push_back(element);
+        }
+        result->m_type = ARRAY;
+        result->m_array = array;
+        return true;
+    }
 
-/* a << b */
-AstElement* lsh_const(Lang* context, AstElement* element, AstElement* node2)
-{
-    Value a, b, r;
-    a = create_const_value(context, element);
-    b = create_const_value(context, node2);
-    r = a << b;
-    return generate_const_to_element(context, r);
+    // Key & value appear alternately
+    Value key = NIL;
+    auto* map = LANG_NEW(this, MapImpl, count / 2);
+    for (AstNode* p = expr_list; p != 0 && p->sibling != 0; p = p->sibling->sibling)
+    {
+        get_folded_value(p, &key);
+        get_folded_value(p->sibling, &element);
+        map->set(key, element);
+    }
+    result->m_type = MAPPING;
+    result->m_map = map;
+    return true;
 }
 
-/* a >> b */
-AstElement* rsh_const(Lang* context, AstElement* element, AstElement* node2)
+// Derive how the value of child is used by parent
+Lang::ValueUsage Lang::get_child_usage(AstNode* node, AstNode* child, ValueUsage usage)
 {
-    Value a, b, r;
-    a = create_const_value(context, element);
-    b = create_const_value(context, node2);
-    r = a >> b;
-    return generate_const_to_element(context, r);
-}
+    switch (node->get_node_type())
+    {
+    case AST_STATEMENTS:
+    case AST_IF_ELSE:
+    case AST_WHILE_LOOP:
+    case AST_DO_WHILE:
+    case AST_FOR_LOOP:
+    case AST_SWITCH_CASE:
+    case AST_CASE:
+        // Conditions & statements, value is read or dropped
+        return VALUE_READ_ONLY;
+
+    case AST_LOOP_EACH:
+    {
+        auto* loop = (AstLoopEach*)node;
+        if (child == loop->decl_or_variable)
+            return VALUE_ASSIGNED;
+        return VALUE_READ_ONLY;
+    }
 
-/* a && b */
-AstElement* land_const(Lang* context, AstElement* element, AstElement* node2)
-{
-    Value a, b, r;
-    a = create_const_value(context, element);
-    b = create_const_value(context, node2);
-    r = (const_to_bool(context, a) && const_to_bool(context, b));
-    return generate_const_to_element(context, r);
-}
+    case AST_LOOP_RANGE:
+    {
+        auto* loop = (AstLoopRange*)node;
+        if (child == loop->decl_or_variable)
+            return VALUE_ASSIGNED;
+        if (child == loop->begin)
+            return VALUE_MAY_ESCAPE;
+        return VALUE_READ_ONLY;
+    }
 
-/* a || b */
-AstElement* lor_const(Lang* context, AstElement* element, AstElement* node2)
-{
-    Value a, b, r;
-    a = create_const_value(context, element);
-    b = create_const_value(context, node2);
-    r = (const_to_bool(context, a) || const_to_bool(context, b));
-    return generate_const_to_element(context, r);
-}
+    case AST_EXPR_ASSIGN:
+        if (child == ((AstExprAssign*)node)->expr1)
+            return VALUE_ASSIGNED;
+        return VALUE_MAY_ESCAPE;
+
+    case AST_EXPR_UNARY:
+        switch (((AstExprUnary*)node)->op)
+        {
+        case OP_INC_PRE:
+        case OP_DEC_PRE:
+        case OP_INC_POST:
+        case OP_DEC_POST:
+            return VALUE_ASSIGNED;
+        default:
+            return VALUE_READ_ONLY;
+        }
+
+    case AST_EXPR_BINARY:
+    {
+        auto op = ((AstExprBinary*)node)->op;
+        if (op == OP_LAND || op == OP_LOR)
+            // Result is one of the operands
+            return usage;
+        return VALUE_READ_ONLY;
+    }
 
-/* ! a */
-AstElement* lnot_const(Lang* context, AstElement* element)
-{
-    Value a, r;
-    a = create_const_value(context, element);
-    r = !const_to_bool(context, a);
-    return generate_const_to_element(context, r);
-}
+    case AST_EXPR_TERNARY:
+        if (child == ((AstExprTernary*)node)->expr1)
+            return VALUE_READ_ONLY;
+        return usage;
 
-/* a ? b : c */
-AstElement* select_const(Lang* context, AstElement* element, AstElement* node2, AstElement* node3)
-{
-    Value a;
-    a = create_const_value(context, element);
-    return const_to_bool(context, a) ? node2 : node3;
+    case AST_EXPR_SINGLE_VALUE:
+        if (child->sibling)
+            // Dropped
+            return VALUE_READ_ONLY;
+        return usage;
+
+    case AST_EXPR_CAST:
+        return usage;
+
+    case AST_EXPR_INDEX:
+    {
+        auto* index = (AstExprIndex*)node;
+        if (child != index->container)
+            return VALUE_MAY_ESCAPE;
+        if (usage == VALUE_ASSIGNED || usage == VALUE_MUTATED)
+            // Update element of container
+            return VALUE_MUTATED;
+        return VALUE_READ_ONLY;
+    }
+
+    default:
+        return VALUE_MAY_ESCAPE;
+    }
 }
 
 }
-#endif
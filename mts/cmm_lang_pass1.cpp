@@ -399,6 +399,19 @@ void Lang::lookup_and_map_identifiers(AstNode *node)
     case AST_FUNCTION:
     {
         auto* function = (AstFunction*)node;
+
+        // Arguments are visible in the frame of function
+        ArgNo arg_no = 0;
+        for (auto* arg = function->prototype->arg_list; arg != 0;
+             arg = (AstFunctionArg*)arg->sibling)
+        {
+            auto* info = LANG_NEW(this, IdentInfo, this);
+            info->type = IDENT_ARGUMENT;
+            info->arg_no = arg_no++;
+            info->arg = arg;
+            m_symbols.add_ident_info(arg->name, info, arg);
+        }
+
         if (function->prototype->attrib & AST_ANONYMOUS_CLOSURE)
             // Skip anonymouse closure, don't add into symbol table
             break;
@@ -437,7 +450,21 @@ void Lang::lookup_and_map_identifiers(AstNode *node)
             this->m_error_code = PASS1_ERROR;
             break;
         }
-        variable->var_type = info->decl->var_type;
+        variable->ident_type = info->type;
+        if (info->type & IDENT_ARGUMENT)
+        {
+            variable->arg_no = info->arg_no;
+            variable->var_type = info->arg->var_type;
+            variable->declaration = info->arg;
+        } else
+        {
+            if (info->type & IDENT_LOCAL_VAR)
+                variable->local_var_no = info->local_var_no;
+            else
+                variable->object_var_no = info->object_var_no;
+            variable->var_type = info->decl->var_type;
+            variable->declaration = info->decl;
+        }
         variable->is_constant = false; // Variant, not constant
         break;
     }
@@ -590,6 +617,16 @@ void Lang::lookup_expr_types(AstNode *node)
             ValueType from_type = expr->expr1->var_type.basic_var_type;
             // Check valid cast
             derive_type_of_op(expr, OP_CAST, to_type, from_type, ANY_TYPE);
+
+            // Let the type be visible as an AstExpr
+            ((AstExpr*)expr)->var_type = expr->var_type;
+            break;
+        }
+        case AST_EXPR_RUNTIME_VALUE:
+        {
+            // Let the type be visible as an AstExpr
+            auto* expr = (AstExprRuntimeValue*)node;
+            ((AstExpr*)expr)->var_type = expr->var_type;
             break;
         }
         case AST_EXPR_BINARY:
@@ -662,13 +699,12 @@ void Lang::lookup_expr_types(AstNode *node)
 
             // Get last child
             auto* p = expr->children;
-            if (p->sibling)
-            {
-                while (p->sibling->sibling)
-                    p = p->sibling;
-            }
+            while (p->sibling)
+                p = p->sibling;
 
             expr->var_type = ((AstExpr*)p)->var_type;
+            expr->is_constant = are_expr_list_constant(expr->expr_list);
+            break;
         }
         default:
             // Skip
@@ -755,7 +791,7 @@ ValueType Lang::derive_type_of_op(
     for (auto i = start_index; i < STD_SIZE_N(expr_op_types); i++)
     {
         auto* op_prototype = &expr_op_types[i];
-        if (op_prototype->op != op)
+        if (op_prototype->op != key_op)
             break;
 
         if ((op_prototype->operand1_type == operand1_type || op_prototype->operand1_type == ANY_TYPE) &&
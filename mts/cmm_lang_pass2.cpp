@@ -1,18 +1,1987 @@
 // cmm_lang_pass2.cpp
 // Initial version Feb/2/2016 by doing
-// AST: pass2
+// AST: pass2, generate byte codes for VM
 
+#include <stdio.h>
+#include <string.h>
+#include "cmm_ast.h"
+#include "cmm_efun.h"
 #include "cmm_lang.h"
+#include "cmm_program.h"
+#include "cmm_register_allocator.h"
 
 namespace cmm
 {
 
+// Instruction being generated, the operands are not mapped yet
+struct CodeEntry
+{
+    Instruction::Code code;
+    CodeOperand operands[3];
+    int label;              // Target of JMP/JCOND, or -1
+};
+
+// Target of break/continue
+struct LoopTarget
+{
+    AstNode* node;          // Loop or switch node
+    int break_label;
+    int continue_label;     // -1 for switch
+};
+
+// Label defined by user
+struct NamedLabel
+{
+    int label;
+    AstNode* node;          // First node refers/defines this label
+    bool is_defined;
+};
+
+// Call inlined into the generating function
+struct InlinedCall
+{
+    size_t start;           // Range of codes [start, end)
+    size_t end;
+    FunctionNo callee_no;
+};
+
+// Max count of nodes in the returned expression of inlined function
+enum { INLINE_BUDGET = 16 };
+
+// Context of generating byte codes
+struct CodeContext
+{
+    // Constants of program (no duplicated)
+    simple::hash_map<simple::string, ConstantIndex> string_constants;
+    simple::hash_map<Int64, ConstantIndex> integer_constants;
+    simple::hash_map<Int64, ConstantIndex> real_constants; // Key is bits of real
+    ConstantIndex nil_constant;
+    bool has_nil_constant;
+
+    // Functions can be called by name in this program
+    simple::hash_map<simple::string, AstFunction*> functions;
+
+    // Context of the generating function
+    AstFunction* function;
+    simple::vector<CodeEntry> codes;
+    simple::vector<RegisterAllocator::Position> label_positions;
+    simple::hash_map<simple::string, NamedLabel> named_labels;
+    simple::vector<LoopTarget> loop_targets;
+    simple::vector<CodeOperand> local_registers;
+    simple::vector<InlinedCall> inlined_calls;
+    RegisterAllocator allocator;
+
+    // Arguments of the function being inlined
+    AstFunction* inline_function;
+    simple::vector<CodeOperand>* inline_args;
+
+    CodeContext() :
+        nil_constant(0),
+        has_nil_constant(false),
+        function(0),
+        inline_function(0),
+        inline_args(0)
+    {
+    }
+};
+
+// Binary operator -> instructions for integer, real & mixed operands
+struct BinaryOpCode
+{
+    Op op;
+    Instruction::Code code_i;
+    Instruction::Code code_r;   // NOP if there is no instruction for real
+    Instruction::Code code_x;
+    bool is_compare;
+};
+
+static BinaryOpCode binary_op_codes[] =
+{
+    { OP_ADD, Instruction::ADDI, Instruction::ADDR, Instruction::ADDX, false },
+    { OP_SUB, Instruction::SUBI, Instruction::SUBR, Instruction::SUBX, false },
+    { OP_MUL, Instruction::MULI, Instruction::MULR, Instruction::MULX, false },
+    { OP_DIV, Instruction::DIVI, Instruction::DIVR, Instruction::DIVX, false },
+    { OP_MOD, Instruction::MODI, Instruction::MODR, Instruction::MODX, false },
+    { OP_EQ,  Instruction::EQI,  Instruction::EQR,  Instruction::EQX,  true  },
+    { OP_NE,  Instruction::NEI,  Instruction::NER,  Instruction::NEX,  true  },
+    { OP_GT,  Instruction::GTI,  Instruction::GTR,  Instruction::GTX,  true  },
+    { OP_LT,  Instruction::LTI,  Instruction::LTR,  Instruction::LTX,  true  },
+    { OP_GE,  Instruction::GEI,  Instruction::GER,  Instruction::GEX,  true  },
+    { OP_LE,  Instruction::LEI,  Instruction::LER,  Instruction::LEX,  true  },
+    { OP_AND, Instruction::ANDI, Instruction::NOP,  Instruction::ANDX, false },
+    { OP_OR,  Instruction::ORI,  Instruction::NOP,  Instruction::ORX,  false },
+    { OP_XOR, Instruction::XORI, Instruction::NOP,  Instruction::XORX, false },
+    { OP_LSH, Instruction::LSHI, Instruction::NOP,  Instruction::LSHX, false },
+    { OP_RSH, Instruction::RSHI, Instruction::NOP,  Instruction::RSHX, false },
+};
+
+// Is this node an expression?
+static bool is_expr_node(AstNode* node)
+{
+    auto type = node->get_node_type();
+    return type >= AST_EXPR_ASSIGN && type <= AST_EXPR_VARIABLE;
+}
+
+// Is the comparison operator
+static bool is_compare_op(Op op)
+{
+    switch (op)
+    {
+    case OP_EQ: case OP_NE: case OP_GT: case OP_LT: case OP_GE: case OP_LE:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Get the operator for "!(a op b)"
+// Only EQ/NE can be inverted for any type, the others can be inverted for
+// integer only (NaN breaks it for real)
+static Op invert_compare_op(Op op)
+{
+    switch (op)
+    {
+    case OP_EQ: return OP_NE;
+    case OP_NE: return OP_EQ;
+    case OP_GT: return OP_LE;
+    case OP_LT: return OP_GE;
+    case OP_GE: return OP_LT;
+    case OP_LE: return OP_GT;
+    default:    return op;
+    }
+}
+
+// Get the type can be trusted for operand
+// Only the value of non-nullable variable is guaranteed to be the type
+static ValueType get_operand_type(const AstVarType& var_type)
+{
+    if (var_type.var_attrib & AST_VAR_MAY_NIL)
+        return MIXED;
+
+    switch (var_type.basic_var_type)
+    {
+    case NIL:
+    case TVOID:
+    case PRIMITIVE_TYPE:
+    case ANY_TYPE:
+    case BAD_TYPE:
+        return MIXED;
+    default:
+        return var_type.basic_var_type;
+    }
+}
+
+// Generate byte codes for all functions & create the program
 bool Lang::pass2()
 {
-    // Lookup the AST to map all identifiers
-    
+    if (m_error_code != ErrorCode::OK || m_num_errors)
+        // Don't generate for bad AST
+        return false;
+
+    CodeContext code_context;
+    m_code = &code_context;
+
+    simple::string name = m_program_name;
+    if (!name.length())
+        name = m_root->location.file->c_str();
+    m_program = XNEW(Program, name.c_str(), Program::INTERPRETED);
+
+    // Self is the first component
+    m_program->add_component(name.c_str());
+    for (auto& it : m_components)
+        m_program->add_component(it.c_str());
+
+    // Object vars
+    // The reference & nullable values may be nil, use mixed as their types
+    for (auto* decl : m_object_vars)
+    {
+        auto type = get_operand_type(decl->var_type);
+        if (type >= REFERENCE_VALUE)
+            type = MIXED;
+        m_program->define_object_var(decl->name.c_str(), type);
+    }
+
+    // Methods are prior to nested functions when calling by name
+    for (auto* function : m_functions)
+        if (function->prototype->attrib & AST_MEMBER_METHOD)
+            code_context.functions.put(function->prototype->name, function);
+    for (auto* function : m_functions)
+    {
+        auto attrib = function->prototype->attrib;
+        if (function == m_entry_function || (attrib & AST_ANONYMOUS_CLOSURE))
+            continue;
+        if (!code_context.functions.contains_key(function->prototype->name))
+            code_context.functions.put(function->prototype->name, function);
+    }
+
+    // Define all functions before generating, the no of function in
+    // program is same as AstFunction::no
+    for (auto* function : m_functions)
+        define_function(function);
+
+    for (auto* function : m_functions)
+        generate_function(function);
+
+    m_code = 0;
+    if (m_error_code != ErrorCode::OK)
+    {
+        // Drop the program with bad functions
+        XDELETE(m_program);
+        m_program = 0;
+        return false;
+    }
+
+    // All done, let the others see it
+    if (m_register_program)
+        m_program->register_program();
+    return true;
+}
+
+// Define function & parameters in program
+void Lang::define_function(AstFunction* function)
+{
+    auto* prototype = function->prototype;
+    simple::string name = prototype->name;
+    Uint32 attrib = Function::INTERPRETED;
+    if (function == m_entry_function)
+    {
+        // Initialize object vars, executed after object created
+        name = "__entry__";
+    } else
+    if (prototype->attrib & AST_ANONYMOUS_CLOSURE)
+    {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "__closure_%u__", (unsigned)function->no);
+        name = buf;
+        attrib |= Function::PRIVATE;
+    } else
+    if ((prototype->attrib & AST_PRIVATE) || !(prototype->attrib & AST_MEMBER_METHOD))
+        // Private method or nested function
+        attrib |= Function::PRIVATE;
+
+    if (prototype->attrib & AST_RANDOM_ARG)
+        attrib |= Function::RANDOM_ARG;
+
+    auto* program_function = m_program->define_function(name.c_str(), 0, 0, 0, (Function::Attrib)attrib);
+    STD_ASSERT(("Function no in program must be same as AST.",
+                m_program->get_function(function->no) == program_function));
+
+    for (auto* arg = prototype->arg_list; arg != 0; arg = (AstFunctionArg*)arg->sibling)
+    {
+        Uint32 arg_attrib = 0;
+        if (arg->var_type.var_attrib & AST_VAR_MAY_NIL)
+            arg_attrib |= Parameter::NULLABLE;
+        if (arg->default_value)
+            arg_attrib |= Parameter::DEFAULT;
+        program_function->define_parameter(arg->name.c_str(),
+                                           arg->var_type.basic_var_type,
+                                           (Parameter::Attrib)arg_attrib);
+    }
+
+    if (!program_function->finish_adding_parameters())
+    {
+        this->syntax_errors(this,
+            "%s(%d): error %d: '%s': arguments with default value must be at the end\n",
+            function->location.file->c_str(), function->location.line,
+            C_PARSER,
+            name.c_str());
+        m_error_code = PASS2_ERROR;
+    }
+
+    Uint32 ret_attrib = 0;
+    if (prototype->ret_var_type.var_attrib & AST_VAR_MAY_NIL)
+        ret_attrib |= SyntaxVariable::NULLABLE;
+    program_function->define_ret_type(prototype->ret_var_type.basic_var_type,
+                                      (SyntaxVariable::Attrib)ret_attrib);
+}
+
+// Generate byte codes for function
+void Lang::generate_function(AstFunction* function)
+{
+    auto* code = m_code;
+    code->function = function;
+    code->codes.clear();
+    code->label_positions.clear();
+    code->named_labels.clear();
+    code->loop_targets.clear();
+    code->local_registers.clear();
+    code->inlined_calls.clear();
+    code->allocator.reset();
+
+    // Create registers for local variables at first, so the registers
+    // created later are temporaries
+    for (auto* decl : function->local_vars)
+        code->local_registers.push_back(new_register(get_operand_type(decl->var_type)));
+
+    generate_arguments_prologue(function);
+
+    if (function == m_entry_function)
+    {
+        // The statements at top are in entry function
+        for (auto* p = m_root->children; p != 0; p = p->sibling)
+            generate_statement(p);
+    } else
+        generate_statement(function->body);
+
+    // Return nil if there is no return statement at end
+    auto nil = nil_operand();
+    emit(Instruction::RET, &nil);
+
+    // All labels referred by goto must be defined
+    for (auto& it : code->named_labels)
+    {
+        auto& named_label = it.second;
+        if (named_label.is_defined)
+            continue;
+        this->syntax_errors(this,
+            "%s(%d): error %d: '%s': undefined label\n",
+            named_label.node->location.file->c_str(), named_label.node->location.line,
+            C_UNDECLARED_IDENTIFER,
+            it.first.c_str());
+        m_error_code = PASS2_ERROR;
+    }
+    if (m_error_code != ErrorCode::OK)
+        return;
+
+    simple::vector<Instruction> codes(code->codes.size());
+    LocalNo max_local_no;
+    if (!resolve_codes(&codes, &max_local_no))
+        return;
+
+    auto* program_function = m_program->get_function(function->no);
+    program_function->reserve_local(max_local_no);
+    program_function->set_byte_codes(&codes[0], codes.size());
+
+    // Keep the inlined calls for tracing
+    for (auto& call : code->inlined_calls)
+        program_function->add_inlined_call((Uint32)call.start, (Uint32)call.end,
+                                           m_program->get_function(call.callee_no));
+}
+
+// Check arguments & fill the default arguments which are not passed
+void Lang::generate_arguments_prologue(AstFunction* function)
+{
+    auto* prototype = function->prototype;
+    bool has_typed_arg = false;
+    for (auto* arg = prototype->arg_list; arg != 0; arg = (AstFunctionArg*)arg->sibling)
+        if (arg->var_type.basic_var_type != MIXED || !arg->default_value)
+            has_typed_arg = true;
+
+    if (has_typed_arg || !(prototype->attrib & AST_RANDOM_ARG))
+        emit(Instruction::CHKPARAM);
+
+    CodeOperand argn;
+    bool has_argn = false;
+    ArgNo arg_no = 0;
+    for (auto* arg = prototype->arg_list; arg != 0;
+         arg = (AstFunctionArg*)arg->sibling, arg_no++)
+    {
+        if (!arg->default_value)
+            continue;
+
+        if (!has_argn)
+        {
+            argn = new_register(INTEGER);
+            emit(Instruction::LDARGN, &argn);
+            has_argn = true;
+        }
+
+        // if (argn > arg_no) goto skip; arg = default;
+        auto skip = new_label();
+        auto no = constant_operand((Integer)arg_no);
+        auto passed = generate_binary(OP_GT, argn, no, 0);
+        emit_jump_if(passed, skip);
+        CodeOperand operand;
+        operand.type = Instruction::ARGUMENT;
+        operand.value = arg_no;
+        operand.offset = 0;
+        operand.is_register = false;
+        operand.value_type = get_operand_type(arg->var_type);
+        generate_expr_to(arg->default_value, operand);
+        bind_label(skip);
+    }
+}
+
+// Generate statement
+void Lang::generate_statement(AstNode* node)
+{
+    if (!node)
+        return;
+
+    auto* code = m_code;
+    switch (node->get_node_type())
+    {
+    case AST_STATEMENTS:
+        for (auto* p = node->children; p != 0; p = p->sibling)
+            generate_statement(p);
+        break;
+
+    case AST_DECLARATIONS:
+        for (auto* decl = ((AstDeclarations*)node)->decl_list; decl != 0;
+             decl = (AstDeclaration*)decl->sibling)
+            generate_declaration(decl);
+        break;
+
+    case AST_FUNCTION:
+        // The nested function is generated separately
+        break;
+
+    case AST_IF_ELSE:
+    {
+        auto* if_else = (AstIfElse*)node;
+        auto else_label = new_label();
+        generate_branch(if_else->cond, false, else_label);
+        generate_statement(if_else->block_then);
+        if (if_else->block_else)
+        {
+            auto end_label = new_label();
+            emit_jump(end_label);
+            bind_label(else_label);
+            generate_statement(if_else->block_else);
+            bind_label(end_label);
+        } else
+            bind_label(else_label);
+        break;
+    }
+
+    case AST_WHILE_LOOP:
+    {
+        // The condition is tested at bottom, jump there at first
+        auto* loop = (AstWhileLoop*)node;
+        LoopTarget target = { node, new_label(), new_label() };
+        auto body_label = new_label();
+        emit_jump(target.continue_label);
+        bind_label(body_label);
+        code->loop_targets.push_back(target);
+        generate_statement(loop->block);
+        code->loop_targets.shrink(code->loop_targets.size() - 1);
+        bind_label(target.continue_label);
+        generate_branch(loop->cond, true, body_label);
+        bind_label(target.break_label);
+        break;
+    }
+
+    case AST_DO_WHILE:
+    {
+        auto* loop = (AstDoWhile*)node;
+        LoopTarget target = { node, new_label(), new_label() };
+        auto body_label = new_label();
+        bind_label(body_label);
+        code->loop_targets.push_back(target);
+        generate_statement(loop->block);
+        code->loop_targets.shrink(code->loop_targets.size() - 1);
+        bind_label(target.continue_label);
+        generate_branch(loop->cond, true, body_label);
+        bind_label(target.break_label);
+        break;
+    }
+
+    case AST_FOR_LOOP:
+    {
+        auto* loop = (AstForLoop*)node;
+        LoopTarget target = { node, new_label(), new_label() };
+        auto body_label = new_label();
+        auto cond_label = new_label();
+        generate_statement(loop->init);
+        emit_jump(cond_label);
+        bind_label(body_label);
+        code->loop_targets.push_back(target);
+        generate_statement(loop->block);
+        code->loop_targets.shrink(code->loop_targets.size() - 1);
+        bind_label(target.continue_label);
+        if (loop->step)
+            generate_expr(loop->step, 0, true);
+        bind_label(cond_label);
+        if (loop->cond)
+            generate_branch(loop->cond, true, body_label);
+        else
+            emit_jump(body_label);
+        bind_label(target.break_label);
+        break;
+    }
+
+    case AST_LOOP_RANGE:
+        generate_loop_range((AstLoopRange*)node);
+        break;
+
+    case AST_LOOP_EACH:
+        generate_loop_each((AstLoopEach*)node);
+        break;
+
+    case AST_SWITCH_CASE:
+        generate_switch_case((AstSwitchCase*)node);
+        break;
+
+    case AST_GOTO:
+    {
+        auto* go = (AstGoto*)node;
+        if (go->goto_type == AST_DIRECT_JMP)
+        {
+            if (!code->named_labels.contains_key(go->target_label))
+            {
+                NamedLabel new_one = { new_label(), node, false };
+                code->named_labels.put(go->target_label, new_one);
+            }
+            NamedLabel* named_label = &code->named_labels[go->target_label];
+            emit_jump(named_label->label);
+            break;
+        }
+
+        // Break or continue
+        for (auto i = code->loop_targets.size(); i > 0; i--)
+        {
+            auto& target = code->loop_targets[i - 1];
+            if (target.node != go->loop_switch)
+                continue;
+            if (go->goto_type == AST_BREAK)
+                emit_jump(target.break_label);
+            else
+                emit_jump(target.continue_label);
+            return;
+        }
+        report_not_supported(node, "break/continue");
+        break;
+    }
+
+    case AST_LABEL:
+    {
+        auto* label = (AstLabel*)node;
+        if (!code->named_labels.contains_key(label->name))
+        {
+            NamedLabel new_one = { new_label(), node, false };
+            code->named_labels.put(label->name, new_one);
+        }
+        NamedLabel* named_label = &code->named_labels[label->name];
+        if (named_label->is_defined)
+        {
+            this->syntax_errors(this,
+                "%s(%d): error %d: '%s': label redefinition\n",
+                node->location.file->c_str(), node->location.line,
+                C_REDEFINITION,
+                label->name.c_str());
+            m_error_code = PASS2_ERROR;
+            break;
+        }
+        named_label->is_defined = true;
+        bind_label(named_label->label);
+        break;
+    }
+
+    case AST_RETURN:
+    {
+        auto* ret = (AstReturn*)node;
+        CodeOperand value;
+        if (ret->expr)
+            value = generate_expr(ret->expr, 0);
+        else
+            value = nil_operand();
+        emit(Instruction::RET, &value);
+        break;
+    }
+
+    default:
+        if (is_expr_node(node))
+        {
+            // Expression statement, drop the result
+            generate_expr((AstExpr*)node, 0, true);
+            break;
+        }
+        report_not_supported(node, ast_node_type_to_c_str(node->get_node_type()));
+        break;
+    }
+}
+
+// Initialize the declared variable
+void Lang::generate_declaration(AstDeclaration* decl)
+{
+    if (decl->usage & AST_VAR_PROPAGATED)
+        // All references were replaced by the constant
+        return;
+
+    CodeOperand operand = local_operand(decl);
+    if (decl->expr)
+    {
+        generate_expr_to(decl->expr, operand);
+        return;
+    }
+
+    if (decl->ident_type & IDENT_OBJECT_VAR)
+        // Object var was initialized when object created
+        return;
+
+    // The slot of local may be used by others before, reset it
+    switch (operand.value_type)
+    {
+    case INTEGER:
+        generate_store(operand, constant_operand((Integer)0));
+        break;
+    case REAL:
+        generate_store(operand, constant_operand((Real)0));
+        break;
+    default:
+        generate_store(operand, nil_operand());
+        break;
+    }
+}
+
+// loop (v = begin upto/downto to) block
+//     v = begin
+//     E = to
+//     LOOPIN v, E, dir
+//     JMP break
+// top:
+//     block
+// continue:
+//     LOOPEND v, E, dir
+//     JMP top
+// break:
+void Lang::generate_loop_range(AstLoopRange* node)
+{
+    CodeOperand var;
+    auto* decl_or_variable = node->decl_or_variable;
+    if (decl_or_variable->get_node_type() == AST_DECLARATIONS)
+    {
+        auto* decl = ((AstDeclarations*)decl_or_variable)->decl_list;
+        generate_declaration(decl);
+        var = local_operand(decl);
+    } else
+    {
+        if (!variable_operand((AstExprVariable*)decl_or_variable, &var))
+            return;
+        generate_expr_to(node->begin, var);
+    }
+
+    // The end of range is evaluated only once
+    auto to = generate_expr(node->to, 0);
+    if (to.type != Instruction::CONSTANT && !is_temporary(to))
+    {
+        auto copy = new_register(to.value_type);
+        generate_store(copy, to);
+        to = copy;
+    }
+
+    auto direction = imm_operand((Instruction::ParaValue)(Instruction::SignedParaValue)node->direction);
+    LoopTarget target = { node, new_label(), new_label() };
+    auto body_label = new_label();
+    emit(Instruction::LOOPIN, &var, &to, &direction);
+    emit_jump(target.break_label);
+    bind_label(body_label);
+    m_code->loop_targets.push_back(target);
+    generate_statement(node->block);
+    m_code->loop_targets.shrink(m_code->loop_targets.size() - 1);
+    bind_label(target.continue_label);
+    emit(Instruction::LOOPEND, &var, &to, &direction);
+    emit_jump(body_label);
+    bind_label(target.break_label);
+}
+
+// loop (v in container) block
+//     C = container
+//     I = 0
+// continue:
+//     LOOPRANGE v, C, I
+//     JMP break
+//     block
+//     JMP continue
+// break:
+void Lang::generate_loop_each(AstLoopEach* node)
+{
+    CodeOperand var;
+    auto* decl_or_variable = node->decl_or_variable;
+    if (decl_or_variable->get_node_type() == AST_DECLARATIONS)
+    {
+        auto* decl = ((AstDeclarations*)decl_or_variable)->decl_list;
+        generate_declaration(decl);
+        var = local_operand(decl);
+    } else
+    if (!variable_operand((AstExprVariable*)decl_or_variable, &var))
+        return;
+
+    // LOOPRANGE may replace the container (keys of mapping), use a copy
+    auto container = new_register();
+    generate_expr_to(node->container, container);
+    auto cursor = new_register(INTEGER);
+    generate_store(cursor, constant_operand((Integer)0));
+
+    LoopTarget target = { node, new_label(), new_label() };
+    bind_label(target.continue_label);
+    emit(Instruction::LOOPRANGE, &var, &container, &cursor);
+    emit_jump(target.break_label);
+    if (var.value_type == INTEGER || var.value_type == REAL)
+    {
+        // Keep the type of variable
+        auto type = imm_operand(var.value_type);
+        emit(Instruction::CAST, &var, &type, &var);
+    }
+    m_code->loop_targets.push_back(target);
+    generate_statement(node->block);
+    m_code->loop_targets.shrink(m_code->loop_targets.size() - 1);
+    emit_jump(target.continue_label);
+    bind_label(target.break_label);
+}
+
+// Compare the value with all cases, then jump to the matched block
+void Lang::generate_switch_case(AstSwitchCase* node)
+{
+    auto value = generate_expr(node->expr, 0);
+    LoopTarget target = { node, new_label(), -1 };
+    int default_label = -1;
+    simple::vector<int> labels;
+    for (auto* c = node->cases; c != 0; c = (AstCase*)c->sibling)
+    {
+        auto label = new_label();
+        labels.push_back(label);
+        if (c->is_default)
+        {
+            default_label = label;
+            continue;
+        }
+        auto case_value = generate_expr(c->case_value, 0);
+        auto cond = generate_binary(OP_EQ, value, case_value, 0);
+        emit_jump_if(cond, label);
+    }
+    emit_jump(default_label >= 0 ? default_label : target.break_label);
+
+    m_code->loop_targets.push_back(target);
+    size_t i = 0;
+    for (auto* c = node->cases; c != 0; c = (AstCase*)c->sibling)
+    {
+        bind_label(labels[i++]);
+        generate_statement(c->block);
+    }
+    m_code->loop_targets.shrink(m_code->loop_targets.size() - 1);
+    bind_label(target.break_label);
+}
+
+// Jump to label if the expr is "when"
+void Lang::generate_branch(AstExpr* expr, bool when, int label)
+{
+    if (expr->is_folded)
+    {
+        // Decided at compile time
+        if (expr->folded_value.is_non_zero() == when)
+            emit_jump(label);
+        return;
+    }
+
+    switch (expr->get_node_type())
+    {
+    case AST_EXPR_SINGLE_VALUE:
+    {
+        auto* p = ((AstExprSingleValue*)expr)->expr_list;
+        while (p->sibling)
+        {
+            generate_expr(p, 0, true);
+            p = (AstExpr*)p->sibling;
+        }
+        generate_branch(p, when, label);
+        return;
+    }
+
+    case AST_EXPR_CONSTANT:
+        if (((AstExprConstant*)expr)->value.is_non_zero() == when)
+            emit_jump(label);
+        return;
+
+    case AST_EXPR_UNARY:
+    {
+        auto* unary = (AstExprUnary*)expr;
+        if (unary->op != OP_NOT)
+            break;
+        generate_branch(unary->expr1, !when, label);
+        return;
+    }
+
+    case AST_EXPR_BINARY:
+    {
+        auto* binary = (AstExprBinary*)expr;
+        if (binary->op == OP_LAND || binary->op == OP_LOR)
+        {
+            // Short circuit
+            // a && b: when true  -> if (!a) skip; if (b) label; skip:
+            //         when false -> if (!a) label; if (!b) label;
+            // a || b: when true  -> if (a) label; if (b) label;
+            //         when false -> if (a) skip; if (!b) label; skip:
+            bool is_and = (binary->op == OP_LAND);
+            if (is_and != when)
+            {
+                generate_branch(binary->expr1, when, label);
+                generate_branch(binary->expr2, when, label);
+            } else
+            {
+                auto skip = new_label();
+                generate_branch(binary->expr1, !when, skip);
+                generate_branch(binary->expr2, when, label);
+                bind_label(skip);
+            }
+            return;
+        }
+
+        if (!is_compare_op(binary->op))
+            break;
+
+        auto a = generate_operand(binary->expr1, has_side_effect(binary->expr2));
+        auto b = generate_expr(binary->expr2, 0);
+        auto op = binary->op;
+        if (!when &&
+            (op == OP_EQ || op == OP_NE ||
+             (a.value_type == INTEGER && b.value_type == INTEGER)))
+        {
+            // Jump by the inverted condition
+            op = invert_compare_op(op);
+            when = true;
+        }
+        auto cond = generate_binary(op, a, b, 0);
+        if (when)
+            emit_jump_if(cond, label);
+        else
+            emit_jump_unless(cond, label);
+        return;
+    }
+
+    default:
+        break;
+    }
+
+    auto cond = generate_expr(expr, 0);
+    if (when)
+        emit_jump_if(cond, label);
+    else
+        emit_jump_unless(cond, label);
+}
+
+// Generate expression, return the operand holds the result
+// The result may be put in dest or not, use generate_expr_to() if the
+// result must be put in dest
+CodeOperand Lang::generate_expr(AstExpr* expr, const CodeOperand* dest, bool discard)
+{
+    if (expr->is_folded)
+        // Worked out by constant folding
+        return constant_operand(expr->folded_value);
+
+    switch (expr->get_node_type())
+    {
+    case AST_EXPR_CONSTANT:
+        return constant_operand(((AstExprConstant*)expr)->value);
+
+    case AST_EXPR_VARIABLE:
+    {
+        CodeOperand operand;
+        if (!variable_operand((AstExprVariable*)expr, &operand))
+            return nil_operand();
+        return operand;
+    }
+
+    case AST_EXPR_SINGLE_VALUE:
+    {
+        // Evaluate all, return the last one
+        auto* p = ((AstExprSingleValue*)expr)->expr_list;
+        while (p->sibling)
+        {
+            generate_expr(p, 0, true);
+            p = (AstExpr*)p->sibling;
+        }
+        return generate_expr(p, dest, discard);
+    }
+
+    case AST_EXPR_ASSIGN:
+        return generate_assign((AstExprAssign*)expr, dest);
+
+    case AST_EXPR_BINARY:
+    {
+        auto* binary = (AstExprBinary*)expr;
+        if (binary->op == OP_LAND || binary->op == OP_LOR)
+            return generate_logic(expr);
+        auto a = generate_operand(binary->expr1, has_side_effect(binary->expr2));
+        auto b = generate_expr(binary->expr2, 0);
+        return generate_binary(binary->op, a, b, dest);
+    }
+
+    case AST_EXPR_TERNARY:
+    {
+        auto* ternary = (AstExprTernary*)expr;
+        if (ternary->expr1->is_folded)
+            // Generate the selected one only
+            return generate_expr(ternary->expr1->folded_value.is_non_zero() ?
+                                 ternary->expr2 : ternary->expr3, dest, discard);
+        return generate_logic(expr);
+    }
+
+    case AST_EXPR_UNARY:
+        return generate_unary((AstExprUnary*)expr, dest, discard);
+
+    case AST_EXPR_CAST:
+    {
+        auto* cast = (AstExprCast*)expr;
+        auto src = generate_expr(cast->expr1, 0);
+        auto type = cast->var_type.basic_var_type;
+        if (type == MIXED || type == src.value_type)
+            return src;
+        auto target = dest ? *dest : new_register(type);
+        auto imm = imm_operand(type);
+        emit(Instruction::CAST, &target, &imm, &src);
+        target.value_type = type;
+        return target;
+    }
+
+    case AST_EXPR_INDEX:
+    {
+        auto* index = (AstExprIndex*)expr;
+        if (index->op != OP_IDX || index->is_reverse_from)
+        {
+            report_not_supported(expr, "index range or reverse index");
+            return nil_operand();
+        }
+        auto container = generate_operand(index->container, has_side_effect(index->index_from));
+        auto key = generate_expr(index->index_from, 0);
+        auto target = dest ? *dest : new_register();
+        emit(Instruction::RIDXXX, &target, &container, &key);
+        target.value_type = MIXED;
+        if (key.value_type == INTEGER &&
+            (container.value_type == STRING || container.value_type == BUFFER))
+            // Get char or byte
+            target.value_type = INTEGER;
+        return target;
+    }
+
+    case AST_EXPR_FUNCTION_CALL:
+        return generate_function_call((AstExprFunctionCall*)expr, dest);
+
+    case AST_EXPR_CREATE_ARRAY:
+    case AST_EXPR_CREATE_MAPPING:
+        return generate_create_container(expr, dest);
+
+    case AST_EXPR_RUNTIME_VALUE:
+    {
+        auto* runtime_value = (AstExprRuntimeValue*)expr;
+        if (runtime_value->value_id == AST_RV_INPUT_ARGUMENTS_COUNT)
+        {
+            auto target = dest ? *dest : new_register(INTEGER);
+            emit(Instruction::LDARGN, &target);
+            target.value_type = INTEGER;
+            return target;
+        }
+
+        // Pack all arguments into an array
+        auto argn = new_register(INTEGER);
+        emit(Instruction::LDARGN, &argn);
+        auto target = dest ? *dest : new_register(ARRAY);
+        CodeOperand args;
+        args.type = Instruction::ARGUMENT;
+        args.value = 0;
+        args.offset = 0;
+        args.is_register = false;
+        args.value_type = MIXED;
+        emit(Instruction::MKIARR, &target, &argn, &args);
+        target.value_type = ARRAY;
+        return target;
+    }
+
+    default:
+        report_not_supported(expr, ast_node_type_to_c_str(expr->get_node_type()));
+        return nil_operand();
+    }
+}
+
+// Generate expression & put the result to dest
+void Lang::generate_expr_to(AstExpr* expr, const CodeOperand& dest)
+{
+    auto result = generate_expr(expr, &dest);
+    generate_store(dest, result);
+}
+
+// Generate expression as an operand of operator
+// If the operand is a variable & it will be modified by the following
+// evaluation (has side effect), copy it to a temporary
+CodeOperand Lang::generate_operand(AstExpr* expr, bool will_be_modified)
+{
+    auto operand = generate_expr(expr, 0);
+    if (!will_be_modified ||
+        operand.type == Instruction::CONSTANT || is_temporary(operand))
+        return operand;
+
+    auto copy = new_register(operand.value_type);
+    generate_store(copy, operand);
+    return copy;
+}
+
+// Generate assignment, return the assigned value
+CodeOperand Lang::generate_assign(AstExprAssign* expr, const CodeOperand* dest)
+{
+    CodeOperand operand, container, key;
+    bool is_assign = (expr->op == OP_ASSIGN || expr->op == OP_QMARK_EQ);
+    bool is_index = generate_lvalue(expr->expr1, !is_assign, has_side_effect(expr->expr2),
+                                    &operand, &container, &key);
+    if (operand.type == Instruction::CONSTANT)
+        // Bad lvalue
+        return operand;
+
+    CodeOperand value;
+    if (expr->op == OP_QMARK_EQ)
+    {
+        // Assign if the value isn't nil
+        value = generate_expr(expr->expr2, 0);
+        auto is_nil = new_register(INTEGER);
+        auto nil_type = imm_operand(NIL);
+        emit(Instruction::ISTYPE, &is_nil, &nil_type, &value);
+        auto skip = new_label();
+        emit_jump_if(is_nil, skip);
+        generate_store(operand, value);
+        if (is_index)
+            emit(Instruction::LIDXXX, &operand, &container, &key);
+        bind_label(skip);
+        return is_index ? value : operand;
+    }
+
+    if (expr->op == OP_ASSIGN)
+    {
+        if (is_index)
+        {
+            value = generate_expr(expr->expr2, 0);
+            emit(Instruction::LIDXXX, &value, &container, &key);
+            return value;
+        }
+        generate_expr_to(expr->expr2, operand);
+        return operand;
+    }
+
+    // Operate then assign
+    Op op;
+    try_map_assign_op_to_op(expr->op, &op);
+    value = generate_expr(expr->expr2, 0);
+    auto result = generate_binary(op, operand, value, &operand);
+    generate_store(operand, result);
+    if (is_index)
+        emit(Instruction::LIDXXX, &operand, &container, &key);
+    return operand;
+}
+
+// Generate binary operation
+CodeOperand Lang::generate_binary(Op op, const CodeOperand& a, const CodeOperand& b, const CodeOperand* dest)
+{
+    BinaryOpCode* info = 0;
+    for (auto i = 0; i < STD_SIZE_N(binary_op_codes); i++)
+        if (binary_op_codes[i].op == op)
+        {
+            info = &binary_op_codes[i];
+            break;
+        }
+    STD_ASSERT(("Not found instruction for binary operator.", info));
 
+    Instruction::Code code = info->code_x;
+    ValueType result_type = info->is_compare ? INTEGER : MIXED;
+    if (a.value_type == INTEGER && b.value_type == INTEGER)
+    {
+        code = info->code_i;
+        result_type = INTEGER;
+    } else
+    if (a.value_type == REAL && b.value_type == REAL && info->code_r != Instruction::NOP)
+    {
+        code = info->code_r;
+        result_type = info->is_compare ? INTEGER : REAL;
+    }
+
+    auto target = dest ? *dest : new_register(result_type);
+    emit(code, &target, &a, &b);
+    target.value_type = result_type;
+    return target;
+}
+
+// Generate unary operation
+CodeOperand Lang::generate_unary(AstExprUnary* expr, const CodeOperand* dest, bool discard)
+{
+    switch (expr->op)
+    {
+    case OP_NEG:
+    {
+        auto a = generate_expr(expr->expr1, 0);
+        if (a.value_type == REAL)
+        {
+            // There is no NEGR, use 0.0 - a
+            auto zero = constant_operand((Real)0);
+            return generate_binary(OP_SUB, zero, a, dest);
+        }
+        auto target = dest ? *dest : new_register(a.value_type == INTEGER ? INTEGER : MIXED);
+        emit(a.value_type == INTEGER ? Instruction::NEGI : Instruction::NEGX, &target, &a);
+        target.value_type = (a.value_type == INTEGER ? INTEGER : MIXED);
+        return target;
+    }
+
+    case OP_REV:
+    {
+        auto a = generate_expr(expr->expr1, 0);
+        auto target = dest ? *dest : new_register(INTEGER);
+        emit(a.value_type == INTEGER ? Instruction::REVI : Instruction::REVX, &target, &a);
+        target.value_type = (a.value_type == INTEGER ? INTEGER : MIXED);
+        return target;
+    }
+
+    case OP_NOT:
+        return generate_logic(expr);
+
+    case OP_INC_PRE:
+    case OP_DEC_PRE:
+    case OP_INC_POST:
+    case OP_DEC_POST:
+    {
+        CodeOperand operand, container, key;
+        bool is_index = generate_lvalue(expr->expr1, true, false, &operand, &container, &key);
+        if (operand.type == Instruction::CONSTANT)
+            // Bad lvalue
+            return operand;
+
+        bool is_post = (expr->op == OP_INC_POST || expr->op == OP_DEC_POST);
+        CodeOperand old;
+        if (is_post && !discard)
+        {
+            // Keep the value before changed
+            old = new_register(operand.value_type);
+            generate_store(old, operand);
+        }
+
+        auto one = (operand.value_type == REAL) ? constant_operand((Real)1) :
+                                                  constant_operand((Integer)1);
+        auto op = (expr->op == OP_INC_PRE || expr->op == OP_INC_POST) ? OP_ADD : OP_SUB;
+        auto result = generate_binary(op, operand, one, &operand);
+        generate_store(operand, result);
+        if (is_index)
+            emit(Instruction::LIDXXX, &operand, &container, &key);
+        return (is_post && !discard) ? old : operand;
+    }
+
+    default:
+        report_not_supported(expr, ast_op_to_string(expr->op).c_str());
+        return nil_operand();
+    }
+}
+
+// Generate calling a function
+// The arguments are put in a block: [argn, arg1, arg2, ...]
+CodeOperand Lang::generate_function_call(AstExprFunctionCall* expr, const CodeOperand* dest)
+{
+    CodeOperand callee;
+    if (expr->target)
+    {
+        // The callee block: [oid, name]
+        callee = new_register(MIXED, 2);
+        generate_expr_to(expr->target, block_element(callee, 0));
+        generate_store(block_element(callee, 1), constant_operand(expr->callee_name));
+    }
+
+    size_t argn = 0;
+    for (auto* p = expr->arguments; p != 0; p = (AstExpr*)p->sibling)
+        argn++;
+    if (argn >= Instruction::PARA_UMAX)
+    {
+        report_not_supported(expr, "too many arguments");
+        return nil_operand();
+    }
+
+    // Try to inline the small function in this program
+    AstFunction* function = 0;
+    AstExpr* inline_expr = 0;
+    if (!expr->target && m_code->functions.try_get(expr->callee_name, &function))
+        inline_expr = get_inline_expr(function, argn);
+
+    auto args = new_register(MIXED, (Uint16)(argn + 1));
+    simple::vector<CodeOperand> arg_operands;
+    Uint16 offset = 1;
+    for (auto* p = expr->arguments; p != 0; p = (AstExpr*)p->sibling)
+    {
+        auto element = block_element(args, offset++);
+        auto value = generate_expr(p, &element);
+        generate_store(element, value);
+        if (!inline_expr)
+            continue;
+
+        // The type of argument is trusted for inlining
+        element.value_type = value.value_type;
+        arg_operands.push_back(element);
+    }
+
+    CodeOperand result;
+    if (inline_expr && generate_inline_call(function, inline_expr, arg_operands, dest, &result))
+        return result;
+
+    generate_store(block_element(args, 0), constant_operand((Integer)argn));
+    auto target = dest ? *dest : new_register();
+    target.value_type = MIXED;
+    if (expr->target)
+    {
+        emit(Instruction::CALLOTHER, &target, &callee, &args);
+        return target;
+    }
+
+    if (function)
+    {
+        // Call function in this program
+        auto no = imm_operand(function->no);
+        emit(Instruction::CALLNEAR, &target, &no, &args);
+        return target;
+    }
+
+    auto name = constant_operand(expr->callee_name);
+    if (Efun::get_efun(m_program->get_constant(name.value)[0]))
+    {
+        emit(Instruction::CALLEFUN, &target, &name, &args);
+        return target;
+    }
+
+    this->syntax_errors(this,
+        "%s(%d): error %d: '%s': undefined function\n",
+        expr->location.file->c_str(), expr->location.line,
+        C_UNDEFINED_FUNCTION,
+        expr->callee_name.c_str());
+    m_error_code = PASS2_ERROR;
+    return target;
+}
+
+// Generate the returned expression of callee with the arguments instead
+// of calling it
+// Return false if the types of arguments can't be trusted, the callee
+// must check them by itself
+bool Lang::generate_inline_call(AstFunction* callee, AstExpr* ret_expr, simple::vector<CodeOperand>& args, const CodeOperand* dest, CodeOperand* result)
+{
+    size_t arg_no = 0;
+    for (auto* arg = callee->prototype->arg_list; arg != 0;
+         arg = (AstFunctionArg*)arg->sibling, arg_no++)
+    {
+        if (arg_no >= args.size())
+            // Default value is constant
+            args.push_back(generate_expr(arg->default_value, 0));
+
+        auto type = arg->var_type.basic_var_type;
+        if (type != MIXED && args[arg_no].value_type != type)
+            return false;
+    }
+
+    auto* code = m_code;
+    InlinedCall call;
+    call.start = code->codes.size();
+    call.callee_no = callee->no;
+    code->inline_function = callee;
+    code->inline_args = &args;
+    *result = generate_expr(ret_expr, dest);
+    code->inline_function = 0;
+    code->inline_args = 0;
+
+    if (result->type != Instruction::CONSTANT && !is_temporary(*result))
+    {
+        // The result of call is a temporary
+        auto target = dest ? *dest : new_register(result->value_type);
+        generate_store(target, *result);
+        target.value_type = result->value_type;
+        *result = target;
+    }
+
+    call.end = code->codes.size();
+    if (call.end > call.start)
+        code->inlined_calls.push_back(call);
+    return true;
+}
+
+// Generate creating array or mapping
+CodeOperand Lang::generate_create_container(AstExpr* expr, const CodeOperand* dest)
+{
+    bool is_array = (expr->get_node_type() == AST_EXPR_CREATE_ARRAY);
+    AstExpr* list = is_array ? ((AstExprCreateArray*)expr)->expr_list :
+                               ((AstExprCreateMapping*)expr)->expr_list;
+    size_t count = 0;
+    for (auto* p = list; p != 0; p = (AstExpr*)p->sibling)
+        count++;
+    if (count > Instruction::PARA_UMAX)
+    {
+        report_not_supported(expr, "too many elements");
+        return nil_operand();
+    }
+
+    auto target = dest ? *dest : new_register(is_array ? ARRAY : MAPPING);
+    if (!count)
+    {
+        auto capacity = constant_operand((Integer)0);
+        emit(is_array ? Instruction::MKEARR : Instruction::MKEMAP, &target, &capacity);
+    } else
+    {
+        auto block = new_register(MIXED, (Uint16)count);
+        Uint16 offset = 0;
+        for (auto* p = list; p != 0; p = (AstExpr*)p->sibling)
+            generate_expr_to(p, block_element(block, offset++));
+
+        // Count of elements or pairs
+        auto n = constant_operand((Integer)(is_array ? count : count / 2));
+        emit(is_array ? Instruction::MKIARR : Instruction::MKIMAP, &target, &n, &block);
+    }
+    target.value_type = is_array ? ARRAY : MAPPING;
+    return target;
+}
+
+// Generate !a, a && b, a || b, a ? b : c
+// Use a new temporary to hold the result, since the dest may be read
+// during evaluating
+CodeOperand Lang::generate_logic(AstExpr* expr)
+{
+    auto target = new_register();
+    auto end_label = new_label();
+    ValueType type1, type2;
+    switch (expr->get_node_type())
+    {
+    case AST_EXPR_UNARY:
+    {
+        // !a
+        auto a = generate_expr(((AstExprUnary*)expr)->expr1, 0);
+        if (a.value_type == INTEGER || a.value_type == REAL)
+        {
+            auto zero = (a.value_type == INTEGER) ? constant_operand((Integer)0) :
+                                                    constant_operand((Real)0);
+            return generate_binary(OP_EQ, a, zero, &target);
+        }
+        generate_store(target, constant_operand((Integer)0));
+        emit_jump_if(a, end_label);
+        generate_store(target, constant_operand((Integer)1));
+        type1 = type2 = INTEGER;
+        break;
+    }
+
+    case AST_EXPR_BINARY:
+    {
+        // a && b: the result is a if a is false, else b
+        // a || b: the result is a if a is true, else b
+        auto* binary = (AstExprBinary*)expr;
+        auto a = generate_expr(binary->expr1, &target);
+        generate_store(target, a);
+        auto first = target;
+        first.value_type = type1 = a.value_type;
+        if (binary->op == OP_LAND)
+            emit_jump_unless(first, end_label);
+        else
+            emit_jump_if(first, end_label);
+        auto b = generate_expr(binary->expr2, &target);
+        generate_store(target, b);
+        type2 = b.value_type;
+        break;
+    }
+
+    default:
+    {
+        // a ? b : c
+        auto* ternary = (AstExprTernary*)expr;
+        auto else_label = new_label();
+        generate_branch(ternary->expr1, false, else_label);
+        auto b = generate_expr(ternary->expr2, &target);
+        generate_store(target, b);
+        emit_jump(end_label);
+        bind_label(else_label);
+        auto c = generate_expr(ternary->expr3, &target);
+        generate_store(target, c);
+        type1 = b.value_type;
+        type2 = c.value_type;
+        break;
+    }
+    }
+    bind_label(end_label);
+    target.value_type = (type1 == type2) ? type1 : MIXED;
+    return target;
+}
+
+// Get the operand of lvalue
+// For "container[key]", return true & the element is loaded to operand if
+// "load" is set. The container & key are copied if they may be modified
+// by following evaluation ("protect" is set).
+// The operand is constant if the expr isn't a valid lvalue.
+bool Lang::generate_lvalue(AstExpr* expr, bool load, bool protect, CodeOperand* operand, CodeOperand* container, CodeOperand* index)
+{
+    switch (expr->get_node_type())
+    {
+    case AST_EXPR_VARIABLE:
+        if (!variable_operand((AstExprVariable*)expr, operand))
+            *operand = nil_operand();
+        return false;
+
+    case AST_EXPR_INDEX:
+    {
+        auto* expr_index = (AstExprIndex*)expr;
+        if (expr_index->op != OP_IDX || expr_index->is_reverse_from)
+            break;
+        *container = generate_operand(expr_index->container, protect || has_side_effect(expr_index->index_from));
+        *index = generate_operand(expr_index->index_from, protect);
+        *operand = new_register();
+        if (load)
+            emit(Instruction::RIDXXX, operand, container, index);
+        return true;
+    }
+
+    default:
+        break;
+    }
+
+    report_not_supported(expr, "lvalue");
+    *operand = nil_operand();
+    return false;
+}
+
+// Store value to dest
+void Lang::generate_store(const CodeOperand& dest, const CodeOperand& src)
+{
+    auto type = dest.value_type;
+    if ((type == INTEGER || type == REAL) && src.value_type != type)
+    {
+        // Keep the type of variable
+        auto imm = imm_operand(type);
+        emit(Instruction::CAST, &dest, &imm, &src);
+        return;
+    }
+
+    if (dest.type == src.type && dest.value == src.value &&
+        dest.offset == src.offset && dest.is_register == src.is_register)
+        // Same one
+        return;
+
+    emit(Instruction::LDX, &dest, &src);
+}
+
+// Create a virtual register or a block of registers
+CodeOperand Lang::new_register(ValueType type, Uint16 width)
+{
+    CodeOperand operand;
+    operand.type = Instruction::LOCAL;
+    operand.value = m_code->allocator.new_register(width);
+    operand.offset = 0;
+    operand.is_register = true;
+    operand.value_type = type;
+    return operand;
+}
+
+// Get an element of block
+CodeOperand Lang::block_element(const CodeOperand& block, Uint16 offset, ValueType type)
+{
+    CodeOperand operand = block;
+    operand.offset = block.offset + offset;
+    operand.value_type = type;
+    return operand;
+}
+
+// Get constant operand, the constant is added into program if not existed
+CodeOperand Lang::constant_operand(const Value& value)
+{
+    auto* code = m_code;
+    ConstantIndex index = 0;
+    bool found = false;
+    Int64 bits = 0;
+    switch (value.m_type)
+    {
+    case NIL:
+        found = code->has_nil_constant;
+        index = code->nil_constant;
+        break;
+    case INTEGER:
+        found = code->integer_constants.try_get(value.m_int, &index);
+        break;
+    case REAL:
+        memcpy(&bits, &value.m_real, sizeof(bits));
+        found = code->real_constants.try_get(bits, &index);
+        break;
+    case STRING:
+        found = code->string_constants.try_get(value.m_string->c_str(), &index);
+        break;
+    default:
+        break;
+    }
+
+    if (!found)
+    {
+        if (m_program->get_constants_count() >= Instruction::PARA_UMAX)
+        {
+            this->syntax_errors(this,
+                "%s(%d): error %d: too many constants in program\n",
+                m_root->location.file->c_str(), m_root->location.line,
+                C_NOT_SUPPORTED);
+            m_error_code = PASS2_ERROR;
+        } else
+            index = m_program->define_constant(value);
+
+        switch (value.m_type)
+        {
+        case NIL:
+            code->nil_constant = index;
+            code->has_nil_constant = true;
+            break;
+        case INTEGER:
+            code->integer_constants.put(value.m_int, index);
+            break;
+        case REAL:
+            code->real_constants.put(bits, index);
+            break;
+        case STRING:
+            code->string_constants.put(value.m_string->c_str(), index);
+            break;
+        default:
+            break;
+        }
+    }
+
+    CodeOperand operand;
+    operand.type = Instruction::CONSTANT;
+    operand.value = index;
+    operand.offset = 0;
+    operand.is_register = false;
+    operand.value_type = value.m_type;
+    return operand;
+}
+
+// Get constant operand of nil
+CodeOperand Lang::nil_operand()
+{
+    Value nil = NIL;
+    return constant_operand(nil);
+}
+
+// Get immediate operand
+CodeOperand Lang::imm_operand(Uint32 imm)
+{
+    CodeOperand operand;
+    operand.type = Instruction::CONSTANT;
+    operand.value = imm;
+    operand.offset = 0;
+    operand.is_register = false;
+    operand.value_type = INTEGER;
+    return operand;
+}
+
+// Get operand of declared variable
+CodeOperand Lang::local_operand(AstDeclaration* decl)
+{
+    if (decl->ident_type & IDENT_OBJECT_VAR)
+    {
+        CodeOperand operand;
+        operand.type = Instruction::MEMBER;
+        operand.value = decl->object_var_no;
+        operand.offset = 0;
+        operand.is_register = false;
+        operand.value_type = get_operand_type(decl->var_type);
+        return operand;
+    }
+    return m_code->local_registers[decl->local_var_no];
+}
+
+// Get operand of variable
+// Return false if the variable can't be accessed
+bool Lang::variable_operand(AstExprVariable* variable, CodeOperand* operand)
+{
+    auto* function = m_code->function;
+    if ((variable->ident_type & IDENT_ARGUMENT) && m_code->inline_function)
+    {
+        // Argument of the inlined function
+        *operand = (*m_code->inline_args)[variable->arg_no];
+        return true;
+    }
+
+    if (variable->ident_type & IDENT_ARGUMENT)
+    {
+        auto* arg = (AstFunctionArg*)tf_get((AstNode*)function->prototype->arg_list, variable->arg_no);
+        if (arg != variable->declaration)
+        {
+            report_not_supported(variable, "argument of outer function");
+            return false;
+        }
+        operand->type = Instruction::ARGUMENT;
+        operand->value = variable->arg_no;
+        operand->offset = 0;
+        operand->is_register = false;
+        operand->value_type = get_operand_type(arg->var_type);
+        return true;
+    }
+
+    auto* decl = (AstDeclaration*)variable->declaration;
+    if ((variable->ident_type & IDENT_LOCAL_VAR) &&
+        decl->in_function_no != function->no)
+    {
+        report_not_supported(variable, "local variable of outer function");
+        return false;
+    }
+    *operand = local_operand(decl);
+    return true;
+}
+
+// Is the operand a temporary (not a variable)?
+bool Lang::is_temporary(const CodeOperand& operand)
+{
+    return operand.is_register &&
+           operand.value >= m_code->local_registers.size();
+}
+
+// Append an instruction, return the position
+size_t Lang::emit(Instruction::Code code, const CodeOperand* p1, const CodeOperand* p2, const CodeOperand* p3)
+{
+    auto* context = m_code;
+    auto pos = context->codes.size();
+    const CodeOperand* operands[] = { p1, p2, p3 };
+    CodeEntry entry;
+    entry.code = code;
+    entry.label = -1;
+    for (auto i = 0; i < 3; i++)
+    {
+        if (!operands[i])
+        {
+            entry.operands[i] = imm_operand(0);
+            continue;
+        }
+        entry.operands[i] = *operands[i];
+        if (operands[i]->is_register)
+            context->allocator.touch(operands[i]->value, (RegisterAllocator::Position)pos);
+    }
+    context->codes.push_back(entry);
+    return pos;
+}
+
+// Jump to label
+void Lang::emit_jump(int label)
+{
+    auto pos = emit(Instruction::JMP);
+    m_code->codes[pos].label = label;
+}
+
+// Jump to label if cond is non-zero
+void Lang::emit_jump_if(const CodeOperand& cond, int label)
+{
+    auto pos = emit(Instruction::JCOND, &cond);
+    m_code->codes[pos].label = label;
+}
+
+// Jump to label if cond is zero
+void Lang::emit_jump_unless(const CodeOperand& cond, int label)
+{
+    if (cond.value_type == INTEGER)
+    {
+        auto zero = constant_operand((Integer)0);
+        auto is_zero = generate_binary(OP_EQ, cond, zero, 0);
+        emit_jump_if(is_zero, label);
+        return;
+    }
+
+    // JCOND cond, skip; JMP label; skip:
+    auto skip = new_label();
+    emit_jump_if(cond, skip);
+    emit_jump(label);
+    bind_label(skip);
+}
+
+// Create a label, bind it to position later
+int Lang::new_label()
+{
+    m_code->label_positions.push_back((RegisterAllocator::Position)RegisterAllocator::NO_POSITION);
+    return (int)(m_code->label_positions.size() - 1);
+}
+
+// Bind label to the next instruction
+void Lang::bind_label(int label)
+{
+    m_code->label_positions[label] = (RegisterAllocator::Position)m_code->codes.size();
+}
+
+// Map registers to locals & labels to offsets, create final instructions
+bool Lang::resolve_codes(simple::vector<Instruction>* codes, LocalNo* max_local_no)
+{
+    auto* code = m_code;
+
+    // Registers used in loop must be alive through the loop
+    for (size_t pos = 0; pos < code->codes.size(); pos++)
+    {
+        auto label = code->codes[pos].label;
+        if (label < 0)
+            continue;
+        auto target = code->label_positions[label];
+        STD_ASSERT(("Label is not bound.", target != (RegisterAllocator::Position)RegisterAllocator::NO_POSITION));
+        if (target <= pos)
+            code->allocator.add_back_edge((RegisterAllocator::Position)pos, target);
+    }
+
+    auto slots = code->allocator.allocate();
+    if (slots > Instruction::PARA_UMAX)
+    {
+        report_not_supported(code->function, "too many local variables");
+        return false;
+    }
+    *max_local_no = (LocalNo)slots;
+
+    // The live ranges are not changed by dropping codes, so eliminate
+    // after allocated
+    simple::vector<Uint32> positions;
+    eliminate_dead_codes(&positions);
+    for (auto& call : code->inlined_calls)
+    {
+        call.start = positions[call.start];
+        call.end = positions[call.end];
+    }
+
+    for (size_t pos = 0; pos < code->codes.size(); pos++)
+    {
+        if (positions[pos] == positions[pos + 1])
+            // Dropped
+            continue;
+
+        auto& entry = code->codes[pos];
+        Instruction::ParaType types[3];
+        Uint32 values[3];
+        for (auto i = 0; i < 3; i++)
+        {
+            auto& operand = entry.operands[i];
+            types[i] = operand.type;
+            values[i] = operand.is_register ?
+                code->allocator.get_slot(operand.value) + operand.offset :
+                operand.value;
+            if (values[i] > Instruction::PARA_UMAX)
+            {
+                report_not_supported(code->function, "too large operand");
+                return false;
+            }
+        }
+
+        if (entry.label >= 0)
+        {
+            // Offset is relative to the next instruction
+            Int32 offset = (Int32)positions[code->label_positions[entry.label]] -
+                           (Int32)(positions[pos] + 1);
+            types[1] = types[2] = Instruction::CONSTANT;
+            values[1] = ((Uint32)offset >> 16) & 0xFFFF;
+            values[2] = (Uint32)offset & 0xFFFF;
+        }
+
+        Instruction instruction;
+        instruction.code = entry.code;
+        instruction.t1 = types[0];
+        instruction.t2 = types[1];
+        instruction.t3 = types[2];
+        instruction.p1 = (Instruction::ParaValue)values[0];
+        instruction.p2 = (Instruction::ParaValue)values[1];
+        instruction.p3 = (Instruction::ParaValue)values[2];
+        codes->push_back(instruction);
+    }
     return true;
 }
 
-}
\ No newline at end of file
+// Drop the codes can't be reached & the jumps to next code
+// positions[pos] is the new position of code at pos, a dropped code has
+// the same position as the next one
+void Lang::eliminate_dead_codes(simple::vector<Uint32>* positions)
+{
+    auto* code = m_code;
+    auto n = code->codes.size();
+
+    // Walk through all the paths from the first code
+    simple::vector<bool> reachable(n);
+    reachable.push_backs(false, n);
+    simple::vector<size_t> pending;
+    pending.push_back(0);
+    while (pending.size())
+    {
+        auto pos = pending[pending.size() - 1];
+        pending.remove(pending.size() - 1);
+        if (pos >= n || reachable[pos])
+            continue;
+
+        reachable[pos] = true;
+        auto& entry = code->codes[pos];
+        if (entry.label >= 0)
+            pending.push_back(code->label_positions[entry.label]);
+        switch (entry.code)
+        {
+        case Instruction::JMP:
+        case Instruction::RET:
+            break;
+
+        case Instruction::LOOPIN:
+        case Instruction::LOOPRANGE:
+        case Instruction::LOOPEND:
+            // May skip the next one
+            pending.push_back(pos + 2);
+            pending.push_back(pos + 1);
+            break;
+
+        default:
+            pending.push_back(pos + 1);
+            break;
+        }
+    }
+
+    for (size_t pos = 0; pos < n; pos++)
+    {
+        auto& entry = code->codes[pos];
+        if (!reachable[pos] || entry.code != Instruction::JMP)
+            continue;
+
+        // The jump skipped by loop instruction must be kept
+        if (pos > 0)
+        {
+            auto prev = code->codes[pos - 1].code;
+            if (prev == Instruction::LOOPIN || prev == Instruction::LOOPRANGE ||
+                prev == Instruction::LOOPEND)
+                continue;
+        }
+
+        auto target = (size_t)code->label_positions[entry.label];
+        auto next = pos + 1;
+        while (next < target && !reachable[next])
+            next++;
+        if (next == target)
+            reachable[pos] = false;
+    }
+
+    positions->push_backs(0, n + 1);
+    Uint32 new_pos = 0;
+    for (size_t pos = 0; pos < n; pos++)
+    {
+        (*positions)[pos] = new_pos;
+        if (reachable[pos])
+            new_pos++;
+    }
+    (*positions)[n] = new_pos;
+}
+
+// May the node modify variables?
+bool Lang::has_side_effect(AstNode* node)
+{
+    if (!node)
+        return false;
+
+    if (is_expr_node(node) && ((AstExpr*)node)->is_folded)
+        return false;
+
+    switch (node->get_node_type())
+    {
+    case AST_EXPR_ASSIGN:
+    case AST_EXPR_FUNCTION_CALL:
+    case AST_EXPR_FUNCTION_CALL_EX:
+        return true;
+
+    case AST_EXPR_UNARY:
+        switch (((AstExprUnary*)node)->op)
+        {
+        case OP_INC_PRE:
+        case OP_DEC_PRE:
+        case OP_INC_POST:
+        case OP_DEC_POST:
+            return true;
+        default:
+            break;
+        }
+        break;
+
+    default:
+        break;
+    }
+
+    for (auto* p = node->children; p != 0; p = p->sibling)
+        if (has_side_effect(p))
+            return true;
+    return false;
+}
+
+// Get the returned expression if the function is small enough to be
+// inlined: the body is only "return expr" & the expr has no side effect
+// Return 0 if the function can't be inlined
+AstExpr* Lang::get_inline_expr(AstFunction* callee, size_t argn)
+{
+    auto* prototype = callee->prototype;
+    if (prototype->attrib & AST_RANDOM_ARG)
+        return 0;
+
+    // The arguments not passed must have constant default values
+    size_t arg_no = 0;
+    for (auto* arg = prototype->arg_list; arg != 0;
+         arg = (AstFunctionArg*)arg->sibling, arg_no++)
+    {
+        if (arg_no < argn)
+            continue;
+        auto* value = arg->default_value;
+        if (!value || (value->get_node_type() != AST_EXPR_CONSTANT && !value->is_folded))
+            return 0;
+    }
+    if (argn > arg_no)
+        // Too many arguments, let the callee report it
+        return 0;
+
+    auto* body = callee->body;
+    if (!body || body->get_node_type() != AST_STATEMENTS)
+        return 0;
+
+    auto* statement = body->children;
+    if (!statement || statement->sibling ||
+        statement->get_node_type() != AST_RETURN)
+        return 0;
+
+    auto* ret_expr = ((AstReturn*)statement)->expr;
+    size_t budget = INLINE_BUDGET;
+    if (!ret_expr || !is_inlinable_expr(ret_expr, callee, &budget))
+        return 0;
+    return ret_expr;
+}
+
+// Can the expression be evaluated in caller?
+// Only the arguments of callee & object vars can be accessed, each node
+// costs one of the budget
+bool Lang::is_inlinable_expr(AstNode* node, AstFunction* callee, size_t* budget)
+{
+    if (!*budget)
+        return false;
+    (*budget)--;
+
+    switch (node->get_node_type())
+    {
+    case AST_EXPR_CONSTANT:
+    case AST_EXPR_BINARY:
+    case AST_EXPR_CAST:
+    case AST_EXPR_INDEX:
+    case AST_EXPR_SINGLE_VALUE:
+    case AST_EXPR_TERNARY:
+        break;
+
+    case AST_EXPR_UNARY:
+        switch (((AstExprUnary*)node)->op)
+        {
+        case OP_INC_PRE:
+        case OP_DEC_PRE:
+        case OP_INC_POST:
+        case OP_DEC_POST:
+            return false;
+        default:
+            break;
+        }
+        break;
+
+    case AST_EXPR_VARIABLE:
+    {
+        auto* variable = (AstExprVariable*)node;
+        if (variable->ident_type & IDENT_OBJECT_VAR)
+            break;
+        if ((variable->ident_type & IDENT_ARGUMENT) &&
+            tf_get((AstNode*)callee->prototype->arg_list, variable->arg_no) == variable->declaration)
+            break;
+        return false;
+    }
+
+    default:
+        return false;
+    }
+
+    if (((AstExpr*)node)->is_folded)
+        // Children won't be generated
+        return true;
+
+    for (auto* p = node->children; p != 0; p = p->sibling)
+        if (!is_inlinable_expr(p, callee, budget))
+            return false;
+    return true;
+}
+
+// Report the construct isn't supported by code generator yet
+void Lang::report_not_supported(AstNode* node, const char* what)
+{
+    this->syntax_errors(this,
+        "%s(%d): error %d: '%s': not supported by code generator\n",
+        node->location.file->c_str(), node->location.line,
+        C_NOT_SUPPORTED,
+        what);
+    m_error_code = PASS2_ERROR;
+}
+
+}
@@ -39,6 +39,16 @@ bool LangSymbols::add_ident_info(const simple::string& name, IdentInfo* info, As
                 ast_var_type_to_string(decl->var_type).c_str(), decl->name.c_str());
             m_lang_context->m_error_code = PASS1_ERROR;
         } else
+        if (info->type & IDENT_ARGUMENT)
+        {
+            auto* arg = (AstFunctionArg*)node;
+            m_lang_context->syntax_errors(m_lang_context,
+                "%s(%d): error %d: '%s %s': redefinition\n",
+                node->location.file->c_str(), node->location.line,
+                C_REDEFINITION,
+                ast_var_type_to_string(arg->var_type).c_str(), arg->name.c_str());
+            m_lang_context->m_error_code = PASS1_ERROR;
+        } else
         if (info->type & (IDENT_OBJECT_FUN))
         {
             auto* function = (AstFunction*)node;
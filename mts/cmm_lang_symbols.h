@@ -22,9 +22,10 @@ enum IdentType
     IDENT_OBJECT_FUN    = 0x0008,
     IDENT_OBJECT_VAR    = 0x0010,
     IDENT_LOCAL_VAR     = 0x0020,
+    IDENT_ARGUMENT      = 0x0040,
 
     IDENT_FUN           = (IDENT_EFUN | IDENT_OS_FUN | IDENT_OBJECT_FUN),
-    IDENT_VAR           = (IDENT_OBJECT_VAR | IDENT_LOCAL_VAR),
+    IDENT_VAR           = (IDENT_OBJECT_VAR | IDENT_LOCAL_VAR | IDENT_ARGUMENT),
     IDENT_ALL           = 0xFFFF,
 };
 
@@ -37,11 +38,13 @@ struct IdentInfo
         LocalNo     local_var_no;   // local variable number
         VariableNo  object_var_no;  // Object variable number
         VariableNo  var_no;         // Common variable number
+        ArgNo       arg_no;         // Argument number
     };
     union
     {
         AstFunction*    function;   // AstNode of function definition
         AstDeclaration* decl;       // AstNode of variable declaration
+        AstFunctionArg* arg;        // AstNode of function argument
     };
     Uint32 type;                    // Ident type
     int    tag;                     // Tag (level) for this identifier 
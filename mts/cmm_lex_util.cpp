@@ -7,6 +7,14 @@
 #include <string.h>
 #include "cmm_lex_util.h"
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CMM_LEX_USE_SSE2 1
+#include <emmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
 namespace cmm
 {
 
@@ -281,4 +289,107 @@ void cmm_trim_to(char *str, size_t size, const char *from)
     str[n] = 0;
 }
 
+/* Is ch a blank (space but new line)? */
+static inline bool cmm_is_blank(char ch)
+{
+    return ch == ' ' || ch == '\t' || ch == '\r' || ch == '\f' || ch == '\v';
+}
+
+/* Is ch a char of identifier? */
+static inline bool cmm_is_ident_char(char ch)
+{
+    return isalnum((unsigned char)ch) || ch == '_';
+}
+
+#if CMM_LEX_USE_SSE2
+/* Index of lowest set bit in a non-zero mask */
+static inline int cmm_lowest_bit(unsigned int mask)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return (int)index;
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+
+/* Bytes of x in range [lo, hi] */
+static inline __m128i cmm_in_range(__m128i x, char lo, char hi)
+{
+    // Shift the range to start at -128, then compare as signed
+    __m128i y = _mm_add_epi8(x, _mm_set1_epi8((char)(128 - (unsigned char)lo)));
+    return _mm_cmplt_epi8(y, _mm_set1_epi8((char)((unsigned char)hi - (unsigned char)lo + 1 - 128)));
+}
+#endif
+
+/* Skip blanks (' ', '\t', '\r', '\f', '\v'), stop at new line */
+const char *cmm_skip_blanks(const char *p, const char *limit)
+{
+#if CMM_LEX_USE_SSE2
+    while (p + 16 <= limit)
+    {
+        __m128i x = _mm_loadu_si128((const __m128i *)p);
+        // '\n' is in range [\t, \r] but it's not a blank
+        __m128i blank = _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8(' ')),
+                                     cmm_in_range(x, '\t', '\r'));
+        blank = _mm_andnot_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8('\n')), blank);
+        unsigned int mask = ~(unsigned int)_mm_movemask_epi8(blank) & 0xFFFF;
+        if (mask)
+            return p + cmm_lowest_bit(mask);
+        p += 16;
+    }
+#endif
+    while (p < limit && cmm_is_blank(*p))
+        p++;
+    return p;
+}
+
+/* Skip chars of identifier [A-Za-z0-9_] */
+const char *cmm_skip_ident_chars(const char *p, const char *limit)
+{
+#if CMM_LEX_USE_SSE2
+    while (p + 16 <= limit)
+    {
+        __m128i x = _mm_loadu_si128((const __m128i *)p);
+        // Fold letters to lower case by setting bit 5, no other char
+        // falls in [a, z] after folding
+        __m128i ident = _mm_or_si128(
+            cmm_in_range(_mm_or_si128(x, _mm_set1_epi8(0x20)), 'a', 'z'),
+            _mm_or_si128(cmm_in_range(x, '0', '9'),
+                         _mm_cmpeq_epi8(x, _mm_set1_epi8('_'))));
+        unsigned int mask = ~(unsigned int)_mm_movemask_epi8(ident) & 0xFFFF;
+        if (mask)
+            return p + cmm_lowest_bit(mask);
+        p += 16;
+    }
+#endif
+    while (p < limit && cmm_is_ident_char(*p))
+        p++;
+    return p;
+}
+
+/* Find the first one of c1, c2 or c3, return limit if not found */
+const char *cmm_find_any_char(const char *p, const char *limit, char c1, char c2, char c3)
+{
+#if CMM_LEX_USE_SSE2
+    __m128i v1 = _mm_set1_epi8(c1);
+    __m128i v2 = _mm_set1_epi8(c2);
+    __m128i v3 = _mm_set1_epi8(c3);
+    while (p + 16 <= limit)
+    {
+        __m128i x = _mm_loadu_si128((const __m128i *)p);
+        __m128i hit = _mm_or_si128(_mm_cmpeq_epi8(x, v1),
+                                   _mm_or_si128(_mm_cmpeq_epi8(x, v2), _mm_cmpeq_epi8(x, v3)));
+        unsigned int mask = (unsigned int)_mm_movemask_epi8(hit);
+        if (mask)
+            return p + cmm_lowest_bit(mask);
+        p += 16;
+    }
+#endif
+    while (p < limit && *p != c1 && *p != c2 && *p != c3)
+        p++;
+    return p;
+}
+
 }
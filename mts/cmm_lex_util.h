@@ -15,4 +15,9 @@ bool cmm_append_input_at_buffer_head(char *text, size_t size, char **ppat, const
 bool cmm_get_token(char *token, size_t size, char **ppat);
 void cmm_trim_to(char* str, size_t size, const char* from);
 
+/* Scan runs of chars in [p, limit), use SSE2 when available */
+const char *cmm_skip_blanks(const char *p, const char *limit);
+const char *cmm_skip_ident_chars(const char *p, const char *limit);
+const char *cmm_find_any_char(const char *p, const char *limit, char c1, char c2, char c3);
+
 }
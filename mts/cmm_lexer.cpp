@@ -3,10 +3,12 @@
 // Immigrated 2015.10.28 by doing
 
 #include "std_port/std_port_cs.h"
+#include "std_port/std_port_mmap.h"
 #include "cmm.h"
 #include "cmm_buffer_new.h"
 #include "cmm_common_util.h"
 #include "cmm_lang.h"
+#include "cmm_lex_util.h"
 #include "cmm_lexer.h"
 #include "cmm_program.h"
 #include "cmm_value.h"
@@ -20,8 +22,9 @@ namespace cmm
 // Unknown file name when not specified
 const char* UNKNOWN_FILE_NAME = "/unknown.c";
     
-// Refer to external variable in cmm_grammar.y
-extern YYSTYPE yylval;
+// The parser is pure (reentrant), the semantic value of token is passed
+// to lex_in() by parser
+#define yylval (*m_lval)
 int yydebug = 1;
 
 #define LEX_EOF ((char) EOF)
@@ -134,15 +137,20 @@ Lexer::Lexer(Lang* context)
     m_current_line_base = 0;
     m_current_line_saved = 0;
     m_current_buf = 0;
+    m_mapped_content = 0;
+    m_mapped_size = 0;
+    m_scan_limit = 0;
     m_is_start = false;
     m_in_crypt_type = (CryptType)0;
     m_in_crypt_code = 0;
     m_fixed_line = 0;
     m_unique_counter = 0;
+    m_lval = 0;
 }
 
 Lexer::~Lexer()
 {
+    close_mapped_file();
 }
 
 void Lexer::handle_elif(char *sp)
@@ -218,7 +226,9 @@ char* Lexer::copy_string(const char* c_str, size_t len)
     if (len == SIZE_MAX)
         len = strlen(c_str);
     char* to = LANG_NEWN(m_lang_context, char, len + 1);
-    memcpy(to, c_str, len + 1);
+    memcpy(to, c_str, len);
+    // The source may be not terminated (such as string in text buffer)
+    to[len] = 0;
     return to;
 }
 
@@ -635,11 +645,9 @@ void Lexer::set_current_line_file(char *linefile)
 // Skip current line in buffer
 void Lexer::skip_line()
 {
-    IntR c;
     char *yyp = this->m_out;
 
-    while (((c = *yyp) != '\n') && (c != LEX_EOF))
-        yyp++;
+    yyp = (char *)cmm_find_any_char(yyp, this->m_scan_limit, '\n', LEX_EOF, LEX_EOF);
 
     // Next read of this '\n' will do vm_refillBuffer() if neccesary
     this->m_out = yyp;
@@ -652,8 +660,12 @@ void Lexer::skip_comment()
 
     for (;;)
     {
-        while ((c = *yyp++) != '*')
+        for (;;)
         {
+            // Jump to the next char may end the comment or the line
+            yyp = (char *)cmm_find_any_char(yyp, this->m_scan_limit, '*', '\n', LEX_EOF);
+            if ((c = *yyp++) == '*')
+                break;
             if (c == LEX_EOF)
             {
                 this->m_out = --yyp;
@@ -817,6 +829,10 @@ void Lexer::refill_buffer()
     size_t i, size;
     bool   is_end_of_file;
 
+    if (this->m_mapped_content)
+        // The whole file is in buffer, nothing more
+        return;
+
     // Here we are sure that we need more from the file
     // Assume this->m_out is one beyond a newline at this->m_last_new_line
     // or after an #include ....
@@ -928,9 +944,9 @@ void Lexer::refill_buffer()
 #define returnOrder(opcode)     { yylval.number = opcode; return L_ORDER;  }
 
 // Lex in
-int Lexer::lex_in()
+int Lexer::lex_in(YYSTYPE* lval)
 {
-    static char partial[MAXLINE + 5];   // extra 5 for safety buffer
+    char partial[MAXLINE + 5];   // extra 5 for safety buffer
     bool   is_real;
     char  *partp;
 
@@ -939,6 +955,7 @@ int Lexer::lex_in()
 
     this->m_text[0] = 0;
 
+    m_lval = lval;
     partp = partial;            // Xeno
     partial[0] = 0;             // Xeno
 
@@ -973,6 +990,8 @@ int Lexer::lex_in()
         case '\f':
         case '\v':
         case '\r':
+            // Skip the following blanks in batch
+            this->m_out = (char *)cmm_skip_blanks(this->m_out, this->m_scan_limit);
             break;
 
         case '+':
@@ -1712,19 +1731,17 @@ int Lexer::lex_in()
                 yyp = this->m_text;
                 oldOut = this->m_out;
                 *yyp++ = oldC = c;
-                for (;;)
                 {
-                    c = *this->m_out++;
-
-                    if (isalnum(c) || c == '_')
+                    auto* end = (char *)cmm_skip_ident_chars(this->m_out, this->m_scan_limit);
+                    size_t len = (size_t)(end - this->m_out);
+                    if (len > (size_t)(this->m_text + MAXLINE - 5 - yyp))
                     {
-                        SAVEC;
-                        continue;
+                        lex_error("Line too long");
+                        len = (size_t)(this->m_text + MAXLINE - 5 - yyp);
                     }
-
-                    // Return the last char
-                    this->m_out--;
-                    break;
+                    memcpy(yyp, this->m_out, len);
+                    yyp += len;
+                    this->m_out = end;
                 }
                 *yyp = 0;
 
@@ -1908,9 +1925,11 @@ bool Lexer::start_new_file(Program *program, IntR fd, const simple::string& file
     m_in_crypt_type = LEX_NO_CRYPT;
 
     // Initialize YACC information & file information
+    close_mapped_file();
     this->m_in_file_fd = fd;
     this->m_current_buf = &m_main_buf;
     this->m_current_buf->buf_end = this->m_out = this->m_current_buf->buf + (DEFMAX >> 1);
+    this->m_scan_limit = this->m_current_buf->buf + DEFMAX;
     *(this->m_last_new_line = this->m_out - 1) = '\n';
     m_lang_context->set_current_attrib(m_default_attrib);
     this->m_current_line = 1;
@@ -1928,6 +1947,70 @@ bool Lexer::start_new_file(Program *program, IntR fd, const simple::string& file
     return true;
 }
 
+// Open a new file to compile by mapping the whole file
+// The lexer scans the content in place without refilling buffer
+// Return false if the file can't be mapped or it's crypted, the caller
+// should use start_new_file() instead
+bool Lexer::start_new_mapped_file(Program *program, const char *os_file_name, const simple::string& file_name)
+{
+    size_t size;
+    close_mapped_file();
+    auto* content = std_map_file_private(os_file_name, MAPPED_HEAD_ROOM, MAPPED_TAIL_ROOM, &size);
+    if (!content)
+        return false;
+
+    char *p = content;
+    char *end = content + size;
+    if (size >= 3 && p[0] == '\xEF' && p[1] == '\xBB' && p[2] == '\xBF')
+        // Skip BOM
+        p += 3;
+
+    if (p < end && (p[0] == '!' || p[0] == '*'))
+    {
+        // Crypted file, let refill_buffer() restore it
+        std_unmap_file_private(content, MAPPED_HEAD_ROOM, MAPPED_TAIL_ROOM, size);
+        return false;
+    }
+
+    generate_file_dir_name();
+    m_default_attrib = 0;
+    m_is_start = false;
+    m_in_crypt_type = LEX_NO_CRYPT;
+
+    this->m_mapped_content = content;
+    this->m_mapped_size = size;
+    this->m_in_file_fd = 0;
+    this->m_current_buf = &m_main_buf;
+    this->m_out = p;
+    this->m_scan_limit = end + MAPPED_TAIL_ROOM;
+
+    // Lead by a new line as start_new_file() does, '#' looks back for it
+    p[-1] = '\n';
+
+    // Whole file is in buffer, mark the end like refill_buffer() does
+    *(this->m_last_new_line = end) = LEX_EOF;
+    this->m_current_buf->buf_end = end + 1;
+
+    m_lang_context->set_current_attrib(m_default_attrib);
+    this->m_current_line = 1;
+    this->m_current_line_base = 0;
+    this->m_current_line_saved = 0;
+    this->m_line_words = 0;
+    m_current_file_name = add_file_name(file_name);
+    return true;
+}
+
+// Unmap the file mapped by start_new_mapped_file()
+void Lexer::close_mapped_file()
+{
+    if (!m_mapped_content)
+        return;
+
+    std_unmap_file_private(m_mapped_content, MAPPED_HEAD_ROOM, MAPPED_TAIL_ROOM, m_mapped_size);
+    m_mapped_content = 0;
+    m_mapped_size = 0;
+}
+
 void Lexer::get_next_char(IntR *ptr_ch)
 {
     IntR ch;
@@ -2005,6 +2088,20 @@ void Lexer::add_input(char *p)
 {
     size_t l = strlen(p);
 
+    if (this->m_mapped_content)
+    {
+        // The head room & the content consumed are before m_out, they
+        // are private pages, overwrite them
+        if (this->m_out - (l + 5) < this->m_mapped_content - MAPPED_HEAD_ROOM)
+        {
+            lex_error("Macro expansion buffer overflow");
+            return;
+        }
+        this->m_out -= l;
+        memmove(this->m_out, p, l);
+        return;
+    }
+
     if (l + (this->m_current_buf->buf_end - this->m_out) >= DEFMAX - 10)
     {
         lex_error("Macro expansion buffer overflow");
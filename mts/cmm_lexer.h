@@ -14,6 +14,8 @@
 namespace cmm
 {
 
+union YYSTYPE;
+
 #define SKIPWHITE   while (vm_isspace(*p) && (*p != '\n')) p++
 
 // for find_or_add_ident
@@ -86,6 +88,8 @@ public:
         EXPANDMAX = 25000,
         NARGS = 25,
         MARKS = '@',
+        MAPPED_HEAD_ROOM = DEFMAX,  // For macro expansion before the content
+        MAPPED_TAIL_ROOM = 64,      // Zero bytes after the content
     };
 
     // Lex-in crypt mode
@@ -125,8 +129,9 @@ public:
     Uint32      get_default_attrib();
     bool        set_default_attrib(Uint32 attrib);
     bool        start_new_file(Program *program, IntR fd, const simple::string& file_name);
+    bool        start_new_mapped_file(Program *program, const char *os_file_name, const simple::string& file_name);
     bool        end_new_file(bool succ);
-    int         lex_in();
+    int         lex_in(YYSTYPE* lval);
 
 private:
     void        lex_errorp(const char* msg);
@@ -151,6 +156,7 @@ private:
     void        handle_else();
     void        handle_endif();
     char*       copy_string(const char* c_str, size_t len = SIZE_MAX);
+    void        close_mapped_file();
 
 private:
     static Keyword *get_keyword(const simple::string& name);
@@ -215,6 +221,13 @@ private:
     // Current linked buffer
     LinkedBuf*   m_current_buf;
 
+    // Whole source file mapped (see start_new_mapped_file)
+    char*        m_mapped_content;
+    size_t       m_mapped_size;
+
+    // End of readable memory from m_out, for scanning in batch
+    char*        m_scan_limit;
+
     // At head of input file?
     bool         m_is_start;
 
@@ -228,6 +241,9 @@ private:
     // unique count, used to generate __COUNTER__
     Uint32       m_unique_counter;
 
+    // Semantic value of the token being lexed (set by parser)
+    YYSTYPE*     m_lval;
+
 private:
     // Keyword array in C++ source file
     static Keyword m_define_keywords[];
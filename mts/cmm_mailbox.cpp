@@ -0,0 +1,88 @@
+// cmm_mailbox.cpp
+
+#include "cmm.h"
+#include "cmm_domain.h"
+#include "cmm_mailbox.h"
+#include "cmm_thread.h"
+
+namespace cmm
+{
+
+// Take value to thread local list
+// The string or buffer not binded to any owner is allocated by native
+// code for this call only, take it without copying
+static Value take_to_local(Thread *thread, const Value& value)
+{
+    if (value.m_type != ValueType::STRING && value.m_type != ValueType::BUFFER)
+        return value.copy_to_local(thread);
+
+    auto *reference = value.m_reference;
+    if (reference->owner || (reference->attrib & (ReferenceImpl::CONSTANT | ReferenceImpl::SHARED)))
+        return value.copy_to_local(thread);
+
+    thread->bind_value(reference);
+    return value;
+}
+
+// Create a call & copy arguments out of current domain
+AsyncCall::AsyncCall(Thread *thread, ObjectId oid, const Value& function_name, Value *args, ArgNo n)
+{
+    m_node.next = 0;
+    m_oid = oid;
+    m_domain = 0;
+    m_arg_no = n;
+    m_state = PENDING;
+    m_detached = false;
+    m_values.set_name("AsyncCall");
+
+    // Copy function name & arguments to thread local list then take them
+    STD_ASSERT(("Thread local values should be empty.", !thread->get_value_list_count()));
+    m_function_name = function_name.copy_to_local(thread);
+    m_args = n ? XNEWN(MMMValue, n) : 0;
+    for (ArgNo i = 0; i < n; i++)
+        m_args[i] = take_to_local(thread, args[i]);
+    thread->transfer_values_to(&m_values);
+}
+
+AsyncCall::~AsyncCall()
+{
+    STD_ASSERT(("Call is still pending.", m_state != PENDING));
+    m_values.free();
+    if (m_args)
+        XDELETEN(m_args);
+}
+
+// Wait until the call is finished
+// If the call is still in mailbox, this thread will enter the target domain
+// & drain the mailbox itself, so there is no need to wake up the waiter
+Value AsyncCall::wait(Thread *thread)
+{
+    while (m_state == PENDING)
+        thread->drain_mailbox(m_domain);
+
+    // Take the return value into current domain
+    thread->get_current_domain()->concat_value_list(&m_values);
+    return m_ret;
+}
+
+// Set result of call
+// ATTENTION: A detached call is freed here
+void AsyncCall::finish(Thread *thread, const Value& ret, State state)
+{
+    if (m_detached)
+    {
+        m_state = state;
+        auto *self = this;
+        XDELETE(self);
+        return;
+    }
+
+    m_ret = ret.copy_to_local(thread);
+    thread->transfer_values_to(&m_values);
+
+    // Publish the result
+    std_cpu_mfence();
+    m_state = state;
+}
+
+} // End of namespace: cmm
@@ -0,0 +1,166 @@
+// cmm_mailbox.h
+// Mailbox of domain for asynchronous cross-domain calls
+
+#pragma once
+
+#include <stddef.h>
+#include "std_port/std_port.h"
+#include "cmm.h"
+#include "cmm_mmm_value.h"
+#include "cmm_value.h"
+#include "cmm_value_list.h"
+
+namespace cmm
+{
+
+class Domain;
+class Thread;
+
+// Lock-free MPSC queue (intrusive)
+// Any thread can push, only the holder of domain can pop.
+class Mailbox
+{
+public:
+    struct Node
+    {
+        Node *volatile next;
+    };
+
+public:
+    Mailbox()
+    {
+        m_stub.next = 0;
+        m_head = &m_stub;
+        m_tail = &m_stub;
+    }
+
+public:
+    // Put a node into queue (any thread)
+    void push(Node *node)
+    {
+        node->next = 0;
+        Node *prev = (Node *)std_cpu_lock_xchg((void **)&m_head, (void *)node);
+        // The queue is broken between xchg & following line, the consumer
+        // will see an empty queue until the link is done
+        prev->next = node;
+    }
+
+    // Take a node from queue (consumer only)
+    // Return 0 if the queue is empty (or a producer is just pushing)
+    Node *pop()
+    {
+        Node *tail = m_tail;
+        Node *next = tail->next;
+        if (tail == &m_stub)
+        {
+            if (!next)
+                // Empty
+                return 0;
+            m_tail = next;
+            tail = next;
+            next = next->next;
+        }
+
+        if (next)
+        {
+            m_tail = next;
+            return tail;
+        }
+
+        if (tail != m_head)
+            // A producer is pushing, try later
+            return 0;
+
+        // Tail is the last one, push stub to take it off
+        push(&m_stub);
+        next = tail->next;
+        if (next)
+        {
+            m_tail = next;
+            return tail;
+        }
+        return 0;
+    }
+
+    // Is the queue empty?
+    bool is_empty() const
+    {
+        return m_tail->next == 0 && m_head == m_tail;
+    }
+
+private:
+    Node *volatile m_head;  // Last pushed node
+    Node *m_tail;           // Next node to pop
+    Node m_stub;
+};
+
+// An asynchronous call_other posted to the mailbox of domain
+// It's also the handle for caller to get result, caller must wait() it
+// before freeing.
+// The arguments & the return value are copied into m_values which doesn't
+// belong to any domain, so they can be passed between domains safely.
+// The string or buffer arguments not binded to any owner are taken
+// without copying (such as data received by reactor).
+class AsyncCall
+{
+friend Domain;
+
+public:
+    enum State
+    {
+        PENDING = 0,
+        DONE = 1,
+        FAILED = 2,
+    };
+
+public:
+    AsyncCall(Thread *thread, ObjectId oid, const Value& function_name, Value *args, ArgNo n);
+    ~AsyncCall();
+
+public:
+    // Get target object
+    ObjectId get_oid() const { return m_oid; }
+
+    // Get state of call
+    State get_state() const { return (State)m_state; }
+
+    // Is the call finished?
+    bool is_finished() const { return m_state != PENDING; }
+
+    // Nobody will wait the call, it will be freed after finished
+    // Must be set before posting
+    void detach() { m_detached = true; }
+
+    // Is this call detached?
+    bool is_detached() const { return m_detached; }
+
+    // Wait until the call is finished & take the return value into
+    // current domain of thread
+    Value wait(Thread *thread);
+
+    // Set result of call (by the thread executed the call)
+    void finish(Thread *thread, const Value& ret, State state);
+
+public:
+    // Get AsyncCall by node
+    static AsyncCall *from_node(Mailbox::Node *node)
+    {
+        return (AsyncCall *)((Uint8 *)node - offsetof(AsyncCall, m_node));
+    }
+
+public:
+    Mailbox::Node m_node;           // Linked in mailbox
+
+private:
+    ObjectId    m_oid;              // Target object
+    Domain     *m_domain;           // Domain posted to
+    MMMValue    m_function_name;    // Function to call
+    MMMValue   *m_args;             // Arguments
+    ArgNo       m_arg_no;           // Count of arguments
+    MMMValue    m_ret;              // Return value
+    ValueList   m_values;           // Values of arguments or return value
+    volatile int m_state;           // State of this call
+    bool        m_detached;         // Free after finished
+};
+
+} // End of namespace: cmm
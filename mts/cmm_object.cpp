@@ -16,7 +16,7 @@ Object::ObjectIdManager *Object::m_id_manager = 0;
 bool Object::init()
 {
     // Create the id manager
-    m_id_manager = XNEW(Object::ObjectIdManager, MAX_ID_PAGES);
+    m_id_manager = XNEW(Object::ObjectIdManager);
     return true;
 }
 
@@ -38,11 +38,32 @@ Object::~Object()
 
 // Allocate an ID & assign to this object
 bool Object::assign_oid()
+{
+    ObjectId oid;
+    oid.i64 = 0;
+    return assign_oid(oid);
+}
+
+// Assign specified ID to this object
+bool Object::assign_oid(ObjectId oid)
 {
     STD_ASSERT(("The object is already binded an id.", !m_oid.i64));
     STD_ASSERT(("The object shouldn't have been joined any domain.", !m_domain));
 
-    auto *entry = Object::m_id_manager->allocate_id();
+    Entry *entry;
+    if (oid.i64)
+    {
+        // Restore a saved oid
+        entry = Object::m_id_manager->allocate_id(oid);
+        if (!entry)
+            // The oid is in use
+            return false;
+    } else
+    {
+        entry = Object::m_id_manager->allocate_id();
+        if (!entry)
+            throw_error("Out of object id entries.\n");
+    }
 
     // Assign oid to me
     m_oid = entry->gid;
@@ -20,7 +20,9 @@ class Program;
 
 class Object
 {
+friend Domain;
 friend Program;
+friend class ProgramReloader;
 
 public:
     struct Entry
@@ -31,22 +33,23 @@ public:
         Domain *domain;     // Domain of the object
     };
 
-private:
-    enum { MAX_ID_PAGES = 8192 };
-
 public:
     // Initialize/shutdown this module
     static bool init();
     static void shutdown();
 
 public:
-    Object() { }
+    Object() : m_prev_instance(0), m_next_instance(0), m_dirty(false) { }
     virtual ~Object();
 
 public:
     // Allocate an oid for this object
     bool assign_oid();
 
+    // Assign specified oid (0 means to allocate one) to this object
+    // Return false if the oid is in use
+    bool assign_oid(ObjectId oid);
+
     // Free this object's oid
     void free_oid();
 
@@ -102,11 +105,20 @@ public:
         return m_program;
     }
 
+    // Return next object of same program in domain
+    Object *get_next_instance()
+    {
+        return m_next_instance;
+    }
+
 private:
                                 // [virtual table]
     ObjectId m_oid;             // Object's ID
     Domain  *m_domain;          // Belong to
     Program *m_program;         // Program of this object
+    Object  *m_prev_instance;   // Objects of same program in domain
+    Object  *m_next_instance;
+    bool     m_dirty;           // Changed since last checkpoint
     Value    m_object_vars[1];  // Members start here
 
 private:
@@ -57,15 +57,174 @@
  */
 
 #include <stdio.h>
+#include <string.h>
+#include <cmath>
+#ifdef _WINDOWS
+#include <io.h>
+#else
+#include <errno.h>
+#include <unistd.h>
+#endif
 #include "std_port/std_port.h"
 #include "cmm_common_util.h"
 #include "cmm_output.h"
+#include "cmm_socket.h"
 #include "cmm_thread.h"
 #include "cmm_value.h"
 
 namespace cmm
 {
 
+// Cache of compiled formats
+volatile Int64 *Output::m_formats = 0;
+
+// Power of 10 for converting real
+static const double powers_of_10[] =
+{
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9,
+};
+
+// Convert unsigned integer to decimal text (no terminator)
+// Return length of text
+static size_t uint64_to_chars(char *p, Uint64 val)
+{
+    char temp[24];
+    size_t n = 0;
+
+    do
+    {
+        temp[n++] = (char) ('0' + val % 10);
+        val /= 10;
+    } while (val > 0);
+
+    for (size_t i = 0; i < n; i++)
+        p[i] = temp[n - 1 - i];
+    return n;
+}
+
+// Convert real to text as printf "%f" (pres 0 means default 6 digits),
+// sign is the char put before positive value or 0
+// The value is scaled to an integer & rounded if the rounding can't be
+// affected by the error of scaling, otherwise it's done by snprintf.
+// Return length of text
+static size_t real_to_chars(char *temp, size_t size, Real real, Integer pres, char sign)
+{
+    int digits = pres ? (int) pres : 6;
+
+    if (digits < (int) (sizeof(powers_of_10) / sizeof(powers_of_10[0])) && real == real)
+    {
+        bool is_negative = std::signbit(real);
+        double scaled = (is_negative ? -real : real) * powers_of_10[digits];
+        if (scaled < 9007199254740992.0)
+        {
+            // Less than 2^53, the error of scaled is less than 2^-53 of it
+            double whole = floor(scaled);
+            double frac = scaled - whole;
+            if (fabs(frac - 0.5) > scaled * 4e-16)
+            {
+                Uint64 val = (Uint64) whole + (frac > 0.5 ? 1 : 0);
+                Uint64 unit = (Uint64) powers_of_10[digits];
+                char *p = temp;
+
+                if (is_negative)
+                    *p++ = '-';
+                else
+                if (sign)
+                    *p++ = sign;
+                p += uint64_to_chars(p, val / unit);
+                *p++ = '.';
+                val %= unit;
+                for (int i = digits - 1; i >= 0; i--, val /= 10)
+                    p[i] = (char) ('0' + val % 10);
+                p += digits;
+                *p = 0;
+                return p - temp;
+            }
+        }
+    }
+
+    char cheat[16];
+    if (sign)
+        snprintf(cheat, sizeof(cheat), "%%%c.%df", sign, digits);
+    else
+        snprintf(cheat, sizeof(cheat), "%%.%df", digits);
+    snprintf(temp, size, cheat, real);
+    return strlen(temp);
+}
+
+// Initialize this module
+bool Output::init()
+{
+    m_formats = XNEWN(Int64, FORMATS_COUNT);
+    memset((void*)m_formats, 0, sizeof(Int64) * FORMATS_COUNT);
+    return true;
+}
+
+// Shutdown this module
+void Output::shutdown()
+{
+    if (! m_formats)
+        return;
+
+    for (size_t i = 0; i < FORMATS_COUNT; i++)
+    {
+        auto *compiled = (CompiledFormat *)(IntR)m_formats[i];
+        if (compiled)
+        {
+            XDELETE(compiled);
+        }
+    }
+    auto *formats = (Int64 *)m_formats;
+    m_formats = 0;
+    XDELETEN(formats);
+}
+
+// Write to stdio file
+bool FileSink::write(const char_t *data, size_t len)
+{
+    return fwrite(data, sizeof(char_t), len, m_fp) == len;
+}
+
+// Write to file descriptor, retry until all are written
+bool FdSink::write(const char_t *data, size_t len)
+{
+    while (len > 0)
+    {
+#ifdef _WINDOWS
+        int n = _write(m_fd, data, (unsigned int)len);
+#else
+        ssize_t n = ::write(m_fd, data, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+#endif
+        if (n <= 0)
+            return false;
+        data += n;
+        len -= (size_t)n;
+    }
+    return true;
+}
+
+// Copy to memory buffer, the part fits is kept
+bool BufferSink::write(const char_t *data, size_t len)
+{
+    size_t n = m_size - m_written;
+    if (n > len)
+        n = len;
+    memcpy(m_buf + m_written, data, n);
+    m_written += n;
+    return n == len;
+}
+
+// Queue to socket
+bool SocketSink::write(const char_t *data, size_t len)
+{
+    if (Socket::send(m_id, data, len) < 0)
+        return false;
+    m_sent += len;
+    return true;
+}
+
 // Append a char to output buffer                                         
 void Output::add_char(char_t ch)
 {
@@ -111,16 +270,28 @@ void Output::add_pad(PadInfo *pad, size_t len)
 // Add n chars
 void Output::add_nchars(const char_t *str, size_t len)
 {
+    if (m_sink && len >= CHUNK_SIZE)
+    {
+        // Write big one directly
+        flush_chunk();
+        if (! m_sink_failed && ! m_sink->write(str, len))
+            m_sink_failed = true;
+        return;
+    }
+
     char_t *p = reserve_space(len);
     memcpy(p, str, len * sizeof(char_t));
 }
 
 // Add an integer
-void Output::add_number(Int64 n, const char *format)
+void Output::add_number(Int64 n)
 {
-    char buf[64];
-    sprintf(buf, format, n);
-    add_nchars(buf, strlen(buf));
+    char buf[32];
+    size_t len = 0;
+    if (n < 0)
+        buf[len++] = '-';
+    len += uint64_to_chars(buf + len, n < 0 ? 0 - (Uint64) n : (Uint64) n);
+    add_nchars(buf, len);
 }
 
 // Add a string
@@ -156,6 +327,12 @@ void Output::add_justified(const char_t *str, size_t slen, PadInfo *pad,
      * may case bad alignment since "Zhong wen" is 6 bytes.
      * How ever, If we get the vm_strwidth of "Zhong wen" & change 6 to 8 = 6 - 4(width) + 6(chars),
      * the result is fine */
+    if (fs <= 0)
+    {
+        // No field size, don't bother to get width
+        add_nchars(str, slen);
+        return;
+    }
     fs -= (int)strwidth(str, slen);
 
     if (fs <= 0)
@@ -190,6 +367,10 @@ void Output::add_justified(const char_t *str, size_t slen, PadInfo *pad,
 // Reserve n chars @ end of output buf
 char_t *Output::reserve_space(size_t n)
 {
+    // Write the full chunk to sink
+    if (m_sink && m_obuf.size() + n > CHUNK_SIZE)
+        flush_chunk();
+
     // Reserved n chars
     size_t pos = m_obuf.size();
     m_obuf.push_backs(0, n);
@@ -264,371 +445,547 @@ void Output::error_occurred(ErrorCode code)
 }
 
 /*
- * THE (s)printf() function.
- * It returns a pointer to it's internal buffer (or a string in the text
- * segment) thus, the string must be copied if it has to survive after
- * this function is called again, or if it's going to be modified (esp.
- * if it risks being free()ed).
+ * Parse a spec of format string, *fpos is the position after '%' & it's
+ * updated to the position after the spec.
+ * take_args: Take arguments of '*', otherwise '*' is marked in op only.
+ * Return false if error occurred, the error code is put into op.
  */
-String Output::format_output(const char_t *format_str, Value *argv, ArgNo argc)
+bool Output::parse_spec(const char_t *format_str, size_t *pos, FormatOp *op, bool take_args)
 {
     int      finfo;
     PadInfo  pad;     /* fs pad string */
     size_t   fpos;      /* position in format_str */
     int      fs;          /* field size */
     Integer  pres;        /* presision */
-    size_t   i;
-    size_t   last;
-
-    // Initialize class members
-    m_argv = argv;
-    m_argc = argc;
-    m_current_arg_index = -1;
-    m_current_arg = 0;
-    m_obuf.clear();
-
-    // For type value
-    Output sub;
 
-    last = 0;
-    for (fpos = 0; 1; fpos++)
+    fpos = *pos;
+    fs = 0;
+    pres = 0;
+    pad.what = 0;
+    pad.len = 0;
+    finfo = 0;
+    op->offset = fpos;
+    op->len = 0;
+    op->has_star = false;
+    op->error = 0;
+    for (; ! (finfo & INFO_T); fpos++)
     {
-        char c = format_str[fpos];
-        
-        if (c == '\n' || ! c)
+        if (! format_str[fpos])
         {
-            if (last != fpos)
-            {
-                add_nchars(format_str + last, fpos - last);
-                last = fpos + 1;
-            } else last++;
-
-            if (! c)
-                break;
-            add_char('\n');
-            continue;
-        } else
-        if (c == '%')
+            finfo |= INFO_T_ERROR;
+            break;
+        }
+        if (((format_str[fpos] >= '0') && (format_str[fpos] <= '9'))
+            || (format_str[fpos] == '*'))
         {
-            if (last != fpos)
-            {
-                add_nchars(format_str + last, fpos - last);
-                last = fpos + 1;
-            } else last++;
-            if (format_str[fpos + 1] == '%')
-            {
-                add_char('%');
-                fpos++;
-                last++;
-                continue;
-            }
-            get_next_arg();
-            fs = 0;
-            pres = 0;
-            pad.len = 0;
-            finfo = 0;
-            for (fpos++; ! (finfo & INFO_T); fpos++)
-            {
-                if (! format_str[fpos])
+            if (pres == -1) {   /* then looking for pres */
+                if (format_str[fpos] == '*')
                 {
-                    finfo |= INFO_T_ERROR;
-                    break;
+                    if (! take_args)
+                    {
+                        op->has_star = true;
+                        pres = 0;
+                        continue;
+                    }
+                    if (m_current_arg->m_type != ValueType::INTEGER)
+                    {
+                        op->error = ERR_INVALID_STAR;
+                        return false;
+                    }
+                    pres = m_current_arg->m_int;
+                    get_next_arg();
+                    continue;
                 }
-                if (((format_str[fpos] >= '0') && (format_str[fpos] <= '9'))
-                    || (format_str[fpos] == '*'))
+                pres = format_str[fpos] - '0';
+                for (fpos++;
+                        (format_str[fpos] >= '0') && (format_str[fpos] <= '9'); fpos++)
                 {
-                    if (pres == -1) {   /* then looking for pres */
-                        if (format_str[fpos] == '*')
-                        {
-                            if (m_current_arg->m_type != ValueType::INTEGER)
-                                error_occurred(ERR_INVALID_STAR);
-                            pres = m_current_arg->m_int;
-                            get_next_arg();
-                            continue;
-                        }
-                        pres = format_str[fpos] - '0';
-                        for (fpos++;
-                                (format_str[fpos] >= '0') && (format_str[fpos] <= '9'); fpos++)
-                        {
-                            pres = pres * 10 + format_str[fpos] - '0';
-                        }
-                        if (pres < 0) pres = 0;
-                    } else
-                    {    /* then is fs (and maybe pres) */
-                        if ((format_str[fpos] == '0') && (((format_str[fpos + 1] >= '1')
-                                                      && (format_str[fpos + 1] <= '9')) || (format_str[fpos + 1] == '*')))
+                    pres = pres * 10 + format_str[fpos] - '0';
+                }
+                if (pres < 0) pres = 0;
+            } else
+            {    /* then is fs (and maybe pres) */
+                if ((format_str[fpos] == '0') && (((format_str[fpos + 1] >= '1')
+                                              && (format_str[fpos + 1] <= '9')) || (format_str[fpos + 1] == '*')))
+                {
+                    pad.what = "0";
+                    pad.len = 1;
+                } else
+                {
+                    if (format_str[fpos] == '*')
+                    {
+                        if (! take_args)
                         {
-                            pad.what = "0";
-                            pad.len = 1;
+                            op->has_star = true;
+                            fs = 0;
                         } else
                         {
-                            if (format_str[fpos] == '*')
+                            if (m_current_arg->m_type != ValueType::INTEGER)
                             {
-                                if (m_current_arg->m_type != ValueType::INTEGER)
-                                    error_occurred(ERR_INVALID_STAR);
-                                fs = (int)m_current_arg->m_int;
-                                if (fs < 0) fs = 0;
-                                if (pres == -2)
-                                    pres = fs;  /* colon */
-                                get_next_arg();
-                                continue;
+                                op->error = ERR_INVALID_STAR;
+                                return false;
                             }
-                            fs = format_str[fpos] - '0';
+                            fs = (int)m_current_arg->m_int;
+                            if (fs < 0) fs = 0;
                         }
-                        for (fpos++;
-                                (format_str[fpos] >= '0') && (format_str[fpos] <= '9'); fpos++)
-                        {
-                            fs = fs * 10 + format_str[fpos] - '0';
-                        }
-                        if (fs < 0) fs = 0;
                         if (pres == -2)
-                        {       /* colon */
-                            pres = fs;
-                        }
+                            pres = fs;  /* colon */
+                        if (take_args)
+                            get_next_arg();
+                        continue;
                     }
-                    fpos--; /* about to get incremented */
-                    continue;
+                    fs = format_str[fpos] - '0';
                 }
-                switch (format_str[fpos])
+                for (fpos++;
+                        (format_str[fpos] >= '0') && (format_str[fpos] <= '9'); fpos++)
                 {
-                case ' ':
-                    finfo |= INFO_PP_SPACE;
-                    break;
-                case '+':
-                    finfo |= INFO_PP_PLUS;
-                    break;
-                case '-':
-                    finfo |= INFO_J_LEFT;
-                    break;
-                case '|':
-                    finfo |= INFO_J_CENTRE;
-                    break;
-                case '.':
-                    pres = -1;
-                    break;
-                case ':':
-                    pres = -2;
-                    break;
-                case 'O':
-                    finfo |= INFO_T_ANY;
-                    break;
-                case 's':
-                    finfo |= INFO_T_STRING;
-                    break;
-                case 'u':
-                    finfo |= INFO_T_UINT;
-                    break;
-                case 'd':
-                    finfo |= INFO_T_INT;
-                    break;
-                case 'i':
-                    if (format_str[fpos + 1] == 'p')
-                    {
-                        fpos++;
-                        finfo |= INFO_T_IP;
-                    } else
-                        finfo |= INFO_T_INT;
-                    break;
-                case 'g':
-                case 'f':
-                    finfo |= INFO_T_FLOAT;
-                    break;
-                case 'c':
-                    finfo |= INFO_T_CHAR;
-                    break;
-                case 'o':
-                    finfo |= INFO_T_OCT;
-                    break;
-                case 'x':
-                    finfo |= INFO_T_HEX;
-                    break;
-                case 'X':
-                    finfo |= INFO_T_C_HEX;
-                    break;
-                case '\'':
-                    fpos++;
-                    pad.what = format_str + fpos;
-                    while (1)
-                    {
-                        if (! format_str[fpos])
-                            error_occurred(ERR_UNEXPECTED_EOS);
-                        if (format_str[fpos] == '\\')
-                        {
-                            if (! format_str[++fpos])
-                                error_occurred(ERR_UNEXPECTED_EOS);
-                        } else
-                        if (format_str[fpos] == '\'')
-                        {
-                            pad.len = format_str + fpos - pad.what;
-                            if (!pad.len)
-                                error_occurred(ERR_NULL_PS);
-                            break;
-                        }
-                        fpos++;
-                    }
-                    break;
-                default:
-                    finfo |= INFO_T_ERROR;
+                    fs = fs * 10 + format_str[fpos] - '0';
                 }
-            }                   /* end of for () */
-            if (pres < 0)
-                error_occurred(ERR_PRES_EXPECTED);
-            /*
-             * now handle the different arg types...
-             */
+                if (fs < 0) fs = 0;
+                if (pres == -2)
+                {       /* colon */
+                    pres = fs;
+                }
+            }
+            fpos--; /* about to get incremented */
+            continue;
+        }
+        switch (format_str[fpos])
+        {
+        case ' ':
+            finfo |= INFO_PP_SPACE;
+            break;
+        case '+':
+            finfo |= INFO_PP_PLUS;
+            break;
+        case '-':
+            finfo |= INFO_J_LEFT;
+            break;
+        case '|':
+            finfo |= INFO_J_CENTRE;
+            break;
+        case '.':
+            pres = -1;
+            break;
+        case ':':
+            pres = -2;
+            break;
+        case 'O':
+            finfo |= INFO_T_ANY;
+            break;
+        case 's':
+            finfo |= INFO_T_STRING;
+            break;
+        case 'u':
+            finfo |= INFO_T_UINT;
+            break;
+        case 'd':
+            finfo |= INFO_T_INT;
+            break;
+        case 'i':
+            if (format_str[fpos + 1] == 'p')
+            {
+                fpos++;
+                finfo |= INFO_T_IP;
+            } else
+                finfo |= INFO_T_INT;
+            break;
+        case 'g':
+        case 'f':
+            finfo |= INFO_T_FLOAT;
+            break;
+        case 'c':
+            finfo |= INFO_T_CHAR;
+            break;
+        case 'o':
+            finfo |= INFO_T_OCT;
+            break;
+        case 'x':
+            finfo |= INFO_T_HEX;
+            break;
+        case 'X':
+            finfo |= INFO_T_C_HEX;
+            break;
+        case '\'':
+            fpos++;
+            pad.what = format_str + fpos;
             while (1)
             {
-                if ((finfo & INFO_T) == INFO_T_ANY)
+                if (! format_str[fpos])
                 {
-                    String str = sub.type_value(m_current_arg);
-                    printf("str.type = %d, int = %p.\n", str.m_type, (void*)str.m_intptr);////----
-                    m_current_arg = &str;
-                    finfo ^= INFO_T_ANY;
-                    finfo |= INFO_T_STRING;
+                    op->error = ERR_UNEXPECTED_EOS;
+                    return false;
                 }
-                if ((finfo & INFO_T) == INFO_T_ERROR)
+                if (format_str[fpos] == '\\')
                 {
-                    error_occurred(ERR_INVALID_FORMAT_STR);
-                } else
-                if ((finfo & INFO_T) == INFO_T_STRING)
-                {
-                    /*
-                     * %s null handling added 930709 by Luke Mewburn
-                     * <zak@rmit.oz.au>
-                     */
-                    const char *arg_str = 0;
-                    if (m_current_arg->m_type == ValueType::INTEGER && m_current_arg->m_int == 0)
-                    {
-                        arg_str = "(Null)";
-                    } else
-                    if (m_current_arg->m_type != ValueType::STRING)
-                        error_occurred(ERR_INCORRECT_ARG_S);
-                    else
+                    if (! format_str[++fpos])
                     {
-                        arg_str = m_current_arg->m_string->c_str();
+                        op->error = ERR_UNEXPECTED_EOS;
+                        return false;
                     }
-
-                    add_justified(arg_str, strlen(arg_str),
-                                  &pad, fs, finfo,
-                                  (((format_str[fpos] != '\n') && (format_str[fpos] != '\0'))));
-                } else
-                if ((finfo & INFO_T) == INFO_T_IP)
-                {
-                    char temp[100];
-
-                    if (m_current_arg->m_type != ValueType::INTEGER)
-                        throw_error("error_occurred: (s)printf(): Incorrect argument(%d) type to %%ip.\n",
-                                    (int) m_current_arg_index + 1);
-                        
-                    sprintf(temp, "%u.%u.%u.%u",
-                            (int) ((m_current_arg->m_int >> 24) & 0xFF),
-                            (int) ((m_current_arg->m_int >> 16) & 0xFF),
-                            (int) ((m_current_arg->m_int >> 8)  & 0xFF),
-                            (int) ((m_current_arg->m_int) & 0xFF));
-
-                    add_justified(temp, strlen(temp), &pad, fs, finfo,
-                                  (((format_str[fpos] != '\n') && (format_str[fpos] != '\0'))));
                 } else
-                if (finfo & INFO_T_INT)
+                if (format_str[fpos] == '\'')
                 {
-                    /* one of the integer * types */
-                    char cheat[16];
-                    char temp[128];
-                    Integer val;
-                    Real real;
-
-                    /* Get number */
-                    if (m_current_arg->m_type == ValueType::INTEGER)
-                        val = m_current_arg->m_int;
-                    else
-                    if (m_current_arg->m_type == ValueType::REAL)
-                        val = (Integer) m_current_arg->m_real;
-                    else
-                        throw_error("error_occurred: (s)printf(): Incorrect argument(%d) type to %%d.\n",
-                                    (int) m_current_arg_index + 1);
-
-                    switch (finfo & INFO_T)
+                    pad.len = format_str + fpos - pad.what;
+                    if (!pad.len)
                     {
-                    case INFO_T_INT:
-                        int64_to_string(temp, sizeof(temp), val, 10, 1, 0);
-                        break;
-
-                    case INFO_T_UINT:
-                        int64_to_string(temp, sizeof(temp), val, 10, 0, 0);
-                        break;
-
-                    case INFO_T_CHAR:
-                        temp[0] = (char) val;
-                        temp[1] = 0;
-                        break;
-
-                    case INFO_T_OCT:
-                        int64_to_string(temp, sizeof(temp), val, 8, 0, 0);
-                        break;
-
-                    case INFO_T_HEX:
-                        int64_to_string(temp, sizeof(temp), val, 16, 0, 0);
-                        break;
-
-                    case INFO_T_C_HEX:
-                        int64_to_string(temp, sizeof(temp), val, 16, 0, 1);
-                        break;
-
-                    case INFO_T_FLOAT:
-                        /* A float */
-                        *cheat = '%';
-                        i = 1;
-                        switch (finfo & INFO_PP)
-                        {
-                        case INFO_PP_SPACE:
-                            cheat[i++] = ' ';
-                            break;
-                        case INFO_PP_PLUS:
-                            cheat[i++] = '+';
-                            break;
-                        }
-                        if (pres)
-                        {
-                            cheat[i++] = '.';
-                            sprintf(cheat + i, "%d", (int) pres);
-                            i += strlen(cheat + i);
-                        }
-                        cheat[i++] = 'f';
-                        cheat[i] = '\0';
-                        if (m_current_arg->m_type == ValueType::REAL)
-                            real = (double) m_current_arg->m_real;
-                        else
-                            /* Convert integer to double for output */
-                            real = (double) m_current_arg->m_int;
-                
-                        sprintf(temp, cheat, real);
-                        break;
-
-                    default:
-                        error_occurred(ERR_BAD_INT_TYPE);
+                        op->error = ERR_NULL_PS;
+                        return false;
                     }
+                    break;
+                }
+                fpos++;
+            }
+            break;
+        default:
+            finfo |= INFO_T_ERROR;
+        }
+    }                   /* end of for () */
+    if (pres < 0)
+    {
+        op->error = ERR_PRES_EXPECTED;
+        return false;
+    }
 
-                    add_justified(temp, strlen(temp), &pad, fs, finfo,
-                                  (((format_str[fpos] != '\n') && (format_str[fpos] != '\0'))));
-                } else
-                    /* type not found */
-                    error_occurred(ERR_UNDEFINED_TYPE);
-                break;
-            } /* end of while (1) */
+    *pos = fpos;
+    op->finfo = finfo;
+    op->fs = fs;
+    op->pres = pres;
+    op->pad = pad;
+    op->trailing = ((format_str[fpos] != '\n') && (format_str[fpos] != '\0'));
+    return true;
+}
+
+// Compile format string into ops
+// The ops after an error are dropped, since the error is raised when
+// executing the op & the rest is never reached
+void Output::compile_format(const char_t *format_str, CompiledFormat *compiled)
+{
+    size_t fpos;
+    size_t last;
+    FormatOp op;
+
+    last = 0;
+    for (fpos = 0; 1; fpos++)
+    {
+        char c = format_str[fpos];
+        if (c && c != '%')
+            continue;
+
+        if (last != fpos)
+        {
+            // Literal text
+            op.offset = last;
+            op.len = fpos - last;
+            compiled->ops.push_back(op);
+        }
+
+        if (! c)
+            break;
+
+        if (format_str[fpos + 1] == '%')
+        {
+            // "%%": The text starts from the 2nd '%'
+            fpos++;
             last = fpos;
-            fpos--; /* bout to get incremented */
+            continue;
+        }
+
+        fpos++;
+        if (! parse_spec(format_str, &fpos, &op, false))
+        {
+            compiled->ops.push_back(op);
+            break;
+        }
+        compiled->ops.push_back(op);
+        last = fpos;
+        fpos--; /* bout to get incremented */
+    }
+}
+
+// Execute compiled ops of format string
+String Output::execute_format(const char_t *format_str, const CompiledFormat *compiled, Value *argv, ArgNo argc)
+{
+    // Initialize class members
+    m_argv = argv;
+    m_argc = argc;
+    m_current_arg_index = -1;
+    m_current_arg = 0;
+    m_sink = 0;
+    m_obuf.clear();
+
+    const FormatOp *op = compiled->ops.get_array_address(0);
+    const FormatOp *end = op + compiled->ops.size();
+    for (; op < end; op++)
+    {
+        if (op->len)
+        {
+            // Literal text
+            add_nchars(format_str + op->offset, op->len);
+            continue;
+        }
+
+        get_next_arg();
+        if (op->has_star)
+        {
+            // Parse again to take arguments of '*'
+            FormatOp spec;
+            size_t fpos = op->offset;
+            if (! parse_spec(format_str, &fpos, &spec, true))
+                error_occurred((ErrorCode)spec.error);
+            add_arg(&spec);
+        } else
+        {
+            if (op->error)
+                error_occurred((ErrorCode)op->error);
+            add_arg(op);
         }
-    } /* end of for (fpos=0; 1; fpos++) */
+    }
+
+    return take_output();
+}
 
-    return String((char_t *)m_obuf.get_array_address(0), m_obuf.size());
+// Add current argument by spec
+void Output::add_arg(const FormatOp *op)
+{
+    int finfo = op->finfo;
+    PadInfo pad = op->pad;
+
+    /*
+     * now handle the different arg types...
+     */
+    String str(ValueType::NIL);
+    if ((finfo & INFO_T) == INFO_T_ANY)
+    {
+        Output sub;
+        str = sub.type_value(m_current_arg);
+        m_current_arg = &str;
+        finfo ^= INFO_T_ANY;
+        finfo |= INFO_T_STRING;
+    }
+    if ((finfo & INFO_T) == INFO_T_ERROR)
+    {
+        error_occurred(ERR_INVALID_FORMAT_STR);
+    } else
+    if ((finfo & INFO_T) == INFO_T_STRING)
+    {
+        /*
+         * %s null handling added 930709 by Luke Mewburn
+         * <zak@rmit.oz.au>
+         */
+        const char *arg_str = 0;
+        if (m_current_arg->m_type == ValueType::INTEGER && m_current_arg->m_int == 0)
+        {
+            arg_str = "(Null)";
+        } else
+        if (m_current_arg->m_type != ValueType::STRING)
+            error_occurred(ERR_INCORRECT_ARG_S);
+        else
+        {
+            arg_str = m_current_arg->m_string->c_str();
+        }
+
+        add_justified(arg_str, strlen(arg_str), &pad, op->fs, finfo, op->trailing);
+    } else
+    if ((finfo & INFO_T) == INFO_T_IP)
+    {
+        char temp[100];
+        char *p = temp;
+
+        if (m_current_arg->m_type != ValueType::INTEGER)
+            throw_error("error_occurred: (s)printf(): Incorrect argument(%d) type to %%ip.\n",
+                        (int) m_current_arg_index + 1);
+
+        for (int shift = 24; shift >= 0; shift -= 8)
+        {
+            p += uint64_to_chars(p, (Uint64) ((m_current_arg->m_int >> shift) & 0xFF));
+            *p++ = '.';
+        }
+        *(--p) = 0;
+
+        add_justified(temp, p - temp, &pad, op->fs, finfo, op->trailing);
+    } else
+    if (finfo & INFO_T_INT)
+    {
+        /* one of the integer * types */
+        char temp[128];
+        size_t len = 0;
+        Integer val;
+
+        /* Get number */
+        if (m_current_arg->m_type == ValueType::INTEGER)
+            val = m_current_arg->m_int;
+        else
+        if (m_current_arg->m_type == ValueType::REAL)
+            val = (Integer) m_current_arg->m_real;
+        else
+            throw_error("error_occurred: (s)printf(): Incorrect argument(%d) type to %%d.\n",
+                        (int) m_current_arg_index + 1);
+
+        switch (finfo & INFO_T)
+        {
+        case INFO_T_INT:
+            if (val < 0)
+            {
+                temp[0] = '-';
+                len = 1 + uint64_to_chars(temp + 1, 0 - (Uint64) val);
+            } else
+                len = uint64_to_chars(temp, (Uint64) val);
+            break;
+
+        case INFO_T_UINT:
+            len = uint64_to_chars(temp, (Uint64) val);
+            break;
+
+        case INFO_T_CHAR:
+            temp[0] = (char) val;
+            len = temp[0] ? 1 : 0;
+            break;
+
+        case INFO_T_OCT:
+            int64_to_string(temp, sizeof(temp), val, 8, 0, 0);
+            len = strlen(temp);
+            break;
+
+        case INFO_T_HEX:
+            int64_to_string(temp, sizeof(temp), val, 16, 0, 0);
+            len = strlen(temp);
+            break;
+
+        case INFO_T_C_HEX:
+            int64_to_string(temp, sizeof(temp), val, 16, 0, 1);
+            len = strlen(temp);
+            break;
+
+        case INFO_T_FLOAT:
+        {
+            /* A float */
+            Real real;
+            if (m_current_arg->m_type == ValueType::REAL)
+                real = (double) m_current_arg->m_real;
+            else
+                /* Convert integer to double for output */
+                real = (double) m_current_arg->m_int;
+
+            char sign = 0;
+            switch (finfo & INFO_PP)
+            {
+            case INFO_PP_SPACE:
+                sign = ' ';
+                break;
+            case INFO_PP_PLUS:
+                sign = '+';
+                break;
+            }
+            len = real_to_chars(temp, sizeof(temp), real, op->pres, sign);
+            break;
+        }
+
+        default:
+            error_occurred(ERR_BAD_INT_TYPE);
+        }
+        temp[len] = 0;
+
+        add_justified(temp, len, &pad, op->fs, finfo, op->trailing);
+    } else
+        /* type not found */
+        error_occurred(ERR_UNDEFINED_TYPE);
+}
+
+// Copy output into a string allocated with the exact size
+String Output::take_output()
+{
+    size_t len = m_obuf.size();
+    auto *string = STRING_ALLOC(len);
+    if (len)
+        memcpy(string->ptr(), m_obuf.get_array_address(0), len * sizeof(char_t));
+    string->ptr()[len] = 0;
+
+    // Bind it by the returned value, it's alive in GC
+    String ret(ValueType::NIL);
+    ret = string;
+    return ret;
+}
+
+/*
+ * THE (s)printf() function.
+ * The format string is compiled into ops for this call only.
+ */
+String Output::format_output(const char_t *format_str, Value *argv, ArgNo argc)
+{
+    CompiledFormat compiled;
+    compiled.key = 0;
+    compile_format(format_str, &compiled);
+    return execute_format(format_str, &compiled, argv, argc);
 } /* end of formatted */
 
+// Format by string value
+// The shared string is never freed or changed, its compiled ops are cached
+// by address. The others are compiled for this call only.
+String Output::format_output(const StringImpl *format, Value *argv, ArgNo argc)
+{
+    if ((format->attrib & (ReferenceImpl::SHARED | ReferenceImpl::CONSTANT)) !=
+        (ReferenceImpl::SHARED | ReferenceImpl::CONSTANT) || ! m_formats)
+        return format_output(format->ptr(), argv, argc);
+
+    size_t hash = (size_t)((Uint64)(IntR)format * 0x9E3779B97F4A7C15ULL >> 32);
+    for (size_t i = 0; i < MAX_PROBES; i++)
+    {
+        volatile Int64 *slot = &m_formats[(hash + i) & (FORMATS_COUNT - 1)];
+        auto *compiled = (CompiledFormat *)(IntR)*slot;
+        if (! compiled)
+        {
+            // Compile & publish it, the slot is never changed until shutdown
+            compiled = XNEW(CompiledFormat);
+            compiled->key = format;
+            compile_format(format->ptr(), compiled);
+            if (! std_cpu_lock_cas(slot, 0, (Int64)(IntR)compiled))
+            {
+                // Taken by other thread
+                XDELETE(compiled);
+                compiled = (CompiledFormat *)(IntR)*slot;
+            }
+        }
+
+        if (compiled->key == format)
+            return execute_format(format->ptr(), compiled, argv, argc);
+    }
+
+    // The slots are taken by others
+    return format_output(format->ptr(), argv, argc);
+}
+
 // Output Value
 String Output::type_value(const Value *value)
 {
+    m_sink = 0;
+    m_sink_failed = false;
     m_obuf.clear();
     type_value_at(value, 0);
-    return String((char_t *)m_obuf.get_array_address(0), m_obuf.size());
+    return take_output();
+}
+
+// Output Value to sink
+bool Output::type_value(const Value *value, OutputSink *sink)
+{
+    m_sink = sink;
+    m_sink_failed = false;
+    m_obuf.clear();
+    type_value_at(value, 0);
+    flush_chunk();
+    m_sink = 0;
+    return ! m_sink_failed;
+}
+
+// Write output to sink & clear it
+void Output::flush_chunk()
+{
+    if (! m_obuf.size())
+        return;
+
+    if (! m_sink_failed && ! m_sink->write(m_obuf.get_array_address(0), m_obuf.size()))
+        m_sink_failed = true;
+    m_obuf.clear();
 }
 
 /* output vm value */
@@ -637,6 +994,10 @@ void Output::type_value_at(const Value *value, size_t ident)
     char buffer[80];
     size_t i;
 
+    if (m_sink_failed)
+        // Nothing can be written any more
+        return;
+
     if (ident > 0)
         // Pad space
         add_pad(0, ident);
@@ -650,7 +1011,10 @@ void Output::type_value_at(const Value *value, size_t ident)
             add_char('<');
             add_c_str(Value::type_to_name(value->m_type));
             add_char(':');
-            add_number((Integer)value->m_reference, "0x%llX");
+            char address[32];
+            int64_to_string(address, sizeof(address), (Integer)value->m_reference, 16, 0, 1);
+            add_c_str("0x");
+            add_c_str(address);
             add_char('>');
             return;
         }
@@ -4,6 +4,7 @@
 
 #pragma once
 
+#include <stdio.h>
 #include "std_template/simple_vector.h"
 #include "std_template/simple_hash_set.h"
 #include "cmm.h"
@@ -15,12 +16,115 @@ namespace cmm
 class Value;
 struct StringImpl;
 
+// Destination of output, the text is written in chunks
+class OutputSink
+{
+public:
+    virtual ~OutputSink() { }
+
+    // Write a chunk, return false if failed (the rest is dropped)
+    virtual bool write(const char_t *data, size_t len) = 0;
+};
+
+// Write to stdio file
+class FileSink : public OutputSink
+{
+public:
+    FileSink(FILE *fp) : m_fp(fp) { }
+    virtual bool write(const char_t *data, size_t len);
+
+private:
+    FILE *m_fp;
+};
+
+// Write to file descriptor (file, pipe, etc.)
+class FdSink : public OutputSink
+{
+public:
+    FdSink(int fd) : m_fd(fd) { }
+    virtual bool write(const char_t *data, size_t len);
+
+private:
+    int m_fd;
+};
+
+// Write to a memory buffer of fixed size, fail when it's full
+class BufferSink : public OutputSink
+{
+public:
+    BufferSink(void *buf, size_t size) :
+        m_buf((Uint8 *)buf),
+        m_size(size),
+        m_written(0)
+    {
+    }
+    virtual bool write(const char_t *data, size_t len);
+
+    // Count of bytes written
+    size_t get_written() const { return m_written; }
+
+private:
+    Uint8 *m_buf;
+    size_t m_size;
+    size_t m_written;
+};
+
+// Send to a socket (id of Socket)
+// All or nothing of a chunk is queued, it fails when the output queue of
+// connection is full
+class SocketSink : public OutputSink
+{
+public:
+    SocketSink(Integer id) :
+        m_id(id),
+        m_sent(0)
+    {
+    }
+    virtual bool write(const char_t *data, size_t len);
+
+    // Count of bytes accepted
+    size_t get_sent() const { return m_sent; }
+
+private:
+    Integer m_id;
+    size_t m_sent;
+};
+
 class Output
 {
+public:
+    enum
+    {
+        FORMATS_COUNT = 1024,       // Cached formats, must be power of 2
+        MAX_PROBES = 8,             // Slots probed for a format
+        CHUNK_SIZE = 4096,          // Written to sink at most
+    };
+
+public:
+    Output() :
+        m_sink(0),
+        m_sink_failed(false)
+    {
+    }
+
+public:
+    // Initialize/shutdown this module
+    static bool init();
+    static void shutdown();
+
 public:
     String format_output(const char_t *format_str, Value *argv, ArgNo argc);
+
+    // The format of shared string is compiled once & cached
+    String format_output(const StringImpl *format, Value *argv, ArgNo argc);
+
     String type_value(const Value *value);
 
+    // Stream the value to sink in chunks, memory used is not related to
+    // size of value
+    // Return false if the sink failed
+    bool type_value(const Value *value, OutputSink *sink);
+
 private:
     enum ErrorCode
     {
@@ -101,11 +205,31 @@ private:
         const char_t *cur;
     };
 
+    // Op of compiled format, literal text or spec
+    struct FormatOp
+    {
+        size_t offset;              // Position in format string
+        size_t len;                 // Length of literal text, 0 for spec
+        int finfo;
+        int fs;
+        Integer pres;
+        PadInfo pad;
+        bool trailing;
+        bool has_star;              // Parsed again to take arguments
+        int error;                  // ErrorCode raised when executing
+    };
+
+    struct CompiledFormat
+    {
+        const StringImpl *key;
+        simple::unsafe_vector<FormatOp> ops;
+    };
+
 private:
     void    add_char(char_t ch);
     void    add_pad(PadInfo *pad, size_t len);
     void    add_nchars(const char_t *str, size_t len);
-    void    add_number(Int64 n, const char *format = "%lld");
+    void    add_number(Int64 n);
     void    add_string(const StringImpl *impl);
     void    add_c_str(const char *c_str);
     void    add_justified(const char_t *str, size_t slen, PadInfo *pad, int fs, int finfo, int trailing);
@@ -114,6 +238,12 @@ private:
     ANALYZER_NO_RETURN
     void    error_occurred(ErrorCode code);
     void    type_value_at(const Value *value, size_t ident);
+    bool    parse_spec(const char_t *format_str, size_t *pos, FormatOp *op, bool take_args);
+    void    compile_format(const char_t *format_str, CompiledFormat *compiled);
+    String  execute_format(const char_t *format_str, const CompiledFormat *compiled, Value *argv, ArgNo argc);
+    void    add_arg(const FormatOp *op);
+    String  take_output();
+    void    flush_chunk();
 
 private:
     Value *m_argv;
@@ -122,6 +252,11 @@ private:
     ArgNo  m_current_arg_index;
     simple::unsafe_vector<char_t> m_obuf; // Output buffer
     simple::hash_set<ReferenceImpl*> m_check_loop;
+    OutputSink *m_sink;                 // Output is streamed to it if not 0
+    bool m_sink_failed;
+
+private:
+    static volatile Int64 *m_formats;   // Compiled formats of shared strings
 };
 
 }
@@ -0,0 +1,242 @@
+// cmm_profiler.cpp
+
+#include <stdio.h>
+#include <string.h>
+#ifndef _WINDOWS
+#include <signal.h>
+#include <sys/time.h>
+#endif
+#include "std_template/simple_hash_map.h"
+#include "std_template/simple_string.h"
+#include "cmm_profiler.h"
+#include "cmm_program.h"
+#include "cmm_thread.h"
+#include "cmm_vm.h"
+
+namespace cmm
+{
+
+Profiler::Bucket* Profiler::m_buckets = 0;
+volatile Int64 Profiler::m_samples_count = 0;
+volatile Int64 Profiler::m_dropped_count = 0;
+bool Profiler::m_running = false;
+
+#ifndef _WINDOWS
+// Previous handler of SIGPROF
+static struct sigaction m_prev_action;
+#endif
+
+// Initialize this module
+bool Profiler::init()
+{
+    return true;
+}
+
+// Shutdown this module
+void Profiler::shutdown()
+{
+    stop();
+    if (m_buckets)
+    {
+        XDELETEN(m_buckets);
+    }
+}
+
+// Start sampling
+bool Profiler::start(Uint32 interval_us)
+{
+#ifdef _WINDOWS
+    return false;
+#else
+    if (m_running)
+        return false;
+
+    // Drop the samples of previous run
+    if (!m_buckets)
+        m_buckets = XNEWN(Bucket, BUCKETS_COUNT);
+    memset((void*)m_buckets, 0, sizeof(Bucket) * BUCKETS_COUNT);
+    m_samples_count = 0;
+    m_dropped_count = 0;
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = on_signal;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGPROF, &action, &m_prev_action) == -1)
+        return false;
+
+    struct itimerval timer;
+    timer.it_interval.tv_sec = interval_us / 1000000;
+    timer.it_interval.tv_usec = interval_us % 1000000;
+    timer.it_value = timer.it_interval;
+    if (setitimer(ITIMER_PROF, &timer, NULL) == -1)
+    {
+        sigaction(SIGPROF, &m_prev_action, NULL);
+        return false;
+    }
+
+    m_running = true;
+    return true;
+#endif
+}
+
+// Stop sampling
+void Profiler::stop()
+{
+#ifndef _WINDOWS
+    if (!m_running)
+        return;
+
+    struct itimerval timer;
+    memset(&timer, 0, sizeof(timer));
+    setitimer(ITIMER_PROF, &timer, NULL);
+    sigaction(SIGPROF, &m_prev_action, NULL);
+    m_running = false;
+#endif
+}
+
+// Write collapsed stacks to file
+// The stacks with same names (such as different positions in caller or
+// different versions of reloaded program) are merged
+bool Profiler::save(const char* file_name)
+{
+    FILE* fp = fopen(file_name, "w");
+    if (!fp)
+        return false;
+
+    // The functions can be resolved, the others may be obsoleted or
+    // sampled while pushing call context
+    simple::hash_map<void*, Function*> known_functions;
+    auto programs = Program::get_all_programs();
+    for (auto& program : programs)
+    {
+        for (FunctionNo i = 0; i < program->get_functions_count(); i++)
+        {
+            auto* function = program->get_function(i);
+            known_functions.put(function, function);
+        }
+    }
+
+    simple::hash_map<simple::string, Int64> stacks;
+    for (size_t i = 0; m_buckets && i < BUCKETS_COUNT; i++)
+    {
+        auto& bucket = m_buckets[i];
+        if (!bucket.ready)
+            continue;
+
+        simple::string stack;
+        for (Uint32 k = 0; k < bucket.depth; k++)
+        {
+            auto& frame = bucket.frames[k];
+            auto* function = Program::get_function_by_entry(frame.function_or_entry);
+            if (k)
+                stack += ";";
+            if (!known_functions.contains_key(function))
+            {
+                stack += "?";
+                continue;
+            }
+            stack += function->get_program()->get_name()->c_str();
+            stack += "::";
+            stack += function->get_name()->c_str();
+
+            // Position of executing instruction
+            auto* codes = function->get_byte_codes_addr();
+            if (frame.code && function->is_being_interpreted() &&
+                frame.code >= codes && frame.code < codes + function->get_byte_codes_count())
+            {
+                char buf[32];
+                snprintf(buf, sizeof(buf), "@%zu", (size_t)(frame.code - codes));
+                stack += buf;
+            }
+        }
+
+        Int64 count = 0;
+        stacks.try_get(stack, &count);
+        stacks.put(stack, count + bucket.count);
+    }
+
+    auto keys = stacks.keys();
+    for (auto& stack : keys)
+        fprintf(fp, "%s %lld\n", stack.c_str(), (long long)stacks[stack]);
+    fclose(fp);
+    return true;
+}
+
+// Handler of timer signal
+// Walk the call contexts of the interrupted thread only, they are not
+// changed by the others
+void Profiler::on_signal(int sig)
+{
+    auto* thread = Thread::get_current_thread();
+    if (!thread)
+        // Not a script thread
+        return;
+
+    auto* first_call_context = thread->get_all_call_contexts();
+    auto* call_context = thread->get_this_call_context();
+    if (call_context < first_call_context)
+        // Not in script function
+        return;
+
+    // Keep the inner frames if the stack is too deep
+    if (call_context - first_call_context >= MAX_DEPTH)
+        first_call_context = call_context - MAX_DEPTH + 1;
+
+    Frame frames[MAX_DEPTH];
+    Uint32 depth = 0;
+    for (auto* p = first_call_context; p <= call_context; p++, depth++)
+    {
+        frames[depth].function_or_entry = p->m_function_or_entry;
+        frames[depth].code = 0;
+    }
+    if (call_context->m_this_code)
+        frames[depth - 1].code = *call_context->m_this_code;
+
+    add_sample(frames, depth);
+}
+
+// Count a stack in table
+void Profiler::add_sample(const Frame* frames, Uint32 depth)
+{
+    std_cpu_lock_add(&m_samples_count, 1);
+
+    // FNV-1a of stack
+    Uint64 hash = 14695981039346656037ULL;
+    for (Uint32 i = 0; i < depth; i++)
+    {
+        hash = (hash ^ (Uint64)(size_t)frames[i].function_or_entry) * 1099511628211ULL;
+        hash = (hash ^ (Uint64)(size_t)frames[i].code) * 1099511628211ULL;
+    }
+    auto key = (Int64)(hash | 1);
+
+    for (size_t n = 0; n < BUCKETS_COUNT; n++)
+    {
+        auto& bucket = m_buckets[(hash + n) & (BUCKETS_COUNT - 1)];
+        if (bucket.key == 0 && std_cpu_lock_cas(&bucket.key, 0, key))
+        {
+            // Claimed, fill the frames before publishing it
+            memcpy(bucket.frames, frames, sizeof(Frame) * depth);
+            bucket.depth = depth;
+            std_cpu_lock_add(&bucket.count, 1);
+            std_cpu_lock_xchg(&bucket.ready, 1);
+            return;
+        }
+
+        if (bucket.key != key)
+            continue;
+
+        // Same hash, compare the frames if they are published
+        if (bucket.ready &&
+            (bucket.depth != depth || memcmp(bucket.frames, frames, sizeof(Frame) * depth) != 0))
+            continue;
+        std_cpu_lock_add(&bucket.count, 1);
+        return;
+    }
+
+    // Table is full
+    std_cpu_lock_add(&m_dropped_count, 1);
+}
+
+}
@@ -0,0 +1,89 @@
+// cmm_profiler.h
+// Sampling profiler of script functions
+
+#pragma once
+
+#include "std_port/std_port.h"
+#include "cmm.h"
+
+namespace cmm
+{
+
+struct Instruction;
+
+// Sample the call stacks of script functions periodically
+// The timer signal (SIGPROF) is delivered to the thread consuming cpu, the
+// handler walks call contexts of that thread from the outermost one to the
+// executing one & counts the stack in a fixed open addressing table. A
+// stack is identified by the entries of all frames & the executing
+// instruction of the innermost one. The bucket is claimed by CAS & the
+// count is increased atomically, so nothing is allocated or locked in
+// signal handler.
+// The functions are resolved when saving, the result is collapsed stacks
+// ("/prog::fn;/prog::fn@pos count" per line) to be drawn as flame graph.
+// The interval is rounded up to the tick of kernel timer, the cost is
+// one walk of call contexts per tick, so it can be kept in production.
+// ATTENTION: Not supported under windows, start() returns false.
+class Profiler
+{
+public:
+    enum
+    {
+        MAX_DEPTH = 48,             // The outer frames are truncated
+        BUCKETS_COUNT = 4096,       // Must be power of 2
+        DEFAULT_INTERVAL = 10000,   // In microseconds
+    };
+
+public:
+    // Initialize/shutdown this module
+    static bool init();
+    static void shutdown();
+
+public:
+    // Start sampling, return false if it's not supported or already started
+    static bool start(Uint32 interval_us = DEFAULT_INTERVAL);
+
+    // Stop sampling, the samples are kept until next start()
+    static void stop();
+
+    // Write collapsed stacks to file, return false if failed to open it
+    static bool save(const char* file_name);
+
+public:
+    static bool is_running() { return m_running; }
+    static size_t get_samples_count() { return (size_t)m_samples_count; }
+    static size_t get_dropped_count() { return (size_t)m_dropped_count; }
+
+private:
+    // Frame of a sampled stack
+    struct Frame
+    {
+        void* function_or_entry;
+        const Instruction* code;    // Only for the innermost frame
+    };
+
+    // Bucket of a stack
+    struct Bucket
+    {
+        volatile Int64 key;         // Hash of stack, 0 means empty
+        volatile Int64 count;
+        volatile Int64 ready;       // Frames are filled
+        Uint32 depth;
+        Frame frames[MAX_DEPTH];
+    };
+
+private:
+    // Handler of timer signal
+    static void on_signal(int sig);
+
+    // Count a stack in table
+    static void add_sample(const Frame* frames, Uint32 depth);
+
+private:
+    static Bucket* m_buckets;
+    static volatile Int64 m_samples_count;
+    static volatile Int64 m_dropped_count;
+    static bool m_running;
+};
+
+}
@@ -3,6 +3,7 @@
 #include <stdio.h>
 #include <stddef.h>
 #include "std_port/std_port.h"
+#include "std_port/std_port_mmap.h"
 #include "cmm_domain.h"
 #include "cmm_object.h"
 #include "cmm_program.h"
@@ -32,6 +33,8 @@ Function::Function(Program* program, const String& name)
     m_max_local_no = 0;
     m_ret_type = NIL;
     m_attrib = (Attrib)0;
+    m_mapped_byte_codes = 0;
+    m_mapped_byte_codes_count = 0;
 }
 
 // Destructor of function
@@ -110,6 +113,8 @@ const Instruction* Function::get_byte_codes_addr() const
 {
     STD_ASSERT(("Byte codes only for the interpreted function.\n",
                 is_being_interpreted()));
+    if (m_mapped_byte_codes)
+        return m_mapped_byte_codes;
     return m_byte_codes.get_array_address(0);
 }
 
@@ -124,6 +129,17 @@ void Function::set_byte_codes(Instruction* codes, size_t len)
     m_byte_codes.push_back_array(codes, len);
 }
 
+// Refer byte codes in a mapped image for interpreted function
+void Function::map_byte_codes(const Instruction* codes, size_t len)
+{
+    STD_ASSERT(("Byte codes only for the interpreted function.\n",
+                is_being_interpreted()));
+    STD_ASSERT(("There are byte codes existed for this function.\n",
+                m_byte_codes.size() == 0 && !m_mapped_byte_codes));
+    m_mapped_byte_codes = codes;
+    m_mapped_byte_codes_count = len;
+}
+
 ObjectVar::ObjectVar(Program* program, const String& name)
 {
     m_program = program;
@@ -181,26 +197,42 @@ Program::Program(const String& name, Attrib attrib)
 {
     m_name = Program::find_or_add_string(name.m_string);
     m_value_list.set_name(m_name->c_str());
-    auto* prev_program = find_program_by_name(m_name);
-    if (prev_program)
+
+    // Set default object's size
+    m_entire_object_size = 0;
+    m_this_component_size = offsetof(AbstractComponent, m_object_vars);
+
+    m_attrib = attrib;
+    m_new_instance_func = 0;
+    m_image = 0;
+    m_image_size = 0;
+
+    // The interpreted program is registered by compiler after all byte
+    // codes generated, nobody can see a half-done one
+    if (!(attrib & Program::INTERPRETED))
+        register_program();
+}
+
+// Put this program into the program table
+// The previous one with same name is replaced (interpreted only)
+void Program::register_program()
+{
+    std_enter_critical_section(m_program_cs);
+    Program* prev_program;
+    if (m_name_programs->try_get(m_name, &prev_program))
     {
-        if (!(attrib & Program::INTERPRETED))
-            throw_error("Program %s has been defined.\n", name.c_str());
+        if (!(m_attrib & Program::INTERPRETED))
+        {
+            std_leave_critical_section(m_program_cs);
+            throw_error("Program %s has been defined.\n", m_name->c_str());
+        }
 
         // Replace the previous definition with new one, put the
         // old one to obsoleted set
         m_obsoleted_programs->put(prev_program);
     }
-
-    std_enter_critical_section(m_program_cs);
     m_name_programs->put(m_name, this);
     std_leave_critical_section(m_program_cs);
-
-    // Set default object's size
-    m_entire_object_size = 0;
-    m_this_component_size = offsetof(AbstractComponent, m_object_vars);
-
-    m_attrib = attrib;
 }
 
 // Destruct program (only being called when shuttint down)
@@ -217,12 +249,18 @@ Program::~Program()
     // Destruct all constants
     m_value_list.free();
 
+    // Functions referred the byte codes in image are gone
+    if (m_image)
+        std_unmap_file(m_image, m_image_size);
+
     std_enter_critical_section(m_program_cs);
-    if (m_name_programs->find(m_name)->second == this)
+    Program* active_program;
+    if (m_name_programs->try_get(m_name, &active_program) &&
+        active_program == this)
         // This program is active now, removed
         m_name_programs->erase(m_name);
     else
-        // This program is obsoleted, removed
+        // This program is obsoleted or not registered, removed
         m_obsoleted_programs->erase(this);
     std_leave_critical_section(m_program_cs);
 }
@@ -299,6 +337,15 @@ void Program::update_all_programs()
         it.second->update_program();
 }
 
+// Get all active programs
+simple::vector<Program*> Program::get_all_programs()
+{
+    std_enter_critical_section(m_program_cs);
+    auto programs = m_name_programs->values();
+    std_leave_critical_section(m_program_cs);
+    return programs;
+}
+
 // Create a interpreter component
 Object* Program::new_interpreter_component()
 {
@@ -322,7 +369,7 @@ ConstantIndex Program::define_constant(const Value& value)
             dup.m_reference = dup.m_reference->copy_to_local(thread);
 
             // Mark them to constant
-            mark_constant(&dup);
+            mark_constant(&dup, &m_value_list);
         }
     }
 
@@ -598,14 +645,16 @@ void Program::add_component(const String& program_name)
 }
 
 // Update program after all programs are loaded
-void Program::update_program()
+void Program::update_program(const ProgramNameMap* pending_programs)
 {
     m_this_component_size = offsetof(AbstractComponent, m_object_vars) + m_object_vars.size() * sizeof(Value);
 
     // Lookup program by name
     for (auto &it: m_components)
     {
-        auto* program = Program::find_program_by_name(it.program_name);
+        Program* program;
+        if (!pending_programs || !pending_programs->try_get(it.program_name, &program))
+            program = Program::find_program_by_name(it.program_name);
         STD_ASSERT(("Program is not found.", program));
         it.program = program;
     }
@@ -632,7 +681,7 @@ void Program::update_program()
 
 // Mark a reference value & all values to CONSTANT in this container
 // (if value is array or mapping)
-void Program::mark_constant(Value* value)
+void Program::mark_constant(Value* value, ValueList* list)
 {
     auto* reference = value->m_reference;
     if (reference->attrib & ReferenceImpl::CONSTANT)
@@ -646,10 +695,10 @@ void Program::mark_constant(Value* value)
         return;
     }
 
-    // Move non-string reference value to this program
+    // Move non-string reference value to the list
     reference->attrib |= ReferenceImpl::CONSTANT;
     reference->unbind();
-    m_value_list.append_value(reference);
+    list->append_value(reference);
     switch (value->m_type)
     {
     case ARRAY:
@@ -657,7 +706,7 @@ void Program::mark_constant(Value* value)
         for (auto& it : ((ArrayImpl*)reference)->a)
         {
             if (it.is_reference_value())
-                mark_constant(&it);
+                mark_constant(&it, list);
         }
         break;
 
@@ -666,9 +715,9 @@ void Program::mark_constant(Value* value)
         for (auto& it : ((MapImpl*)reference)->m)
         {
             if (it.first.is_reference_value())
-                mark_constant(&it.first);
+                mark_constant(&it.first, list);
             if (it.second.is_reference_value())
-                mark_constant(&it.second);
+                mark_constant(&it.second, list);
         }
         break;
 
@@ -751,6 +800,18 @@ void Program::mark_value(MarkValueState& state, Object* object)
 // Create a new instance
 Object* Program::new_instance(Domain* domain)
 {
+    ObjectId oid;
+    oid.i64 = 0;
+    return new_instance(domain, oid);
+}
+
+// Create a new instance with specified oid (0 means to allocate one)
+// Return 0 if the oid is in use
+Object* Program::new_instance(Domain* domain, ObjectId oid)
+{
+    if (domain->get_type() == Domain::READ_ONLY)
+        throw_error("Can't create object in read-only domain %s.\n", domain->get_name());
+
     Thread* thread = Thread::get_current_thread();
     Domain* prev_domain = thread->get_current_domain();
 
@@ -777,8 +838,13 @@ Object* Program::new_instance(Domain* domain)
                 p->m_object_vars[object_var->m_no].m_type = type;
             }
         }
-        ob->assign_oid();
-        ob->set_domain(domain);
+        if (ob->assign_oid(oid))
+            ob->set_domain(domain);
+        else
+        {
+            STD_MEM_FREE(ob);
+            ob = 0;
+        }
     }
 
     thread->switch_domain(prev_domain);
@@ -821,7 +887,11 @@ Value Program::invoke(Thread* thread, ObjectId oid, const Value& function_name,
     // ATTENTION: When program executed here, it should push all registeres before calling
     // this routine into stack(>=stack pointer). Since the GC will trace all root pointers
     // in local stack. It will lose root if any registered was not saved now.
-    thread->push_domain_context(args + n);
+    // Without argument, start from address of local variable (see Thread::drain_mailbox)
+    void *start_sp = &start_sp;
+    if (args)
+        start_sp = args + n;
+    thread->push_domain_context(start_sp);
     thread->get_current_domain()->check_gc();  // Check target domain GC after copied arguments
     Value other_ret = (component_impl->*func)(thread, args, n);
     Value this_ret = thread->pop_domain_context(other_ret);
@@ -830,6 +900,33 @@ Value Program::invoke(Thread* thread, ObjectId oid, const Value& function_name,
     return this_ret; // Return value was in this_ret
 }
 
+// Invoke a function of object in READ_ONLY domain
+// The object is never changed (see Domain::set_read_only), so it's called
+// in current domain without entering its domain. The arguments, temporary
+// values & return value are all in current domain, nothing to be copied.
+Value Program::invoke_read_only(Thread* thread, Object* object, const Value& function_name, Value* args, ArgNo n) const
+{
+    CalleeInfo callee;
+
+    if (function_name.m_type != ValueType::STRING)
+        // Bad type of function name
+        return NIL;
+
+    if (!get_public_callee_by_name((String*)&function_name, &callee))
+        // No such function
+        return NIL;
+
+    // Call
+    auto component_no = callee.component_no;
+    auto offset = get_component_offset(component_no);
+    auto* component_impl = (AbstractComponent*)(((Uint8*)object) + offset);
+    auto func = callee.function->get_script_entry();
+    thread->push_call_context(object, callee.function, args, n, component_no);
+    Value ret = (component_impl->*func)(thread, args, n);
+    thread->pop_call_context();
+    return ret;
+}
+
 // Invoke self function
 // Call public function in this program OR private function of this component
 Value Program::invoke_self(Thread* thread, const Value& function_name, Value* args, ArgNo n) const
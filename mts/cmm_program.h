@@ -134,6 +134,15 @@ public:
         };
     };
 
+    // Call inlined into byte codes, keep it for tracing
+    struct InlinedCall
+    {
+        Uint32 start;           // Range of byte codes [start, end)
+        Uint32 end;
+        const Function* callee;
+    };
+    typedef simple::vector<InlinedCall> InlinedCalls;
+
 public:
     Function(Program* program, const String& name);
     ~Function();
@@ -168,6 +177,20 @@ public:
     // Set byte codes
     void set_byte_codes(Instruction* codes, size_t len);
 
+    // Refer byte codes in a mapped image instead of copying them
+    // The image must be alive until the function is destructed
+    void map_byte_codes(const Instruction* codes, size_t len);
+
+    // Add a call inlined into byte codes
+    void add_inlined_call(Uint32 start, Uint32 end, const Function* callee)
+    {
+        InlinedCall call;
+        call.start = start;
+        call.end = end;
+        call.callee = callee;
+        m_inlined_calls.push_back(call);
+    }
+
 public:
     // Get attribute
     Attrib get_attrib() const
@@ -175,12 +198,24 @@ public:
         return m_attrib;
     }
 
+    // Get count of byte codes
+    size_t get_byte_codes_count() const
+    {
+        return m_mapped_byte_codes ? m_mapped_byte_codes_count : m_byte_codes.size();
+    }
+
     // Get the entry pointer for efun
     EfunEntry get_efun_entry() const
     {
         return m_entry.efun_entry;
     }
 
+    // Get the calls inlined into byte codes
+    const InlinedCalls& get_inlined_calls() const
+    {
+        return m_inlined_calls;
+    }
+
     // Get local variables
     const LocalVariables& get_local_variables() const
     {
@@ -271,6 +306,11 @@ private:
     // Byte codes for interpreted function
     typedef simple::unsafe_vector<Instruction> ByteCodes;
     ByteCodes m_byte_codes;
+    InlinedCalls m_inlined_calls;
+
+    // Byte codes in mapped image (not owned), prior to m_byte_codes
+    const Instruction* m_mapped_byte_codes;
+    size_t m_mapped_byte_codes_count;
 
     // Entry
     Entry       m_entry;
@@ -284,6 +324,19 @@ friend Program;
 public:
     ObjectVar(Program* program, const String& name);
 
+public:
+    // Get name of object var
+    StringImpl* get_name() const
+    {
+        return m_name;
+    }
+
+    // Get type of object var
+    ValueType get_type() const
+    {
+        return m_type;
+    }
+
 private:
     StringImpl*  m_name;
     Program*     m_program;
@@ -318,6 +371,9 @@ public:
         ComponentOffset offset;
     };
 
+    // Program name -> program map
+    typedef simple::hash_map<StringImpl*, Program*> ProgramNameMap;
+
 public:
     // Initialize/shutdown this module
     static bool init();
@@ -351,6 +407,9 @@ public:
     // Update callees of all programs
     static void update_all_programs();
 
+    // Get all active programs
+    static simple::vector<Program*> get_all_programs();
+
 public:
     // Create an interpreter component
     static Object* new_interpreter_component();
@@ -391,20 +450,34 @@ public:
     // Add component in this program
     void add_component(const String& program_name);
 
+    // Put this program into the program table
+    void register_program();
+
     // Set function handler: new_instance
     void set_new_instance_func(NewInstanceFunc func)
     {
         m_new_instance_func = func;
     }
 
+    // Keep the mapped image referred by this program, unmapped when
+    // program is destructed
+    void set_image(void* image, size_t size)
+    {
+        m_image = image;
+        m_image_size = size;
+    }
+
     // Update program after all programs are loaded
-    void update_program();
+    // The components are looked up in pending programs (not registered
+    // yet) at first if pending_programs is not 0
+    void update_program(const ProgramNameMap* pending_programs = 0);
 
-private:
+public:
     // Mark a reference value & all values to CONSTANT in this container
-    // (if value is array or mapping)
-    void mark_constant(Value* value);
-        
+    // (if value is array or mapping), move them to list
+    static void mark_constant(Value* value, ValueList* list);
+
+private:
     // Update all callees during updating program
     void update_callees();
 
@@ -421,6 +494,18 @@ public:
         return m_components[component_no].offset;
     }
 
+    // Get component name by component no
+    StringImpl* get_component_name(ComponentNo component_no) const
+    {
+        return m_components[component_no].program_name;
+    }
+
+    // Get components count (include itself)
+    ComponentNo get_components_count() const
+    {
+        return (ComponentNo)m_components.size();
+    }
+
     // Get constant by index
     Value* get_constant(ConstantIndex index) const
     {
@@ -439,6 +524,12 @@ public:
         return m_functions[function_no];
     }
 
+    // Get functions count
+    FunctionNo get_functions_count() const
+    {
+        return (FunctionNo)m_functions.size();
+    }
+
     // Get mapped component no
     ComponentNo get_mapped_component_no(ComponentNo this_component_no, ComponentNo call_component_no) const
     {
@@ -503,12 +594,19 @@ public:
     // Create a new instance
     Object* new_instance(Domain* domain);
 
+    // Create a new instance with specified oid (to restore a saved one)
+    Object* new_instance(Domain* domain, ObjectId oid);
+
     // Invoke routine
     // function_name may be modified to shared string, IGNORE the const
     // ATTENTION: Must use Value for input parameter to avoid constructor String(),
     // or the modification of function_name (to lookup shared) would be useless.
     Value invoke(Thread* thread, ObjectId oid, const Value& function_name, Value* args, ArgNo n) const;
 
+    // Invoke routine of object in READ_ONLY domain without entering it
+    // See ATTENTION of invoke
+    Value invoke_read_only(Thread* thread, Object* object, const Value& function_name, Value* args, ArgNo n) const;
+
     // Invoke routine can be accessed by self component
     // See ATTENTION of invoke
     Value invoke_self(Thread* thread, const Value& function_name, Value* args, ArgNo n) const;
@@ -535,7 +633,6 @@ private:
     static FunctionEntryMap* m_entry_functions;
 
     // Program name -> program map
-    typedef simple::hash_map<StringImpl*, Program*> ProgramNameMap;
     static ProgramNameMap* m_name_programs;
 
     // Obsoleted programs
@@ -554,6 +651,10 @@ private:
     // New() instance function
     NewInstanceFunc m_new_instance_func;
 
+    // Mapped image of program cache (see ProgramCache)
+    void* m_image;
+    size_t m_image_size;
+
     // All components of this program
     simple::unsafe_vector<ComponentInfo> m_components;
 
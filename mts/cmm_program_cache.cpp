@@ -0,0 +1,607 @@
+// cmm_program_cache.cpp
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "std_port/std_port.h"
+#include "std_port/std_port_cs.h"
+#include "std_port/std_port_mmap.h"
+#include "cmm_file_path.h"
+#include "cmm_program.h"
+#include "cmm_program_cache.h"
+#include "cmm_vm.h"
+
+namespace cmm
+{
+
+// Append records to image
+class ImageWriter
+{
+public:
+    ImageWriter() :
+        m_data(4096)
+    {
+    }
+
+public:
+    void write(const void* data, size_t size)
+    {
+        m_data.push_back_array((const Uint8*)data, size);
+    }
+
+    void write_u8(Uint8 v) { write(&v, sizeof(v)); }
+    void write_u32(Uint32 v) { write(&v, sizeof(v)); }
+
+    // Write string with terminator, so it can be used in image directly
+    void write_string(const StringImpl* string)
+    {
+        write_u32((Uint32)string->length());
+        write(string->c_str(), string->length() + 1);
+    }
+
+    // Write a constant value, return false if it can't be saved
+    bool write_value(const Value& value)
+    {
+        write_u8((Uint8)value.m_type);
+        switch (value.m_type)
+        {
+        case NIL:
+            return true;
+        case INTEGER:
+            write(&value.m_int, sizeof(value.m_int));
+            return true;
+        case REAL:
+            write(&value.m_real, sizeof(value.m_real));
+            return true;
+        case STRING:
+            write_string(value.m_string);
+            return true;
+        case ARRAY:
+            write_u32((Uint32)value.m_array->size());
+            for (auto& it : value.m_array->a)
+                if (!write_value(it))
+                    return false;
+            return true;
+        case MAPPING:
+            write_u32((Uint32)value.m_map->size());
+            for (auto& it : value.m_map->m)
+                if (!write_value(it.first) || !write_value(it.second))
+                    return false;
+            return true;
+        default:
+            // Buffer, function, object... can't be in image
+            return false;
+        }
+    }
+
+    // Pad to align
+    void align(size_t n)
+    {
+        while (m_data.size() % n)
+            write_u8(0);
+    }
+
+    size_t size() const { return m_data.size(); }
+    Uint8* data() const { return &m_data[0]; }
+
+private:
+    simple::vector<Uint8> m_data;
+};
+
+// Read records from a mapped image
+// All reading are bounded, m_is_bad is set when out of image
+class ImageReader
+{
+public:
+    ImageReader(const Uint8* data, size_t size) :
+        m_data(data),
+        m_size(size),
+        m_offset(sizeof(ProgramCache::ImageHeader)),
+        m_is_bad(false)
+    {
+    }
+
+public:
+    const void* read(size_t size)
+    {
+        if (m_is_bad || size > m_size - m_offset)
+        {
+            m_is_bad = true;
+            return 0;
+        }
+        auto* p = m_data + m_offset;
+        m_offset += size;
+        return p;
+    }
+
+    Uint8 read_u8()
+    {
+        auto* p = (const Uint8*)read(sizeof(Uint8));
+        return p ? *p : 0;
+    }
+
+    Uint32 read_u32()
+    {
+        Uint32 v = 0;
+        auto* p = read(sizeof(v));
+        if (p)
+            memcpy(&v, p, sizeof(v));
+        return v;
+    }
+
+    // Return c string in image, "" if bad
+    const char* read_string()
+    {
+        auto len = read_u32();
+        auto* p = (const char*)read((size_t)len + 1);
+        if (!p || p[len] != 0)
+        {
+            m_is_bad = true;
+            return "";
+        }
+        return p;
+    }
+
+    // Read a constant value
+    // The container is created as temporary (not binded to domain), it
+    // will be copied by Program::define_constant
+    Value read_value()
+    {
+        Value value = NIL;
+        switch (read_u8())
+        {
+        case NIL:
+            break;
+        case INTEGER:
+        {
+            Integer v = 0;
+            if (auto* p = read(sizeof(v)))
+                memcpy(&v, p, sizeof(v));
+            value = v;
+            break;
+        }
+        case REAL:
+        {
+            Real v = 0;
+            if (auto* p = read(sizeof(v)))
+                memcpy(&v, p, sizeof(v));
+            value = v;
+            break;
+        }
+        case STRING:
+            value = Program::find_or_add_string(read_string());
+            break;
+        case ARRAY:
+        {
+            auto count = read_u32();
+            if (count > m_size)
+            {
+                m_is_bad = true;
+                break;
+            }
+            auto* array = XNEW(ArrayImpl, count);
+            for (Uint32 i = 0; i < count && !m_is_bad; i++)
+                array->push_back(read_value());
+            value.m_type = ARRAY;
+            value.m_array = array;
+            break;
+        }
+        case MAPPING:
+        {
+            auto count = read_u32();
+            if (count > m_size)
+            {
+                m_is_bad = true;
+                break;
+            }
+            auto* map = XNEW(MapImpl, count);
+            for (Uint32 i = 0; i < count && !m_is_bad; i++)
+            {
+                Value key = read_value();
+                Value element = read_value();
+                map->set(key, element);
+            }
+            value.m_type = MAPPING;
+            value.m_map = map;
+            break;
+        }
+        default:
+            m_is_bad = true;
+            break;
+        }
+        return value;
+    }
+
+    // Free temporary container created by read_value
+    static void free_value(Value* value)
+    {
+        if (value->m_type == ARRAY)
+        {
+            XDELETE(value->m_array);
+        } else
+        if (value->m_type == MAPPING)
+        {
+            XDELETE(value->m_map);
+        }
+        *value = NIL;
+    }
+
+    bool is_bad() const { return m_is_bad; }
+
+    // Content is invalid although it's in image
+    void set_bad() { m_is_bad = true; }
+
+private:
+    const Uint8* m_data;
+    size_t m_size;
+    size_t m_offset;
+    bool m_is_bad;
+};
+
+// Stamps of sources known
+ProgramCache::SourceStampMap* ProgramCache::m_source_stamps = 0;
+std_critical_section_t* ProgramCache::m_cs = 0;
+
+bool ProgramCache::init()
+{
+    m_source_stamps = XNEW(SourceStampMap);
+    std_new_critical_section(&m_cs);
+    return true;
+}
+
+void ProgramCache::shutdown()
+{
+    std_delete_critical_section(m_cs);
+    XDELETE(m_source_stamps);
+}
+
+// Get modified time & size of a source file
+bool ProgramCache::stat_source_file(const char* file_name, SourceStamp* stamp)
+{
+    struct stat st;
+    if (stat(file_name, &st) == -1)
+        return false;
+
+#ifdef __linux__
+    stamp->mtime = (Uint64)st.st_mtim.tv_sec * 1000000000 + (Uint64)st.st_mtim.tv_nsec;
+#else
+    stamp->mtime = (Uint64)st.st_mtime * 1000000000;
+#endif
+    stamp->size = (Uint64)st.st_size;
+    stamp->hash = 0;
+
+    // Reuse the hash if this version of file was hashed
+    SourceStamp known;
+    std_enter_critical_section(m_cs);
+    bool found = m_source_stamps->try_get(file_name, &known);
+    std_leave_critical_section(m_cs);
+    if (found && known.mtime == stamp->mtime && known.size == stamp->size)
+        stamp->hash = known.hash;
+    return true;
+}
+
+// Hash content of a source file (FNV-1a 64)
+bool ProgramCache::hash_source_file(const char* file_name, SourceStamp* stamp)
+{
+    if (stamp->hash)
+        // Already hashed
+        return true;
+
+    FILE *fp = fopen(file_name, "rb");
+    if (!fp)
+        return false;
+
+    Uint64 hash = 0xCBF29CE484222325ULL;
+    Uint8 buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+    {
+        for (size_t i = 0; i < n; i++)
+        {
+            hash ^= buf[i];
+            hash *= 0x100000001B3ULL;
+        }
+    }
+    fclose(fp);
+
+    // 0 is reserved for not hashed
+    stamp->hash = hash ? hash : 1;
+
+    std_enter_critical_section(m_cs);
+    m_source_stamps->put(file_name, *stamp);
+    std_leave_critical_section(m_cs);
+    return true;
+}
+
+// Get image file name of program in output directory
+// Program "/a/b" -> output/a/b.b
+bool ProgramCache::get_image_file_name(const simple::string& program_name, simple::string* image_file_name)
+{
+    char output_dir[MAX_PATH_LEN];
+    FilePath::get_output_dir(output_dir, sizeof(output_dir));
+    if (!output_dir[0])
+        // No output directory, don't cache
+        return false;
+
+    char file_name[MAX_PATH_LEN];
+    if (FilePath::generate_output_file_name(program_name.c_str(), file_name, sizeof(file_name), ".b") != OK)
+        return false;
+
+    *image_file_name = file_name;
+    return true;
+}
+
+// Is the header valid for source?
+// Compare the stamp at first, hash the source only if it's touched
+bool ProgramCache::is_valid_header(const void* image, size_t size,
+                                   const char* source_file_name, SourceStamp* stamp)
+{
+    auto* header = (const ProgramCache::ImageHeader*)image;
+    if (size < sizeof(ProgramCache::ImageHeader))
+        return false;
+
+    if (header->magic != ProgramCache::IMAGE_MAGIC ||
+        header->version != ProgramCache::IMAGE_VERSION ||
+        header->instruction_size != sizeof(Instruction) ||
+        header->image_size != size ||
+        header->codes_offset % ProgramCache::IMAGE_CODES_ALIGN != 0 ||
+        header->codes_offset > size ||
+        (size - header->codes_offset) / sizeof(Instruction) < header->codes_count)
+        // Bad image
+        return false;
+
+    if (header->source_size != stamp->size)
+        // Source is changed
+        return false;
+
+    if (header->source_mtime == stamp->mtime)
+        // Source is not touched since the image was saved
+        return true;
+
+    return hash_source_file(source_file_name, stamp) &&
+           header->source_hash == stamp->hash;
+}
+
+// Is the image valid for source?
+bool ProgramCache::validate(const char* image_file_name, const char* source_file_name,
+                            SourceStamp* stamp)
+{
+    size_t size;
+    void* image = std_map_file(image_file_name, &size);
+    if (!image)
+        return false;
+
+    bool ret = is_valid_header(image, size, source_file_name, stamp);
+    std_unmap_file(image, size);
+    return ret;
+}
+
+// Load program from image if it's valid for source
+Program* ProgramCache::load(const char* image_file_name, const char* source_file_name,
+                            SourceStamp* stamp, simple::vector<simple::string>* components)
+{
+    size_t size;
+    void* image = std_map_file(image_file_name, &size);
+    if (!image)
+        return 0;
+
+    if (!is_valid_header(image, size, source_file_name, stamp))
+    {
+        // Outdated
+        std_unmap_file(image, size);
+        return 0;
+    }
+
+    auto* header = (const ImageHeader*)image;
+    auto* codes = (const Instruction*)((const Uint8*)image + header->codes_offset);
+    ImageReader reader((const Uint8*)image, size);
+
+    auto* program = XNEW(Program, reader.read_string(), Program::INTERPRETED);
+    program->set_image(image, size);
+
+    // Self is the first component
+    auto components_count = reader.read_u32();
+    for (Uint32 i = 0; i < components_count && !reader.is_bad(); i++)
+    {
+        const char* name = reader.read_string();
+        program->add_component(name);
+        if (i > 0)
+            components->push_back(name);
+    }
+
+    auto object_vars_count = reader.read_u32();
+    for (Uint32 i = 0; i < object_vars_count && !reader.is_bad(); i++)
+    {
+        const char* name = reader.read_string();
+        program->define_object_var(name, (ValueType)reader.read_u8());
+    }
+
+    auto constants_count = reader.read_u32();
+    for (Uint32 i = 0; i < constants_count && !reader.is_bad(); i++)
+    {
+        Value value = reader.read_value();
+        if (!reader.is_bad())
+            program->define_constant(value);
+        ImageReader::free_value(&value);
+    }
+
+    auto functions_count = reader.read_u32();
+    for (Uint32 i = 0; i < functions_count && !reader.is_bad(); i++)
+    {
+        const char* name = reader.read_string();
+        auto attrib = (Function::Attrib)reader.read_u32();
+        auto* function = program->define_function(name, 0, 0, 0, attrib);
+
+        auto parameters_count = reader.read_u32();
+        for (Uint32 k = 0; k < parameters_count && !reader.is_bad(); k++)
+        {
+            const char* parameter_name = reader.read_string();
+            auto type = (ValueType)reader.read_u8();
+            function->define_parameter(parameter_name, type, (Parameter::Attrib)reader.read_u32());
+        }
+        if (!function->finish_adding_parameters())
+        {
+            reader.set_bad();
+            break;
+        }
+        function->define_ret_type((ValueType)reader.read_u8());
+        function->reserve_local((LocalNo)reader.read_u32());
+
+        auto codes_start = reader.read_u32();
+        auto codes_count = reader.read_u32();
+        if (codes_start > header->codes_count ||
+            codes_count > header->codes_count - codes_start)
+        {
+            reader.set_bad();
+            break;
+        }
+        function->map_byte_codes(codes + codes_start, codes_count);
+    }
+
+    // Inlined calls refer to functions defined above
+    for (Uint32 i = 0; i < functions_count && !reader.is_bad(); i++)
+    {
+        auto* function = program->get_function(i);
+        auto inlined_calls_count = reader.read_u32();
+        for (Uint32 k = 0; k < inlined_calls_count && !reader.is_bad(); k++)
+        {
+            auto start = reader.read_u32();
+            auto end = reader.read_u32();
+            auto callee_no = reader.read_u32();
+            if (callee_no >= functions_count)
+            {
+                reader.set_bad();
+                break;
+            }
+            function->add_inlined_call(start, end, program->get_function(callee_no));
+        }
+    }
+
+    if (reader.is_bad() ||
+        program->get_functions_count() != functions_count ||
+        program->get_constants_count() != constants_count)
+    {
+        // Bad image, the mapping is released by program
+        STD_TRACE("Bad program image %s.\n", image_file_name);
+        XDELETE(program);
+        components->clear();
+        return 0;
+    }
+
+    return program;
+}
+
+// Save program to image
+bool ProgramCache::save(const char* image_file_name, const char* source_file_name,
+                        SourceStamp* stamp, const Program* program)
+{
+    if (!hash_source_file(source_file_name, stamp))
+        return false;
+
+    ImageWriter writer;
+    ImageHeader header;
+    memset(&header, 0, sizeof(header));
+    writer.write(&header, sizeof(header));
+
+    writer.write_string(program->get_name());
+
+    writer.write_u32((Uint32)program->get_components_count());
+    for (ComponentNo i = 0; i < program->get_components_count(); i++)
+        writer.write_string(program->get_component_name(i));
+
+    writer.write_u32((Uint32)program->get_object_vars_count());
+    for (VariableNo i = 0; i < program->get_object_vars_count(); i++)
+    {
+        auto* object_var = program->get_object_var(i);
+        writer.write_string(object_var->get_name());
+        writer.write_u8((Uint8)object_var->get_type());
+    }
+
+    writer.write_u32((Uint32)program->get_constants_count());
+    for (ConstantIndex i = 0; i < program->get_constants_count(); i++)
+        if (!writer.write_value(*program->get_constant(i)))
+            // Can't be saved in image
+            return false;
+
+    // Byte codes of functions are laid out one by one
+    auto functions_count = program->get_functions_count();
+    Uint32 codes_count = 0;
+    writer.write_u32((Uint32)functions_count);
+    for (FunctionNo i = 0; i < functions_count; i++)
+    {
+        auto* function = program->get_function(i);
+        writer.write_string(function->get_name());
+        writer.write_u32((Uint32)function->get_attrib());
+        auto& parameters = function->get_parameters();
+        writer.write_u32((Uint32)parameters.size());
+        for (size_t k = 0; k < parameters.size(); k++)
+        {
+            auto* parameter = parameters[k];
+            writer.write_string(parameter->get_name());
+            writer.write_u8((Uint8)parameter->get_type());
+            writer.write_u32((Uint32)parameter->get_attrib());
+        }
+        writer.write_u8((Uint8)function->get_ret_type());
+        writer.write_u32((Uint32)function->get_max_local_no());
+        writer.write_u32(codes_count);
+        writer.write_u32((Uint32)function->get_byte_codes_count());
+        codes_count += (Uint32)function->get_byte_codes_count();
+    }
+
+    for (FunctionNo i = 0; i < functions_count; i++)
+    {
+        auto& inlined_calls = program->get_function(i)->get_inlined_calls();
+        writer.write_u32((Uint32)inlined_calls.size());
+        for (size_t k = 0; k < inlined_calls.size(); k++)
+        {
+            auto& call = inlined_calls[k];
+            FunctionNo callee_no = 0;
+            while (callee_no < functions_count && program->get_function(callee_no) != call.callee)
+                callee_no++;
+            writer.write_u32(call.start);
+            writer.write_u32(call.end);
+            writer.write_u32((Uint32)callee_no);
+        }
+    }
+
+    writer.align(IMAGE_CODES_ALIGN);
+    header.codes_offset = (Uint32)writer.size();
+    header.codes_count = codes_count;
+    for (FunctionNo i = 0; i < functions_count; i++)
+    {
+        auto* function = program->get_function(i);
+        writer.write(function->get_byte_codes_addr(),
+                     function->get_byte_codes_count() * sizeof(Instruction));
+    }
+
+    header.magic = IMAGE_MAGIC;
+    header.version = IMAGE_VERSION;
+    header.instruction_size = (Uint16)sizeof(Instruction);
+    header.source_hash = stamp->hash;
+    header.source_mtime = stamp->mtime;
+    header.source_size = stamp->size;
+    header.image_size = (Uint32)writer.size();
+    memcpy(writer.data(), &header, sizeof(header));
+
+    // Write to temporary file & rename, the readers never see a partial
+    // image
+    if (FilePath::assure_path(image_file_name) != OK)
+        return false;
+    simple::string temp_file_name = simple::string(image_file_name) + ".tmp";
+    FILE *fp = fopen(temp_file_name.c_str(), "wb");
+    if (!fp)
+        return false;
+    bool succ = fwrite(writer.data(), 1, writer.size(), fp) == writer.size();
+    succ = (fclose(fp) == 0) && succ;
+    if (succ && rename(temp_file_name.c_str(), image_file_name) != 0)
+    {
+        // Rename can't replace existed file on some platforms
+        remove(image_file_name);
+        succ = rename(temp_file_name.c_str(), image_file_name) == 0;
+    }
+    if (!succ)
+        remove(temp_file_name.c_str());
+    return succ;
+}
+
+}
@@ -0,0 +1,109 @@
+// cmm_program_cache.h
+// Precompiled image of interpreted program
+
+#pragma once
+
+#include "std_port/std_port.h"
+#include "std_template/simple_hash_map.h"
+#include "std_template/simple_string.h"
+#include "std_template/simple_vector.h"
+#include "cmm.h"
+#include "cmm_value.h"
+
+namespace cmm
+{
+
+class Program;
+
+// Save compiled program to an image file & load it back without lexing,
+// parsing & generating again.
+// Layout of image:
+//    [ImageHeader]
+//    Records: name, components, object vars, constants, functions
+//    [Padding to align Instruction]
+//    Byte codes of all functions
+// The image is mapped read-only, the byte codes are referred by functions
+// directly, so they are paged in when the functions are executed at
+// first time. The image is valid only when the source, version & layout
+// of Instruction are all matched.
+// The source matches if its modified time & size are same as recorded,
+// otherwise the content is hashed & compared. The stamps of sources are
+// kept in a shared table, so a source is hashed at most once until it's
+// modified, no matter how many times it's validated or compiled.
+class ProgramCache
+{
+public:
+    enum
+    {
+        IMAGE_MAGIC = 0x424D4D43,   // "CMMB"
+        IMAGE_VERSION = 3,          // Increase it when the layout or byte codes are changed
+        IMAGE_CODES_ALIGN = 8,
+    };
+
+    struct ImageHeader
+    {
+        Uint32 magic;
+        Uint16 version;
+        Uint16 instruction_size;    // sizeof(Instruction)
+        Uint64 source_hash;         // Hash of source content
+        Uint64 source_mtime;        // Modified time of source
+        Uint64 source_size;         // Size of source
+        Uint32 image_size;          // Size of whole image
+        Uint32 codes_offset;        // Offset of byte codes section
+        Uint32 codes_count;         // Count of instructions in section
+        Uint32 reserved;
+    };
+
+    // Identity of source file content
+    struct SourceStamp
+    {
+        Uint64 mtime;
+        Uint64 size;
+        Uint64 hash;                // 0 if not hashed yet
+    };
+
+public:
+    // Initialize/shutdown this module
+    static bool init();
+    static void shutdown();
+
+public:
+    // Get modified time & size of a source file, the hash is filled if
+    // it's known for this version of file
+    // Return false if the file is not existed
+    static bool stat_source_file(const char* file_name, SourceStamp* stamp);
+
+    // Hash content of a source file if it's not hashed yet
+    // Return false if the file can not be read
+    static bool hash_source_file(const char* file_name, SourceStamp* stamp);
+
+    // Get image file name of program in output directory
+    static bool get_image_file_name(const simple::string& program_name, simple::string* image_file_name);
+
+    // Load program from image if it's valid for source
+    // The program is not registered to program table
+    // Return 0 if the image is not existed, outdated or bad
+    static Program* load(const char* image_file_name, const char* source_file_name,
+                         SourceStamp* stamp, simple::vector<simple::string>* components);
+
+    // Save program to image
+    static bool save(const char* image_file_name, const char* source_file_name,
+                     SourceStamp* stamp, const Program* program);
+
+    // Is the image valid for source?
+    static bool validate(const char* image_file_name, const char* source_file_name,
+                         SourceStamp* stamp);
+
+private:
+    // Is the image header matched with source?
+    static bool is_valid_header(const void* image, size_t size,
+                                const char* source_file_name, SourceStamp* stamp);
+
+private:
+    // Stamps of sources known, file name -> stamp
+    typedef simple::hash_map<simple::string, SourceStamp> SourceStampMap;
+    static SourceStampMap* m_source_stamps;
+    static struct std_critical_section *m_cs;
+};
+
+}
@@ -0,0 +1,285 @@
+// cmm_program_reload.cpp
+
+#include <string.h>
+#include "std_memmgr/std_memmgr.h"
+#include "cmm_domain.h"
+#include "cmm_object.h"
+#include "cmm_program.h"
+#include "cmm_program_reload.h"
+#include "cmm_thread.h"
+
+namespace cmm
+{
+
+ProgramReloader::ProgramReloader(CompileDriver::ResolveFunc resolve) :
+    m_resolve(resolve),
+    m_use_cache(false),
+    m_migrated_count(0)
+{
+}
+
+ProgramReloader::~ProgramReloader()
+{
+    for (auto& it : m_plans)
+        XDELETE(it);
+}
+
+// Add a program to be reloaded
+void ProgramReloader::add_program(const char* program_name)
+{
+    m_program_names.put(program_name);
+}
+
+// Compile new versions & replace the active ones
+size_t ProgramReloader::compile(size_t worker_count)
+{
+    add_dependents();
+
+    // Remember the active versions
+    auto program_names = m_program_names.to_array();
+    Program::ProgramNameMap old_programs;
+    for (auto& it : program_names)
+    {
+        auto* name = Program::find_string(it.c_str());
+        auto* program = name ? Program::find_program_by_name(name) : 0;
+        if (program)
+            old_programs.put(program->get_name(), program);
+    }
+
+    // The components not reloaded are active ones, don't compile them
+    CompileDriver driver(m_resolve);
+    driver.set_use_cache(m_use_cache);
+    driver.set_register_programs(false);
+    driver.set_compile_loaded_components(false);
+    for (auto& it : program_names)
+    {
+        simple::string file_name;
+        if (!m_resolve || !m_resolve(it, &file_name))
+        {
+            // No source, such as native program
+            STD_TRACE("No source to reload program %s.\n", it.c_str());
+            continue;
+        }
+        driver.add_file(file_name.c_str(), it.c_str());
+    }
+    auto failed = driver.compile_all(worker_count);
+
+    // Update the new versions before anyone can see them, the components
+    // are looked up in new versions at first
+    auto& programs = driver.get_programs();
+    Program::ProgramNameMap new_programs;
+    for (size_t i = 0; i < programs.size(); i++)
+        new_programs.put(programs[i]->get_name(), programs[i]);
+    for (size_t i = 0; i < programs.size(); i++)
+        programs[i]->update_program(&new_programs);
+
+    // Replace the active ones, the old ones are obsoleted
+    for (size_t i = 0; i < programs.size(); i++)
+    {
+        auto* program = programs[i];
+        program->register_program();
+
+        Program* old_program;
+        if (!old_programs.try_get(program->get_name(), &old_program))
+            // A new program
+            continue;
+
+        auto* plan = XNEW(Plan);
+        plan->old_program = old_program;
+        plan->new_program = program;
+        make_plan(plan);
+        m_plans.push_back(plan);
+    }
+
+    // All domains have objects to be migrated
+    m_pending_domains = Domain::get_all_domain_ids();
+    return failed;
+}
+
+// Migrate objects in all domains not migrated yet
+size_t ProgramReloader::migrate(Thread* thread)
+{
+    simple::vector<DomainId> busy_domains;
+    auto* prev_domain = thread->get_current_domain();
+    for (auto& id : m_pending_domains)
+    {
+        auto* domain = Domain::get_domain_by_id(id);
+        if (!domain)
+            // Domain was destructed
+            continue;
+
+        thread->switch_domain(domain);
+        if (domain->get_type() == Domain::READ_ONLY)
+            // Being called without lock, keep the old versions
+            continue;
+
+        if (!is_affected(domain))
+            // No object to be migrated
+            continue;
+
+        if (domain->has_contexts())
+            // Some frames may refer the objects, try later
+            busy_domains.push_back(id);
+        else
+            m_migrated_count += migrate_domain(domain);
+    }
+    thread->switch_domain(prev_domain);
+
+    m_pending_domains = simple::move(busy_domains);
+    return m_pending_domains.size();
+}
+
+// Add programs use the reloading ones as component
+// The components of a program are flatten, so a program depends on a
+// reloading one if it's in the components list
+void ProgramReloader::add_dependents()
+{
+    auto programs = Program::get_all_programs();
+    for (auto& program : programs)
+    {
+        simple::string name = program->get_name()->c_str();
+        if (m_program_names.contains(name))
+            continue;
+
+        // Component 0 is the program itself
+        for (ComponentNo i = 1; i < program->get_components_count(); i++)
+        {
+            if (m_program_names.contains(program->get_component_name(i)->c_str()))
+            {
+                m_program_names.put(name);
+                break;
+            }
+        }
+    }
+}
+
+// Map object vars of new version to old version
+// The var is kept if there is one with same name & same type in same
+// component of old version. A mixed var takes any type.
+void ProgramReloader::make_plan(Plan* plan)
+{
+    auto* old_program = plan->old_program;
+    auto* new_program = plan->new_program;
+    for (ComponentNo i = 0; i < new_program->get_components_count(); i++)
+    {
+        auto* component = new_program->get_component(i);
+        auto to_offset = new_program->get_component_offset(i);
+
+        // Lookup same component in old version (the names are shared)
+        Program* old_component = 0;
+        ComponentOffset from_offset = 0;
+        for (ComponentNo k = 0; k < old_program->get_components_count(); k++)
+        {
+            if (old_program->get_component_name(k) == new_program->get_component_name(i))
+            {
+                old_component = old_program->get_component(k);
+                from_offset = old_program->get_component_offset(k);
+                break;
+            }
+        }
+
+        for (VariableNo k = 0; k < component->get_object_vars_count(); k++)
+        {
+            auto* object_var = component->get_object_var(k);
+            Slot slot;
+            slot.to = (Uint32)(to_offset + offsetof(AbstractComponent, m_object_vars) + k * sizeof(Value));
+            slot.from = 0;
+            slot.type = object_var->get_type();
+            if (slot.type == ValueType::MIXED)
+                slot.type = ValueType::NIL;
+
+            for (VariableNo n = 0; old_component && n < old_component->get_object_vars_count(); n++)
+            {
+                auto* old_var = old_component->get_object_var(n);
+                if (old_var->get_name() != object_var->get_name())
+                    continue;
+                if (old_var->get_type() == object_var->get_type() ||
+                    object_var->get_type() == ValueType::MIXED)
+                    slot.from = (Uint32)(from_offset + offsetof(AbstractComponent, m_object_vars) + n * sizeof(Value));
+                break;
+            }
+            plan->slots.push_back(slot);
+        }
+    }
+}
+
+// Are there objects of old versions in domain?
+bool ProgramReloader::is_affected(Domain* domain)
+{
+    for (auto& plan : m_plans)
+        if (domain->get_first_instance(plan->old_program))
+            return true;
+    return false;
+}
+
+// Migrate all affected objects in domain
+size_t ProgramReloader::migrate_domain(Domain* domain)
+{
+    size_t count = 0;
+    for (auto& plan : m_plans)
+    {
+        // The migrated object is linked to list of new version, get the
+        // next one before migrating
+        auto* ob = domain->get_first_instance(plan->old_program);
+        while (ob)
+        {
+            auto* next = ob->get_next_instance();
+            migrate_object(domain, ob, plan);
+            ob = next;
+            count++;
+        }
+    }
+    return count;
+}
+
+// Migrate an object to new version
+void ProgramReloader::migrate_object(Domain* domain, Object* ob, const Plan* plan)
+{
+    auto* new_program = plan->new_program;
+    size_t old_size = plan->old_program->get_entire_object_size();
+    size_t new_size = new_program->get_entire_object_size();
+    size_t vars_offset = offsetof(Object, m_object_vars);
+
+    // Keep the old values, they may be overlapped by new layout
+    m_snapshot.clear();
+    m_snapshot.push_back_array((const Uint8*)ob, old_size);
+
+    // Move to a new block if the layout is larger
+    auto* new_ob = ob;
+    if (new_size > old_size)
+    {
+        new_ob = (Object*)STD_MEM_ALLOC(new_size);
+        if (!new_ob)
+            throw_error("Failed to allocate object for program %s.\n",
+                        new_program->get_name()->c_str());
+        memcpy((void*)new_ob, (void*)ob, vars_offset);
+    }
+
+    // Build components of new layout
+    memset((Uint8*)new_ob + vars_offset, 0, new_size - vars_offset);
+    for (ComponentNo i = 0; i < new_program->get_components_count(); i++)
+    {
+        auto* p = (AbstractComponent*)((Uint8*)new_ob + new_program->get_component_offset(i));
+        p->m_program = new_program->get_component(i);
+    }
+    for (size_t i = 0; i < plan->slots.size(); i++)
+    {
+        auto& slot = plan->slots[i];
+        auto* value = (Value*)((Uint8*)new_ob + slot.to);
+        if (slot.from)
+            memcpy((void*)value, &m_snapshot[slot.from], sizeof(Value));
+        else
+            value->m_type = slot.type;
+    }
+
+    domain->object_was_replaced(ob, new_ob, new_program);
+    auto* entry = Object::get_entry_by_id(new_ob->m_oid);
+    entry->object = new_ob;
+    entry->program = new_program;
+
+    if (new_ob != ob)
+        // The object was moved, don't destruct it
+        STD_MEM_FREE(ob);
+}
+
+}
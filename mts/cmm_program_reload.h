@@ -0,0 +1,116 @@
+// cmm_program_reload.h
+// Reload programs & migrate live objects to the new versions
+
+#pragma once
+
+#include "std_port/std_port.h"
+#include "std_template/simple_hash_set.h"
+#include "std_template/simple_string.h"
+#include "std_template/simple_vector.h"
+#include "cmm.h"
+#include "cmm_compile_driver.h"
+#include "cmm_global_id.h"
+#include "cmm_value.h"
+
+namespace cmm
+{
+
+class Domain;
+class Object;
+class Program;
+class Thread;
+
+// Reload programs without stopping the domains
+// 1. compile()
+//    Compile the new versions of programs & all programs using them as
+//    component (their layouts & callees are changed). The new versions
+//    are updated before they are registered, so the others see either the
+//    old or the whole new ones. The old versions are kept in obsoleted
+//    set, the running frames & objects not migrated still use them.
+// 2. migrate()
+//    Migrate objects of old versions domain by domain. An object var is
+//    kept if there is a var with same name & type in same component of
+//    the new version, others are reset. The object is migrated in place
+//    if the new layout is not larger, or it's moved to a new block & the
+//    oid entry is updated.
+//    The objects of a program are linked in each domain, so the cost is
+//    proportional to count of affected objects.
+//    A domain can't be migrated while some threads have frames in it
+//    (they may refer the object or the values in it), skip it & retry
+//    by calling migrate() again later. The objects in READ_ONLY domain
+//    are called without lock, they are never migrated.
+//    ATTENTION: The object may be moved, refer it by oid instead of
+//    pointer across reloading.
+class ProgramReloader
+{
+public:
+    ProgramReloader(CompileDriver::ResolveFunc resolve);
+    ~ProgramReloader();
+
+public:
+    // Load unchanged programs from images in output directory
+    void set_use_cache(bool use_cache)
+    {
+        m_use_cache = use_cache;
+    }
+
+    // Add a program to be reloaded
+    void add_program(const char* program_name);
+
+    // Compile new versions & replace the active ones
+    // Use count of cpus if worker_count is 0
+    // Return count of failed files
+    size_t compile(size_t worker_count = 0);
+
+    // Migrate objects in all domains not migrated yet
+    // Return count of domains skipped (call again later)
+    size_t migrate(Thread* thread);
+
+public:
+    size_t get_reloaded_count() const { return m_plans.size(); }
+    size_t get_migrated_count() const { return m_migrated_count; }
+
+private:
+    // Value slot in new layout
+    struct Slot
+    {
+        Uint32 to;              // Offset in new object
+        Uint32 from;            // Offset in old object, 0 if no such var
+        ValueType type;         // Initial type if no such var
+    };
+
+    // How to migrate objects from old version to new version
+    struct Plan
+    {
+        Program* old_program;
+        Program* new_program;
+        simple::vector<Slot> slots;
+    };
+
+private:
+    // Add programs use the reloading ones as component
+    void add_dependents();
+
+    // Map object vars of new version to old version
+    void make_plan(Plan* plan);
+
+    // Are there objects of old versions in domain? (domain must be held)
+    bool is_affected(Domain* domain);
+
+    // Migrate all affected objects in domain (domain must be held)
+    size_t migrate_domain(Domain* domain);
+
+    // Migrate an object to new version
+    void migrate_object(Domain* domain, Object* ob, const Plan* plan);
+
+private:
+    CompileDriver::ResolveFunc m_resolve;
+    bool m_use_cache;
+    simple::hash_set<simple::string> m_program_names;
+    simple::vector<Plan*> m_plans;
+    simple::vector<DomainId> m_pending_domains;
+    simple::vector<Uint8> m_snapshot;   // Old object being migrated
+    size_t m_migrated_count;
+};
+
+}
@@ -2,95 +2,150 @@
 // Initial version 2011.7.1 by doing
 // Immigrated 2015.11.5 by doing
 
-#include "cmm_lang.h"
+#include "cmm.h"
 #include "cmm_register_allocator.h"
 
-#if 0 ////----
 namespace cmm
 {
 
-/* allocate a register for a function */
-IntR cmm_alloc_register(AstFunction *func, ValueType type)
+RegisterAllocator::RegisterAllocator() :
+    m_ranges(64),
+    m_back_edges(16)
 {
-    STD_ASSERT(func);
-
-    /* try to find a free register */
-    for (auto& it : func->registers)
-    {
-        if (! it.is_using && it.type == type)
-        {
-            it.is_using = true;
-            it.is_fixed_reg = false;
-            return it.index;
-        }
-    }
-
-    /* no free register, allocate a new one */
-    AstRegister new_reg;
-    new_reg.index = (Uint16)func->registers.size();
-    new_reg.type = type;
-    new_reg.is_using = true;
-    new_reg.is_fixed_reg = false;
-    func->registers.push_back(new_reg);
-    return new_reg.index;
 }
 
-/* allocate a fixed register for a function, fixed register won't be auto freed */
-IntR cmm_alloc_fixed_register(AstFunction *func, ValueType type)
+// Reset to allocate for next function
+void RegisterAllocator::reset()
 {
-    STD_ASSERT(func);
-
-    /* try to find a free register */
-    for (auto& it : func->registers)
-    {
-        if (! it.is_using && it.type == type)
-        {
-            it.is_using = true;
-            it.is_fixed_reg = true;
-            return it.index;
-        }
-    }
+    m_ranges.clear();
+    m_back_edges.clear();
+}
 
-    /* no free register, allocate a new one */
-    AstRegister new_reg;
-    new_reg.index = (Uint16)func->registers.size();
-    new_reg.type = type;
-    new_reg.is_using = true;
-    new_reg.is_fixed_reg = true;
-    func->registers.push_back(new_reg);
-    return new_reg.index;
+// Create a virtual register (or a block)
+RegisterAllocator::Register RegisterAllocator::new_register(Uint16 width)
+{
+    STD_ASSERT(("Width of register block must be positive.", width > 0));
+    LiveRange range;
+    range.start = NO_POSITION;
+    range.end = 0;
+    range.width = width;
+    range.slot = 0;
+    m_ranges.push_back(range);
+    return (Register)(m_ranges.size() - 1);
 }
 
-/* Make a register fixed */
-void cmm_set_register_fixed(AstFunction *func, IntR reg_index, bool fixed)
+// The register is written or read at position
+void RegisterAllocator::touch(Register reg, Position pos)
 {
-    STD_ASSERT(func);
-    STD_ASSERT(reg_index < (IntR)func->registers.size());
+    auto& range = m_ranges[reg];
+    if (range.start == NO_POSITION || pos < range.start)
+        range.start = pos;
+    if (pos > range.end)
+        range.end = pos;
+}
 
-    func->registers[reg_index].is_fixed_reg = fixed;
+// There is a jump back to previous position
+void RegisterAllocator::add_back_edge(Position from, Position to)
+{
+    STD_ASSERT(("Back edge must jump backward.", to <= from));
+    BackEdge edge;
+    edge.from = from;
+    edge.to = to;
+    m_back_edges.push_back(edge);
 }
 
-/* free a register for a function */
-void cmm_free_register(AstFunction *func, IntR reg_index)
+// Extend live ranges across loops
+// A register lives before the loop & is used in the loop must be alive
+// until the end of loop, since the loop may run again
+void RegisterAllocator::extend_ranges_over_loops()
 {
-    STD_ASSERT(func);
-    STD_ASSERT(reg_index < (IntR)func->registers.size());
+    bool changed;
+    do
+    {
+        changed = false;
+        for (auto& edge : m_back_edges)
+        {
+            for (auto& range : m_ranges)
+            {
+                if (range.start == NO_POSITION)
+                    // Never used
+                    continue;
 
-    func->registers[reg_index].is_using = false;
+                if (range.start < edge.to &&
+                    range.end >= edge.to && range.end < edge.from)
+                {
+                    range.end = edge.from;
+                    changed = true;
+                }
+            }
+        }
+    } while (changed);
 }
 
-/* Free currently using return value registers */
-void cmm_free_ret_registers(AstFunction *func)
+// Map all registers to local slots by linear scan
+size_t RegisterAllocator::allocate()
 {
-    STD_ASSERT(func);
+    extend_ranges_over_loops();
+
+    // Order registers by start position (counting sort, the positions
+    // are dense since they are index of instructions)
+    size_t count = m_ranges.size();
+    Position max_pos = 0;
+    for (auto& range : m_ranges)
+        if (range.start != NO_POSITION && range.start > max_pos)
+            max_pos = range.start;
 
-    /* make all return value registers free */
-    for (auto& it : func->registers)
+    simple::vector<Uint32> heads(max_pos + 2);
+    heads.push_backs(0, max_pos + 2);
+    for (auto& range : m_ranges)
+        if (range.start != NO_POSITION)
+            heads[range.start + 1]++;
+    for (Position pos = 1; pos <= max_pos + 1; pos++)
+        heads[pos] += heads[pos - 1];
+
+    simple::vector<Register> order(count);
+    order.push_backs(0, heads[max_pos + 1]);
+    for (Register reg = 0; reg < (Register)count; reg++)
     {
-        if (!it.is_fixed_reg)
-            it.is_using = false;
+        auto& range = m_ranges[reg];
+        if (range.start != NO_POSITION)
+            order[heads[range.start]++] = reg;
     }
+
+    // Scan: free_from[slot] is the first position the slot can be reused
+    simple::vector<Position> free_from;
+    for (auto reg : order)
+    {
+        auto& range = m_ranges[reg];
+        size_t slot = 0;
+        for (;;)
+        {
+            size_t i = 0;
+            while (i < range.width &&
+                   slot + i < free_from.size() &&
+                   free_from[slot + i] <= range.start)
+                i++;
+            if (i == range.width || slot + i >= free_from.size())
+                // Slots [slot, slot + width) are free or not created yet
+                break;
+            // Slot + i is busy, try the next one
+            slot += i + 1;
+        }
+
+        while (free_from.size() < slot + range.width)
+            free_from.push_back(0);
+        for (size_t i = 0; i < range.width; i++)
+            free_from[slot + i] = range.end + 1;
+        range.slot = (LocalNo)slot;
+    }
+
+    return free_from.size();
+}
+
+// Get slot of register after allocated
+LocalNo RegisterAllocator::get_slot(Register reg) const
+{
+    return m_ranges[reg].slot;
 }
 
 }
-#endif
@@ -4,17 +4,75 @@
 
 #pragma once
 
+#include "std_template/simple_vector.h"
 #include "cmm.h"
 
 namespace cmm
 {
 
-struct AstFunction;
+// Map virtual registers to local slots by live range
+// The code generator creates virtual registers freely & reports where
+// they are written or read in the linear instruction stream. After the
+// whole function is generated, the live ranges are extended over backward
+// jumps (a register lives through the loop if it's used across the loop),
+// then they are mapped to local slots by linear scan. Registers don't
+// overlap share the same slot, so a function needs only as many locals
+// as values alive at the same time.
+class RegisterAllocator
+{
+public:
+    typedef Uint32 Register;
+    typedef Uint32 Position;
+
+    enum { NO_POSITION = 0xFFFFFFFF };
+
+public:
+    RegisterAllocator();
+
+public:
+    // Reset to allocate for next function
+    void reset();
+
+    // Create a virtual register or a block of width contiguous registers
+    Register new_register(Uint16 width = 1);
+
+    // The register is written or read at position
+    void touch(Register reg, Position pos);
+
+    // There is a jump at position "from" back to position "to"
+    void add_back_edge(Position from, Position to);
+
+    // Map all registers to local slots
+    // Return count of slots used
+    size_t allocate();
+
+    // Get slot of register after allocated
+    LocalNo get_slot(Register reg) const;
+
+    // Get count of registers
+    size_t get_register_count() const { return m_ranges.size(); }
+
+private:
+    struct LiveRange
+    {
+        Position start;
+        Position end;
+        Uint16   width;
+        LocalNo  slot;
+    };
+
+    struct BackEdge
+    {
+        Position from;
+        Position to;
+    };
+
+    // Extend live ranges across loops until nothing changed
+    void extend_ranges_over_loops();
 
-IntR cmm_alloc_register(AstFunction *func, ValueType type);
-IntR cmm_alloc_fixed_register(AstFunction *func, ValueType type);
-void cmm_free_register(AstFunction *func, IntR reg_index);
-void cmm_free_ret_registers(AstFunction *func);
-void cmm_set_register_fixed(AstFunction *func, IntR reg_index, bool fiexed);
+private:
+    simple::vector<LiveRange> m_ranges;
+    simple::vector<BackEdge> m_back_edges;
+};
 
 }
@@ -0,0 +1,450 @@
+// cmm_scheduler.cpp
+
+#include <stdio.h>
+#include <limits.h>
+#include "std_port/std_port.h"
+#include "cmm.h"
+#include "cmm_call.h"
+#include "cmm_coroutine.h"
+#include "cmm_domain.h"
+#include "cmm_scheduler.h"
+#include "cmm_thread.h"
+
+namespace cmm
+{
+
+Scheduler::Worker *Scheduler::m_workers = 0;
+size_t Scheduler::m_worker_count = 0;
+volatile AtomInt Scheduler::m_running_count = 0;
+volatile int Scheduler::m_stopping = 0;
+bool Scheduler::m_started = false;
+volatile AtomInt Scheduler::m_next_worker = 0;
+
+Scheduler::TaskDeque::TaskDeque()
+{
+    std_init_spin_lock(&m_lock);
+    m_capacity = 64;
+    m_tasks = XNEWN(Task, m_capacity);
+    m_top = 0;
+    m_bottom = 0;
+}
+
+Scheduler::TaskDeque::~TaskDeque()
+{
+    XDELETEN(m_tasks);
+    std_destroy_spin_lock(&m_lock);
+}
+
+// Push at bottom
+void Scheduler::TaskDeque::push(const Task& task)
+{
+    std_get_spin_lock(&m_lock);
+    if (m_bottom - m_top >= m_capacity)
+        grow();
+    m_tasks[m_bottom & (m_capacity - 1)] = task;
+    m_bottom++;
+    std_release_spin_lock(&m_lock);
+}
+
+// Push at top
+// ATTENTION: m_top may wrap around, the indexes are used by mask & the
+// difference of them is still correct
+void Scheduler::TaskDeque::push_top(const Task& task)
+{
+    std_get_spin_lock(&m_lock);
+    if (m_bottom - m_top >= m_capacity)
+        grow();
+    m_top--;
+    m_tasks[m_top & (m_capacity - 1)] = task;
+    std_release_spin_lock(&m_lock);
+}
+
+// Pop at bottom
+bool Scheduler::TaskDeque::pop(Task *task)
+{
+    if (m_bottom == m_top)
+        // Empty, don't bother to lock
+        return false;
+
+    bool got = false;
+    std_get_spin_lock(&m_lock);
+    if (m_bottom != m_top)
+    {
+        m_bottom--;
+        *task = m_tasks[m_bottom & (m_capacity - 1)];
+        got = true;
+    }
+    std_release_spin_lock(&m_lock);
+    return got;
+}
+
+// Take at top
+bool Scheduler::TaskDeque::steal(Task *task)
+{
+    if (m_bottom == m_top)
+        // Empty, don't bother to lock
+        return false;
+
+    bool got = false;
+    std_get_spin_lock(&m_lock);
+    if (m_bottom != m_top)
+    {
+        *task = m_tasks[m_top & (m_capacity - 1)];
+        m_top++;
+        got = true;
+    }
+    std_release_spin_lock(&m_lock);
+    return got;
+}
+
+// Grow the array when full
+void Scheduler::TaskDeque::grow()
+{
+    size_t count = m_bottom - m_top;
+    auto *tasks = XNEWN(Task, m_capacity * 2);
+    for (size_t i = 0; i < count; i++)
+        tasks[i] = m_tasks[(m_top + i) & (m_capacity - 1)];
+    XDELETEN(m_tasks);
+    m_tasks = tasks;
+    m_capacity *= 2;
+    m_top = 0;
+    m_bottom = count;
+}
+
+// Initialize this module
+bool Scheduler::init()
+{
+    return true;
+}
+
+// Shutdown this moudule
+void Scheduler::shutdown()
+{
+    stop();
+}
+
+// Start workers
+bool Scheduler::start(size_t worker_count)
+{
+    if (m_started)
+        return false;
+
+    if (!worker_count)
+        worker_count = (size_t)std_get_cpu_count();
+
+    m_stopping = 0;
+    m_next_worker = 0;
+    m_worker_count = worker_count;
+    m_workers = XNEWN(Worker, worker_count);
+    for (size_t i = 0; i < worker_count; i++)
+    {
+        auto *worker = &m_workers[i];
+        worker->index = i;
+        worker->thread = 0;
+        worker->sleeping = 0;
+        worker->wakeup_seq = 0;
+        worker->random_seed = (Uint32)(i * 2654435761u + 1);
+        worker->executed = 0;
+        worker->stolen = 0;
+    }
+
+    m_started = true;
+    for (size_t i = 0; i < worker_count; i++)
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "Worker(%zu)", i);
+        std_cpu_lock_add(&m_running_count, 1);
+        if (!std_create_task(name, NULL, (void *)worker_entry, &m_workers[i]))
+        {
+            std_cpu_lock_add(&m_running_count, -1);
+            STD_TRACE("Failed to create worker %zu.\n", i);
+        }
+    }
+    return true;
+}
+
+// Stop all workers
+void Scheduler::stop()
+{
+    if (!m_started)
+        return;
+
+    // Notify & wait all workers to exit
+    m_stopping = 1;
+    std_cpu_mfence();
+    while (m_running_count > 0)
+    {
+        for (size_t i = 0; i < m_worker_count; i++)
+            wake_worker(&m_workers[i]);
+        std_sleep(1);
+    }
+
+    // Drop the tasks left in deques (pushed after the owner exited or the
+    // owner failed to start)
+    for (size_t i = 0; i < m_worker_count; i++)
+    {
+        Task task;
+        while (m_workers[i].deque.pop(&task))
+            drop_task(task);
+    }
+
+    XDELETEN(m_workers);
+    m_worker_count = 0;
+    m_started = false;
+}
+
+// Submit a call as a task
+bool Scheduler::submit(Thread *thread, ObjectId oid, const Value& function_name, Value *args, ArgNo n)
+{
+    if (!m_started)
+        // No one would run it
+        return false;
+
+    auto *entry = Object::get_entry_by_id(oid);
+    auto *domain = entry ? entry->domain : 0;
+    if (!domain)
+        // No such object
+        return false;
+
+    auto *call = XNEW(AsyncCall, thread, oid, function_name, args, n);
+    call->detach();
+    domain->post_call(call);
+    schedule_domain(domain);
+    return true;
+}
+
+// Let a worker run the domain
+void Scheduler::schedule_domain(Domain *domain)
+{
+    if (!m_started)
+        return;
+
+    if (!std_cpu_lock_cas(&domain->m_scheduled, 0, 1))
+        // Already in a deque
+        return;
+
+    // Prefer the worker ran it last time
+    size_t index = (size_t)domain->m_last_worker;
+    if (index >= m_worker_count)
+        index = (size_t)std_cpu_lock_add(&m_next_worker, 1) % m_worker_count;
+    auto *worker = &m_workers[index];
+    Task task;
+    task.coroutine = 0;
+    task.domain_id = domain->get_id();
+    worker->deque.push(task);
+
+    notify_worker(worker);
+}
+
+// Run the entry in a new coroutine on a worker
+bool Scheduler::spawn(Coroutine::Entry entry, void *para, size_t stack_size)
+{
+    if (!m_started)
+        return false;
+
+    Task task;
+    task.coroutine = XNEW(Coroutine, entry, para, stack_size);
+    task.domain_id.i64 = 0;
+    auto *worker = &m_workers[(size_t)std_cpu_lock_add(&m_next_worker, 1) % m_worker_count];
+    worker->deque.push(task);
+    notify_worker(worker);
+    return true;
+}
+
+// Wake up the owner, or an idle one to steal it if the owner is busy
+void Scheduler::notify_worker(Worker *worker)
+{
+    if (worker->sleeping)
+    {
+        wake_worker(worker);
+        return;
+    }
+    for (size_t i = 0; i < m_worker_count; i++)
+    {
+        if (m_workers[i].sleeping)
+        {
+            wake_worker(&m_workers[i]);
+            break;
+        }
+    }
+}
+
+// Entry of worker thread
+void *Scheduler::worker_entry(Worker *worker)
+{
+    auto *thread = XNEW(Thread);
+    thread->start();
+    worker->thread = thread;
+
+    while (!m_stopping)
+    {
+        Task task;
+        if (take_task(worker, &task))
+        {
+            run_task(worker, task);
+            continue;
+        }
+
+        // Nothing to do, park for a while
+        int seq = worker->wakeup_seq;
+        worker->sleeping = 1;
+        std_cpu_mfence();
+        if (!m_stopping && !take_task(worker, &task))
+        {
+            std_wait_address(&worker->wakeup_seq, seq, PARK_TIMEOUT);
+            worker->sleeping = 0;
+            continue;
+        }
+        worker->sleeping = 0;
+        run_task(worker, task);
+    }
+
+    // Finish all coroutines in my deque
+    Task task;
+    while (worker->deque.pop(&task))
+    {
+        if (task.coroutine)
+            run_coroutine(worker, task.coroutine);
+        else
+            drop_task(task);
+    }
+
+    worker->thread = 0;
+    thread->stop();
+    XDELETE(thread);
+    std_cpu_lock_add(&m_running_count, -1);
+    return 0;
+}
+
+// Get a task from local deque or steal one from the most loaded worker
+bool Scheduler::take_task(Worker *worker, Task *task)
+{
+    if (worker->deque.pop(task))
+        return true;
+
+    // Start from a random victim to spread thieves
+    worker->random_seed ^= worker->random_seed << 13;
+    worker->random_seed ^= worker->random_seed >> 17;
+    worker->random_seed ^= worker->random_seed << 5;
+    size_t start = worker->random_seed % m_worker_count;
+
+    Worker *victim = 0;
+    size_t max_size = 0;
+    for (size_t i = 0; i < m_worker_count; i++)
+    {
+        auto *p = &m_workers[(start + i) % m_worker_count];
+        if (p == worker)
+            continue;
+        size_t size = p->deque.size();
+        if (size > max_size)
+        {
+            max_size = size;
+            victim = p;
+        }
+    }
+
+    if (victim && victim->deque.steal(task))
+    {
+        worker->stolen++;
+        return true;
+    }
+    return false;
+}
+
+// Run a task
+void Scheduler::run_task(Worker *worker, const Task& task)
+{
+    if (task.coroutine)
+        run_coroutine(worker, task.coroutine);
+    else
+        run_domain(worker, task.domain_id);
+}
+
+// Run a domain
+void Scheduler::run_domain(Worker *worker, DomainId id)
+{
+    auto *domain = Domain::get_domain_by_id(id);
+    if (!domain)
+        // Domain was destructed
+        return;
+
+    // Calls posted from now on will reschedule the domain
+    domain->m_last_worker = (int)worker->index;
+    domain->m_scheduled = 0;
+    std_cpu_mfence();
+
+    worker->thread->drain_mailbox(domain);
+    worker->executed++;
+
+    // Batch limit reached, run it later
+    if (domain->has_pending_calls())
+        schedule_domain(domain);
+}
+
+// Resume a coroutine
+void Scheduler::run_coroutine(Worker *worker, Coroutine *co)
+{
+    worker->executed++;
+    if (!co->resume())
+    {
+        // Finished
+        XDELETE(co);
+        return;
+    }
+
+    // Yielded, let others run before it
+    Task task;
+    task.coroutine = co;
+    task.domain_id.i64 = 0;
+    worker->deque.push_top(task);
+}
+
+// Drop a task left when stopping
+// The coroutine is run to end (it can't be freed when suspended), the
+// domain can be scheduled again after restarting
+void Scheduler::drop_task(const Task& task)
+{
+    if (task.coroutine)
+    {
+        auto *co = task.coroutine;
+        while (co->resume())
+            std_sleep(1);
+        XDELETE(co);
+        return;
+    }
+
+    auto *domain = Domain::get_domain_by_id(task.domain_id);
+    if (domain)
+        domain->m_scheduled = 0;
+}
+
+// Wake up the worker if it is parked
+void Scheduler::wake_worker(Worker *worker)
+{
+    // The futex word is int, don't use std_cpu_lock_add on it. A lost
+    // increment still changes the word, then the worker won't sleep on
+    // the old value
+    worker->wakeup_seq++;
+    std_wake_address(&worker->wakeup_seq, 1);
+}
+
+// Return statistics of workers
+Value Scheduler::get_scheduler_detail()
+{
+    Array arr(m_worker_count);
+    for (size_t i = 0; i < m_worker_count; i++)
+    {
+        auto *worker = &m_workers[i];
+        Value map = NIL;
+        map = XNEW(MapImpl, 5);
+        map.set("index", worker->index);
+        map.set("queued", worker->deque.size());
+        map.set("sleeping", worker->sleeping);
+        map.set("executed", (Int64)worker->executed);
+        map.set("stolen", (Int64)worker->stolen);
+        arr.push_back(map);
+    }
+    return arr;
+}
+
+} // End of namespace: cmm
@@ -0,0 +1,154 @@
+// cmm_scheduler.h
+// M:N scheduler, run domains on a fixed pool of worker threads
+
+#pragma once
+
+#include "std_port/std_port.h"
+#include "std_port/std_port_spin_lock.h"
+#include "cmm.h"
+#include "cmm_coroutine.h"
+#include "cmm_mailbox.h"
+#include "cmm_value.h"
+
+namespace cmm
+{
+
+class Domain;
+class Thread;
+
+// A task is a domain which has calls in its mailbox, or a coroutine to be
+// resumed. Each worker owns a deque of tasks: the owner pops at bottom
+// (newest, cache warm) while an idle worker steals at top (oldest) of the
+// most loaded one.
+// A domain is always scheduled to the worker ran it last time.
+class Scheduler
+{
+public:
+    struct Task
+    {
+        Coroutine *coroutine;   // Coroutine to resume, or
+        DomainId domain_id;     // Domain to drain
+    };
+
+    // Deque of tasks
+    class TaskDeque
+    {
+    public:
+        TaskDeque();
+        ~TaskDeque();
+
+    public:
+        // Push at bottom
+        void push(const Task& task);
+
+        // Push at top, it will be popped by owner at last
+        void push_top(const Task& task);
+
+        // Pop at bottom (by owner)
+        bool pop(Task *task);
+
+        // Take at top (by thief)
+        bool steal(Task *task);
+
+        // Count of tasks (unlocked, for heuristic only)
+        size_t size() const { return m_bottom - m_top; }
+
+    private:
+        // Grow the array when full (lock must be held)
+        void grow();
+
+    private:
+        std_spin_lock_t m_lock;
+        Task *m_tasks;
+        size_t m_capacity;      // Power of 2
+        size_t m_top;           // Index of oldest one
+        size_t m_bottom;        // Index for next push
+    };
+
+    struct Worker
+    {
+        size_t index;
+        Thread *thread;
+        TaskDeque deque;
+        volatile int sleeping;  // Is this worker parked?
+        volatile int wakeup_seq;// Futex word to park on
+        Uint32 random_seed;     // For choosing victim
+        Uint64 executed;        // Count of tasks ran
+        Uint64 stolen;          // Count of tasks stolen from others
+    };
+
+    enum { PARK_TIMEOUT = 100 };    // In ms
+
+public:
+    // Initialize/shutdown this module
+    static bool init();
+    static void shutdown();
+
+public:
+    // Start workers (0 means count of cpus)
+    static bool start(size_t worker_count = 0);
+
+    // Stop all workers, wait until they exited
+    static void stop();
+
+    // Is the scheduler started?
+    static bool is_started() { return m_started; }
+
+public:
+    // Submit a call as a task, the result is dropped
+    // Return false if there is no such object or scheduler isn't started
+    static bool submit(Thread *thread, ObjectId oid, const Value& function_name, Value *args = 0, ArgNo n = 0);
+
+    // Submit a call as a task (with parameter)
+    template<class... Types>
+    static bool submit(Thread *thread, ObjectId oid, const Value& function_name, Types&&... args)
+    {
+        Value params[] = { args... };
+        ArgNo n = sizeof(params) / sizeof(params[0]);
+        return submit(thread, oid, function_name, params, n);
+    }
+
+    // Let a worker run the domain (there are calls in mailbox)
+    static void schedule_domain(Domain *domain);
+
+    // Run the entry in a new coroutine on a worker
+    static bool spawn(Coroutine::Entry entry, void *para, size_t stack_size = Coroutine::DEFAULT_STACK_SIZE);
+
+    // Return statistics of workers in a mapping value
+    static Value get_scheduler_detail();
+
+private:
+    // Entry of worker thread
+    static void *worker_entry(Worker *worker);
+
+    // Get a task from local deque or steal one
+    static bool take_task(Worker *worker, Task *task);
+
+    // Run a task
+    static void run_task(Worker *worker, const Task& task);
+
+    // Run a domain
+    static void run_domain(Worker *worker, DomainId id);
+
+    // Resume a coroutine
+    static void run_coroutine(Worker *worker, Coroutine *co);
+
+    // Drop a task left when stopping
+    static void drop_task(const Task& task);
+
+    // Wake up the worker if it is parked
+    static void wake_worker(Worker *worker);
+
+    // Wake up the worker or an idle one after pushing a task to it
+    static void notify_worker(Worker *worker);
+
+private:
+    static Worker *m_workers;
+    static size_t m_worker_count;
+    static volatile AtomInt m_running_count;
+    static volatile int m_stopping;
+    static bool m_started;
+    static volatile AtomInt m_next_worker;
+};
+
+} // End of namespace: cmm
@@ -0,0 +1,470 @@
+// cmm_serializer.cpp
+
+#include <string.h>
+#include "std_port/std_port.h"
+#include "cmm_object.h"
+#include "cmm_output.h"
+#include "cmm_program.h"
+#include "cmm_serializer.h"
+#include "cmm_value_list.h"
+
+namespace cmm
+{
+
+Serializer::Serializer(OutputSink *sink) :
+    m_sink(sink),
+    m_data(FLUSH_SIZE),
+    m_flushed(0),
+    m_unsupported(0)
+{
+}
+
+Serializer::~Serializer()
+{
+    reset_strings();
+}
+
+// Write a value & all values referred by it
+void Serializer::write_value(const Value& value)
+{
+    switch (value.m_type)
+    {
+    case INTEGER:
+        write_byte(SERIAL_INTEGER);
+        write_int(value.m_int);
+        return;
+
+    case REAL:
+        write_byte(SERIAL_REAL);
+        write_real(value.m_real);
+        return;
+
+    case OBJECT:
+        write_byte(SERIAL_OBJECT);
+        write_uint((Uint64)value.m_oid.i64);
+        return;
+
+    case STRING:
+        write_string(value.m_string);
+        return;
+
+    case BUFFER:
+    case ARRAY:
+    case MAPPING:
+        if (write_reference(value.m_reference))
+            return;
+        break;
+
+    default:
+        break;
+    }
+
+    // Nil or not supported
+    if (value.m_type != NIL)
+        m_unsupported++;
+    write_byte(SERIAL_NIL);
+}
+
+// Write member vars of object
+// Format: program, components count, then for each component:
+//     name, vars count, (var name, value) x N
+// The vars are written by names, so they can be restored after the
+// layout of program was changed
+void Serializer::write_object_vars(Object *ob)
+{
+    auto *program = ob->get_program();
+    write_string(program->get_name());
+    write_uint(program->get_components_count());
+    for (ComponentNo i = 0; i < program->get_components_count(); i++)
+    {
+        auto *component = program->get_component(i);
+        auto *p = (AbstractComponent *)((Uint8 *)ob + program->get_component_offset(i));
+        write_string(program->get_component_name(i));
+        write_uint(component->get_object_vars_count());
+        for (VariableNo k = 0; k < component->get_object_vars_count(); k++)
+        {
+            write_string(component->get_object_var(k)->get_name());
+            write_value(p->m_object_vars[k]);
+        }
+    }
+}
+
+// Write unsigned integer as varint (7 bits per byte)
+void Serializer::write_uint(Uint64 val)
+{
+    while (val >= 0x80)
+    {
+        write_byte((Uint8)(val | 0x80));
+        val >>= 7;
+    }
+    write_byte((Uint8)val);
+}
+
+// Write real in 8 bytes (little endian)
+void Serializer::write_real(Real val)
+{
+    Uint64 bits;
+    memcpy(&bits, &val, sizeof(bits));
+    for (int i = 0; i < 8; i++, bits >>= 8)
+        write_byte((Uint8)bits);
+}
+
+// Write raw bytes
+void Serializer::write_bytes(const void *p, size_t len)
+{
+    m_data.push_back_array((const Uint8 *)p, len);
+}
+
+// Write string, or index of it if the content was written
+void Serializer::write_string(const StringImpl *string)
+{
+    StringKey key;
+    key.string = string;
+    Uint32 index;
+    if (m_strings.try_get(key, &index))
+    {
+        write_byte(SERIAL_STRING_REF);
+        write_uint(index);
+        return;
+    }
+
+    // The string in value may be freed by GC before the table is reset,
+    // keep a copy of it unless it's a constant one
+    if (!string->is_constant())
+    {
+        auto *copy = STRING_ALLOC(string);
+        m_copied_strings.push_back(copy);
+        key.string = copy;
+    }
+    m_strings.put(key, (Uint32)m_strings.size());
+    write_byte(SERIAL_STRING);
+    write_uint(string->length());
+    write_bytes(string->ptr(), string->length());
+}
+
+// Write array/mapping/buffer, or index of it if it was written in graph
+// Return false if the value is not supported
+bool Serializer::write_reference(ReferenceImpl *reference)
+{
+    Uint32 index;
+    if (m_references.try_get(reference, &index))
+    {
+        write_byte(SERIAL_REF);
+        write_uint(index);
+        return true;
+    }
+
+    switch (reference->get_type())
+    {
+    case BUFFER:
+    {
+        auto *buffer = (BufferImpl *)reference;
+        if (buffer->buffer_attrib & BufferImpl::CONTAIN_CLASS)
+            // The class may contain pointers
+            return false;
+
+        m_references.put(reference, (Uint32)m_references.size());
+        write_byte(SERIAL_BUFFER);
+        write_uint(buffer->length());
+        write_bytes(buffer->data(), buffer->length());
+        return true;
+    }
+
+    case ARRAY:
+    {
+        // Register before elements, they may refer this array
+        auto *arr = (ArrayImpl *)reference;
+        m_references.put(reference, (Uint32)m_references.size());
+        write_byte(SERIAL_ARRAY);
+        write_uint(arr->size());
+        for (auto &it : arr->a)
+            write_value(it);
+        return true;
+    }
+
+    case MAPPING:
+    {
+        auto *map = (MapImpl *)reference;
+        m_references.put(reference, (Uint32)m_references.size());
+        write_byte(SERIAL_MAPPING);
+        write_uint(map->size());
+        for (auto &it : map->m)
+        {
+            write_value(it.first);
+            write_value(it.second);
+        }
+        return true;
+    }
+
+    default:
+        return false;
+    }
+}
+
+// Forget the written arrays/mappings/buffers
+void Serializer::reset_references()
+{
+    m_references.clear();
+}
+
+// Forget all written strings
+void Serializer::reset_strings()
+{
+    m_strings.clear();
+    for (auto &it : m_copied_strings)
+        STRING_FREE(it);
+    m_copied_strings.clear();
+}
+
+// Write data to sink
+bool Serializer::flush(bool force)
+{
+    if (!m_sink || m_data.size() == 0)
+        return true;
+
+    if (!force && m_data.size() < FLUSH_SIZE)
+        return true;
+
+    bool ok = m_sink->write((const char_t *)get_data(), m_data.size());
+    m_flushed += m_data.size();
+    m_data.clear();
+    return ok;
+}
+
+Deserializer::Deserializer(ValueList *values, const void *data, size_t len) :
+    m_values(values),
+    m_begin((const Uint8 *)data),
+    m_p((const Uint8 *)data),
+    m_end((const Uint8 *)data + len)
+{
+}
+
+Deserializer::~Deserializer()
+{
+    reset_strings();
+}
+
+// Forget all read strings
+void Deserializer::reset_strings()
+{
+    for (auto &it : m_strings)
+        STRING_FREE(it);
+    m_strings.clear();
+}
+
+// Read a value
+bool Deserializer::read_value(Value *value)
+{
+    return read_value_at(value, 0);
+}
+
+bool Deserializer::read_byte(Uint8 *b)
+{
+    if (m_p >= m_end)
+        return false;
+    *b = *m_p++;
+    return true;
+}
+
+// Read varint
+bool Deserializer::read_uint(Uint64 *val)
+{
+    Uint64 result = 0;
+    for (int shift = 0; shift < 64; shift += 7)
+    {
+        Uint8 b;
+        if (!read_byte(&b))
+            return false;
+        result |= (Uint64)(b & 0x7F) << shift;
+        if (!(b & 0x80))
+        {
+            *val = result;
+            return true;
+        }
+    }
+    // Too long
+    return false;
+}
+
+// Read zigzag varint
+bool Deserializer::read_int(Int64 *val)
+{
+    Uint64 u;
+    if (!read_uint(&u))
+        return false;
+    *val = (Int64)(u >> 1) ^ -(Int64)(u & 1);
+    return true;
+}
+
+// Read real in 8 bytes (little endian)
+bool Deserializer::read_real(Real *val)
+{
+    if (get_left() < 8)
+        return false;
+
+    Uint64 bits = 0;
+    for (int i = 7; i >= 0; i--)
+        bits = (bits << 8) | m_p[i];
+    m_p += 8;
+    memcpy(val, &bits, sizeof(bits));
+    return true;
+}
+
+// Read string or index of string
+bool Deserializer::read_string(StringImpl **string)
+{
+    Uint8 tag;
+    Uint64 n;
+    if (!read_byte(&tag) || !read_uint(&n))
+        return false;
+
+    if (tag == SERIAL_STRING_REF)
+    {
+        if (n >= m_strings.size())
+            return false;
+        *string = m_strings[(size_t)n];
+        return true;
+    }
+
+    if (tag != SERIAL_STRING || n > get_left())
+        return false;
+
+    // Keep it in table, don't bind it to any owner
+    auto *impl = STRING_ALLOC((const char *)m_p, (size_t)n);
+    m_p += n;
+    m_strings.push_back(impl);
+    *string = impl;
+    return true;
+}
+
+// Read a value at depth of graph
+bool Deserializer::read_value_at(Value *value, size_t depth)
+{
+    if (depth > MAX_DEPTH)
+        return false;
+
+    if (m_p >= m_end)
+        return false;
+
+    Uint8 tag = *m_p;
+    if (tag == SERIAL_STRING || tag == SERIAL_STRING_REF)
+    {
+        StringImpl *string;
+        if (!read_string(&string))
+            return false;
+        // Bind to list, set the value without binding to domain
+        auto *copy = STRING_ALLOC(string);
+        m_values->append_value(copy);
+        value->m_type = STRING;
+        value->m_reference = copy;
+        return true;
+    }
+
+    Uint64 n;
+    m_p++;
+    switch (tag)
+    {
+    case SERIAL_NIL:
+        *value = NIL;
+        return true;
+
+    case SERIAL_INTEGER:
+    {
+        Int64 i;
+        if (!read_int(&i))
+            return false;
+        *value = Value((Integer)i);
+        return true;
+    }
+
+    case SERIAL_REAL:
+    {
+        Real r;
+        if (!read_real(&r))
+            return false;
+        *value = Value(r);
+        return true;
+    }
+
+    case SERIAL_OBJECT:
+    {
+        ObjectId oid;
+        if (!read_uint(&n))
+            return false;
+        oid.i64 = (Int64)n;
+        *value = Value(oid);
+        return true;
+    }
+
+    case SERIAL_REF:
+    {
+        if (!read_uint(&n) || n >= m_references.size())
+            return false;
+        auto *reference = m_references[(size_t)n];
+        value->m_type = (ValueType)reference->type;
+        value->m_reference = reference;
+        return true;
+    }
+
+    case SERIAL_BUFFER:
+    {
+        if (!read_uint(&n) || n > get_left())
+            return false;
+        auto *buffer = BUFFER_ALLOC(m_p, (size_t)n);
+        m_values->append_value(buffer);
+        m_p += n;
+        m_references.push_back(buffer);
+        value->m_type = BUFFER;
+        value->m_reference = buffer;
+        return true;
+    }
+
+    case SERIAL_ARRAY:
+    {
+        // Each element takes 1 byte at least
+        if (!read_uint(&n) || n > get_left())
+            return false;
+        auto *arr = XNEW(ArrayImpl, (size_t)n);
+        m_values->append_value(arr);
+        m_references.push_back(arr);
+        value->m_type = ARRAY;
+        value->m_reference = arr;
+        for (Uint64 i = 0; i < n; i++)
+        {
+            Value element = NIL;
+            if (!read_value_at(&element, depth + 1))
+                return false;
+            arr->push_back(element);
+        }
+        return true;
+    }
+
+    case SERIAL_MAPPING:
+    {
+        // Each pair takes 2 bytes at least
+        if (!read_uint(&n) || n > get_left() / 2)
+            return false;
+        auto *map = XNEW(MapImpl, (size_t)n);
+        m_values->append_value(map);
+        m_references.push_back(map);
+        value->m_type = MAPPING;
+        value->m_reference = map;
+        for (Uint64 i = 0; i < n; i++)
+        {
+            Value key = NIL;
+            Value val = NIL;
+            if (!read_value_at(&key, depth + 1) ||
+                !read_value_at(&val, depth + 1))
+                return false;
+            map->set(key, val);
+        }
+        return true;
+    }
+
+    default:
+        // Bad tag
+        return false;
+    }
+}
+
+} // End of namespace: cmm
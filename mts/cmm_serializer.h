@@ -0,0 +1,177 @@
+// cmm_serializer.h
+// Native binary format of values
+
+#pragma once
+
+#include "std_port/std_port.h"
+#include "std_template/simple_hash_map.h"
+#include "std_template/simple_vector.h"
+#include "cmm.h"
+#include "cmm_value.h"
+
+namespace cmm
+{
+
+class Object;
+class OutputSink;
+class ValueList;
+
+// Format of a value:
+//     tag:Uint8 [payload]
+// Integers are written as zigzag varint, reals as 8 bytes little endian.
+// A string is written once in the stream, the later ones with same
+// content refer it by index. An array, mapping or buffer is written once
+// in a graph, the later ones (shared sub-graph or cycle) refer it by
+// index.
+enum SerialTag
+{
+    SERIAL_NIL = 0,
+    SERIAL_INTEGER = 1,     // varint
+    SERIAL_REAL = 2,        // 8 bytes
+    SERIAL_OBJECT = 3,      // oid
+    SERIAL_STRING = 4,      // len, bytes (new string)
+    SERIAL_STRING_REF = 5,  // index of string
+    SERIAL_BUFFER = 6,      // len, bytes
+    SERIAL_ARRAY = 7,       // count, elements
+    SERIAL_MAPPING = 8,     // count, key/value pairs
+    SERIAL_REF = 9,         // index of array/mapping/buffer
+};
+
+// Write values to a memory block, flush it to sink when it's large
+class Serializer
+{
+public:
+    enum { FLUSH_SIZE = 64 * 1024 };
+
+public:
+    Serializer(OutputSink *sink = 0);
+    ~Serializer();
+
+public:
+    // Write a value & all values referred by it
+    // The function & buffer contains class are not supported, write them
+    // as nil & count them
+    void write_value(const Value& value);
+
+    // Write member vars of object, by names of components & vars
+    void write_object_vars(Object *ob);
+
+    // Write primitive values
+    void write_byte(Uint8 b) { m_data.push_back(b); }
+    void write_uint(Uint64 val);
+    void write_int(Int64 val) { write_uint(((Uint64)val << 1) ^ (Uint64)(val >> 63)); }
+    void write_real(Real val);
+    void write_bytes(const void *p, size_t len);
+    void write_string(const StringImpl *string);
+
+public:
+    // Forget the written arrays/mappings/buffers, start a new graph
+    void reset_references();
+
+    // Forget all written strings
+    void reset_strings();
+
+    // Write data to sink if there are too many, or force to write all
+    // Return false if the sink failed
+    bool flush(bool force = false);
+
+public:
+    // Data not flushed yet
+    const Uint8 *get_data() const { return m_data.get_array_address(0); }
+    size_t get_data_size() const { return m_data.size(); }
+
+    // Bytes written to sink
+    size_t get_flushed() const { return m_flushed; }
+
+    // Count of values written as nil since they are not supported
+    size_t get_unsupported_count() const { return m_unsupported; }
+
+private:
+    // Key of string table, compare by content
+    struct StringKey
+    {
+        const StringImpl *string;
+
+        bool operator ==(const StringKey& other) const
+        {
+            return StringImpl::compare(string, other.string) == 0;
+        }
+    };
+
+    struct string_key_hash_func
+    {
+        size_t operator()(const StringKey& key) const
+        {
+            return key.string->hash_value();
+        }
+    };
+
+private:
+    // Write a reference value not written in graph
+    bool write_reference(ReferenceImpl *reference);
+
+private:
+    OutputSink *m_sink;
+    simple::unsafe_vector<Uint8> m_data;
+    simple::hash_map<StringKey, Uint32, string_key_hash_func> m_strings;
+    simple::unsafe_vector<StringImpl *> m_copied_strings;
+    simple::hash_map<ReferenceImpl *, Uint32> m_references;
+    size_t m_flushed;
+    size_t m_unsupported;
+};
+
+// Read values from a memory block
+// The values are bound to the list instead of domain, since the graph
+// being read is not referred by any root of GC. Concat the list to domain
+// after the values are referred.
+class Deserializer
+{
+public:
+    enum { MAX_DEPTH = 1024 };
+
+public:
+    Deserializer(ValueList *values, const void *data, size_t len);
+    ~Deserializer();
+
+public:
+    // Read a value, return false if the data is bad
+    bool read_value(Value *value);
+
+    // Read primitive values
+    bool read_byte(Uint8 *b);
+    bool read_uint(Uint64 *val);
+    bool read_int(Int64 *val);
+    bool read_real(Real *val);
+
+    // Read string, it's kept in table until reset_strings()
+    bool read_string(StringImpl **string);
+
+public:
+    // Forget the read arrays/mappings/buffers, start a new graph
+    void reset_references() { m_references.clear(); }
+
+    // Forget all read strings
+    void reset_strings();
+
+    // Is all data read?
+    bool is_end() const { return m_p >= m_end; }
+
+    // Bytes read
+    size_t get_offset() const { return m_p - m_begin; }
+
+private:
+    bool read_value_at(Value *value, size_t depth);
+
+    // Bytes not read, a count larger than it must be bad
+    size_t get_left() const { return m_end - m_p; }
+
+private:
+    ValueList *m_values;
+    const Uint8 *m_begin;
+    const Uint8 *m_p;
+    const Uint8 *m_end;
+    simple::unsafe_vector<StringImpl *> m_strings;
+    simple::unsafe_vector<ReferenceImpl *> m_references;
+};
+
+} // End of namespace: cmm
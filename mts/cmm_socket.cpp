@@ -1,9 +1,1212 @@
 // cmm_socket.cpp
 
+#include <stdio.h>
 #include <string.h>
+#ifdef __linux__
+#include <signal.h>
+#include <sys/epoll.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/uio.h>
+#include <netinet/tcp.h>
+#endif
+#include "std_port/std_port_cs.h"
+#include "std_memmgr/std_memmgr.h"
+#include "cmm_program.h"
+#include "cmm_scheduler.h"
 #include "cmm_socket.h"
+#include "cmm_thread.h"
 
 namespace cmm
 {
 
+struct std_critical_section* Socket::m_cs = 0;
+Socket::ConnectionMap* Socket::m_connections = 0;
+Socket::OwnerMap* Socket::m_owners = 0;
+Socket::Reactor* Socket::m_reactors = 0;
+size_t Socket::m_reactor_count = 0;
+volatile AtomInt Socket::m_running_count = 0;
+volatile int Socket::m_stopping = 0;
+volatile AtomInt Socket::m_next_reactor = 0;
+Socket::Id Socket::m_next_id = 1;
+bool Socket::m_started = false;
+bool Socket::m_use_uring = true;
+StringImpl* Socket::m_accepted_name = 0;
+StringImpl* Socket::m_read_name = 0;
+StringImpl* Socket::m_closed_name = 0;
+
+// Initialize this module
+bool Socket::init()
+{
+    std_new_critical_section(&m_cs);
+    m_connections = XNEW(ConnectionMap);
+    m_owners = XNEW(OwnerMap);
+    m_accepted_name = Program::find_or_add_string("socket_accepted");
+    m_read_name = Program::find_or_add_string("socket_read");
+    m_closed_name = Program::find_or_add_string("socket_closed");
+    return true;
+}
+
+// Shutdown this module
+void Socket::shutdown()
+{
+    stop();
+    XDELETE(m_owners);
+    XDELETE(m_connections);
+    std_delete_critical_section(m_cs);
+}
+
+#ifdef __linux__
+
+// Set socket to non-blocking mode
+static bool set_non_blocking(SOCKET fd)
+{
+    int flags = fcntl(fd, F_GETFL, 0);
+    return flags != -1 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) != -1;
+}
+
+// Resolve host:port to IPv4 address
+static bool resolve_address(const char* host, int port, struct sockaddr_in* addr)
+{
+    memset(addr, 0, sizeof(*addr));
+    addr->sin_family = AF_INET;
+    addr->sin_port = htons((Uint16)port);
+    if (!host || !host[0])
+    {
+        addr->sin_addr.s_addr = htonl(INADDR_ANY);
+        return true;
+    }
+    if (inet_pton(AF_INET, host, &addr->sin_addr) == 1)
+        return true;
+
+    // Not a numeric address, lookup it (blocked)
+    struct addrinfo hints, *result;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host, NULL, &hints, &result) != 0 || !result)
+        return false;
+    addr->sin_addr = ((struct sockaddr_in*)result->ai_addr)->sin_addr;
+    freeaddrinfo(result);
+    return true;
+}
+
+// Print "ip:port" of address
+static void print_address(const struct sockaddr_in* addr, char* buf, size_t size)
+{
+    char ip[INET_ADDRSTRLEN];
+    if (!inet_ntop(AF_INET, &addr->sin_addr, ip, sizeof(ip)))
+        strcpy(ip, "?");
+    snprintf(buf, size, "%s:%d", ip, (int)ntohs(addr->sin_port));
+}
+
+// Start reactors
+bool Socket::start(size_t reactor_count)
+{
+    if (m_started)
+        return false;
+
+    if (!reactor_count)
+        reactor_count = (size_t)std_get_cpu_count();
+
+    // Writing to a socket closed by peer should fail instead of killing
+    // the process
+    signal(SIGPIPE, SIG_IGN);
+
+    m_stopping = 0;
+    m_next_reactor = 0;
+    m_reactor_count = reactor_count;
+    m_reactors = XNEWN(Reactor, reactor_count);
+    for (size_t i = 0; i < reactor_count; i++)
+    {
+        auto* reactor = &m_reactors[i];
+        reactor->index = i;
+        reactor->thread = 0;
+        reactor->epoll_fd = -1;
+        reactor->destroyed_count = 0;
+        reactor->wakeup_fds[0] = reactor->wakeup_fds[1] = -1;
+        if (pipe(reactor->wakeup_fds) == 0)
+        {
+            set_non_blocking(reactor->wakeup_fds[0]);
+            set_non_blocking(reactor->wakeup_fds[1]);
+        }
+        std_init_spin_lock(&reactor->lock);
+
+        // Fall back to epoll if io_uring is not supported
+        reactor->ring = m_use_uring ? create_uring(reactor) : 0;
+        if (reactor->ring)
+            continue;
+        reactor->epoll_fd = epoll_create(STD_MAX_POLL_SOCKETS);
+        if (reactor->wakeup_fds[0] != -1)
+        {
+            struct epoll_event event;
+            event.events = EPOLLIN;
+            event.data.ptr = 0;
+            epoll_ctl(reactor->epoll_fd, EPOLL_CTL_ADD, reactor->wakeup_fds[0], &event);
+        }
+    }
+
+    m_started = true;
+    for (size_t i = 0; i < reactor_count; i++)
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "Reactor(%zu)", i);
+        std_cpu_lock_add(&m_running_count, 1);
+        if (!std_create_task(name, NULL, (void *)reactor_entry, &m_reactors[i]))
+        {
+            std_cpu_lock_add(&m_running_count, -1);
+            STD_TRACE("Failed to create reactor %zu.\n", i);
+        }
+    }
+    return true;
+}
+
+// Stop reactors & close all sockets
+void Socket::stop()
+{
+    if (!m_started)
+        return;
+
+    // Notify & wait all reactors to exit
+    m_stopping = 1;
+    std_cpu_mfence();
+    while (m_running_count > 0)
+        std_sleep(1);
+
+    // Destroy the rings first, the pending requests are dropped & the
+    // connections can be freed directly
+    for (size_t i = 0; i < m_reactor_count; i++)
+    {
+        auto* reactor = &m_reactors[i];
+        if (reactor->ring)
+        {
+            std_uring_destroy(reactor->ring);
+            reactor->ring = 0;
+        }
+        reactor->requests.clear();
+    }
+
+    // Close the left connections (the reactors are gone)
+    std_enter_critical_section(m_cs);
+    auto connections = m_connections->values();
+    std_leave_critical_section(m_cs);
+    for (auto& conn : connections)
+        destroy_connection(conn);
+
+    for (size_t i = 0; i < m_reactor_count; i++)
+    {
+        auto* reactor = &m_reactors[i];
+        if (reactor->epoll_fd != -1)
+            ::close(reactor->epoll_fd);
+        if (reactor->wakeup_fds[0] != -1)
+        {
+            ::close(reactor->wakeup_fds[0]);
+            ::close(reactor->wakeup_fds[1]);
+        }
+        std_destroy_spin_lock(&reactor->lock);
+    }
+    XDELETEN(m_reactors);
+    m_reactor_count = 0;
+    m_started = false;
+}
+
+// Count of reactors using io_uring
+size_t Socket::get_uring_reactors_count()
+{
+    size_t count = 0;
+    for (size_t i = 0; m_started && i < m_reactor_count; i++)
+        if (m_reactors[i].ring)
+            count++;
+    return count;
+}
+
+// Listen on host:port
+Socket::Id Socket::listen(ObjectId owner, const char* host, int port)
+{
+    struct sockaddr_in addr;
+    if (!m_started || !resolve_address(host, port, &addr))
+        return -1;
+
+    SOCKET fd = port_socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+
+    int on = 1;
+    port_setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if (port_bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+        port_listen(fd, SOMAXCONN) < 0 ||
+        !set_non_blocking(fd))
+    {
+        port_close(fd);
+        return -1;
+    }
+
+    // Get the bound port if port 0 is used
+    char address[64];
+    socklen_t len = sizeof(addr);
+    port_getsockname(fd, (struct sockaddr*)&addr, &len);
+    print_address(&addr, address, sizeof(address));
+    return add_connection(fd, owner, true, false, address);
+}
+
+// Connect to host:port
+Socket::Id Socket::connect(ObjectId owner, const char* host, int port)
+{
+    struct sockaddr_in addr;
+    if (!m_started || !resolve_address(host, port, &addr))
+        return -1;
+
+    SOCKET fd = port_socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+
+    int on = 1;
+    port_setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    if (!set_non_blocking(fd) ||
+        (port_connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 && errno != EINPROGRESS))
+    {
+        port_close(fd);
+        return -1;
+    }
+
+    // Wait writable for finishing of connecting
+    char address[64];
+    print_address(&addr, address, sizeof(address));
+    return add_connection(fd, owner, false, true, address);
+}
+
+// Send data
+Integer Socket::send(Id id, const Slice* slices, size_t count)
+{
+    size_t size = 0;
+    for (size_t i = 0; i < count; i++)
+        size += slices[i].size;
+
+    // Pin the connection & send without m_cs, then the sends to different
+    // connections don't wait for each other
+    std_enter_critical_section(m_cs);
+    Connection* conn;
+    if (!m_connections->try_get(id, &conn) || conn->is_listening || conn->closing)
+        conn = 0;
+    else
+        std_cpu_lock_add(&conn->users, 1);
+    std_leave_critical_section(m_cs);
+    if (!conn)
+        return -1;
+
+    Integer ret = -1;
+    std_get_spin_lock(&conn->output_lock);
+    size_t queued = conn->output.size() - conn->output_offset;
+    if (queued + size <= MAX_OUTPUT_SIZE)
+    {
+        // Send directly if nothing is queued before
+        Integer sent = 0;
+        if (!conn->want_write)
+            sent = send_slices(conn, slices, count);
+
+        if (sent < 0)
+            request_close(conn);
+        else
+        {
+            // Queue the rest, let reactor flush it
+            for (size_t i = 0; i < count; i++)
+            {
+                size_t skip = (size_t)sent < slices[i].size ? (size_t)sent : slices[i].size;
+                sent -= skip;
+                conn->output.push_back_array((const Uint8*)slices[i].data + skip, slices[i].size - skip);
+            }
+            if (conn->output.size() > conn->output_offset && !conn->want_write)
+            {
+                conn->want_write = true;
+                if (conn->reactor->ring)
+                    post_request(conn, REQUEST_WRITE);
+                else
+                    update_events(conn);
+            }
+            ret = (Integer)size;
+        }
+    }
+    std_release_spin_lock(&conn->output_lock);
+    std_cpu_lock_add(&conn->users, -1);
+    return ret;
+}
+
+// Send data to all connections owned by the owners
+// The data is copied once, the payload is freed after all reactors sent it
+void Socket::broadcast(const ObjectId* owners, size_t count, const void* data, size_t size, Integer* statuses)
+{
+    auto* payload = (Payload*)STD_MEM_ALLOC(sizeof(Payload) + size);
+    payload->refs = 1;
+    payload->size = size;
+    memcpy(payload->data, data, size);
+
+    // Pin the connections, then send without m_cs
+    struct Target
+    {
+        Connection* conn;
+        size_t index;                   // Index of owner
+    };
+    simple::vector<Target> targets;
+    std_enter_critical_section(m_cs);
+    for (size_t i = 0; i < count; i++)
+    {
+        statuses[i] = -1;
+        Connection* conn;
+        if (!m_owners->try_get(owners[i], &conn))
+            continue;
+        for (; conn; conn = conn->next_owned)
+        {
+            if (conn->is_listening || conn->closing)
+                continue;
+            std_cpu_lock_add(&conn->users, 1);
+            Target target = { conn, i };
+            targets.push_back(target);
+        }
+    }
+    std_leave_critical_section(m_cs);
+
+    for (auto& it : targets)
+    {
+        auto* conn = it.conn;
+        std_get_spin_lock(&conn->output_lock);
+        Integer queued = conn->closing ? -1 : send_payload(conn, payload);
+        std_release_spin_lock(&conn->output_lock);
+        std_cpu_lock_add(&conn->users, -1);
+        if (queued > statuses[it.index])
+            statuses[it.index] = queued;
+    }
+    release_payload(payload);
+}
+
+// Close a socket
+bool Socket::close(Id id)
+{
+    bool ret = false;
+    std_enter_critical_section(m_cs);
+    Connection* conn;
+    if (m_connections->try_get(id, &conn))
+    {
+        request_close(conn);
+        ret = true;
+    }
+    std_leave_critical_section(m_cs);
+    return ret;
+}
+
+// Hand over the socket to another object
+bool Socket::set_owner(Id id, ObjectId owner)
+{
+    bool ret = false;
+    std_enter_critical_section(m_cs);
+    Connection* conn;
+    if (m_connections->try_get(id, &conn))
+    {
+        unlink_owner(conn);
+        conn->owner = owner;
+        link_owner(conn);
+        ret = true;
+    }
+    std_leave_critical_section(m_cs);
+    return ret;
+}
+
+// Get address of peer
+bool Socket::get_address(Id id, simple::string* address)
+{
+    bool ret = false;
+    std_enter_critical_section(m_cs);
+    Connection* conn;
+    if (m_connections->try_get(id, &conn))
+    {
+        *address = conn->address;
+        ret = true;
+    }
+    std_leave_critical_section(m_cs);
+    return ret;
+}
+
+// Entry of reactor thread
+void* Socket::reactor_entry(Reactor* reactor)
+{
+    auto* thread = XNEW(Thread);
+    thread->start();
+    reactor->thread = thread;
+
+    if (reactor->ring)
+        run_uring(reactor);
+    else
+        run_epoll(reactor);
+
+    thread->stop();
+    XDELETE(thread);
+    std_cpu_lock_add(&m_running_count, -1);
+    return 0;
+}
+
+// Loop of reactor waiting on epoll
+void Socket::run_epoll(Reactor* reactor)
+{
+    struct epoll_event events[MAX_EVENTS];
+    while (!m_stopping)
+    {
+        int n = epoll_wait(reactor->epoll_fd, events, MAX_EVENTS, WAIT_TIMEOUT);
+        for (int i = 0; i < n; i++)
+        {
+            auto* conn = (Connection*)events[i].data.ptr;
+            if (!conn)
+            {
+                // Woken up, the requests are handled later
+                char buf[64];
+                while (read(reactor->wakeup_fds[0], buf, sizeof(buf)) > 0);
+                continue;
+            }
+            if (conn->closing)
+                // Will be destroyed later
+                continue;
+
+            if (conn->is_listening)
+            {
+                on_accept(reactor, conn);
+                continue;
+            }
+            if (events[i].events & EPOLLOUT)
+                on_write(reactor, conn);
+            if (!conn->closing && (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)))
+                on_read(reactor, conn);
+        }
+
+        // Destroy the connections closed by scripts
+        handle_requests(reactor);
+    }
+}
+
+// Loop of reactor waiting on io_uring
+// The requests prepared in last round are submitted with the waiting
+void Socket::run_uring(Reactor* reactor)
+{
+    while (!m_stopping)
+    {
+        if (std_uring_submit(reactor->ring, 1, WAIT_TIMEOUT) < 0)
+            std_sleep(1);
+
+        std_uring_cqe_t cqe;
+        while (std_uring_peek(reactor->ring, &cqe))
+            on_completion(reactor, &cqe);
+
+        handle_requests(reactor);
+    }
+
+    // Wait the cancelled requests of destroyed connections, the others
+    // are freed by stop()
+    for (int i = 0; reactor->destroyed_count && i < 100; i++)
+    {
+        std_uring_submit(reactor->ring, 1, 10);
+        std_uring_cqe_t cqe;
+        while (std_uring_peek(reactor->ring, &cqe))
+            on_completion(reactor, &cqe);
+        handle_requests(reactor);
+    }
+}
+
+// Create io_uring of reactor
+// The wakeup pipe is read as fixed file into fixed buffer
+std_uring_t* Socket::create_uring(Reactor* reactor)
+{
+    if (reactor->wakeup_fds[0] == -1)
+        return 0;
+
+    auto* ring = std_uring_create(URING_ENTRIES);
+    if (!ring)
+        return 0;
+
+    struct iovec iov;
+    iov.iov_base = reactor->wakeup_buf;
+    iov.iov_len = sizeof(reactor->wakeup_buf);
+    if (!std_uring_provide_buffers(ring, URING_BUFFERS_COUNT, URING_BUFFER_SIZE) ||
+        !std_uring_register_files(ring, &reactor->wakeup_fds[0], 1) ||
+        !std_uring_register_buffers(ring, &iov, 1) ||
+        !std_uring_prep_read_fixed(ring, 0, reactor->wakeup_buf, sizeof(reactor->wakeup_buf), 0, 0, OP_WAKEUP))
+    {
+        std_uring_destroy(ring);
+        return 0;
+    }
+    return ring;
+}
+
+// Handle a completion of io_uring
+// The user data is connection | op, a connection is never freed before the
+// last completion of its requests
+void Socket::on_completion(Reactor* reactor, const std_uring_cqe_t* cqe)
+{
+    auto op = (Op)(cqe->user_data & OP_MASK);
+    auto* conn = (Connection*)(size_t)(cqe->user_data & ~(Uint64)OP_MASK);
+    switch (op)
+    {
+    case OP_WAKEUP:
+        // Read pipe again, the requests are handled later
+        std_uring_prep_read_fixed(reactor->ring, 0, reactor->wakeup_buf, sizeof(reactor->wakeup_buf), 0, 0, OP_WAKEUP);
+        return;
+
+    case OP_CANCEL:
+        return;
+
+    default:
+        break;
+    }
+
+    if (!cqe->more)
+    {
+        // The request is finished
+        if (op == OP_POLL_OUT)
+            conn->is_polling_out = false;
+        else
+            conn->is_receiving = false;
+    }
+
+    if (op == OP_SEND)
+        // Release the payload even if it's closing
+        on_sent(reactor, conn, cqe->res);
+
+    if (!conn->closing)
+    {
+        switch (op)
+        {
+        case OP_ACCEPT:
+            if (cqe->res >= 0)
+                on_accepted(reactor, conn, (SOCKET)cqe->res, NULL);
+            break;
+
+        case OP_RECV:
+            if (cqe->res > 0 && cqe->buffer_id >= 0)
+            {
+                auto* buffer = BUFFER_ALLOC(std_uring_get_buffer(reactor->ring, cqe->buffer_id), (size_t)cqe->res);
+                Value args[] = { conn->id, buffer };
+                post_callback(reactor->thread, conn->owner, m_read_name, args, sizeof(args) / sizeof(args[0]));
+            } else
+            if (cqe->res != -ENOBUFS)
+                // Closed by peer or error occurred (the recv is armed
+                // again if it's out of buffers)
+                close_by_reactor(reactor, conn);
+            break;
+
+        case OP_POLL_OUT:
+            on_write(reactor, conn);
+            break;
+
+        default:
+            break;
+        }
+
+        // Arm the finished requests again
+        if (!conn->closing)
+            update_events(conn);
+    }
+
+    if (cqe->buffer_id >= 0)
+        std_uring_recycle_buffer(reactor->ring, cqe->buffer_id);
+    if (!cqe->more)
+        release_op(conn);
+}
+
+// Handle requests posted to reactor
+void Socket::handle_requests(Reactor* reactor)
+{
+    std_get_spin_lock(&reactor->lock);
+    auto requests = simple::move(reactor->requests);
+    std_release_spin_lock(&reactor->lock);
+    for (auto& request : requests)
+    {
+        auto* conn = request.conn;
+        if (request.type == REQUEST_CLOSE)
+        {
+            release_op(conn);
+            destroy_connection(conn);
+            continue;
+        }
+
+        if (request.type == REQUEST_SEND)
+        {
+            // Handle it as nothing is sent if it can't be prepared or the
+            // connection is closing
+            auto* payload = conn->sending;
+            if (!conn->closing &&
+                std_uring_prep_send(reactor->ring, (int)conn->fd, payload->data, (Uint32)payload->size,
+                                    MSG_NOSIGNAL, (Uint64)(size_t)conn | OP_SEND))
+                std_cpu_lock_add(&conn->pending_ops, 1);
+            else
+            {
+                on_sent(reactor, conn, 0);
+                if (!conn->closing)
+                    update_events(conn);
+            }
+            release_op(conn);
+            continue;
+        }
+
+        // The connection may be destroyed after the request is posted
+        if (!conn->is_destroyed && !conn->closing)
+            update_events(conn);
+        release_op(conn);
+    }
+}
+
+// Accept new connections
+void Socket::on_accept(Reactor* reactor, Connection* conn)
+{
+    for (size_t i = 0; i < MAX_ACCEPT_BATCH; i++)
+    {
+        struct sockaddr_in addr;
+        socklen_t len = sizeof(addr);
+        int fd = port_accept(conn->fd, (struct sockaddr*)&addr, &len);
+        if (fd < 0)
+            break;
+
+        if (!set_non_blocking(fd))
+        {
+            port_close(fd);
+            continue;
+        }
+        on_accepted(reactor, conn, fd, &addr);
+    }
+}
+
+// Set up an accepted connection & notify owner
+// Get address of peer if addr is NULL
+void Socket::on_accepted(Reactor* reactor, Connection* conn, SOCKET fd, const struct sockaddr_in* addr)
+{
+    int on = 1;
+    port_setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+    char address[64];
+    struct sockaddr_in peer_addr;
+    socklen_t len = sizeof(peer_addr);
+    if (!addr && port_getpeername(fd, (struct sockaddr*)&peer_addr, &len) == 0)
+        addr = &peer_addr;
+    if (addr)
+        print_address(addr, address, sizeof(address));
+    else
+        strcpy(address, "?");
+
+    // Put it in table, so the script can use it in socket_accepted, then
+    // notify owner before the connection is armed, so socket_accepted is
+    // always the first callback of it
+    // Pin it, the script may close it before it's armed
+    auto* accepted = register_connection(fd, conn->owner, false, false, address);
+    std_cpu_lock_add(&accepted->users, 1);
+    Value args[] = { conn->id, accepted->id, address };
+    post_callback(reactor->thread, conn->owner, m_accepted_name, args, sizeof(args) / sizeof(args[0]));
+    arm_connection(accepted);
+    std_cpu_lock_add(&accepted->users, -1);
+}
+
+// Receive all arrived data into a new buffer & deliver it in one callback
+void Socket::on_read(Reactor* reactor, Connection* conn)
+{
+    // Allocate the buffer by size of arrived data, 0 if peer is closed
+    int capacity = 0;
+    if (ioctl(conn->fd, FIONREAD, &capacity) < 0 || capacity <= 0)
+        capacity = MIN_READ_SIZE;
+    else if (capacity > MAX_READ_BATCH)
+        capacity = MAX_READ_BATCH;
+    auto* buffer = BUFFER_ALLOC((size_t)capacity);
+
+    size_t size = 0;
+    bool is_closed = false;
+    while (size < (size_t)capacity)
+    {
+        int n = port_recv(conn->fd, (char*)buffer->data() + size, capacity - size, 0);
+        if (n > 0)
+        {
+            size += n;
+            continue;
+        }
+        if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+            is_closed = true;
+        break;
+    }
+
+    if (size)
+    {
+        buffer->len = size;
+        Value args[] = { conn->id, buffer };
+        post_callback(reactor->thread, conn->owner, m_read_name, args, sizeof(args) / sizeof(args[0]));
+    } else
+        BUFFER_FREE(buffer);
+    if (is_closed)
+        close_by_reactor(reactor, conn);
+}
+
+// Flush queued output
+void Socket::on_write(Reactor* reactor, Connection* conn)
+{
+    std_get_spin_lock(&conn->output_lock);
+    bool ok = flush_output(conn);
+    if (ok && conn->output.size() == 0)
+    {
+        // All sent (or connected)
+        conn->want_write = false;
+        update_events(conn);
+    } else
+    if (ok && reactor->ring)
+        // Poll of io_uring is one shot
+        update_events(conn);
+    std_release_spin_lock(&conn->output_lock);
+
+    if (!ok)
+        close_by_reactor(reactor, conn);
+}
+
+// Payload is sent by reactor
+// Put the rest before the data queued after it
+void Socket::on_sent(Reactor* reactor, Connection* conn, int res)
+{
+    auto* payload = conn->sending;
+    conn->sending = 0;
+    if (conn->closing)
+    {
+        release_payload(payload);
+        return;
+    }
+
+    bool ok = res >= 0 || res == -EAGAIN || res == -EINTR;
+    std_get_spin_lock(&conn->output_lock);
+    size_t sent = res > 0 ? (size_t)res : 0;
+    if (ok && sent < payload->size)
+    {
+        size_t queued = conn->output.size() - conn->output_offset;
+        simple::vector<Uint8> output(payload->size - sent + queued);
+        output.push_back_array(payload->data + sent, payload->size - sent);
+        if (queued)
+            output.push_back_array(&conn->output[conn->output_offset], queued);
+        conn->output = simple::move(output);
+        conn->output_offset = 0;
+    }
+    if (ok && conn->output.size() == conn->output_offset)
+    {
+        // All sent, the reactor polls writable if it's still queued
+        conn->output.clear();
+        conn->output_offset = 0;
+        conn->want_write = false;
+    }
+    std_release_spin_lock(&conn->output_lock);
+    release_payload(payload);
+
+    if (!ok)
+        close_by_reactor(reactor, conn);
+}
+
+// Create connection, put it in table & wait events of it
+Socket::Id Socket::add_connection(SOCKET fd, ObjectId owner, bool is_listening, bool want_write, const char* address)
+{
+    // The connection isn't known by script yet, it can't be closed before
+    // it's armed
+    auto* conn = register_connection(fd, owner, is_listening, want_write, address);
+    Id id = conn->id;
+    arm_connection(conn);
+    return id;
+}
+
+// Create connection, put it in table & assign it to a reactor
+Socket::Connection* Socket::register_connection(SOCKET fd, ObjectId owner, bool is_listening, bool want_write, const char* address)
+{
+    auto* conn = XNEW(Connection);
+    conn->fd = fd;
+    conn->owner = owner;
+    conn->is_listening = is_listening;
+    conn->want_write = want_write;
+    conn->closing = 0;
+    conn->pending_ops = 0;
+    conn->users = 0;
+    conn->is_destroyed = false;
+    conn->is_receiving = false;
+    conn->is_polling_out = false;
+    conn->sending = 0;
+    conn->prev_owned = 0;
+    conn->next_owned = 0;
+    std_init_spin_lock(&conn->output_lock);
+    conn->output_offset = 0;
+    strncpy(conn->address, address, sizeof(conn->address));
+    conn->address[sizeof(conn->address) - 1] = 0;
+
+    auto index = (size_t)std_cpu_lock_add(&m_next_reactor, 1) % m_reactor_count;
+    conn->reactor = &m_reactors[index];
+
+    std_enter_critical_section(m_cs);
+    conn->id = m_next_id++;
+    m_connections->put(conn->id, conn);
+    link_owner(conn);
+    std_leave_critical_section(m_cs);
+    return conn;
+}
+
+// Start to wait events of a registered connection
+void Socket::arm_connection(Connection* conn)
+{
+    if (conn->reactor->ring)
+    {
+        // Closed by script before armed, it's destroyed by the request
+        if (conn->closing)
+            return;
+
+        // Arm directly if it's accepted by the reactor itself
+        if (Thread::get_current_thread() == conn->reactor->thread)
+            update_events(conn);
+        else
+        {
+            std_enter_critical_section(m_cs);
+            post_request(conn, REQUEST_ADD);
+            std_leave_critical_section(m_cs);
+        }
+        return;
+    }
+
+    // The script may send before it's armed, update_events() failed then,
+    // take want_write under output_lock so that the EPOLLOUT isn't lost
+    std_get_spin_lock(&conn->output_lock);
+    if (!conn->closing)
+    {
+        struct epoll_event event;
+        event.events = EPOLLIN | (conn->want_write ? EPOLLOUT : 0);
+        event.data.ptr = conn;
+        epoll_ctl(conn->reactor->epoll_fd, EPOLL_CTL_ADD, conn->fd, &event);
+    }
+    std_release_spin_lock(&conn->output_lock);
+}
+
+// Remove from table, close & free it
+void Socket::destroy_connection(Connection* conn)
+{
+    std_enter_critical_section(m_cs);
+    m_connections->erase(conn->id);
+    unlink_owner(conn);
+    std_leave_critical_section(m_cs);
+
+    // No one can pin it any more, wait the script threads sending on it
+    // (they hold it for a non-blocking send only)
+    while (conn->users)
+        std_cpu_pause();
+
+    auto* reactor = conn->reactor;
+    if (reactor->ring)
+    {
+        // Cancel the armed requests, free it at last completion
+        if (conn->pending_ops)
+        {
+            conn->is_destroyed = true;
+            reactor->destroyed_count++;
+            if (conn->is_receiving || conn->is_polling_out || conn->sending)
+                std_uring_prep_cancel_fd(reactor->ring, (int)conn->fd, OP_CANCEL);
+            return;
+        }
+    } else
+    if (reactor->epoll_fd != -1)
+        epoll_ctl(reactor->epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+    free_connection(conn);
+}
+
+// Close & free connection
+void Socket::free_connection(Connection* conn)
+{
+    if (conn->is_destroyed)
+        conn->reactor->destroyed_count--;
+    if (conn->sending)
+        release_payload(conn->sending);
+    port_close(conn->fd);
+    std_destroy_spin_lock(&conn->output_lock);
+    XDELETE(conn);
+}
+
+// A pending op is done
+void Socket::release_op(Connection* conn)
+{
+    if (std_cpu_lock_add(&conn->pending_ops, -1) == 1 && conn->is_destroyed)
+        free_connection(conn);
+}
+
+// Closed by peer or error occurred
+void Socket::close_by_reactor(Reactor* reactor, Connection* conn)
+{
+    if (!std_cpu_lock_cas(&conn->closing, 0, 1))
+        // Closed by script, it's destroyed later
+        return;
+
+    Value args[] = { conn->id };
+    post_callback(reactor->thread, conn->owner, m_closed_name, args, sizeof(args) / sizeof(args[0]));
+    destroy_connection(conn);
+}
+
+// Queue connection to be closed by its reactor
+void Socket::request_close(Connection* conn)
+{
+    if (!std_cpu_lock_cas(&conn->closing, 0, 1))
+        // Already closing
+        return;
+
+    post_request(conn, REQUEST_CLOSE);
+}
+
+// Post a request to reactor of connection
+// Wake up the reactor only if there was no request, the reactor will see
+// all requests posted before it takes them
+void Socket::post_request(Connection* conn, RequestType type)
+{
+    auto* reactor = conn->reactor;
+    std_cpu_lock_add(&conn->pending_ops, 1);
+
+    Request request = { conn, type };
+    std_get_spin_lock(&reactor->lock);
+    bool was_empty = reactor->requests.size() == 0;
+    reactor->requests.push_back(request);
+    std_release_spin_lock(&reactor->lock);
+    if (was_empty && reactor->wakeup_fds[1] != -1)
+    {
+        char c = 0;
+        if (write(reactor->wakeup_fds[1], &c, 1) < 0)
+        {
+            // The pipe is full, the reactor is being woken up
+        }
+    }
+}
+
+// Link connection to its owner
+void Socket::link_owner(Connection* conn)
+{
+    Connection* first = 0;
+    m_owners->try_get(conn->owner, &first);
+    conn->prev_owned = 0;
+    conn->next_owned = first;
+    if (first)
+        first->prev_owned = conn;
+    m_owners->put(conn->owner, conn);
+}
+
+// Unlink connection from its owner
+void Socket::unlink_owner(Connection* conn)
+{
+    if (conn->next_owned)
+        conn->next_owned->prev_owned = conn->prev_owned;
+    if (conn->prev_owned)
+        conn->prev_owned->next_owned = conn->next_owned;
+    else if (conn->next_owned)
+        m_owners->put(conn->owner, conn->next_owned);
+    else
+        m_owners->erase(conn->owner);
+    conn->prev_owned = 0;
+    conn->next_owned = 0;
+}
+
+// Send payload to a connection
+Integer Socket::send_payload(Connection* conn, Payload* payload)
+{
+    size_t queued = conn->output.size() - conn->output_offset;
+    if (queued + payload->size > MAX_OUTPUT_SIZE)
+        return -1;
+
+    if (!conn->want_write && conn->reactor->ring)
+    {
+        // Sent by reactor with the others, the data sent later is queued
+        // until it's done
+        conn->want_write = true;
+        conn->sending = payload;
+        std_cpu_lock_add(&payload->refs, 1);
+        post_request(conn, REQUEST_SEND);
+        return 0;
+    }
+
+    Integer sent = 0;
+    if (!conn->want_write)
+    {
+        Slice slice = { payload->data, payload->size };
+        sent = send_slices(conn, &slice, 1);
+        if (sent < 0)
+        {
+            request_close(conn);
+            return -1;
+        }
+    }
+    conn->output.push_back_array(payload->data + sent, payload->size - sent);
+    if (conn->output.size() > conn->output_offset && !conn->want_write)
+    {
+        // Served by epoll
+        conn->want_write = true;
+        update_events(conn);
+    }
+    return (Integer)queued;
+}
+
+// Release a reference of payload
+void Socket::release_payload(Payload* payload)
+{
+    if (std_cpu_lock_add(&payload->refs, -1) == 1)
+        STD_MEM_FREE(payload);
+}
+
+// Send output as much as possible
+bool Socket::flush_output(Connection* conn)
+{
+    while (conn->output_offset < conn->output.size())
+    {
+        int n = port_send(conn->fd, (const char*)&conn->output[conn->output_offset],
+                          conn->output.size() - conn->output_offset, 0);
+        if (n > 0)
+        {
+            conn->output_offset += n;
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+            // Try later
+            return true;
+        return false;
+    }
+
+    // All sent, reuse the buffer
+    conn->output.clear();
+    conn->output_offset = 0;
+    return true;
+}
+
+// Send slices directly
+Integer Socket::send_slices(Connection* conn, const Slice* slices, size_t count)
+{
+    Integer sent = 0;
+    struct iovec iov[MAX_SLICES];
+    for (size_t i = 0; i < count; )
+    {
+        int n = 0;
+        size_t size = 0;
+        for (; i < count && n < MAX_SLICES; i++)
+        {
+            if (!slices[i].size)
+                continue;
+            iov[n].iov_base = (void*)slices[i].data;
+            iov[n].iov_len = slices[i].size;
+            size += slices[i].size;
+            n++;
+        }
+        if (!n)
+            break;
+
+        auto ret = writev(conn->fd, iov, n);
+        if (ret < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+                // Try later
+                break;
+            return -1;
+        }
+        sent += ret;
+        if ((size_t)ret < size)
+            // Kernel buffer is full
+            break;
+    }
+    return sent;
+}
+
+// Update events waited of connection
+void Socket::update_events(Connection* conn)
+{
+    auto* ring = conn->reactor->ring;
+    if (ring)
+    {
+        auto user_data = (Uint64)(size_t)conn;
+        if (!conn->is_receiving &&
+            (conn->is_listening ?
+             std_uring_prep_accept_multishot(ring, (int)conn->fd, SOCK_NONBLOCK, user_data | OP_ACCEPT) :
+             std_uring_prep_recv_multishot(ring, (int)conn->fd, user_data | OP_RECV)))
+        {
+            conn->is_receiving = true;
+            std_cpu_lock_add(&conn->pending_ops, 1);
+        }
+        if (conn->want_write && !conn->is_polling_out && !conn->sending &&
+            std_uring_prep_poll(ring, (int)conn->fd, POLLOUT, user_data | OP_POLL_OUT))
+        {
+            conn->is_polling_out = true;
+            std_cpu_lock_add(&conn->pending_ops, 1);
+        }
+        return;
+    }
+
+    struct epoll_event event;
+    event.events = EPOLLIN | (conn->want_write ? EPOLLOUT : 0);
+    event.data.ptr = conn;
+    epoll_ctl(conn->reactor->epoll_fd, EPOLL_CTL_MOD, conn->fd, &event);
+}
+
+#else
+
+// Reactors are based on epoll, not supported on other platforms yet
+bool Socket::start(size_t reactor_count)
+{
+    STD_TRACE("Socket reactors are not supported on this platform.\n");
+    return false;
+}
+
+void Socket::stop()
+{
+}
+
+size_t Socket::get_uring_reactors_count()
+{
+    return 0;
+}
+
+Socket::Id Socket::listen(ObjectId owner, const char* host, int port)
+{
+    return -1;
+}
+
+Socket::Id Socket::connect(ObjectId owner, const char* host, int port)
+{
+    return -1;
+}
+
+Integer Socket::send(Id id, const Slice* slices, size_t count)
+{
+    return -1;
+}
+
+void Socket::broadcast(const ObjectId* owners, size_t count, const void* data, size_t size, Integer* statuses)
+{
+    for (size_t i = 0; i < count; i++)
+        statuses[i] = -1;
+}
+
+bool Socket::close(Id id)
+{
+    return false;
+}
+
+bool Socket::set_owner(Id id, ObjectId owner)
+{
+    return false;
+}
+
+bool Socket::get_address(Id id, simple::string* address)
+{
+    return false;
+}
+
+#endif
+
+// Post a callback to owner
+// The reference arguments created by reactor are unbinded, so they are
+// taken by the call without copying, or freed if the owner is gone
+void Socket::post_callback(Thread* thread, ObjectId owner, const Value& function_name, Value* args, ArgNo n)
+{
+    for (ArgNo i = 0; i < n; i++)
+        if (args[i].m_type == ValueType::STRING || args[i].m_type == ValueType::BUFFER)
+            args[i].m_reference->unbind();
+
+    if (Scheduler::submit(thread, owner, function_name, args, n))
+        return;
+
+    for (ArgNo i = 0; i < n; i++)
+    {
+        if (args[i].m_type == ValueType::STRING)
+            STRING_FREE(args[i].m_string);
+        else if (args[i].m_type == ValueType::BUFFER)
+            BUFFER_FREE(args[i].m_buffer);
+    }
+}
+
 }
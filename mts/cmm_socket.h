@@ -1,11 +1,315 @@
 // cmm_socket.h
+// Network I/O served by reactor threads
 
 #pragma once
 
+#include "std_port/std_port.h"
+#include "std_port/std_port_spin_lock.h"
+#include "std_port/std_port_uring.h"
+#include "std_template/simple_hash_map.h"
+#include "std_template/simple_string.h"
+#include "std_template/simple_vector.h"
 #include "cmm.h"
+#include "cmm_value.h"
 #include "std_socket/std_socket_port.h"
 
 namespace cmm
 {
 
+class Thread;
+
+// Non-blocking sockets owned by reactor threads
+// Each reactor waits on its own io_uring (or epoll set if io_uring is not
+// supported by kernel), the connections are assigned to reactors round
+// robin when they are accepted or connected. When data arrived, the
+// reactor posts one call to the domain of owner object, so a burst of
+// packets is delivered by one callback, and the calls in a mailbox are
+// drained in batch by scheduler.
+// io_uring: Accepting & receiving are multishot requests armed once per
+// connection, the kernel picks a provided buffer when data arrived, so
+// idle connections occupy no buffer. All requests prepared in a round &
+// the waiting are done by one syscall. The data is copied from provided
+// buffer to a buffer value, the provided one is recycled at once.
+// epoll: The reactor reads all arrived data (at most MAX_READ_BATCH bytes)
+// into a buffer allocated with the size of arrived data when readable.
+// The buffer is not binded & it's taken by the call as argument without
+// copying. Callbacks of owner object:
+//     void socket_accepted(int listen_id, int id, string address)
+//     void socket_read(int id, buffer data)
+//     void socket_closed(int id)
+// The socket_closed is called only when the peer closed or an error
+// occurred. The accepted connection is owned by owner of the listening
+// one, it can be handed over to others by set_owner().
+// Sending is tried by caller directly, the slices of strings or buffers
+// are gathered by writev without concating. Only the rest not taken by
+// kernel is copied to the queue & flushed by reactor when writable.
+// Broadcasting copies the data once into a shared payload for all target
+// connections. The connections served by io_uring with nothing queued are
+// sent by their reactors, all sends of a reactor are submitted by one
+// syscall.
+// The sockets are referred by id in scripts, an id is never reused, so a
+// closed id never refers to a new connection reusing the fd.
+// ATTENTION: A connection is freed only by its reactor, the others must
+// hold m_cs or pin it (see Connection::users) while referring it. The
+// sending is done with the connection pinned, not holding m_cs. The io_uring requests are armed only by
+// the reactor, the others post requests to it. The callbacks are delivered
+// only when the scheduler is started (or the domain is drained by others).
+class Socket
+{
+public:
+    typedef Integer Id;
+
+    // Data to be sent
+    struct Slice
+    {
+        const void* data;
+        size_t size;
+    };
+
+    enum
+    {
+        MAX_READ_BATCH = 64 * 1024,     // Read at most per event
+        MAX_ACCEPT_BATCH = 64,          // Accept at most per event
+        MAX_OUTPUT_SIZE = 4 * 1024 * 1024, // Queued output of a connection
+        MAX_EVENTS = 256,               // Events per wait
+        MAX_SLICES = 64,                // Slices per writev
+        MIN_READ_SIZE = 512,            // When size of arrived data is unknown
+        WAIT_TIMEOUT = 100,             // In ms
+        URING_ENTRIES = 256,            // Submission queue of io_uring
+        URING_BUFFERS_COUNT = 256,      // Provided buffers per reactor
+        URING_BUFFER_SIZE = 16 * 1024,
+    };
+
+public:
+    // Initialize/shutdown this module
+    static bool init();
+    static void shutdown();
+
+public:
+    // Start reactors (0 means count of cpus)
+    // Return false if not supported or already started
+    static bool start(size_t reactor_count = 0);
+
+    // Stop reactors & close all sockets
+    static void stop();
+
+    // Are reactors running?
+    static bool is_started() { return m_started; }
+
+    // Use io_uring if it's supported (default), effective at next start()
+    static void set_use_uring(bool use_uring) { m_use_uring = use_uring; }
+
+    // Count of reactors using io_uring
+    static size_t get_uring_reactors_count();
+
+public:
+    // Listen on host:port, return id or -1
+    static Id listen(ObjectId owner, const char* host, int port);
+
+    // Connect to host:port, return id or -1
+    // The connecting is finished in background, the data sent before is
+    // queued
+    static Id connect(ObjectId owner, const char* host, int port);
+
+    // Send data, return count of bytes accepted or -1
+    // All or nothing is accepted
+    static Integer send(Id id, const Slice* slices, size_t count);
+
+    static Integer send(Id id, const void* data, size_t size)
+    {
+        Slice slice = { data, size };
+        return send(id, &slice, 1);
+    }
+
+    // Send data to all connections owned by the owners
+    // Put status of each owner into statuses: bytes queued before the data
+    // (max of its connections, for backpressure) or -1 if it owns no
+    // connection or its output is full
+    static void broadcast(const ObjectId* owners, size_t count, const void* data, size_t size, Integer* statuses);
+
+    // Close a socket, no socket_closed callback for it
+    static bool close(Id id);
+
+    // Hand over the socket to another object
+    static bool set_owner(Id id, ObjectId owner);
+
+    // Get address of peer (or bound address of listening socket)
+    static bool get_address(Id id, simple::string* address);
+
+private:
+    struct Reactor;
+
+    // Shared data of broadcasting
+    struct Payload
+    {
+        volatile AtomInt refs;
+        size_t size;
+        Uint8 data[1];
+    };
+
+    struct Connection
+    {
+        Id id;
+        SOCKET fd;
+        ObjectId owner;
+        Connection* prev_owned;         // Connections of same owner
+        Connection* next_owned;
+        Reactor* reactor;
+        bool is_listening;
+        bool want_write;                // Waiting for writable
+        volatile AtomInt closing;       // Closed by script or peer
+        volatile AtomInt pending_ops;   // io_uring requests & posted requests
+        volatile AtomInt users;         // Script threads sending out of m_cs
+        bool is_destroyed;              // Free when no pending ops
+        bool is_receiving;              // Multishot accept/recv is armed
+        bool is_polling_out;            // Poll of writable is armed
+        Payload* sending;               // Being sent by reactor
+        std_spin_lock_t output_lock;
+        simple::vector<Uint8> output;   // Data to be sent
+        size_t output_offset;           // Sent bytes in output
+        char address[64];
+    };
+
+    // Request to reactor
+    enum RequestType
+    {
+        REQUEST_ADD = 1,                // Arm requests of new connection
+        REQUEST_WRITE = 2,              // Wait writable
+        REQUEST_CLOSE = 3,              // Closed by script
+        REQUEST_SEND = 4,               // Send the payload
+    };
+
+    struct Request
+    {
+        Connection* conn;
+        RequestType type;
+    };
+
+    // Operation of io_uring request, in low bits of user data
+    enum Op
+    {
+        OP_WAKEUP = 1,
+        OP_CANCEL = 2,
+        OP_ACCEPT = 3,
+        OP_RECV = 4,
+        OP_POLL_OUT = 5,
+        OP_SEND = 6,
+        OP_MASK = 7,
+    };
+
+    struct Reactor
+    {
+        size_t index;
+        int epoll_fd;                   // -1 if io_uring is used
+        std_uring_t* ring;
+        size_t destroyed_count;         // Waiting for pending ops
+        int wakeup_fds[2];              // Pipe to wake up reactor
+        char wakeup_buf[64];
+        Thread* thread;
+        std_spin_lock_t lock;
+        simple::vector<Request> requests;
+    };
+
+    typedef simple::hash_map<Id, Connection*> ConnectionMap;
+    typedef simple::hash_map<ObjectId, Connection*, global_id_hash_func> OwnerMap;
+
+private:
+    // Entry of reactor thread
+    static void* reactor_entry(Reactor* reactor);
+
+    // Loop of reactor
+    static void run_epoll(Reactor* reactor);
+    static void run_uring(Reactor* reactor);
+
+    // Create io_uring of reactor, return 0 if not supported
+    static std_uring_t* create_uring(Reactor* reactor);
+
+    // Handle a completion of io_uring
+    static void on_completion(Reactor* reactor, const std_uring_cqe_t* cqe);
+
+    // Handle requests posted to reactor
+    static void handle_requests(Reactor* reactor);
+
+    // Handle events of a connection
+    static void on_accept(Reactor* reactor, Connection* conn);
+    static void on_accepted(Reactor* reactor, Connection* conn, SOCKET fd, const struct sockaddr_in* addr);
+    static void on_read(Reactor* reactor, Connection* conn);
+    static void on_write(Reactor* reactor, Connection* conn);
+    static void on_sent(Reactor* reactor, Connection* conn, int res);
+
+    // Create connection, put it in table & wait events of it
+    static Id add_connection(SOCKET fd, ObjectId owner, bool is_listening, bool want_write, const char* address);
+
+    // Create connection, put it in table & assign it to a reactor
+    // The events are not waited until it's armed
+    static Connection* register_connection(SOCKET fd, ObjectId owner, bool is_listening, bool want_write, const char* address);
+
+    // Start to wait events of a registered connection
+    // The connection must be pinned if it may be closed by script
+    static void arm_connection(Connection* conn);
+
+    // Remove from table, close & free it (by its reactor)
+    // With io_uring, it's freed after the pending ops are done
+    static void destroy_connection(Connection* conn);
+    static void free_connection(Connection* conn);
+
+    // A pending op is done, free the connection if it's the last one
+    static void release_op(Connection* conn);
+
+    // Closed by peer or error occurred (by its reactor)
+    static void close_by_reactor(Reactor* reactor, Connection* conn);
+
+    // Queue connection to be closed by its reactor (m_cs must be held or
+    // the connection is pinned)
+    static void request_close(Connection* conn);
+
+    // Link/unlink connection to its owner (m_cs must be held)
+    static void link_owner(Connection* conn);
+    static void unlink_owner(Connection* conn);
+
+    // Send payload to a pinned connection (output_lock must be held)
+    // Return bytes queued before or -1
+    static Integer send_payload(Connection* conn, Payload* payload);
+
+    // Release a reference of payload
+    static void release_payload(Payload* payload);
+
+    // Post a request to reactor of connection (m_cs must be held or the
+    // connection is pinned if it's in table)
+    static void post_request(Connection* conn, RequestType type);
+
+    // Send output as much as possible (output_lock must be held)
+    // Return false if error occurred
+    static bool flush_output(Connection* conn);
+
+    // Send slices directly (output_lock must be held & output is empty)
+    // Return count of bytes sent or -1 if error occurred
+    static Integer send_slices(Connection* conn, const Slice* slices, size_t count);
+
+    // Update events waited of connection
+    // With io_uring, arm the requests not armed yet (by its reactor)
+    static void update_events(Connection* conn);
+
+    // Post a callback to owner, the reference arguments are taken by call
+    static void post_callback(Thread* thread, ObjectId owner, const Value& function_name, Value* args, ArgNo n);
+
+private:
+    static struct std_critical_section* m_cs;
+    static ConnectionMap* m_connections;
+    static OwnerMap* m_owners;          // First connection of owners
+    static Reactor* m_reactors;
+    static size_t m_reactor_count;
+    static volatile AtomInt m_running_count;
+    static volatile int m_stopping;
+    static volatile AtomInt m_next_reactor;
+    static Id m_next_id;
+    static bool m_started;
+    static bool m_use_uring;
+
+    // Names of callbacks (shared strings)
+    static StringImpl* m_accepted_name;
+    static StringImpl* m_read_name;
+    static StringImpl* m_closed_name;
+};
+
 }
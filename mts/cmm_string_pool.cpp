@@ -134,7 +134,7 @@ StringImpl *StringPool::find(const char* c_str, size_t len)
     std_get_spin_lock(&m_lock);
     auto it = m_pool.find_ex(key);
     if (it != m_pool.end())
-        string_in_pool = STRING_ALLOC(c_str, len);
+        string_in_pool = it->ptr();
     else
         string_in_pool = 0;
     std_release_spin_lock(&m_lock);
@@ -9,6 +9,7 @@
 #include "cmm_output.h"
 #include "cmm_program.h"
 #include "cmm_thread.h"
+#include "cmm_vm.h"
 
 namespace cmm
 {
@@ -57,6 +58,7 @@ Thread::Thread(const char *name)
 {
     // Set default values
     m_current_domain = 0;
+    m_coroutine = 0;
 
     // Set name to this thread
     if (name)
@@ -235,6 +237,26 @@ void Thread::trace_call_stack()
 
         char oid_desc[64];
         object->get_oid().print(oid_desc, sizeof(oid_desc), "Object");
+
+        // The executing instruction may be in calls inlined by compiler,
+        // print them as the frames called by this function
+        if (call_context->m_this_code && function->is_being_interpreted())
+        {
+            auto pos = (Uint32)(*call_context->m_this_code - function->get_byte_codes_addr());
+            auto& inlined_calls = function->get_inlined_calls();
+            for (auto i = inlined_calls.size(); i > 0; i--)
+            {
+                auto& call = inlined_calls[i - 1];
+                if (pos < call.start || pos >= call.end)
+                    continue;
+                printf("Function %s::%s (inlined) @ %s(%s)\n",
+                       call.callee->get_program()->get_name()->c_str(),
+                       call.callee->get_name()->c_str(),
+                       program->get_name()->c_str(),
+                       oid_desc);
+            }
+        }
+
         printf("Function %s::%s @ %s(%s)\n",
                function->get_program()->get_name()->c_str(),
                function->get_name()->c_str(),
@@ -279,6 +301,27 @@ void Thread::switch_domain(Domain *to_domain)
     m_current_domain = to_domain;
 }
 
+// Enter the domain & execute calls in its mailbox
+// Return count of executed calls
+size_t Thread::drain_mailbox(Domain *domain)
+{
+    if (domain == m_current_domain)
+        // Already in the domain
+        return domain->drain_mailbox(this);
+
+    // Save sp to current domain context before switching
+    update_end_sp_of_current_domain_context();
+
+    // Enter target domain with address of local variable as start_sp, all
+    // values of calls are in stack frames of callee
+    void *start_sp = &start_sp;
+    switch_domain(domain);
+    push_domain_context(start_sp);
+    size_t count = domain->drain_mailbox(this);
+    pop_domain_context(NIL);
+    return count;
+}
+
 // Switch object by oid
 // Since the object may be destructed in other thread, I must lock the
 // object & switch to it
@@ -321,6 +364,9 @@ bool Thread::try_switch_object_by_id(Thread *thread, ObjectId to_oid, Value *arg
         // OK, switch to right domain
         m_current_domain = to_domain;
         thread->transfer_values_to_current_domain();
+        if (to_domain)
+            // The object may be changed by the call
+            to_domain->mark_dirty(ob);
         return true;
     }
 
@@ -14,10 +14,12 @@ namespace cmm
 {
 
 class CallContext;
+class Coroutine;
 class Domain;
 class Function;
 class Object;
 class Thread;
+struct Instruction;
 
 // Reserve Values as local variables
 #define __RESERVE_LOCAL(n) \
@@ -69,6 +71,7 @@ public:
     ComponentNo m_component_no;     // Component no in this object
     ArgNo       m_arg_no;           // Real arguments count (valid only for RANDOM_ARG)
     LocalNo     m_local_no;         // Local variables count
+    const Instruction *const *m_this_code; // Executing instruction (for interpreted function only)
 };
 
 // Define the node of DomainContext
@@ -81,6 +84,7 @@ typedef simple::list_node<DomainContext> DomainContextNode;
 //   m_stack[m_sp] is to store the next pushed value.
 class Thread
 {
+friend Coroutine;
 friend DomainContext;
 
 public:
@@ -111,6 +115,13 @@ public:
         return m_get_stack_pointer_func;
     }
 
+private:
+    // Bind thread to current OS thread (for coroutine switching)
+    static void set_current_thread(Thread *thread)
+    {
+        std_set_tls_data(m_thread_tls_id, thread);
+    }
+
 public:
     Thread(const char *name = 0);
     ~Thread();
@@ -122,6 +133,9 @@ public:
     // Thread will be stopped
     void stop();
 
+    // Get the coroutine owns this thread (0 if it's a native thread)
+    Coroutine *get_coroutine() const { return m_coroutine; }
+
     // Update current context sp
     void update_end_sp_of_current_domain_context()
     {
@@ -209,13 +223,18 @@ public:
     {
         if (m_this_call_context >= m_end_call_context)
             throw "Too depth call context.\n";
-        m_this_call_context++;
-        m_this_call_context->m_function_or_entry = function_or_entry;
-        m_this_call_context->m_args = args;
-        m_this_call_context->m_arg_no = argn;
-        m_this_call_context->m_this_object = ob;
-        m_this_call_context->m_component_no = component_no;
+        // Fill the new context before publishing it, the profiler may read
+        // m_this_call_context from signal handler at any time
+        auto *call_context = m_this_call_context + 1;
+        call_context->m_function_or_entry = function_or_entry;
+        call_context->m_args = args;
+        call_context->m_arg_no = argn;
+        call_context->m_this_object = ob;
+        call_context->m_component_no = component_no;
+        call_context->m_this_code = 0;
         // Don't init locals, it should be updated after entered function
+        std_compiler_barrier();
+        m_this_call_context = call_context;
     }
 
     // Push new domain context
@@ -243,6 +262,9 @@ public:
     // Try to switch execution ownership to a new domain by oid
     bool try_switch_object_by_id(Thread *thread, ObjectId to_oid, Value *args, ArgNo n, void* end_sp);
 
+    // Enter the domain & execute calls in its mailbox
+    size_t drain_mailbox(Domain *domain);
+
 public:
     // Bind value to local memory list
     void bind_value(ReferenceImpl *value)
@@ -253,6 +275,12 @@ public:
     // Drop local values & free them
     void free_values();
 
+    // Move all values in local value list to other list
+    void transfer_values_to(ValueList *list)
+    {
+        list->concat_list(&m_value_list);
+    }
+
     // Is the value list empty?
     size_t get_value_list_count()
     {
@@ -308,6 +336,9 @@ private:
     // Start DomainContextNode for convenience
     DomainContextNode *m_start_domain_context;
 
+    // Owner coroutine
+    Coroutine *m_coroutine;
+
 private:
     static std_tls_t m_thread_tls_id;
 
@@ -60,6 +60,7 @@ void ValueList::concat_list(ValueList* list)
     {
         STD_ASSERT(("Bad owner of value in list when concating.", (head_address[i])->owner == list));
         auto* p = head_address[i];
+        p->owner = this;
         p->offset = offset++;
         if (m_low > p)
             m_low = p;
@@ -2,6 +2,7 @@
 
 #include <math.h>
 #include <stdio.h>
+#include <string.h>
 #include "std_port/std_port.h"
 #include "cmm.h"
 #include "cmm_call.h"
@@ -74,29 +75,31 @@ Simulator::InstructionInfo Simulator::m_instruction_info[] =
     _INST(LDX,      2, "$$ $1, $2"),
     _INST(LDARGN,   1, "$$ $1, argn"),
     _INST(RIDXXX,   3, "$$ $1, $2[$3]"),
-    _INST(LIDXXX,   3, "$$ $1[$3], $2"),
+    _INST(LIDXXX,   3, "$$ $2[$3], $1"),
     _INST(MKEARR,   3, "$$ $1, [] capacity:$2"),
     _INST(MKIARR,   3, "$$ $1, [$3... x$2]"),
     _INST(MKEMAP,   3, "$$ $1, {} capacity:$2"),
     _INST(MKIMAP,   3, "$$ $1, {$3:... x$2}"),
-    _INST(JMP,      1, "$$ $1.offset"),
-    _INST(JCOND,    2, "$$ $1.offset when $2 != 0"),
-    _INST(CALLNEAR, 2, "$$ $1.fun($2...)"),
-    _INST(CALLFAR,  3, "$$ $31.fun($2...)"),
-    _INST(CALLNAME, 2, "$$ $1($2...)"),
-    _INST(CALLOTHER,3, "$$ $1($2...)"),
-    _INST(CALLEFUN, 3, "$$ $1($2...)"),
+    _INST(JMP,      1, "$$ $23.offset"),
+    _INST(JCOND,    2, "$$ $23.offset when $1 != 0"),
+    _INST(CALLNEAR, 3, "$$ $1, $2.fun($3...)"),
+    _INST(CALLFAR,  3, "$$ $1, $2($3...)"),
+    _INST(CALLNAME, 3, "$$ $1, $2($3...)"),
+    _INST(CALLOTHER,3, "$$ $1, $2($3...)"),
+    _INST(CALLEFUN, 3, "$$ $1, $2($3...)"),
     _INST(CHKPARAM, 0, "$$"),
     _INST(RET,      1, "$$ $1"),
-    _INST(LOOPIN,   3, "$$ ($1=$2 to $3)"),
-    _INST(LOOPRANGE,3, "$$ ($1 in $2)"),
-    _INST(LOOPEND,  0, "LOOP END"),
+    _INST(LOOPIN,   3, "$$ $1 to $2 step $3.imm"),
+    _INST(LOOPRANGE,3, "$$ $1 in $2 at $3"),
+    _INST(LOOPEND,  3, "$$ $1 to $2 step $3.imm"),
     { (Instruction::Code)0, 0, 0,  } // 0 Mark end
 };
 
 // Map Code to index
 Uint8 Simulator::m_code_map[256];
 
+static_assert(sizeof(Instruction) == 8, "Instruction should be packed to 8 bytes.");
+
 bool Simulator::init()
 {
     // Build code map: code->index
@@ -170,6 +173,15 @@ Value Simulator::interpreter(AbstractComponent *_component, Thread *_thread, Val
     sim.m_program = sim.m_function->get_program();
     sim.m_argn = __n;
     sim.m_args = __args;
+    if (__n < sim.m_function->get_max_arg_no())
+    {
+        // Reserve space for the arguments not passed, they are nil or
+        // set to default value by byte codes
+        auto max_arg_no = sim.m_function->get_max_arg_no();
+        sim.m_args = (Value *)STD_ALLOCA(sizeof(Value) * max_arg_no);
+        memcpy(sim.m_args, __args, sizeof(Value) * __n);
+        memset(sim.m_args + __n, 0, sizeof(Value) * (max_arg_no - __n));
+    }
     sim.m_localn = sim.m_function->get_max_local_no();
     sim.m_locals = (Value *)STD_ALLOCA(sizeof(Value) * sim.m_localn);
     sim.m_constantn = sim.m_program->get_constants_count();
@@ -180,6 +192,10 @@ Value Simulator::interpreter(AbstractComponent *_component, Thread *_thread, Val
 
     // Set byte codes
     sim.m_byte_codes = sim.m_function->get_byte_codes_addr();
+    sim.m_this_code = sim.m_byte_codes;
+
+    // Let the tracer know where the function is executing
+    _thread->get_this_call_context()->m_this_code = &sim.m_this_code;
 
     // Start simulation
     return sim.run();
@@ -191,6 +207,142 @@ Integer Simulator::make_function_constant(ComponentNo component_no, FunctionNo f
     return (((Integer)component_no << 16) | function_no);
 }
 
+// Disassemble an instruction by its memo
+// $$        : name of instruction
+// $n        : operand n by kind, such as c1 (constant), a1 (argument),
+//             l1 (local), m1 (member)
+// $n.imm    : immediate number of operand n (.type/.fun are same)
+// $mn.imm   : 32 bits immediate number combined by operand m & n
+// $mn.immf  : real number m.n (n /= 10000)
+// $mn.offset: jump target, offset is relative to next instruction
+size_t Simulator::disassemble(const Instruction *code, size_t pos, char *buf, size_t size)
+{
+    static const char kinds[] = { 'c', 'a', 'l', 'm' };
+    const Instruction::ParaType types[] = { code->t1, code->t2, code->t3 };
+    const Instruction::ParaValue values[] = { code->p1, code->p2, code->p3 };
+    auto *info = &m_instruction_info[m_code_map[code->code]];
+
+    size_t len = 0;
+    buf[0] = 0;
+    for (const char *p = info->memo; *p && len + 1 < size; )
+    {
+        if (*p != '$')
+        {
+            buf[len++] = *p++;
+            buf[len] = 0;
+            continue;
+        }
+
+        p++;
+        if (*p == '$')
+        {
+            // Name of instruction
+            p++;
+            len += snprintf(buf + len, size - len, "%s", info->name);
+            len = len < size ? len : size - 1;
+            continue;
+        }
+
+        // Get operands
+        int indexes[2] = { 0, -1 };
+        indexes[0] = *p++ - '1';
+        if (*p >= '1' && *p <= '3')
+            indexes[1] = *p++ - '1';
+        const char *suffix = p;
+        size_t suffix_len = 0;
+        if (*p == '.')
+        {
+            suffix = ++p;
+            while (*p >= 'a' && *p <= 'z')
+                p++;
+            suffix_len = p - suffix;
+        }
+
+        // Combine the operands to 32 bits
+        Uint32 imm = values[indexes[0]];
+        if (indexes[1] >= 0)
+            imm = (imm << 16) | values[indexes[1]];
+
+        if (suffix_len == 0)
+            len += snprintf(buf + len, size - len, "%c%u",
+                            kinds[types[indexes[0]]], (unsigned)values[indexes[0]]);
+        else if (strncmp(suffix, "offset", suffix_len) == 0)
+            len += snprintf(buf + len, size - len, "->%d", (int)(pos + 1) + (Int32)imm);
+        else if (strncmp(suffix, "immf", suffix_len) == 0)
+            len += snprintf(buf + len, size - len, "%g",
+                            (Real)(Instruction::SignedParaValue)values[indexes[0]] +
+                            (indexes[1] >= 0 ? (Real)values[indexes[1]] / 10000.0 : 0));
+        else if (strncmp(suffix, "type", suffix_len) == 0)
+            len += snprintf(buf + len, size - len, "%s", Value::type_to_name((ValueType)imm));
+        else if (indexes[1] >= 0)
+            len += snprintf(buf + len, size - len, "%d", (Int32)imm);
+        else
+            len += snprintf(buf + len, size - len, "%d", (int)(Instruction::SignedParaValue)imm);
+        len = len < size ? len : size - 1;
+    }
+    return len;
+}
+
+// Print byte codes of a function
+void Simulator::print_byte_codes(const Function *function)
+{
+    auto *codes = function->get_byte_codes_addr();
+    auto n = function->get_byte_codes_count();
+    printf("Function %s::%s: %zu instructions, %zu bytes\n",
+           function->get_program()->get_name()->c_str(),
+           function->get_name()->c_str(),
+           n, n * sizeof(Instruction));
+    for (size_t i = 0; i < n; i++)
+    {
+        char text[128];
+        disassemble(codes + i, i, text, sizeof(text));
+        printf("%6zu: %s\n", i, text);
+    }
+}
+
+// Find the first instruction writing member of object
+// Most instructions write p1, LIDXXX writes container p2, LOOPRANGE writes
+// all operands
+size_t Simulator::find_member_write(const Function *function)
+{
+    auto *codes = function->get_byte_codes_addr();
+    auto n = function->get_byte_codes_count();
+    for (size_t i = 0; i < n; i++)
+    {
+        auto *code = codes + i;
+        switch (code->code)
+        {
+        case Instruction::NOP:
+        case Instruction::JMP:
+        case Instruction::JCOND:
+        case Instruction::CHKPARAM:
+        case Instruction::RET:
+        case Instruction::LOOPIN:
+            // Read operands only
+            continue;
+
+        case Instruction::LOOPRANGE:
+            // p2 is replaced by keys of mapping, p3 is the cursor
+            if (code->t2 == Instruction::MEMBER || code->t3 == Instruction::MEMBER)
+                return i;
+            break;
+
+        case Instruction::LIDXXX:
+            // p2[p3]<-p1, p1 is read only
+            if (code->t2 == Instruction::MEMBER)
+                return i;
+            continue;
+
+        default:
+            break;
+        }
+
+        if (code->t1 == Instruction::MEMBER)
+            return i;
+    }
+    return n;
+}
+
 #define GET_P1      Value *p1 = get_parameter_value(0)
 #define GET_P2      Value *p2 = get_parameter_value(1)
 #define GET_P3      Value *p3 = get_parameter_value(2)
@@ -204,6 +356,7 @@ Value Simulator::run()
     m_ip = m_byte_codes;
     for (;;)
     {
+        m_this_code = m_ip;
         if (m_ip->code == Instruction::RET)
         {
             GET_P1;
@@ -213,7 +366,6 @@ Value Simulator::run()
         // Get index of InstructionInfo for this code
         size_t index = m_code_map[m_ip->code];
         auto *info = &m_instruction_info[index];
-        m_this_code = m_ip;
         m_ip++;
         (this->*info->entry)();
 
@@ -298,6 +450,8 @@ void Simulator::xMULX()
 void Simulator::xDIVI()
 {
     GET_P1; GET_P2; GET_P3;
+    if (!p3->m_int)
+        throw_error("Divided by zero.\n");
     p1->m_type = ValueType::INTEGER;
     p1->m_int = p2->m_int / p3->m_int;
 }
@@ -318,6 +472,8 @@ void Simulator::xDIVX()
 void Simulator::xMODI()
 {
     GET_P1; GET_P2; GET_P3;
+    if (!p3->m_int)
+        throw_error("Divided by zero.\n");
     p1->m_type = ValueType::INTEGER;
     p1->m_int = p2->m_int % p3->m_int;
 }
@@ -647,8 +803,9 @@ void Simulator::xRIDXXX()
                             (Int64)p3->m_int, p2->m_string->length());
             p1->m_type = INTEGER;
             p1->m_int = p2->m_string->get(p3->m_int);
-            break;
+            return;
         }
+        break;
     case BUFFER:
         if (p3->m_type == INTEGER)
         {
@@ -657,8 +814,9 @@ void Simulator::xRIDXXX()
                             (Int64)p3->m_int, p2->m_buffer->length());
             p1->m_type = INTEGER;
             p1->m_int = p2->m_buffer->get(p3->m_int);
-            break;
+            return;
         }
+        break;
     case ARRAY:
         if (p3->m_type == INTEGER)
         {
@@ -666,12 +824,13 @@ void Simulator::xRIDXXX()
                 throw_error("Index (%lld) is out of array range (%zu).\n",
                             (Int64)p3->m_int, p2->m_array->size());
             *p1 = p2->m_array->get(p3->m_int);
-            break;
+            return;
         }
+        break;
 
     case MAPPING:
         *p1 = p2->m_map->get(*p3);
-        break;
+        return;
 
     default:
         break;
@@ -685,6 +844,9 @@ void Simulator::xRIDXXX()
 void Simulator::xLIDXXX()
 {
     GET_P1; GET_P2; GET_P3;
+    if (p2->m_type >= REFERENCE_VALUE && p2->m_reference->is_constant())
+        throw_error("Can't modify constant %s.\n", Value::type_to_name(p2->m_type));
+
     switch (p2->m_type)
     {
     case ARRAY:
@@ -694,12 +856,13 @@ void Simulator::xLIDXXX()
                 throw_error("Index (%lld) is out of array range (%zu).\n",
                             (Int64)p3->m_int, p2->m_array->size());
             p2->m_array->set(p3->m_int, *p1);
-            break;
+            return;
         }
+        break;
 
     case MAPPING:
         p2->m_map->set(*p3, *p1);
-        break;
+        return;
 
     default:
         break;
@@ -793,11 +956,14 @@ void Simulator::xCALLNAME()
 void Simulator::xCALLOTHER()
 {
     GET_P1; GET_P2; GET_P3;
-    if (p2->m_type != STRING)
-        throw_error("Bad type to call, expected string got %s.\n",
-                    Value::type_to_name(p1->m_type));
     // p2 is locals: oid, name
-    *p1 = m_program->invoke(m_thread, p2[0].m_oid, p2[1], p3 + 1, (ArgNo)p3->m_int);
+    if (p2[0].m_type != OBJECT)
+        throw_error("Bad type to call other, expected object got %s.\n",
+                    Value::type_to_name(p2[0].m_type));
+    if (p2[1].m_type != STRING)
+        throw_error("Bad type to call, expected string got %s.\n",
+                    Value::type_to_name(p2[1].m_type));
+    *p1 = call_other(m_thread, p2[0].m_oid, p2[1], p3 + 1, (ArgNo)p3->m_int);
 }
 
 void Simulator::xCALLEFUN()
@@ -813,40 +979,36 @@ void Simulator::xCALLEFUN()
 void Simulator::xCHKPARAM()
 {
     // Check the count & type of all arguments
-    // Pad default if necessary
+    // The default arguments are padded by the following byte codes
     if (m_argn < m_function->get_min_arg_no())
-        throw_error("Two few arguments to %s, expected %d, got %d.\n",
+        throw_error("Too few arguments to %s, expected %d, got %d.\n",
                     m_function->get_name()->c_str(),
-                    m_function->get_min_arg_no(), m_argn);
+                    (int)m_function->get_min_arg_no(), (int)m_argn);
 
-    if (m_argn > m_function->get_min_arg_no() &&
-        !m_function->get_attrib() & Function::RANDOM_ARG)
-        throw_error("Two many arguments to %s, expected %d, got %d.\n",
+    if (m_argn > m_function->get_max_arg_no() &&
+        !(m_function->get_attrib() & Function::RANDOM_ARG))
+        throw_error("Too many arguments to %s, expected %d, got %d.\n",
                     m_function->get_name()->c_str(),
-                    m_function->get_max_arg_no(), m_argn);
+                    (int)m_function->get_max_arg_no(), (int)m_argn);
 
-    // Check types
+    // Check types of the passed arguments
     auto& parameters = (Parameters&)m_function->get_parameters();
-    Value *p = m_args;
-    for (auto& it : parameters)
+    ArgNo n = m_argn;
+    if (n > (ArgNo)parameters.size())
+        n = (ArgNo)parameters.size();
+    for (ArgNo i = 0; i < n; i++)
     {
-        if (it->get_type() != p->m_type &&
-            (!it->is_nullable() || p->m_type != NIL))
-            // Type is not matched
-            throw_error("Bad type of arguments %s, expected %s, got %s.\n",
-                        it->get_name()->c_str(),
-                        it->get_type(), p->m_type);
-    }
-    // Append the default parameters if necessary
-    if (m_argn < m_function->get_min_arg_no())
-    {
-        auto *new_args = (Value *)STD_ALLOCA(sizeof(Value) * m_function->get_max_arg_no());
-        memcpy(new_args, m_args, sizeof(Value) * m_argn);
-        while (m_argn < m_function->get_min_arg_no())
-        {
-            new_args[m_argn] = parameters[m_argn]->get_default();
-            m_argn++;
-        }
+        auto *it = parameters[i];
+        auto *p = &m_args[i];
+        if (it->get_type() == MIXED || it->get_type() == p->m_type)
+            continue;
+        if (it->is_nullable() && p->m_type == NIL)
+            continue;
+        // Type is not matched
+        throw_error("Bad type of argument %s, expected %s, got %s.\n",
+                    it->get_name()->c_str(),
+                    Value::type_to_name(it->get_type()),
+                    Value::type_to_name(p->m_type));
     }
 }
 
@@ -856,19 +1018,84 @@ void Simulator::xRET()
     throw_error("The instruction RET shouldn't be invoked.\n");
 }
 
+// Is the value in range (to "to" by direction)?
+static bool is_in_loop_range(const Value *value, const Value *to, int direction)
+{
+    if (value->m_type == INTEGER && to->m_type == INTEGER)
+        return direction > 0 ? value->m_int <= to->m_int : value->m_int >= to->m_int;
+    return direction > 0 ? *value <= *to : *value >= *to;
+}
+
+// Enter loop: p1 = loop variable, p2 = end, p3 = direction (1/-1)
+// Skip the next instruction (jump out of loop) if p1 is in range
 void Simulator::xLOOPIN()
 {
-    // More to be added
+    GET_P1; GET_P2; GET_P3_IMM;
+    if (is_in_loop_range(p1, p2, (Instruction::SignedParaValue)p3))
+        m_ip++;
 }
 
+// Get next element in container: p1 = element, p2 = container, p3 = cursor
+// Skip the next instruction (jump out of loop) if got element
+// ATTENTION: p2 must be a private copy of container, it will be replaced
+// by keys if it's a mapping
 void Simulator::xLOOPRANGE()
 {
-    // More to be added
+    GET_P1; GET_P2; GET_P3;
+    if (p2->m_type == MAPPING)
+    {
+        // Loop in keys of mapping
+        Value keys = NIL;
+        p2->m_map->keys(&keys);
+        *p2 = keys;
+    }
+
+    size_t size;
+    switch (p2->m_type)
+    {
+    case NIL:     size = 0; break;
+    case STRING:  size = p2->m_string->length(); break;
+    case BUFFER:  size = p2->m_buffer->length(); break;
+    case ARRAY:   size = p2->m_array->size(); break;
+    default:
+        throw_error("Failed to loop in %s.\n", Value::type_to_name(p2->m_type));
+    }
+
+    auto i = (size_t)p3->m_int;
+    if (i >= size)
+        // End of loop
+        return;
+
+    switch (p2->m_type)
+    {
+    case STRING:
+        p1->m_type = INTEGER;
+        p1->m_int = p2->m_string->get(i);
+        break;
+    case BUFFER:
+        p1->m_type = INTEGER;
+        p1->m_int = p2->m_buffer->get(i);
+        break;
+    default:
+        *p1 = p2->m_array->get(i);
+        break;
+    }
+    p3->m_int++;
+    m_ip++;
 }
 
+// End of loop: p1 = loop variable, p2 = end, p3 = direction (1/-1)
+// Skip the next instruction (jump back to loop) if p1 is out of range
 void Simulator::xLOOPEND()
 {
-    // More to be added
+    GET_P1; GET_P2; GET_P3_IMM;
+    int direction = (Instruction::SignedParaValue)p3;
+    if (p1->m_type == INTEGER)
+        p1->m_int += direction;
+    else
+        *p1 = *p1 + Value((Integer)direction);
+    if (!is_in_loop_range(p1, p2, direction))
+        m_ip++;
 }
 
 }
@@ -3,6 +3,7 @@
 #pragma once
 
 #include "cmm.h"
+#include "cmm_program.h"
 #include "cmm_value.h"
 
 namespace cmm
@@ -13,9 +14,12 @@ class Program;
 class Thread;
 
 // Single instruction structure
+// Packed to 8 bytes: 8-bit code, 2-bit kinds of operands & three 16-bit
+// operands, so 8 instructions are in a cache line. The width is fixed,
+// the jumps, inlined ranges & tracer refer the instructions by index.
 struct Instruction
 {
-    enum ParaType
+    enum ParaType : Uint8
     {
         CONSTANT = 0,   // In this program
         ARGUMENT = 1,   // Arguments in this context
@@ -26,7 +30,7 @@ struct Instruction
     typedef Uint16 ParaValue;
     typedef Int16  SignedParaValue;
 
-    enum Code
+    enum Code : Uint8
     {
         NOP       = 0,   // N/A
         ADDI      = 1,   // p1<-p2, p3
@@ -84,7 +88,7 @@ struct Instruction
         LDX       = 72,  // p1<-p2
         LDARGN    = 73,  // p1<-argn
         RIDXXX    = 75,  // p1<-p2[p3]
-        LIDXXX    = 78,  // p1[p3]<-p2
+        LIDXXX    = 78,  // p2[p3]<-p1
         MKEARR    = 81,  // p1<-[], capacity=p2
         MKIARR    = 84,  // p1<-p2... x p3
         MKEMAP    = 87,  // p1<-{}, capacity=p2
@@ -98,9 +102,9 @@ struct Instruction
         CALLEFUN  = 120, // p1<-call(p2 = name, p3 = argn, args)
         CHKPARAM  = 123, // chkparam
         RET       = 126, // ret p1
-        LOOPIN    = 129, // loop(p1=p2 to p3)
-        LOOPRANGE = 132, // loop(p1 in p2)
-        LOOPEND   = 135, // loop end
+        LOOPIN    = 129, // if (p1 in range to p2, step p3) skip next
+        LOOPRANGE = 132, // if (p3 < sizeof(p2)) p1=p2[p3++], skip next
+        LOOPEND   = 135, // p1+=p3, if (p1 out of range to p2) skip next
     };
 
     // Condition for jump
@@ -115,9 +119,9 @@ struct Instruction
     };
 
     Code      code;
-    ParaType  t1;
-    ParaType  t2;
-    ParaType  t3;
+    ParaType  t1 : 2;
+    ParaType  t2 : 2;
+    ParaType  t3 : 2;
     ParaValue p1;
     ParaValue p2;
     ParaValue p3;
@@ -185,6 +189,18 @@ public:
     static Value interpreter(AbstractComponent *_component, Thread *_thread, Value *__args, ArgNo __n);
     static Integer make_function_constant(ComponentNo component_no, FunctionNo function_no);
 
+public:
+    // Disassemble an instruction at pos by its memo
+    // Return length of text
+    static size_t disassemble(const Instruction *code, size_t pos, char *buf, size_t size);
+
+    // Print byte codes of a function
+    static void print_byte_codes(const Function *function);
+
+    // Find the first instruction writing member of object
+    // Return count of byte codes if there is none
+    static size_t find_member_write(const Function *function);
+
 public:
     Value run();
 
@@ -17,13 +17,24 @@
 #include "std_memmgr/std_memmgr.h"
 #include "std_memmgr/std_bin_alloc.h"
 #include "cmm_buffer_new.h"
+#include "cmm_checkpoint.h"
+#include "cmm_compile_driver.h"
+#include "cmm_coroutine.h"
+#include "cmm_data_image.h"
 #include "cmm_domain.h"
 #include "cmm_efun.h"
+#include "cmm_file_path.h"
 #include "cmm_lang.h"
 #include "cmm_lexer.h"
 #include "cmm_init_mmgr.h"
 #include "cmm_object.h"
+#include "cmm_output.h"
 #include "cmm_program.h"
+#include "cmm_program_cache.h"
+#include "cmm_program_reload.h"
+#include "cmm_profiler.h"
+#include "cmm_scheduler.h"
+#include "cmm_socket.h"
 #include "cmm_thread.h"
 #include "cmm_value.h"
 
@@ -129,11 +140,6 @@ void Entry(Test *ob)
 }
 #endif
 
-namespace cmm
-{
-int conflict = 0;
-}
-
 class AAA
 {
 public:
@@ -314,11 +320,17 @@ int main(int argn, char *argv[])
     auto* d = Thread::get_current_thread_domain();
 
 #if 1
+    FilePath::init();
     Program::init();
+    ProgramCache::init();
+    Profiler::init();
     Simulator::init();
+    Output::init();
     Efun::init();
     Lang::init();
     Lexer::init();
+    Scheduler::init();
+    Socket::init();
 #endif
 
     ////----test_gc();
@@ -339,11 +351,17 @@ int main(int argn, char *argv[])
 ////----        Thread::get_current_thread()->restore_call_stack_for_error(try_context);
     }
 
+    Socket::shutdown();
+    Scheduler::shutdown();
     Lexer::shutdown();
     Lang::shutdown();
     Efun::shutdown();
+    Output::shutdown();
     Simulator::shutdown();
+    Profiler::shutdown();
+    ProgramCache::shutdown();
     Program::shutdown();
+    FilePath::shutdown();
     Thread::shutdown();
     Domain::shutdown();
     Object::shutdown();
@@ -354,27 +372,48 @@ int main(int argn, char *argv[])
 
 void ttt();
 
-void compile()
+// Program "/a/b" is compiled from "../a/b.c"
+bool resolve_source(const simple::string& program_name, simple::string* file_name)
 {
-    FILE *fp;
-
-    /* Create compile context */
-    auto* context = XNEW(Lang);
-
-    /* Start new file in lex */ 
-    fp = fopen("../script.c", "r");
+    *file_name = simple::string("..") + program_name + ".c";
+    FILE *fp = fopen(file_name->c_str(), "r");
     if (fp == 0)
-        fp = fopen("z:/doing/Project/mts/script.c", "r");
-    context->m_lexer.start_new_file(NULL, (IntR)fp, "script.c");
-    auto ret = context->parse();
-    auto root = context->m_root;
+        return false;
+    fclose(fp);
+    return true;
+}
+
+void compile()
+{
+    // Images of programs are saved in output directory
+    FilePath::set_output_dir("output");
+
+    CompileDriver driver(resolve_source);
+    driver.set_use_cache(true);
+    driver.add_file("../demo.c", "/demo");
+    driver.add_file("../counter.c", "/counter");
+
+    // The script has syntax errors, it should fail to compile
+    driver.add_file("../script.c", "/script");
+    auto failed = driver.compile_all();
+    printf("Compiled %zu files (%zu from cache), %zu failed.\n",
+           driver.get_compiled_count(), driver.get_cached_count(), failed);
+}
 
-    printf("ret = %d.\n", (int)ret);
-    // Debug output
-    context->print_ast(context->m_root, 0);
+static volatile AtomInt coroutine_done = 0;
 
-    XDELETE(context);
-    fclose(fp);
+// Call other domain in a coroutine
+void coroutine_entry(void *para)
+{
+    auto *ob = (Object *)para;
+    auto *thread = Thread::get_current_thread();
+    Value key = NIL;
+    for (auto i = 0; i < 4; i++)
+    {
+        call_other(thread, ob->get_oid(), key = "get_name");
+        Coroutine::yield();
+    }
+    std_cpu_lock_add(&coroutine_done, 1);
 }
 
 int main_body(int argn, char *argv[])
@@ -471,8 +510,170 @@ int main_body(int argn, char *argv[])
 
     Program::update_all_programs();
 
+    // Run the compiled script
+    auto *script_program = Program::find_program_by_name((key = "/demo").m_string);
+    if (script_program)
+    {
+        auto *script_domain = XNEW(Domain, "script");
+        auto *script_ob = script_program->new_instance(script_domain);
+        call_other(thread, script_ob->get_oid(), key = "__entry__");
+        Value sum = call_other(thread, script_ob->get_oid(), key = "sum", 10);
+        printf("sum(10) = %lld\n", (long long)sum.m_int);
+        Value list_count = call_other(thread, script_ob->get_oid(), key = "make_list");
+        printf("make_list() = %lld\n", (long long)list_count.m_int);
+
+        // Reload the script & migrate the object to new version
+        // The object may be moved, refer it by oid
+        auto script_oid = script_ob->get_oid();
+        ProgramReloader reloader(resolve_source);
+        reloader.set_use_cache(true);
+        reloader.add_program("/demo");
+        auto reload_failed = reloader.compile();
+        auto pending = reloader.migrate(thread);
+        sum = call_other(thread, script_oid, key = "sum", 10);
+        printf("Reloaded %zu programs (%zu failed), %zu objects migrated, %zu domains pending, sum(10) = %lld\n",
+               reloader.get_reloaded_count(), reload_failed, reloader.get_migrated_count(),
+               pending, (long long)sum.m_int);
+
+        // Save all objects, then save the object called since then only
+        FILE *checkpoint_fp = fopen("output/checkpoint.bin", "wb");
+        if (checkpoint_fp)
+        {
+            FileSink sink(checkpoint_fp);
+            Checkpointer checkpointer(&sink);
+            checkpointer.save(thread);
+            auto full_count = checkpointer.get_saved_count();
+            call_other(thread, script_oid, key = "add", 1, 2);
+            auto checkpoint_pending = checkpointer.save(thread);
+            printf("Checkpoint: %zu objects saved, %zu changed since then (%zu domains pending), %zu bytes.\n",
+                   full_count, checkpointer.get_saved_count() - full_count,
+                   checkpoint_pending, checkpointer.get_written());
+            fclose(checkpoint_fp);
+        }
+
+        // Print byte codes of the largest function & measure dispatching
+        auto *active_program = Program::find_program_by_name((key = "/demo").m_string);
+        const Function *largest = 0;
+        for (FunctionNo i = 0; i < active_program->get_functions_count(); i++)
+        {
+            auto *function = active_program->get_function(i);
+            if (!largest || function->get_byte_codes_count() > largest->get_byte_codes_count())
+                largest = function;
+        }
+        if (largest)
+            Simulator::print_byte_codes(largest);
+        Profiler::start();
+        auto b = std_get_os_us_counter();
+        sum = call_other(thread, script_oid, key = "sum", 1000000);
+        auto e = std_get_os_us_counter();
+        Profiler::stop();
+        printf("Dispatch cost: %zuus, sum(1000000) = %lld, %zu bytes per instruction.\n",
+               (size_t)(e - b), (long long)sum.m_int, sizeof(Instruction));
+        if (Profiler::save("output/profile.folded"))
+            printf("Profiled %zu samples (%zu dropped) to output/profile.folded.\n",
+                   Profiler::get_samples_count(), Profiler::get_dropped_count());
+
+        // Snapshot all objects in a child process, then drop the script
+        // domain & restore the object from snapshot with same oid
+        std_freq_t snapshot_held_us = 0;
+        auto snapshot_pid = Checkpointer::fork_snapshot(thread, "output/snapshot.bin", &snapshot_held_us);
+        printf("Snapshot: domains were held for %lldus.\n", (long long)snapshot_held_us);
+        if (Checkpointer::wait_snapshot(snapshot_pid))
+        {
+            XDELETE(script_domain);
+            CheckpointLoader loader;
+            auto loaded = loader.load_file(thread, "output/snapshot.bin");
+            sum = call_other(thread, script_oid, key = "sum", 10);
+            printf("Snapshot %s: %zu objects restored in %zu domains (%zu failed), sum(10) = %lld\n",
+                   loaded ? "loaded" : "broken", loader.get_restored_count(),
+                   loader.get_domains_count(), loader.get_failed_count(), (long long)sum.m_int);
+        }
+    }
+
     call_efun(thread, key = "printf", "a=%d\n", 555);
 
+    // Compile a table to data image, load it as a READ_ONLY domain & query
+    // it from current domain without entering the data domain
+    {
+        Value items = NIL, item = NIL;
+        items = XNEW(MapImpl, 8);
+        for (Integer i = 0; i < 1000; i++)
+        {
+            char name[32];
+            snprintf(name, sizeof(name), "item_%lld", (long long)i);
+            item = XNEW(MapImpl, 4);
+            item.set(key = "name", value = name);
+            item.set(key = "price", value = i * 10);
+            item.set(key = "weight", value = i / 4.0);
+            items.set(key = name, item);
+        }
+        auto *data_domain = DataImage::save("output/items.dat", items) ?
+            DataImage::load_domain("output/items.dat", "items") : 0;
+        if (data_domain)
+        {
+            Value id = call_efun(thread, key = "data_domain", "items");
+            Value price = call_efun(thread, key = "data_get", id, "item_42", "price");
+            Value count = call_efun(thread, key = "data_size", id);
+            printf("Data image: %zu bytes, %lld items, price of item_42 = %lld\n",
+                   data_domain->get_data_image()->get_size(), (long long)count.m_int, (long long)price.m_int);
+            XDELETE(data_domain);
+        }
+    }
+
+    // Initialize an object, then turn its domain to READ_ONLY & call it
+    // from current domain without lock
+    auto *lookup_program = Program::find_program_by_name((key = "/demo").m_string);
+    if (lookup_program)
+    {
+        auto *lookup_domain = XNEW(Domain, "lookup");
+        auto *lookup_ob = lookup_program->new_instance(lookup_domain);
+        call_other(thread, lookup_ob->get_oid(), key = "__entry__");
+        auto *prev_domain = thread->get_current_domain();
+        thread->switch_domain(lookup_domain);
+        lookup_domain->set_read_only();
+        thread->switch_domain(prev_domain);
+
+        auto acquisitions = lookup_domain->get_lock_stat().acquisitions;
+        Value sum = call_other(thread, lookup_ob->get_oid(), key = "sum", 10);
+        printf("Read-only domain: sum(10) = %lld, %lld locks taken.\n", (long long)sum.m_int,
+               (long long)(lookup_domain->get_lock_stat().acquisitions - acquisitions));
+        XDELETE(lookup_domain);
+    }
+
+    // Reading member into a local container isn't a write, writing element
+    // of member is
+    auto *counter_program = Program::find_program_by_name((key = "/counter").m_string);
+    if (counter_program)
+    {
+        for (FunctionNo i = 0; i < counter_program->get_functions_count(); i++)
+        {
+            auto *function = counter_program->get_function(i);
+            auto pos = Simulator::find_member_write(function);
+            if (pos < function->get_byte_codes_count())
+                printf("Member write: %s at %zu.\n", function->get_name()->c_str(), pos);
+            else
+                printf("Member write: %s none.\n", function->get_name()->c_str());
+        }
+
+        auto *counter_domain = XNEW(Domain, "counter");
+        counter_program->new_instance(counter_domain);
+        auto *prev_domain = thread->get_current_domain();
+        auto *call_context = thread->get_this_call_context();
+        thread->switch_domain(counter_domain);
+        try
+        {
+            counter_domain->set_read_only();
+            printf("Counter domain: turned to read-only unexpectedly.\n");
+        }
+        catch (...)
+        {
+            printf("Counter domain: can't be read-only.\n");
+            thread->restore_call_stack_for_error(call_context);
+        }
+        thread->switch_domain(prev_domain);
+        XDELETE(counter_domain);
+    }
+
     auto *a1 = BUFFER_NEW(AAA, 888);
     auto *a2 = BUFFER_NEWN(AAA, 3);
     auto *a11 = BUFFER_ALLOC(a1, sizeof(*a1));
@@ -506,6 +707,81 @@ int main_body(int argn, char *argv[])
 //    printf("ret = %d.\n", (int) ret.m_int);
     auto e = std_get_os_us_counter();
     printf("Total cost: %zuus.\n", (size_t)(e - b));
+
+    // Pipeline calls to other domain via mailbox
+    AsyncCall *calls[16];
+    b = std_get_os_us_counter();
+    for (auto i = 0; i < 16; i++)
+        calls[i] = call_other_async(thread, ob2->get_oid(), key = "get_name");
+    for (auto i = 0; i < 16; i++)
+        ret = wait_async_call(thread, calls[i]);
+    e = std_get_os_us_counter();
+    printf("Async calls cost: %zuus, ret = %s.\n", (size_t)(e - b),
+           ret.m_type == ValueType::STRING ? ret.m_string->c_str() : "?");
+
+    // Run the calls on workers
+    Scheduler::start(maxThreadCount);
+    b = std_get_os_us_counter();
+    for (auto i = 0; i < 16; i++)
+        calls[i] = call_other_async(thread, (i & 1) ? ob->get_oid() : ob2->get_oid(), key = "get_name");
+    for (auto i = 0; i < 16; i++)
+        ret = wait_async_call(thread, calls[i]);
+    e = std_get_os_us_counter();
+    printf("Scheduled calls cost: %zuus.\n", (size_t)(e - b));
+
+    // Run script in coroutines, they yield instead of blocking workers
+    b = std_get_os_us_counter();
+    for (auto i = 0; i < 16; i++)
+        Scheduler::spawn(coroutine_entry, ob2);
+    while (coroutine_done < 16)
+        std_sleep(1);
+    e = std_get_os_us_counter();
+    printf("Coroutines cost: %zuus.\n", (size_t)(e - b));
+
+    // Echo by script through the sockets served by reactor
+    auto *echo_program = Program::find_program_by_name((key = "/demo").m_string);
+    if (echo_program && Socket::start(1))
+    {
+        auto *echo_ob = echo_program->new_instance(XNEW(Domain, "echo"));
+        Value listen_id = call_other(thread, echo_ob->get_oid(), key = "start_echo");
+        simple::string address;
+        int port = 0;
+        if (Socket::get_address(listen_id.m_int, &address))
+            sscanf(strchr(address.c_str(), ':') + 1, "%d", &port);
+
+        char buf[64] = { 0 };
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons((Uint16)port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        SOCKET fd = port_socket(AF_INET, SOCK_STREAM, 0);
+        b = std_get_os_us_counter();
+        if (port_connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0 &&
+            port_send(fd, "hello", 5, 0) == 5)
+        {
+            // Receive the greeting & the echo
+            size_t size = 0;
+            for (auto i = 0; i < 1000 && !strstr(buf, "hello"); i++)
+            {
+                if (port_isDataArrived(fd) != 0)
+                {
+                    std_sleep(1);
+                    continue;
+                }
+                int n = port_recv(fd, buf + size, sizeof(buf) - 1 - size, 0);
+                if (n <= 0)
+                    break;
+                size += n;
+            }
+        }
+        e = std_get_os_us_counter();
+        port_close(fd);
+        printf("Echo through %s (%s): %s, cost: %zuus.\n", address.c_str(),
+               Socket::get_uring_reactors_count() ? "io_uring" : "epoll", buf, (size_t)(e - b));
+        Socket::stop();
+    }
+    Scheduler::stop();
     XDELETE(ob);
 
     return 0;
@@ -540,7 +816,7 @@ int main_body(int argn, char *argv[])
     while (threadCount > 0)
         std_sleep(1);
     printf("t = %lld\n", t);
-    printf("Conflict = %d\n", conflict);
+    printf("Contended = %lld\n", (long long)domains[0]->get_lock_stat().contended);
 
     // Close all domains
     for (auto i = 0; i < domains.size(); i++)
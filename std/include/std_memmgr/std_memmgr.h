@@ -232,6 +232,10 @@ struct std_lms;
 int        std_init_mem_mgr(std_init_mgr_para_t* paras);
 int        std_shutdown_mem_mgr();
 
+/* Hold/release all locks around fork() */
+void       std_lock_mem_mgr_for_fork();
+void       std_unlock_mem_mgr_after_fork();
+
 /* Allocate page */
 void      *std_allocate_mem_page();
 void       std_free_mem_page(void *page);
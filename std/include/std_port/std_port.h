@@ -270,6 +270,10 @@ extern int           std_wait_event(std_event_id_t eventId);
 extern int           std_wait_event_by_time(std_event_id_t eventId, int timeout);
 extern int           std_raise_event(std_event_id_t eventId);
 
+/* Wait on address (futex) Operations */
+extern int           std_wait_address(volatile int *address, int expected, int timeout);
+extern void          std_wake_address(volatile int *address, int count);
+
 /* Semaphore may be accessed in processes */
 extern int           std_create_proc_sem(std_proc_sem_id_t *pProcSemId, const char *name);
 extern int           std_open_proc_sem(std_proc_sem_id_t *pProcSemId, const char *name);
@@ -304,10 +308,13 @@ extern std_pid_t     std_get_current_process_id();
 extern int           std_is_process_alive(std_pid_t pid);
 extern void          std_sleep(int msec);
 extern void          std_relinquish();
+extern int           std_get_cpu_count();
 extern void          std_set_default_task_stack_size(size_t size);
 extern size_t        std_get_default_task_stack_size();
 
 extern int           std_fork();
+extern int           std_wait_process(std_pid_t pid, int *exit_code);
+extern void          std_exit_forked_process(int r);
 
 /* Timer Operations */
 extern int           std_start_timer(int index, int msec);
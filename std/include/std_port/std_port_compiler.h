@@ -23,6 +23,7 @@
 #define std_cpu_lock_add(ptr, val)                  __sync_fetch_and_add(ptr, val)
 #define std_cpu_pause()                             __asm("pause")
 #define std_cpu_mfence()                            __asm("mfence")
+#define std_compiler_barrier()                      __asm__ __volatile__("" ::: "memory")
 
 #define STD_BEGIN_ALIGNED_STRUCT(n)
 #define STD_END_ALIGNED_STRUCT(n)                   __attribute__ ((aligned(n)))
@@ -43,6 +44,7 @@
 #endif /* En of _M_X64 */
 #define std_cpu_pause()                             _mm_pause()
 #define std_cpu_mfence()                            _mm_mfence()
+#define std_compiler_barrier()                      _ReadWriteBarrier()
 
 #define STD_BEGIN_ALIGNED_STRUCT(n)                 __declspec(align(n))
 #define STD_END_ALIGNED_STRUCT(n)
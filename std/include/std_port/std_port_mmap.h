@@ -15,11 +15,23 @@ extern "C" {
 #define STD_PAGE_ALL_ACCESS     (STD_PAGE_READ | STD_PAGE_WRITE | STD_PAGE_EXECUTE)
 
 #define STD_PAGE_SIZE           4096
+#define STD_HUGE_PAGE_SIZE      (2 * 1024 * 1024)
 
 extern void* std_mem_reserve(void* address, size_t size);
 extern int   std_mem_release(void* address, size_t size);
 extern int   std_mem_commit(void* address, size_t size, int flags);
 extern int   std_mem_decommit(void* address, size_t size);
+extern int   std_mem_advise_huge_page(void* address, size_t size);
+
+// Map a whole file read-only, the pages are loaded when accessed
+extern void* std_map_file(const char* file_name, size_t* ret_size);
+extern int   std_unmap_file(void* address, size_t size);
+
+// Map a whole file copy-on-write (writing won't change the file), with
+// writable head_room bytes before the content & at least tail_room zero
+// bytes after it. Return address of the content
+extern char* std_map_file_private(const char* file_name, size_t head_room, size_t tail_room, size_t* ret_size);
+extern int   std_unmap_file_private(char* content, size_t head_room, size_t tail_room, size_t size);
 
 // Align size
 inline size_t std_align_size(size_t size)
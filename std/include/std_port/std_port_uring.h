@@ -0,0 +1,70 @@
+// std_port_uring.h
+// Initial version Oct/19/2026 by doing
+// Wrapper for io_uring (linux), not available on other platforms
+
+#ifndef _STD_PORT_URING_H_
+#define _STD_PORT_URING_H_
+
+#include <stddef.h>
+#include "std_port/std_port_type.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct iovec;
+
+// Opaque ring, owned by one thread
+typedef struct std_uring std_uring_t;
+
+// Completion of a request
+typedef struct std_uring_cqe
+{
+    Uint64 user_data;
+    int    res;             // Result or -errno
+    int    buffer_id;       // Provided buffer used, -1 if none
+    int    more;            // Multishot request is still armed
+} std_uring_cqe_t;
+
+// Create a ring with entries of submission queue
+// Return NULL if io_uring (or the features used here) is not supported by
+// kernel, the caller should fall back to epoll/blocking calls
+extern std_uring_t* std_uring_create(Uint32 entries);
+extern void         std_uring_destroy(std_uring_t* ring);
+
+// Register fixed files & buffers, the fixed ones are referred by index
+// Return 1 means OK
+extern int std_uring_register_files(std_uring_t* ring, const int* fds, Uint32 count);
+extern int std_uring_register_buffers(std_uring_t* ring, const struct iovec* iov, Uint32 count);
+
+// Provide count (power of 2) buffers of size for multishot recv
+// Return 1 means OK
+extern int   std_uring_provide_buffers(std_uring_t* ring, Uint32 count, Uint32 size);
+extern void* std_uring_get_buffer(std_uring_t* ring, int buffer_id);
+extern void  std_uring_recycle_buffer(std_uring_t* ring, int buffer_id);
+
+// Prepare requests, they are submitted in batch by std_uring_submit()
+// The queue is submitted first if it's full
+// Return 1 means OK
+extern int std_uring_prep_read(std_uring_t* ring, int fd, void* buf, Uint32 size, Uint64 offset, Uint64 user_data);
+extern int std_uring_prep_read_fixed(std_uring_t* ring, int file_index, void* buf, Uint32 size, Uint64 offset, int buf_index, Uint64 user_data);
+extern int std_uring_prep_send(std_uring_t* ring, int fd, const void* buf, Uint32 size, int flags, Uint64 user_data);
+extern int std_uring_prep_writev(std_uring_t* ring, int fd, const struct iovec* iov, Uint32 count, Uint64 user_data);
+extern int std_uring_prep_accept_multishot(std_uring_t* ring, int fd, int flags, Uint64 user_data);
+extern int std_uring_prep_recv_multishot(std_uring_t* ring, int fd, Uint64 user_data);
+extern int std_uring_prep_poll(std_uring_t* ring, int fd, Uint32 events, Uint64 user_data);
+extern int std_uring_prep_cancel_fd(std_uring_t* ring, int fd, Uint64 user_data);
+
+// Submit prepared requests & wait at least wait_nr completions or
+// timeout (in ms, -1 means infinite)
+// Return count of submitted requests or -1
+extern int std_uring_submit(std_uring_t* ring, Uint32 wait_nr, int timeout_ms);
+
+// Get a completion, return 0 if the queue is empty
+extern int std_uring_peek(std_uring_t* ring, std_uring_cqe_t* cqe);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
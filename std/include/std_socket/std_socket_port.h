@@ -80,6 +80,10 @@ extern int errno;
 
 #endif /* End of all OS */
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 /* Utilities function */
 int is_raw_socket(SOCKET socketFd);
 SOCKET get_raw_socket(SOCKET socketFd);
@@ -105,4 +109,8 @@ int port_isDataArrived(SOCKET socketFd);
 int port_waitConnectFinished(SOCKET socketFd, int sec);
 int port_waitDataArrived(SOCKET socketFd, int sec);
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif /* End of __STD_SOCKET_PORT_H__ */
@@ -68,7 +68,8 @@ public:
         if (m_space < vec.size())
         {
             // Reallocate array
-            m_allocator->template deleten<T>(__FILE__, __LINE__, m_array);
+            if (m_array)
+                m_allocator->template deleten<T>(__FILE__, __LINE__, m_array);
             m_space = vec.size();
             m_array = m_allocator->template newn<T>(__FILE__, __LINE__, m_space);
         }
@@ -94,8 +95,11 @@ public:
         m_size = vec.m_size;
         m_array = vec.m_array;
 
-        // Rsh won't hold the array any longer
+        // Rsh won't hold the array any longer, it's empty & can be
+        // reused
         vec.m_array = 0;
+        vec.m_size = 0;
+        vec.m_space = 0;
 
         return *this;
     }
@@ -127,7 +131,8 @@ public:
         new_array = m_allocator->template newn<T>(__FILE__, __LINE__, m_space);
         for (size_t i = 0; i < m_size; i++)
             new_array[i] = simple::move(m_array[i]);
-        m_allocator->template deleten<T>(__FILE__, __LINE__, m_array);
+        if (m_array)
+            m_allocator->template deleten<T>(__FILE__, __LINE__, m_array);
         m_array = new_array;
     }
 
@@ -150,7 +155,8 @@ public:
         new_array = m_allocator->template newn<T>(__FILE__, __LINE__, m_space);
         for (size_t i = 0; i < m_size; i++)
             new_array[i] = simple::move(m_array[i]);
-        m_allocator->template deleten<T>(__FILE__, __LINE__, m_array);
+        if (m_array)
+            m_allocator->template deleten<T>(__FILE__, __LINE__, m_array);
         m_array = new_array;
     }
 
@@ -175,7 +181,8 @@ public:
             new_array = m_allocator->template newn<T>(__FILE__, __LINE__, m_space);
             for (size_t i = 0; i < m_size; i++)
                 new_array[i] = simple::move(m_array[i]);
-            m_allocator->template deleten<T>(__FILE__, __LINE__, m_array);
+            if (m_array)
+                m_allocator->template deleten<T>(__FILE__, __LINE__, m_array);
             m_array = new_array;
         }
     }
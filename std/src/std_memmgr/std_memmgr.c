@@ -565,6 +565,23 @@ int std_shutdown_mem_mgr()
     return 0;
 }
 
+// Hold all locks of the manager before fork(), so the child process
+// won't inherit a lock held by other thread
+void std_lock_mem_mgr_for_fork()
+{
+    _std_get_all_mem_spin_lock();
+    if (_mem_mgr_options & STD_USE_BA_ALLOC)
+        std_get_spin_lock(&_ba_pool.lock);
+}
+
+// Release the locks after fork() (in both parent & child)
+void std_unlock_mem_mgr_after_fork()
+{
+    if (_mem_mgr_options & STD_USE_BA_ALLOC)
+        std_release_spin_lock(&_ba_pool.lock);
+    _std_release_all_mem_spin_lock();
+}
+
 // Is the memory manager installed?
 int std_is_mem_mgr_installed()
 {
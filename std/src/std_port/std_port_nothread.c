@@ -153,6 +153,15 @@ extern int std_raise_event(std_event_id_t eventId)
     return 1;
 }
 
+extern int std_wait_address(volatile int *address, int expected, int timeout)
+{
+    return 1;
+}
+
+extern void std_wake_address(volatile int *address, int count)
+{
+}
+
 extern int std_create_proc_sem(std_proc_sem_Id_t *pProcSemId, const char *name)
 {
     return 1;
@@ -246,4 +255,10 @@ extern void std_relinquish()
     /* Do nothing */
 }
 
+/* Get count of online processors */
+extern int std_get_cpu_count()
+{
+    return 1;
+}
+
 #endif  /* End of ~STD_MULTI_tHREAD */
@@ -36,6 +36,10 @@
 #include <sys/time.h>
 #include <time.h>
 #include <unistd.h>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
 
 #if defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__APPLE_CC__)
 #define PTHREAD_MUTEX_RECURSIVE_NP PTHREAD_MUTEX_RECURSIVE
@@ -501,6 +505,44 @@ extern int std_raise_event(std_event_id_t eventId)
     return 1;
 }
 
+/* Block the caller while *address == expected
+ * Return 1 means waken (or value changed), 0 means timeout
+ * The caller must recheck the condition since the function may return
+ * spuriously */
+extern int std_wait_address(volatile int *address, int expected, int timeout)
+{
+#ifdef __linux__
+    struct timespec tm;
+    struct timespec *ptm = NULL;
+
+    if (timeout != STD_WAIT_FOREVER)
+    {
+        tm.tv_sec = timeout / 1000;
+        tm.tv_nsec = (timeout % 1000) * 1000000;
+        ptm = &tm;
+    }
+
+    if (syscall(SYS_futex, (int *) address, FUTEX_WAIT_PRIVATE, expected, ptm, NULL, 0) == 0)
+        return 1;
+
+    /* EAGAIN: value changed; EINTR: signal, both are treated as waken */
+    return errno != ETIMEDOUT;
+#else
+    /* No futex, just give up the cpu & let caller check again */
+    if (*address == expected)
+        sched_yield();
+    return 1;
+#endif
+}
+
+/* Wake up to count waiters blocked on address */
+extern void std_wake_address(volatile int *address, int count)
+{
+#ifdef __linux__
+    syscall(SYS_futex, (int *) address, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+#endif
+}
+
 extern int std_create_proc_sem(std_proc_sem_id_t *pProcSemId, const char *name)
 {
     sem_t *sem;
@@ -919,6 +961,13 @@ extern void std_relinquish()
     sched_yield();
 }
 
+/* Get count of online processors */
+extern int std_get_cpu_count()
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int) n : 1;
+}
+
 #endif /* End of STD_MULTI_tHREAD */
 
 #endif  /* End of _POSIX */
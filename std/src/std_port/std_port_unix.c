@@ -29,6 +29,7 @@
 #include <string.h>
 #include <sys/socket.h>
 #include <sys/time.h>
+#include <sys/wait.h>
 #include <time.h>
 #include <unistd.h>
 
@@ -189,6 +190,28 @@ extern int std_fork()
     return fork();
 }
 
+/* Wait for a child process to exit */
+/* Return 1 means OK, 0 means failed */
+extern int std_wait_process(std_pid_t pid, int *exit_code)
+{
+    int status;
+
+    while (waitpid(pid, &status, 0) == -1)
+    {
+        if (errno != EINTR)
+            return 0;
+    }
+
+    *exit_code = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+    return 1;
+}
+
+/* Exit forked process without cleanup of parent (atexit, stdio) */
+extern void std_exit_forked_process(int r)
+{
+    _exit(r);
+}
+
 /* Start/restart a timer
  * index: which timer (currently, only 0 is supoorted)
  * msec - millisecond
@@ -9,14 +9,20 @@
 #include "std_port/std_port.h"
 #include "std_port/std_port_mmap.h"
 #include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 // Reserve memory, can not be allocated by others
 // Argument address can be 0 or specified address
 extern void* std_mem_reserve(void* address, size_t size)
 {
     void *p = mmap(address, size, PROT_NONE, MAP_PRIVATE | MAP_ANON, -1, 0);
-    if (p == NULL)
+    if (p == MAP_FAILED)
+    {
         STD_TRACE("std_port_mem_reserve(mmap).Error = %d.\n", errno);
+        return NULL;
+    }
     return p;
 }
 
@@ -84,4 +90,118 @@ extern int std_mem_decommit(void* address, size_t size)
     return 0;
 }
 
-#endif  /* End of _WINDOWS */
+// Hint the system to back the range with huge pages
+// The address should be aligned to STD_HUGE_PAGE_SIZE
+// Return 1 means OK, 0 means not supported (the range is still usable)
+extern int std_mem_advise_huge_page(void* address, size_t size)
+{
+#ifdef MADV_HUGEPAGE
+    if (madvise(address, size, MADV_HUGEPAGE) == 0)
+        return 1;
+
+    STD_TRACE("std_mem_advise_huge_page(madvise).Error = %d.\n", errno);
+#endif
+    return 0;
+}
+
+// Map a whole file read-only
+// Return NULL if the file is not existed or empty
+extern void* std_map_file(const char* file_name, size_t* ret_size)
+{
+    struct stat st;
+    void *p;
+    int fd;
+
+    fd = open(file_name, O_RDONLY);
+    if (fd == -1)
+        return NULL;
+
+    if (fstat(fd, &st) == -1 || st.st_size == 0)
+    {
+        close(fd);
+        return NULL;
+    }
+
+    // The mapping is still valid after the fd closed
+    p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED)
+    {
+        STD_TRACE("std_map_file(mmap).Error = %d.\n", errno);
+        return NULL;
+    }
+
+    *ret_size = (size_t)st.st_size;
+    return p;
+}
+
+// Unmap file mapped by std_map_file
+// Return 1 means OK
+extern int std_unmap_file(void* address, size_t size)
+{
+    if (munmap(address, size) == 0)
+        return 1;
+
+    STD_TRACE("std_unmap_file(munmap).Error = %d.\n", errno);
+    return 0;
+}
+
+// Map a whole file copy-on-write with head & tail room
+// Return NULL if the file is not existed
+extern char* std_map_file_private(const char* file_name, size_t head_room, size_t tail_room, size_t* ret_size)
+{
+    struct stat st;
+    size_t total;
+    char *base;
+    void *p;
+    int fd;
+
+    fd = open(file_name, O_RDONLY);
+    if (fd == -1)
+        return NULL;
+
+    if (fstat(fd, &st) == -1)
+    {
+        close(fd);
+        return NULL;
+    }
+
+    // Reserve the whole range with anonymous pages, then map the file
+    // over it, the bytes after the content in last page are zero
+    head_room = std_align_size(head_room);
+    total = head_room + std_align_size((size_t)st.st_size + tail_room);
+    base = (char *)mmap(NULL, total, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+    if (base == (char *)MAP_FAILED)
+    {
+        STD_TRACE("std_map_file_private(mmap).Error = %d.\n", errno);
+        close(fd);
+        return NULL;
+    }
+
+    if (st.st_size > 0)
+    {
+        p = mmap(base + head_room, (size_t)st.st_size, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_FIXED, fd, 0);
+        if (p == MAP_FAILED)
+        {
+            STD_TRACE("std_map_file_private(mmap).Error = %d.\n", errno);
+            munmap(base, total);
+            close(fd);
+            return NULL;
+        }
+    }
+    close(fd);
+
+    *ret_size = (size_t)st.st_size;
+    return base + head_room;
+}
+
+// Unmap file mapped by std_map_file_private
+// Return 1 means OK
+extern int std_unmap_file_private(char* content, size_t head_room, size_t tail_room, size_t size)
+{
+    head_room = std_align_size(head_room);
+    return std_unmap_file(content - head_room, head_room + std_align_size(size + tail_room));
+}
+
+#endif  /* End of _UNIX */
@@ -0,0 +1,533 @@
+// std_port_unix_uring.c
+// Initial version Oct/19/2026 by doing
+// Wrapper for io_uring (linux), not available on other platforms
+
+#include "std_port/std_port_platform.h"
+
+#ifdef _UNIX
+
+#include "std_port/std_port.h"
+#include "std_port/std_port_mmap.h"
+#include "std_port/std_port_uring.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/io_uring.h>
+#include <linux/time_types.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+#if defined(__linux__) && defined(IORING_RECV_MULTISHOT) && defined(__NR_io_uring_setup)
+
+// Multishot recv needs a newer kernel than the other features used here,
+// there is no flag for it, so the features of 6.3 are required (the flag
+// may be missing in older headers)
+#ifndef IORING_FEAT_REG_REG_RING
+#define IORING_FEAT_REG_REG_RING    (1U << 13)
+#endif
+
+// Buffer group of provided buffers
+#define BUFFER_GROUP    0
+
+struct std_uring
+{
+    int fd;
+
+    // Submission queue
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned  sq_mask;
+    unsigned  sq_entries;
+    unsigned  sqe_tail;             // Prepared but maybe not submitted
+    struct io_uring_sqe* sqes;
+
+    // Completion queue
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned  cq_mask;
+    struct io_uring_cqe* cqes;
+
+    void*  ring_ptr;
+    size_t ring_size;
+    size_t sqes_size;
+
+    // Provided buffers
+    struct io_uring_buf_ring* buf_ring;
+    size_t buf_ring_size;
+    char*  bufs;
+    Uint32 buf_count;
+    Uint32 buf_size;
+    Uint16 buf_tail;
+};
+
+static int uring_setup(unsigned entries, struct io_uring_params* params)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags, void* arg, size_t size)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, size);
+}
+
+static int uring_register(int fd, unsigned opcode, const void* arg, unsigned nr_args)
+{
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+// Create a ring
+extern std_uring_t* std_uring_create(Uint32 entries)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN;
+    int fd = uring_setup(entries, &params);
+    if (fd < 0)
+    {
+        STD_TRACE("std_uring_create(io_uring_setup).Error = %d.\n", errno);
+        return NULL;
+    }
+
+    Uint32 required = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_EXT_ARG | IORING_FEAT_REG_REG_RING;
+    if ((params.features & required) != required)
+    {
+        STD_TRACE("std_uring_create: features %x are not supported.\n", required & ~params.features);
+        close(fd);
+        return NULL;
+    }
+
+    // The SQ & CQ rings share one mapping
+    size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    size_t ring_size = sq_size > cq_size ? sq_size : cq_size;
+    char* ring_ptr = (char*)mmap(NULL, ring_size, PROT_READ | PROT_WRITE,
+                                 MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (ring_ptr == MAP_FAILED)
+    {
+        STD_TRACE("std_uring_create(mmap).Error = %d.\n", errno);
+        close(fd);
+        return NULL;
+    }
+
+    size_t sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    void* sqes = mmap(NULL, sqes_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED)
+    {
+        STD_TRACE("std_uring_create(mmap).Error = %d.\n", errno);
+        munmap(ring_ptr, ring_size);
+        close(fd);
+        return NULL;
+    }
+
+    std_uring_t* ring = (std_uring_t*)calloc(1, sizeof(std_uring_t));
+    ring->fd = fd;
+    ring->sq_head = (unsigned*)(ring_ptr + params.sq_off.head);
+    ring->sq_tail = (unsigned*)(ring_ptr + params.sq_off.tail);
+    ring->sq_mask = *(unsigned*)(ring_ptr + params.sq_off.ring_mask);
+    ring->sq_entries = params.sq_entries;
+    ring->sqe_tail = *ring->sq_tail;
+    ring->sqes = (struct io_uring_sqe*)sqes;
+    ring->cq_head = (unsigned*)(ring_ptr + params.cq_off.head);
+    ring->cq_tail = (unsigned*)(ring_ptr + params.cq_off.tail);
+    ring->cq_mask = *(unsigned*)(ring_ptr + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(ring_ptr + params.cq_off.cqes);
+    ring->ring_ptr = ring_ptr;
+    ring->ring_size = ring_size;
+    ring->sqes_size = sqes_size;
+
+    // Map the slots to sqes one by one, so the array is never changed
+    unsigned* array = (unsigned*)(ring_ptr + params.sq_off.array);
+    for (unsigned i = 0; i < params.sq_entries; i++)
+        array[i] = i;
+    return ring;
+}
+
+// Destroy a ring, the pending requests are cancelled
+extern void std_uring_destroy(std_uring_t* ring)
+{
+    if (ring->buf_ring)
+    {
+        // Unregister before freeing, so kernel never writes to them
+        struct io_uring_buf_reg reg;
+        memset(&reg, 0, sizeof(reg));
+        reg.bgid = BUFFER_GROUP;
+        uring_register(ring->fd, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+        munmap(ring->buf_ring, ring->buf_ring_size);
+        munmap(ring->bufs, (size_t)ring->buf_count * ring->buf_size);
+    }
+    munmap(ring->sqes, ring->sqes_size);
+    munmap(ring->ring_ptr, ring->ring_size);
+    close(ring->fd);
+    free(ring);
+}
+
+// Register fixed files
+// Return 1 means OK
+extern int std_uring_register_files(std_uring_t* ring, const int* fds, Uint32 count)
+{
+    if (uring_register(ring->fd, IORING_REGISTER_FILES, fds, count) == 0)
+        return 1;
+
+    STD_TRACE("std_uring_register_files.Error = %d.\n", errno);
+    return 0;
+}
+
+// Register fixed buffers, the pages are pinned
+// Return 1 means OK
+extern int std_uring_register_buffers(std_uring_t* ring, const struct iovec* iov, Uint32 count)
+{
+    if (uring_register(ring->fd, IORING_REGISTER_BUFFERS, iov, count) == 0)
+        return 1;
+
+    STD_TRACE("std_uring_register_buffers.Error = %d.\n", errno);
+    return 0;
+}
+
+// Provide buffers for multishot recv
+// The kernel picks a buffer when data arrived, so no buffer is occupied
+// by idle connections
+// Return 1 means OK
+extern int std_uring_provide_buffers(std_uring_t* ring, Uint32 count, Uint32 size)
+{
+    STD_ASSERT(!ring->buf_ring);
+    STD_ASSERT((count & (count - 1)) == 0 && count <= 32768);
+
+    size_t buf_ring_size = (count * sizeof(struct io_uring_buf) + STD_PAGE_SIZE - 1) & ~(size_t)(STD_PAGE_SIZE - 1);
+    void* buf_ring = mmap(NULL, buf_ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buf_ring == MAP_FAILED)
+        return 0;
+    void* bufs = mmap(NULL, (size_t)count * size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (bufs == MAP_FAILED)
+    {
+        munmap(buf_ring, buf_ring_size);
+        return 0;
+    }
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (Uint64)(size_t)buf_ring;
+    reg.ring_entries = count;
+    reg.bgid = BUFFER_GROUP;
+    if (uring_register(ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0)
+    {
+        STD_TRACE("std_uring_provide_buffers.Error = %d.\n", errno);
+        munmap(bufs, (size_t)count * size);
+        munmap(buf_ring, buf_ring_size);
+        return 0;
+    }
+
+    ring->buf_ring = (struct io_uring_buf_ring*)buf_ring;
+    ring->buf_ring_size = buf_ring_size;
+    ring->bufs = (char*)bufs;
+    ring->buf_count = count;
+    ring->buf_size = size;
+    ring->buf_tail = 0;
+    for (Uint32 i = 0; i < count; i++)
+        std_uring_recycle_buffer(ring, (int)i);
+    return 1;
+}
+
+// Get address of a provided buffer
+extern void* std_uring_get_buffer(std_uring_t* ring, int buffer_id)
+{
+    return ring->bufs + (size_t)buffer_id * ring->buf_size;
+}
+
+// Give a provided buffer back to kernel
+extern void std_uring_recycle_buffer(std_uring_t* ring, int buffer_id)
+{
+    struct io_uring_buf* buf = &ring->buf_ring->bufs[ring->buf_tail & (ring->buf_count - 1)];
+    buf->addr = (Uint64)(size_t)std_uring_get_buffer(ring, buffer_id);
+    buf->len = ring->buf_size;
+    buf->bid = (Uint16)buffer_id;
+    ring->buf_tail++;
+    __atomic_store_n(&ring->buf_ring->tail, ring->buf_tail, __ATOMIC_RELEASE);
+}
+
+// Get a free sqe, submit the prepared ones if the queue is full
+static struct io_uring_sqe* get_sqe(std_uring_t* ring)
+{
+    if (ring->sqe_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= ring->sq_entries)
+    {
+        if (std_uring_submit(ring, 0, 0) < 0 ||
+            ring->sqe_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= ring->sq_entries)
+        {
+            STD_TRACE("std_uring: submission queue is full.\n");
+            return NULL;
+        }
+    }
+
+    struct io_uring_sqe* sqe = &ring->sqes[ring->sqe_tail & ring->sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sqe_tail++;
+    return sqe;
+}
+
+// Prepare reading of file
+extern int std_uring_prep_read(std_uring_t* ring, int fd, void* buf, Uint32 size, Uint64 offset, Uint64 user_data)
+{
+    struct io_uring_sqe* sqe = get_sqe(ring);
+    if (!sqe)
+        return 0;
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = (Uint64)(size_t)buf;
+    sqe->len = size;
+    sqe->off = offset;
+    sqe->user_data = user_data;
+    return 1;
+}
+
+// Prepare reading of fixed file into fixed buffer
+extern int std_uring_prep_read_fixed(std_uring_t* ring, int file_index, void* buf, Uint32 size, Uint64 offset, int buf_index, Uint64 user_data)
+{
+    struct io_uring_sqe* sqe = get_sqe(ring);
+    if (!sqe)
+        return 0;
+    sqe->opcode = IORING_OP_READ_FIXED;
+    sqe->flags = IOSQE_FIXED_FILE;
+    sqe->fd = file_index;
+    sqe->addr = (Uint64)(size_t)buf;
+    sqe->len = size;
+    sqe->off = offset;
+    sqe->buf_index = (Uint16)buf_index;
+    sqe->user_data = user_data;
+    return 1;
+}
+
+// Prepare sending of socket
+extern int std_uring_prep_send(std_uring_t* ring, int fd, const void* buf, Uint32 size, int flags, Uint64 user_data)
+{
+    struct io_uring_sqe* sqe = get_sqe(ring);
+    if (!sqe)
+        return 0;
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = fd;
+    sqe->addr = (Uint64)(size_t)buf;
+    sqe->len = size;
+    sqe->msg_flags = (Uint32)flags;
+    sqe->user_data = user_data;
+    return 1;
+}
+
+// Prepare gathered writing (at current position of file)
+extern int std_uring_prep_writev(std_uring_t* ring, int fd, const struct iovec* iov, Uint32 count, Uint64 user_data)
+{
+    struct io_uring_sqe* sqe = get_sqe(ring);
+    if (!sqe)
+        return 0;
+    sqe->opcode = IORING_OP_WRITEV;
+    sqe->fd = fd;
+    sqe->addr = (Uint64)(size_t)iov;
+    sqe->len = count;
+    sqe->off = (Uint64)-1;
+    sqe->user_data = user_data;
+    return 1;
+}
+
+// Prepare multishot accept, each connection completes with its fd
+extern int std_uring_prep_accept_multishot(std_uring_t* ring, int fd, int flags, Uint64 user_data)
+{
+    struct io_uring_sqe* sqe = get_sqe(ring);
+    if (!sqe)
+        return 0;
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = (Uint32)flags;
+    sqe->user_data = user_data;
+    return 1;
+}
+
+// Prepare multishot recv into provided buffers
+extern int std_uring_prep_recv_multishot(std_uring_t* ring, int fd, Uint64 user_data)
+{
+    struct io_uring_sqe* sqe = get_sqe(ring);
+    if (!sqe)
+        return 0;
+    sqe->opcode = IORING_OP_RECV;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->buf_group = BUFFER_GROUP;
+    sqe->user_data = user_data;
+    return 1;
+}
+
+// Prepare one shot poll of events (POLLIN, POLLOUT...)
+extern int std_uring_prep_poll(std_uring_t* ring, int fd, Uint32 events, Uint64 user_data)
+{
+    struct io_uring_sqe* sqe = get_sqe(ring);
+    if (!sqe)
+        return 0;
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = events;
+    sqe->user_data = user_data;
+    return 1;
+}
+
+// Prepare cancelling of all requests on fd
+extern int std_uring_prep_cancel_fd(std_uring_t* ring, int fd, Uint64 user_data)
+{
+    struct io_uring_sqe* sqe = get_sqe(ring);
+    if (!sqe)
+        return 0;
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = fd;
+    sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+    sqe->user_data = user_data;
+    return 1;
+}
+
+// Submit prepared requests & wait completions in one syscall
+// Return count of submitted requests or -1
+extern int std_uring_submit(std_uring_t* ring, Uint32 wait_nr, int timeout_ms)
+{
+    __atomic_store_n(ring->sq_tail, ring->sqe_tail, __ATOMIC_RELEASE);
+    unsigned to_submit = ring->sqe_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+
+    // Don't wait if there are completions already
+    if (wait_nr &&
+        __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE) - *ring->cq_head >= wait_nr)
+        wait_nr = 0;
+    if (!to_submit && !wait_nr)
+        return 0;
+
+    unsigned flags = 0;
+    struct io_uring_getevents_arg arg;
+    struct __kernel_timespec ts;
+    memset(&arg, 0, sizeof(arg));
+    if (wait_nr)
+    {
+        flags |= IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+        if (timeout_ms >= 0)
+        {
+            ts.tv_sec = timeout_ms / 1000;
+            ts.tv_nsec = (long long)(timeout_ms % 1000) * 1000000;
+            arg.ts = (Uint64)(size_t)&ts;
+        }
+    }
+
+    int ret = uring_enter(ring->fd, to_submit, wait_nr, flags, wait_nr ? &arg : NULL, wait_nr ? sizeof(arg) : 0);
+    if (ret < 0)
+    {
+        if (errno == ETIME || errno == EINTR || errno == EBUSY || errno == EAGAIN)
+            // Timeout or interrupted, nothing is submitted
+            return 0;
+        STD_TRACE("std_uring_submit(io_uring_enter).Error = %d.\n", errno);
+        return -1;
+    }
+    return ret;
+}
+
+// Get a completion
+extern int std_uring_peek(std_uring_t* ring, std_uring_cqe_t* cqe)
+{
+    unsigned head = *ring->cq_head;
+    if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+        return 0;
+
+    struct io_uring_cqe* p = &ring->cqes[head & ring->cq_mask];
+    cqe->user_data = p->user_data;
+    cqe->res = p->res;
+    cqe->buffer_id = (p->flags & IORING_CQE_F_BUFFER) ? (int)(p->flags >> IORING_CQE_BUFFER_SHIFT) : -1;
+    cqe->more = (p->flags & IORING_CQE_F_MORE) ? 1 : 0;
+    __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+#else
+
+// io_uring is not available, the callers use the fallback
+extern std_uring_t* std_uring_create(Uint32 entries)
+{
+    return NULL;
+}
+
+extern void std_uring_destroy(std_uring_t* ring)
+{
+}
+
+extern int std_uring_register_files(std_uring_t* ring, const int* fds, Uint32 count)
+{
+    return 0;
+}
+
+extern int std_uring_register_buffers(std_uring_t* ring, const struct iovec* iov, Uint32 count)
+{
+    return 0;
+}
+
+extern int std_uring_provide_buffers(std_uring_t* ring, Uint32 count, Uint32 size)
+{
+    return 0;
+}
+
+extern void* std_uring_get_buffer(std_uring_t* ring, int buffer_id)
+{
+    return NULL;
+}
+
+extern void std_uring_recycle_buffer(std_uring_t* ring, int buffer_id)
+{
+}
+
+extern int std_uring_prep_read(std_uring_t* ring, int fd, void* buf, Uint32 size, Uint64 offset, Uint64 user_data)
+{
+    return 0;
+}
+
+extern int std_uring_prep_read_fixed(std_uring_t* ring, int file_index, void* buf, Uint32 size, Uint64 offset, int buf_index, Uint64 user_data)
+{
+    return 0;
+}
+
+extern int std_uring_prep_send(std_uring_t* ring, int fd, const void* buf, Uint32 size, int flags, Uint64 user_data)
+{
+    return 0;
+}
+
+extern int std_uring_prep_writev(std_uring_t* ring, int fd, const struct iovec* iov, Uint32 count, Uint64 user_data)
+{
+    return 0;
+}
+
+extern int std_uring_prep_accept_multishot(std_uring_t* ring, int fd, int flags, Uint64 user_data)
+{
+    return 0;
+}
+
+extern int std_uring_prep_recv_multishot(std_uring_t* ring, int fd, Uint64 user_data)
+{
+    return 0;
+}
+
+extern int std_uring_prep_poll(std_uring_t* ring, int fd, Uint32 events, Uint64 user_data)
+{
+    return 0;
+}
+
+extern int std_uring_prep_cancel_fd(std_uring_t* ring, int fd, Uint64 user_data)
+{
+    return 0;
+}
+
+extern int std_uring_submit(std_uring_t* ring, Uint32 wait_nr, int timeout_ms)
+{
+    return -1;
+}
+
+extern int std_uring_peek(std_uring_t* ring, std_uring_cqe_t* cqe)
+{
+    return 0;
+}
+
+#endif
+
+#endif
@@ -271,6 +271,12 @@ extern void std_relinquish()
     taskRelinquish(0); // ???
 }
 
+/* Get count of online processors */
+extern int std_get_cpu_count()
+{
+    return 1;
+}
+
 /* Get current working directory */
 extern void std_get_cwd(char *path, size_t size)
 {
@@ -33,6 +33,10 @@
 #include <sys/timeb.h>
 #include <time.h>
 
+#if _WIN32_WINNT >= 0x0602
+#pragma comment(lib, "Synchronization.lib")
+#endif
+
 #ifndef STD_NO_MULTI_tHREAD
 
 /* Support functions only for windows */
@@ -235,6 +239,37 @@ extern int std_raise_event(std_event_id_t eventId)
     return ret;
 }
 
+/* Block the caller while *address == expected
+ * Return 1 means waken (or value changed), 0 means timeout
+ * The caller must recheck the condition since the function may return
+ * spuriously */
+extern int std_wait_address(volatile int *address, int expected, int timeout)
+{
+#if _WIN32_WINNT >= 0x0602
+    if (WaitOnAddress(address, &expected, sizeof(int),
+                      timeout == STD_WAIT_FOREVER ? INFINITE : (DWORD) timeout))
+        return 1;
+
+    return GetLastError() != ERROR_TIMEOUT;
+#else
+    /* No WaitOnAddress, just give up the cpu & let caller check again */
+    if (*address == expected)
+        Sleep(0);
+    return 1;
+#endif
+}
+
+/* Wake up to count waiters blocked on address */
+extern void std_wake_address(volatile int *address, int count)
+{
+#if _WIN32_WINNT >= 0x0602
+    if (count == 1)
+        WakeByAddressSingle((PVOID) address);
+    else
+        WakeByAddressAll((PVOID) address);
+#endif
+}
+
 extern int std_create_proc_sem(std_proc_sem_id_t *pProcSemId, const char *name)
 {
     HANDLE h;
@@ -541,13 +576,34 @@ extern void std_relinquish(int msec)
     Sleep(0);
 }
 
+/* Get count of online processors */
+extern int std_get_cpu_count()
+{
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors > 0 ? (int) info.dwNumberOfProcessors : 1;
+}
+
 /* Fork process */
 /* Not supported */
 extern int std_fork()
+{
+    return -1;
+}
+
+/* Wait for a child process to exit */
+/* Not supported */
+extern int std_wait_process(std_pid_t pid, int *exit_code)
 {
     return 0;
 }
 
+/* Exit forked process */
+extern void std_exit_forked_process(int r)
+{
+    ExitProcess((UINT) r);
+}
+
 /* Start/restart a timer
  * index: which timer (currently, only 0 is supoorted)
  * msec - millisecond
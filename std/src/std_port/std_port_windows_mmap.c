@@ -86,4 +86,118 @@ extern int std_mem_decommit(void* address, size_t size)
     return 0;
 }
 
+// Hint the system to back the range with huge pages
+// Large pages require SeLockMemoryPrivilege & MEM_LARGE_PAGES when
+// reserving, so we don't try it here
+// Return 1 means OK, 0 means not supported (the range is still usable)
+extern int std_mem_advise_huge_page(void* address, size_t size)
+{
+    return 0;
+}
+
+// Map a whole file read-only
+// Return NULL if the file is not existed or empty
+extern void* std_map_file(const char* file_name, size_t* ret_size)
+{
+    LARGE_INTEGER size;
+    HANDLE file, mapping;
+    void *p;
+
+    file = CreateFileA(file_name, GENERIC_READ, FILE_SHARE_READ, NULL,
+                       OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return NULL;
+
+    if (!GetFileSizeEx(file, &size) || size.QuadPart == 0)
+    {
+        CloseHandle(file);
+        return NULL;
+    }
+
+    // The view is still valid after the handles closed
+    mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(file);
+    if (mapping == NULL)
+    {
+        STD_TRACE("std_map_file(CreateFileMapping).Error = %d.\n", (int)GetLastError());
+        return NULL;
+    }
+
+    p = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+    if (p == NULL)
+    {
+        STD_TRACE("std_map_file(MapViewOfFile).Error = %d.\n", (int)GetLastError());
+        return NULL;
+    }
+
+    *ret_size = (size_t)size.QuadPart;
+    return p;
+}
+
+// Unmap file mapped by std_map_file
+// Return 1 means OK
+extern int std_unmap_file(void* address, size_t size)
+{
+    if (UnmapViewOfFile(address))
+        return 1;
+
+    STD_TRACE("std_unmap_file(UnmapViewOfFile).Error = %d.\n", (int)GetLastError());
+    return 0;
+}
+
+// Map a whole file copy-on-write with head & tail room
+// A view can't be placed after the head room, so read the file into
+// committed pages instead
+// Return NULL if the file is not existed
+extern char* std_map_file_private(const char* file_name, size_t head_room, size_t tail_room, size_t* ret_size)
+{
+    LARGE_INTEGER size;
+    HANDLE file;
+    DWORD n;
+    size_t total;
+    char *base;
+
+    file = CreateFileA(file_name, GENERIC_READ, FILE_SHARE_READ, NULL,
+                       OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return NULL;
+
+    if (!GetFileSizeEx(file, &size) || size.QuadPart > 0x7FFFFFFF)
+    {
+        CloseHandle(file);
+        return NULL;
+    }
+
+    head_room = std_align_size(head_room);
+    total = head_room + std_align_size((size_t)size.QuadPart + tail_room);
+    base = (char *)VirtualAlloc(NULL, total, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+    if (base == NULL)
+    {
+        STD_TRACE("std_map_file_private(VirtualAlloc).Error = %d.\n", (int)GetLastError());
+        CloseHandle(file);
+        return NULL;
+    }
+
+    if (!ReadFile(file, base + head_room, (DWORD)size.QuadPart, &n, NULL) ||
+        n != (DWORD)size.QuadPart)
+    {
+        STD_TRACE("std_map_file_private(ReadFile).Error = %d.\n", (int)GetLastError());
+        VirtualFree(base, 0, MEM_RELEASE);
+        CloseHandle(file);
+        return NULL;
+    }
+    CloseHandle(file);
+
+    *ret_size = (size_t)size.QuadPart;
+    return base + head_room;
+}
+
+// Unmap file mapped by std_map_file_private
+// Return 1 means OK
+extern int std_unmap_file_private(char* content, size_t head_room, size_t tail_room, size_t size)
+{
+    return std_mem_release(content - std_align_size(head_room), 0);
+}
+
 #endif  /* End of _WINDOWS */
@@ -13,7 +13,7 @@ int os_socket_init()
 {
     if (! os_epoll_init())
     {
-        VM_FATAL("Failed to initialize os_epoll.\n");
+        STD_FATAL("Failed to initialize os_epoll.\n");
         return 0;
     }
 
@@ -107,7 +107,7 @@ int os_recvfrom(__in SOCKET s, __out char *buf, __in int len, __in int flags, __
 /* select */
 int os_select(__in SOCKET nfds, __in_out fd_set *readfds, __in_out fd_set *writefds, __in_out fd_set *exceptfds, __in const struct timeval* timeout)
 {
-    VM_VERIFY(0 && "Please do NOT use select modal!! Use os_poll instead !!");
+    STD_ASSERT(0 && "Please do NOT use select modal!! Use os_poll instead !!");
     return 0;
 }
 
@@ -2,11 +2,9 @@
 // 2010.09.27   Initial version by doing
 // 2015.10.17   Immigrate by doing
 
-#if 0 ////----
-
 #include "std_port/std_port.h"
-#include "std_socket_bsd_errno.h"
-#include "std_socket_port.h"
+#include "std_socket/std_socket_bsd_errno.h"
+#include "std_socket/std_socket_port.h"
 #include "std_os_socket.h"
 
 /* There may be server type of socket.
@@ -423,5 +421,3 @@ int port_waitDataArrived(SOCKET socket_fd, int sec)
     /* There is data arrived */
     return 0;
 }
-
-#endif ////----